@@ -8,6 +8,7 @@
 #include "escher/impl/glsl_compiler.h"
 #include "escher/impl/image_cache.h"
 #include "escher/impl/mesh_manager.h"
+#include "escher/impl/sampler_cache.h"
 #include "escher/renderer/paper_renderer.h"
 #include "escher/renderer/texture.h"
 #include "escher/resources/resource_recycler.h"
@@ -66,6 +67,8 @@ Escher::Escher(VulkanDeviceQueuesPtr device)
                                        command_buffer_sequencer_.get())),
       glsl_compiler_(std::make_unique<impl::GlslToSpirvCompiler>()),
       image_cache_(std::make_unique<impl::ImageCache>(this, gpu_allocator())),
+      sampler_cache_(
+          std::make_unique<impl::SamplerCache>(vulkan_context_.device)),
       gpu_uploader_(NewGpuUploader(this,
                                    command_buffer_pool(),
                                    transfer_command_buffer_pool(),
@@ -67,6 +67,7 @@ class Escher : public MeshBuilderFactory {
   }
   impl::GlslToSpirvCompiler* glsl_compiler() { return glsl_compiler_.get(); }
   impl::ImageCache* image_cache() { return image_cache_.get(); }
+  impl::SamplerCache* sampler_cache() { return sampler_cache_.get(); }
 
   // Pool for CommandBuffers submitted on the main queue.
   impl::CommandBufferPool* command_buffer_pool() {
@@ -95,6 +96,8 @@ class Escher : public MeshBuilderFactory {
   std::unique_ptr<impl::CommandBufferPool> transfer_command_buffer_pool_;
   std::unique_ptr<impl::GlslToSpirvCompiler> glsl_compiler_;
   std::unique_ptr<impl::ImageCache> image_cache_;
+  // Outlives |resource_recycler_|, which destroys the Textures that use it.
+  std::unique_ptr<impl::SamplerCache> sampler_cache_;
 
   std::unique_ptr<impl::GpuUploader> gpu_uploader_;
   std::unique_ptr<ResourceRecycler> resource_recycler_;
@@ -19,6 +19,7 @@ class GpuAllocator;
 class GpuMem;
 class Image;
 class ImageFactory;
+class Layer;
 class MeshBuilder;
 class MeshBuilderFactory;
 struct MeshSpec;
@@ -30,6 +31,7 @@ class PaperRenderer;
 class Resource;
 class ResourceRecycler;
 class Renderer;
+class RetainedModel;
 class Semaphore;
 class Shape;
 class Stage;
@@ -44,6 +46,7 @@ typedef ftl::RefPtr<Buffer> BufferPtr;
 typedef ftl::RefPtr<Framebuffer> FramebufferPtr;
 typedef ftl::RefPtr<GpuMem> GpuMemPtr;
 typedef ftl::RefPtr<Image> ImagePtr;
+typedef ftl::RefPtr<Layer> LayerPtr;
 typedef ftl::RefPtr<Material> MaterialPtr;
 typedef ftl::RefPtr<Mesh> MeshPtr;
 typedef ftl::RefPtr<MeshBuilder> MeshBuilderPtr;
@@ -59,10 +62,14 @@ class CommandBuffer;
 class CommandBufferPool;
 class CommandBufferSequencer;
 class ComputeShader;
+class DamageTracker;
+class DepthPyramid;
 class EscherImpl;
+class FramebufferCache;
 class GlslToSpirvCompiler;
 class GpuUploader;
 class ImageCache;
+class LayerCache;
 class MeshManager;
 class MeshShaderBinding;
 class ModelData;
@@ -70,7 +77,12 @@ class ModelDisplayList;
 class ModelPipeline;
 class ModelPipelineCache;
 class ModelRenderer;
+class ObjectUniformCache;
+class OcclusionCuller;
 class Pipeline;
+class RenderGraph;
+class SamplerCache;
+class SecondaryCommandBufferCache;
 class SsdoAccelerator;
 class SsdoSampler;
 
@@ -0,0 +1,97 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include "escher/util/hash.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Maps keys to values that are evicted once they go unused for a number of
+// rounds (e.g. frames).  It holds the bookkeeping of caches of Vulkan objects,
+// such as FramebufferCache, which create the values and decide what becomes of
+// the evicted ones; it can therefore be tested without a device.  Not
+// thread-safe.
+template <typename Value>
+class AgingCache {
+ public:
+  // Values that go unused for |max_age| consecutive rounds are evicted at the
+  // end of the last of them.
+  explicit AgingCache(uint64_t max_age) : max_age_(max_age) {
+    FTL_DCHECK(max_age > 0);
+  }
+
+  // Return the value for |key|, invoking |create| to create it if there is
+  // none.  The value is used in the current round.
+  template <typename CreateFunc>
+  Value& Obtain(ByteKey key, const CreateFunc& create) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      ++miss_count_;
+      it = entries_.emplace(std::move(key), Entry{create(), round_}).first;
+    } else {
+      ++hit_count_;
+    }
+    it->second.last_round = round_;
+    return it->second.value;
+  }
+
+  // End the current round, evicting the values that have now gone unused for
+  // |max_age| rounds.  Each one is passed to |evict| (which may move it)
+  // before it is destroyed.
+  template <typename EvictFunc>
+  void EndRound(const EvictFunc& evict) {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (round_ - it->second.last_round >= max_age_) {
+        evict(&it->second.value);
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    ++round_;
+  }
+  void EndRound() {
+    EndRound([](Value*) {});
+  }
+
+  // Evict every value, passing each one to |evict| as in EndRound().
+  template <typename EvictFunc>
+  void Clear(const EvictFunc& evict) {
+    for (auto& pair : entries_) {
+      evict(&pair.second.value);
+    }
+    entries_.clear();
+  }
+
+  // Statistics, for debugging.
+  uint32_t hit_count() const { return hit_count_; }
+  uint32_t miss_count() const { return miss_count_; }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    Value value;
+    uint64_t last_round;
+  };
+
+  const uint64_t max_age_;
+  std::unordered_map<ByteKey, Entry, ByteKeyHash> entries_;
+  uint64_t round_ = 0;
+
+  uint32_t hit_count_ = 0;
+  uint32_t miss_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(AgingCache);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -35,10 +35,49 @@ void CommandBuffer::Begin(uint64_t sequence_number) {
   FTL_DCHECK(sequence_number > sequence_number_);
   is_active_ = true;
   sequence_number_ = sequence_number;
+  elided_state_change_count_ = 0;
+  ResetBoundState();
   auto result = command_buffer_.begin(vk::CommandBufferBeginInfo());
   FTL_DCHECK(result == vk::Result::eSuccess);
 }
 
+void CommandBuffer::BeginSecondary(vk::RenderPass render_pass) {
+  FTL_DCHECK(!is_active_ && !is_submitted_);
+  is_active_ = true;
+  is_secondary_ = true;
+  elided_state_change_count_ = 0;
+  ResetBoundState();
+  used_resources_.clear();
+
+  vk::CommandBufferInheritanceInfo inheritance_info;
+  inheritance_info.renderPass = render_pass;
+  inheritance_info.subpass = 0;
+  vk::CommandBufferBeginInfo begin_info;
+  begin_info.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue |
+                     vk::CommandBufferUsageFlagBits::eSimultaneousUse;
+  begin_info.pInheritanceInfo = &inheritance_info;
+  auto result = command_buffer_.begin(begin_info);
+  FTL_DCHECK(result == vk::Result::eSuccess);
+}
+
+void CommandBuffer::EndSecondary() {
+  FTL_DCHECK(is_active_ && is_secondary_);
+  is_active_ = false;
+  auto result = command_buffer_.end();
+  FTL_DCHECK(result == vk::Result::eSuccess);
+}
+
+void CommandBuffer::MoveWaitSemaphoresTo(CommandBuffer* primary) {
+  FTL_DCHECK(is_secondary_ && !primary->is_secondary_);
+  for (size_t i = 0; i < wait_semaphores_.size(); ++i) {
+    primary->AddWaitSemaphore(std::move(wait_semaphores_[i]),
+                              wait_semaphore_stages_[i]);
+  }
+  wait_semaphores_.clear();
+  wait_semaphores_for_submit_.clear();
+  wait_semaphore_stages_.clear();
+}
+
 bool CommandBuffer::Submit(vk::Queue queue,
                            CommandBufferFinishedCallback callback) {
   TRACE_DURATION("gfx", "escher::CommandBuffer::Submit");
@@ -102,6 +141,13 @@ void CommandBuffer::AddSignalSemaphore(SemaphorePtr semaphore) {
 
 void CommandBuffer::KeepAlive(Resource* resource) {
   FTL_DCHECK(is_active_);
+  if (is_secondary_) {
+    // Secondary buffers have no sequence number of their own; they are kept
+    // alive by SecondaryCommandBufferCache until all primary buffers that
+    // executed them have finished.
+    used_resources_.push_back(ResourcePtr(resource));
+    return;
+  }
   if (sequence_number_ == resource->sequence_number()) {
     // The resource is already being kept alive by this CommandBuffer.
     return;
@@ -125,16 +171,164 @@ void CommandBuffer::DrawMesh(const MeshPtr& mesh) {
   AddWaitSemaphore(mesh->TakeWaitSemaphore(),
                    vk::PipelineStageFlagBits::eVertexInput);
 
-  vk::Buffer vbo = mesh->vk_vertex_buffer();
-  vk::DeviceSize vbo_offset = mesh->vertex_buffer_offset();
   uint32_t vbo_binding = MeshShaderBinding::kTheOnlyCurrentlySupportedBinding;
-  command_buffer_.bindVertexBuffers(vbo_binding, 1, &vbo, &vbo_offset);
-  command_buffer_.bindIndexBuffer(mesh->vk_index_buffer(),
-                                  mesh->index_buffer_offset(),
-                                  vk::IndexType::eUint32);
+  BindVertexBuffer(vbo_binding, mesh->vk_vertex_buffer(),
+                   mesh->vertex_buffer_offset());
+  BindIndexBuffer(mesh->vk_index_buffer(), mesh->index_buffer_offset());
   command_buffer_.drawIndexed(mesh->num_indices(), 1, 0, 0, 0);
 }
 
+void CommandBuffer::DrawMeshInstances(const MeshPtr& mesh,
+                                      uint32_t instance_binding,
+                                      vk::Buffer instance_buffer,
+                                      vk::DeviceSize instance_buffer_offset,
+                                      uint32_t instance_count) {
+  KeepAlive(mesh);
+
+  AddWaitSemaphore(mesh->TakeWaitSemaphore(),
+                   vk::PipelineStageFlagBits::eVertexInput);
+
+  uint32_t vbo_binding = MeshShaderBinding::kTheOnlyCurrentlySupportedBinding;
+  FTL_DCHECK(instance_binding != vbo_binding);
+  BindVertexBuffer(vbo_binding, mesh->vk_vertex_buffer(),
+                   mesh->vertex_buffer_offset());
+  BindVertexBuffer(instance_binding, instance_buffer, instance_buffer_offset);
+  BindIndexBuffer(mesh->vk_index_buffer(), mesh->index_buffer_offset());
+  command_buffer_.drawIndexed(mesh->num_indices(), instance_count, 0, 0, 0);
+}
+
+void CommandBuffer::DrawMeshesIndirect(const MeshPtr& mesh,
+                                       uint32_t instance_binding,
+                                       vk::Buffer instance_buffer,
+                                       vk::DeviceSize instance_buffer_offset,
+                                       vk::Buffer indirect_buffer,
+                                       vk::DeviceSize indirect_buffer_offset,
+                                       uint32_t draw_count) {
+  KeepAlive(mesh);
+
+  AddWaitSemaphore(mesh->TakeWaitSemaphore(),
+                   vk::PipelineStageFlagBits::eVertexInput);
+
+  uint32_t vbo_binding = MeshShaderBinding::kTheOnlyCurrentlySupportedBinding;
+  FTL_DCHECK(instance_binding != vbo_binding);
+  BindVertexBuffer(vbo_binding, mesh->vk_vertex_buffer(), 0);
+  BindVertexBuffer(instance_binding, instance_buffer, instance_buffer_offset);
+  BindIndexBuffer(mesh->vk_index_buffer(), 0);
+  command_buffer_.drawIndexedIndirect(indirect_buffer, indirect_buffer_offset,
+                                      draw_count,
+                                      sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+void CommandBuffer::BindGraphicsPipeline(vk::Pipeline pipeline) {
+  if (bound_pipeline_ == pipeline) {
+    ++elided_state_change_count_;
+    return;
+  }
+  bound_pipeline_ = pipeline;
+  command_buffer_.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+  // The stencil reference must be set again after binding a new pipeline.
+  has_stencil_reference_ = false;
+}
+
+void CommandBuffer::BindGraphicsDescriptorSet(
+    vk::PipelineLayout layout,
+    uint32_t set_index,
+    vk::DescriptorSet descriptor_set,
+    uint32_t dynamic_offset_count,
+    const uint32_t* dynamic_offsets) {
+  if (set_index < kMaxTrackedDescriptorSets && dynamic_offset_count <= 1) {
+    BoundDescriptorSet& bound = bound_descriptor_sets_[set_index];
+    if (bound.layout == layout && bound.descriptor_set == descriptor_set &&
+        bound.dynamic_offset_count == dynamic_offset_count &&
+        (dynamic_offset_count == 0 ||
+         bound.dynamic_offset == dynamic_offsets[0])) {
+      ++elided_state_change_count_;
+      return;
+    }
+  }
+
+  command_buffer_.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout,
+                                     set_index, 1, &descriptor_set,
+                                     dynamic_offset_count, dynamic_offsets);
+
+  // Binding a set with a different layout may disturb sets that were bound
+  // with other layouts.  Rather than tracking layout compatibility, forget
+  // about all of them.
+  for (auto& bound : bound_descriptor_sets_) {
+    if (bound.layout != layout) {
+      bound = BoundDescriptorSet();
+    }
+  }
+  if (set_index < kMaxTrackedDescriptorSets) {
+    BoundDescriptorSet& bound = bound_descriptor_sets_[set_index];
+    if (dynamic_offset_count <= 1) {
+      bound.layout = layout;
+      bound.descriptor_set = descriptor_set;
+      bound.dynamic_offset_count = dynamic_offset_count;
+      bound.dynamic_offset = dynamic_offset_count ? dynamic_offsets[0] : 0;
+    } else {
+      bound = BoundDescriptorSet();
+    }
+  }
+}
+
+void CommandBuffer::BindVertexBuffer(uint32_t binding,
+                                     vk::Buffer buffer,
+                                     vk::DeviceSize offset) {
+  if (binding < kMaxTrackedVertexBindings) {
+    if (bound_vertex_buffers_[binding] == buffer &&
+        bound_vertex_buffer_offsets_[binding] == offset) {
+      ++elided_state_change_count_;
+      return;
+    }
+    bound_vertex_buffers_[binding] = buffer;
+    bound_vertex_buffer_offsets_[binding] = offset;
+  }
+  command_buffer_.bindVertexBuffers(binding, 1, &buffer, &offset);
+}
+
+void CommandBuffer::BindIndexBuffer(vk::Buffer buffer, vk::DeviceSize offset) {
+  if (bound_index_buffer_ == buffer && bound_index_buffer_offset_ == offset) {
+    ++elided_state_change_count_;
+    return;
+  }
+  bound_index_buffer_ = buffer;
+  bound_index_buffer_offset_ = offset;
+  command_buffer_.bindIndexBuffer(buffer, offset, vk::IndexType::eUint32);
+}
+
+void CommandBuffer::SetStencilReference(uint32_t reference) {
+  if (has_stencil_reference_ && stencil_reference_ == reference) {
+    ++elided_state_change_count_;
+    return;
+  }
+  has_stencil_reference_ = true;
+  stencil_reference_ = reference;
+  command_buffer_.setStencilReference(vk::StencilFaceFlagBits::eFront,
+                                     reference);
+}
+
+void CommandBuffer::SetScissor(const vk::Rect2D& scissor) {
+  if (has_scissor_ && scissor_ == scissor) {
+    ++elided_state_change_count_;
+    return;
+  }
+  has_scissor_ = true;
+  scissor_ = scissor;
+  command_buffer_.setScissor(0, 1, &scissor);
+}
+
+void CommandBuffer::ResetBoundState() {
+  bound_pipeline_ = vk::Pipeline();
+  bound_descriptor_sets_.fill(BoundDescriptorSet());
+  bound_vertex_buffers_.fill(vk::Buffer());
+  bound_vertex_buffer_offsets_.fill(0);
+  bound_index_buffer_ = vk::Buffer();
+  bound_index_buffer_offset_ = 0;
+  has_stencil_reference_ = false;
+  has_scissor_ = false;
+}
+
 void CommandBuffer::CopyImage(const ImagePtr& src_image,
                               const ImagePtr& dst_image,
                               vk::ImageLayout src_layout,
@@ -211,6 +405,11 @@ void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
       barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
       src_stage_mask = vk::PipelineStageFlagBits::eTransfer;
       break;
+    case vk::ImageLayout::ePresentSrcKHR:
+      // Presentation only reads the image, and is synchronized by the
+      // semaphore that is waited upon before rendering to the image.
+      src_stage_mask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+      break;
     case vk::ImageLayout::eUndefined:
       // If layout was eUndefined, we don't need a srcAccessMask.
       src_stage_mask = vk::PipelineStageFlagBits::eTopOfPipe;
@@ -279,45 +478,71 @@ void CommandBuffer::TransitionImageLayout(const ImagePtr& image,
 void CommandBuffer::BeginRenderPass(
     vk::RenderPass render_pass,
     const FramebufferPtr& framebuffer,
-    const std::vector<vk::ClearValue>& clear_values) {
+    const std::vector<vk::ClearValue>& clear_values,
+    vk::SubpassContents contents) {
   BeginRenderPass(render_pass, framebuffer, clear_values.data(),
-                  clear_values.size());
+                  clear_values.size(), contents);
 }
 
 void CommandBuffer::BeginRenderPass(vk::RenderPass render_pass,
                                     const FramebufferPtr& framebuffer,
                                     const vk::ClearValue* clear_values,
-                                    size_t clear_value_count) {
-  FTL_DCHECK(is_active_);
-  uint32_t width = framebuffer->width();
-  uint32_t height = framebuffer->height();
+                                    size_t clear_value_count,
+                                    vk::SubpassContents contents) {
+  vk::Rect2D render_area;
+  render_area.offset = vk::Offset2D{0, 0};
+  render_area.extent =
+      vk::Extent2D{framebuffer->width(), framebuffer->height()};
+  BeginRenderPass(render_pass, framebuffer, clear_values, clear_value_count,
+                  render_area, contents);
+}
+
+void CommandBuffer::BeginRenderPass(
+    vk::RenderPass render_pass,
+    const FramebufferPtr& framebuffer,
+    const std::vector<vk::ClearValue>& clear_values,
+    const vk::Rect2D& render_area,
+    vk::SubpassContents contents) {
+  BeginRenderPass(render_pass, framebuffer, clear_values.data(),
+                  clear_values.size(), render_area, contents);
+}
+
+void CommandBuffer::BeginRenderPass(vk::RenderPass render_pass,
+                                    const FramebufferPtr& framebuffer,
+                                    const vk::ClearValue* clear_values,
+                                    size_t clear_value_count,
+                                    const vk::Rect2D& render_area,
+                                    vk::SubpassContents contents) {
+  FTL_DCHECK(is_active_ && !is_secondary_);
+  FTL_DCHECK(render_area.offset.x >= 0 && render_area.offset.y >= 0);
+  FTL_DCHECK(render_area.offset.x + render_area.extent.width <=
+                 framebuffer->width() &&
+             render_area.offset.y + render_area.extent.height <=
+                 framebuffer->height());
 
   vk::RenderPassBeginInfo info;
   info.renderPass = render_pass;
-  info.renderArea.offset.x = 0;
-  info.renderArea.offset.y = 0;
-  info.renderArea.extent.width = width;
-  info.renderArea.extent.height = height;
+  info.renderArea = render_area;
   info.clearValueCount = static_cast<uint32_t>(clear_value_count);
   info.pClearValues = clear_values;
   info.framebuffer = framebuffer->get();
 
-  command_buffer_.beginRenderPass(&info, vk::SubpassContents::eInline);
+  command_buffer_.beginRenderPass(&info, contents);
+  ResetBoundState();
+  if (contents == vk::SubpassContents::eSecondaryCommandBuffers) {
+    // Secondary command buffers inherit no dynamic state, and must set their
+    // own viewport and scissor.
+    return;
+  }
 
   vk::Viewport viewport;
-  viewport.width = static_cast<float>(width);
-  viewport.height = static_cast<float>(height);
+  viewport.width = static_cast<float>(framebuffer->width());
+  viewport.height = static_cast<float>(framebuffer->height());
   viewport.minDepth = static_cast<float>(0.0f);
   viewport.maxDepth = static_cast<float>(1.0f);
   command_buffer_.setViewport(0, 1, &viewport);
 
-  // TODO: probably unnecessary?
-  vk::Rect2D scissor;
-  scissor.extent.width = width;
-  scissor.extent.height = height;
-  scissor.offset.x = 0;
-  scissor.offset.y = 0;
-  command_buffer_.setScissor(0, 1, &scissor);
+  SetScissor(render_area);
 
   // TODO: should we retain the framebuffer?
 }
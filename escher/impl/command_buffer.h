@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <array>
 #include <functional>
 #include <vector>
 
@@ -67,6 +68,60 @@ class CommandBuffer {
   // Retain mesh in used_resources.
   void DrawMesh(const MeshPtr& mesh);
 
+  // Like DrawMesh(), except that |instance_count| instances are drawn, using
+  // per-instance vertex attributes from |instance_buffer|, which is bound at
+  // |instance_binding|.  The caller is responsible for keeping
+  // |instance_buffer| alive.
+  void DrawMeshInstances(const MeshPtr& mesh,
+                         uint32_t instance_binding,
+                         vk::Buffer instance_buffer,
+                         vk::DeviceSize instance_buffer_offset,
+                         uint32_t instance_count);
+
+  // Like DrawMeshInstances(), except that the draws are specified by
+  // |draw_count| vk::DrawIndexedIndirectCommands in |indirect_buffer|.  The
+  // vertex and index buffers of |mesh| are bound at offset zero; each command
+  // must provide the firstIndex and vertexOffset of the mesh that it draws.
+  // The caller is responsible for keeping |indirect_buffer| alive, and for
+  // retaining any other meshes that are drawn.  Requires the multiDrawIndirect
+  // device feature if |draw_count| > 1.
+  void DrawMeshesIndirect(const MeshPtr& mesh,
+                          uint32_t instance_binding,
+                          vk::Buffer instance_buffer,
+                          vk::DeviceSize instance_buffer_offset,
+                          vk::Buffer indirect_buffer,
+                          vk::DeviceSize indirect_buffer_offset,
+                          uint32_t draw_count);
+
+  // State-tracking wrappers around the corresponding vk::CommandBuffer
+  // methods.  Each call is elided if it would not change the state that is
+  // already bound; see elided_state_change_count().  The tracked state is reset
+  // whenever a render pass begins, so within a render pass these must not be
+  // mixed with graphics state that is bound directly via get().
+  void BindGraphicsPipeline(vk::Pipeline pipeline);
+  void BindGraphicsDescriptorSet(vk::PipelineLayout layout,
+                                 uint32_t set_index,
+                                 vk::DescriptorSet descriptor_set,
+                                 uint32_t dynamic_offset_count = 0,
+                                 const uint32_t* dynamic_offsets = nullptr);
+  void BindVertexBuffer(uint32_t binding,
+                        vk::Buffer buffer,
+                        vk::DeviceSize offset);
+  // Index type is always eUint32.
+  void BindIndexBuffer(vk::Buffer buffer, vk::DeviceSize offset);
+  // Sets the stencil reference for front faces.  Binding a new pipeline resets
+  // the tracked reference; see ModelRenderer::Draw() for the rationale.
+  void SetStencilReference(uint32_t reference);
+  // Sets the scissor rectangle.  BeginRenderPass() sets it to the render area,
+  // which is usually the whole framebuffer.
+  void SetScissor(const vk::Rect2D& scissor);
+
+  // Number of calls to the state-tracking methods above that were elided since
+  // the command buffer was obtained from its pool.
+  uint32_t elided_state_change_count() const {
+    return elided_state_change_count_;
+  }
+
   // Copy pixels from one image to another.  No image barriers or other
   // synchronization is used.  Retain both images in used_resources.
   void CopyImage(const ImagePtr& src_image,
@@ -83,13 +138,38 @@ class CommandBuffer {
 
   // Convenient way to begin a render-pass that renders to the whole framebuffer
   // (i.e. width/height of viewport and scissors are obtained from framebuffer).
-  void BeginRenderPass(vk::RenderPass,
-                       const FramebufferPtr& framebuffer,
-                       const std::vector<vk::ClearValue>& clear_values);
-  void BeginRenderPass(vk::RenderPass,
-                       const FramebufferPtr& framebuffer,
-                       const vk::ClearValue* clear_values,
-                       size_t clear_value_count);
+  // If |contents| is eSecondaryCommandBuffers, the viewport and scissor are
+  // not set, since the only command allowed in the subpass is
+  // executeCommands(); see SecondaryCommandBufferCache.
+  void BeginRenderPass(
+      vk::RenderPass,
+      const FramebufferPtr& framebuffer,
+      const std::vector<vk::ClearValue>& clear_values,
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
+  void BeginRenderPass(
+      vk::RenderPass,
+      const FramebufferPtr& framebuffer,
+      const vk::ClearValue* clear_values,
+      size_t clear_value_count,
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
+
+  // Like BeginRenderPass(), except that only |render_area| of the framebuffer
+  // is rendered: attachments are only cleared and stored within it, and the
+  // scissor is set to it.  Callers that change the scissor must keep it within
+  // |render_area|.  The viewport still covers the whole framebuffer.
+  void BeginRenderPass(
+      vk::RenderPass,
+      const FramebufferPtr& framebuffer,
+      const std::vector<vk::ClearValue>& clear_values,
+      const vk::Rect2D& render_area,
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
+  void BeginRenderPass(
+      vk::RenderPass,
+      const FramebufferPtr& framebuffer,
+      const vk::ClearValue* clear_values,
+      size_t clear_value_count,
+      const vk::Rect2D& render_area,
+      vk::SubpassContents contents = vk::SubpassContents::eInline);
 
   // Simple wrapper around endRenderPass().
   void EndRenderPass() { command_buffer_.endRenderPass(); }
@@ -106,6 +186,7 @@ class CommandBuffer {
 
  private:
   friend class CommandBufferPool;
+  friend class SecondaryCommandBufferCache;
 
   // Called by CommandBufferPool, which is responsible for eventually destroying
   // the Vulkan command buffer and fence.  Submit() and Retire() use the fence
@@ -123,6 +204,22 @@ class CommandBuffer {
   // Return false and do nothing if the buffer's submission fence is not ready.
   bool Retire();
 
+  // Called by SecondaryCommandBufferCache to record a secondary command buffer
+  // that continues the first subpass of |render_pass|.  Resources that are
+  // passed to KeepAlive() are retained until the next call to BeginSecondary(),
+  // since the buffer may be executed by any number of primary buffers.
+  void BeginSecondary(vk::RenderPass render_pass);
+  void EndSecondary();
+
+  // Called by SecondaryCommandBufferCache, so that the primary buffer that
+  // executes this secondary buffer waits for the semaphores that were added
+  // while it was recorded (e.g. those of newly-uploaded meshes).
+  void MoveWaitSemaphoresTo(CommandBuffer* primary);
+
+  // Forget all state that was bound by the state-tracking methods, so that
+  // subsequent calls will not be elided.
+  void ResetBoundState();
+
   const vk::Device device_;
   const vk::CommandBuffer command_buffer_;
   const vk::Fence fence_;
@@ -137,8 +234,33 @@ class CommandBuffer {
   std::vector<SemaphorePtr> signal_semaphores_;
   std::vector<vk::Semaphore> signal_semaphores_for_submit_;
 
+  // State that is tracked by the Bind*() and Set*() methods.
+  struct BoundDescriptorSet {
+    vk::PipelineLayout layout;
+    vk::DescriptorSet descriptor_set;
+    // Sets with more than one dynamic offset are not tracked.
+    uint32_t dynamic_offset_count = 0;
+    uint32_t dynamic_offset = 0;
+  };
+  static constexpr uint32_t kMaxTrackedDescriptorSets = 4;
+  static constexpr uint32_t kMaxTrackedVertexBindings = 2;
+  vk::Pipeline bound_pipeline_;
+  std::array<BoundDescriptorSet, kMaxTrackedDescriptorSets>
+      bound_descriptor_sets_;
+  std::array<vk::Buffer, kMaxTrackedVertexBindings> bound_vertex_buffers_;
+  std::array<vk::DeviceSize, kMaxTrackedVertexBindings>
+      bound_vertex_buffer_offsets_;
+  vk::Buffer bound_index_buffer_;
+  vk::DeviceSize bound_index_buffer_offset_ = 0;
+  bool has_stencil_reference_ = false;
+  uint32_t stencil_reference_ = 0;
+  bool has_scissor_ = false;
+  vk::Rect2D scissor_;
+  uint32_t elided_state_change_count_ = 0;
+
   bool is_active_ = false;
   bool is_submitted_ = false;
+  bool is_secondary_ = false;
 
   uint64_t sequence_number_ = 0;
 
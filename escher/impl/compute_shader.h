@@ -37,7 +37,23 @@ class ComputeShader {
                 uint32_t z,
                 const void* push_constants);
 
+  // Same as Dispatch(), except that the number of workgroups is read from a
+  // vk::DispatchIndirectCommand at |offset| in |indirect_buffer|, which is
+  // typically written by a previous dispatch.
+  void DispatchIndirect(std::vector<TexturePtr> textures,
+                        std::vector<BufferPtr> buffers,
+                        CommandBuffer* command_buffer,
+                        const BufferPtr& indirect_buffer,
+                        vk::DeviceSize offset,
+                        const void* push_constants);
+
  private:
+  // Update descriptors and push-constants, and bind the pipeline.
+  void Bind(const std::vector<TexturePtr>& textures,
+            const std::vector<BufferPtr>& buffers,
+            CommandBuffer* command_buffer,
+            const void* push_constants);
+
   const vk::Device device_;
   const std::vector<vk::DescriptorSetLayoutBinding>
       descriptor_set_layout_bindings_;
@@ -0,0 +1,207 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/damage_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "escher/geometry/bounding_box.h"
+#include "escher/impl/object_key.h"
+#include "escher/scene/object.h"
+#include "escher/util/hash.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// Targets that have not been rendered into for this many frames are forgotten,
+// e.g. because they belonged to a swapchain that has since been destroyed.
+constexpr uint64_t kMaxTargetAge = 16;
+
+bool IsEmpty(const vk::Rect2D& rect) {
+  return rect.extent.width == 0 || rect.extent.height == 0;
+}
+
+vk::Rect2D UnionRects(const vk::Rect2D& a, const vk::Rect2D& b) {
+  if (IsEmpty(a)) {
+    return b;
+  } else if (IsEmpty(b)) {
+    return a;
+  }
+  const int32_t x0 = std::min(a.offset.x, b.offset.x);
+  const int32_t y0 = std::min(a.offset.y, b.offset.y);
+  const int32_t x1 =
+      std::max(a.offset.x + static_cast<int32_t>(a.extent.width),
+               b.offset.x + static_cast<int32_t>(b.extent.width));
+  const int32_t y1 =
+      std::max(a.offset.y + static_cast<int32_t>(a.extent.height),
+               b.offset.y + static_cast<int32_t>(b.extent.height));
+  vk::Rect2D result;
+  result.offset = vk::Offset2D{x0, y0};
+  result.extent = vk::Extent2D{static_cast<uint32_t>(x1 - x0),
+                               static_cast<uint32_t>(y1 - y0)};
+  return result;
+}
+
+}  // namespace
+
+bool DamageTracker::FrameState::operator==(const FrameState& other) const {
+  return camera_transform == other.camera_transform &&
+         clear_color == other.clear_color && key_light == other.key_light &&
+         fill_light_intensity == other.fill_light_intensity &&
+         width == other.width && height == other.height &&
+         layer_image_uid == other.layer_image_uid &&
+         enable_lighting == other.enable_lighting &&
+         renderer_settings == other.renderer_settings;
+}
+
+DamageTracker::DamageTracker(uint32_t margin) : margin_(margin) {}
+
+DamageTracker::~DamageTracker() = default;
+
+void DamageTracker::BeginFrame(const FrameState& state) {
+  is_fully_damaged_ = !has_state_ || state != state_;
+  state_ = state;
+  has_state_ = true;
+  damage_ = vk::Rect2D();
+  objects_.clear();
+}
+
+void DamageTracker::AddObjects(const std::vector<Object>& objects,
+                               const mat4& transform,
+                               uint32_t pass) {
+  FTL_DCHECK(has_state_);
+  for (const Object& object : objects) {
+    if (HasShapeModifiers(object)) {
+      // The object may change from frame to frame.
+      is_fully_damaged_ = true;
+    }
+
+    ByteKey key;
+    AppendToKey(&key, pass);
+    AppendObjectToKey(&key, object);
+    auto result = objects_.emplace(std::move(key), Entry{vk::Rect2D(), 0});
+    Entry& entry = result.first->second;
+    if (result.second) {
+      entry.rect = GetObjectRect(object, transform);
+    }
+    ++entry.count;
+  }
+}
+
+vk::Rect2D DamageTracker::EndFrame(vk::Image target) {
+  FTL_DCHECK(has_state_);
+  vk::Rect2D full_frame;
+  full_frame.extent = vk::Extent2D{state_.width, state_.height};
+
+  // Objects that are in only one of the frames, or in different numbers,
+  // damage their rects.  The rects are the same in both frames, because the
+  // camera and frame size are.
+  if (is_fully_damaged_) {
+    damage_ = full_frame;
+  } else {
+    for (auto& pair : objects_) {
+      auto it = previous_objects_.find(pair.first);
+      if (it == previous_objects_.end() ||
+          it->second.count != pair.second.count) {
+        AddDamage(pair.second.rect);
+      }
+    }
+    for (auto& pair : previous_objects_) {
+      if (objects_.find(pair.first) == objects_.end()) {
+        AddDamage(pair.second.rect);
+      }
+    }
+  }
+  previous_objects_ = std::move(objects_);
+  objects_.clear();
+
+  // Accumulate the damage into every target.  Whatever has accumulated into
+  // |target| since it was last rendered must be rendered now.
+  ++frame_count_;
+  vk::Rect2D result = full_frame;
+  bool found = false;
+  for (auto it = targets_.begin(); it != targets_.end();) {
+    if (it->image == target) {
+      result = UnionRects(it->damage, damage_);
+      it->damage = vk::Rect2D();
+      it->last_frame = frame_count_;
+      found = true;
+    } else if (frame_count_ - it->last_frame > kMaxTargetAge) {
+      it = targets_.erase(it);
+      continue;
+    } else {
+      it->damage = UnionRects(it->damage, damage_);
+    }
+    ++it;
+  }
+  if (!found) {
+    targets_.push_back(Target{target, vk::Rect2D(), frame_count_});
+  }
+  return result;
+}
+
+void DamageTracker::Reset() {
+  has_state_ = false;
+  previous_objects_.clear();
+  objects_.clear();
+  targets_.clear();
+}
+
+vk::Rect2D DamageTracker::GetObjectRect(const Object& object,
+                                        const mat4& transform) const {
+  vk::Rect2D full_frame;
+  full_frame.extent = vk::Extent2D{state_.width, state_.height};
+
+  // Shape modifiers (e.g. kWobble) are not accounted for by the bounding box,
+  // and clip-groups without clippers have no bounds.
+  const BoundingBox box = object.bounding_box();
+  if (HasShapeModifiers(object) || box.is_empty()) {
+    return full_frame;
+  }
+
+  vec2 min(std::numeric_limits<float>::max());
+  vec2 max(std::numeric_limits<float>::lowest());
+  for (int i = 0; i < 8; ++i) {
+    const vec4 corner =
+        transform * vec4((i & 1) ? box.max().x : box.min().x,
+                         (i & 2) ? box.max().y : box.min().y,
+                         (i & 4) ? box.max().z : box.min().z, 1.f);
+    if (corner.w <= 0.f) {
+      // The object crosses the eye plane.
+      return full_frame;
+    }
+    const vec2 ndc = vec2(corner) / corner.w;
+    min = glm::min(min, ndc);
+    max = glm::max(max, ndc);
+  }
+
+  // Convert to pixels, expand by the margin, and clamp to the frame.
+  const vec2 size(state_.width, state_.height);
+  const vec2 margin(static_cast<float>(margin_));
+  const vec2 min_px = glm::clamp(
+      glm::floor((min + 1.f) * 0.5f * size) - margin, vec2(0.f), size);
+  const vec2 max_px = glm::clamp(
+      glm::ceil((max + 1.f) * 0.5f * size) + margin, vec2(0.f), size);
+  if (min_px.x >= max_px.x || min_px.y >= max_px.y) {
+    // The object is outside of the frame.
+    return vk::Rect2D();
+  }
+  vk::Rect2D rect;
+  rect.offset = vk::Offset2D{static_cast<int32_t>(min_px.x),
+                             static_cast<int32_t>(min_px.y)};
+  rect.extent = vk::Extent2D{static_cast<uint32_t>(max_px.x - min_px.x),
+                             static_cast<uint32_t>(max_px.y - min_px.y)};
+  return rect;
+}
+
+void DamageTracker::AddDamage(const vk::Rect2D& rect) {
+  damage_ = UnionRects(damage_, rect);
+}
+
+}  // namespace impl
+}  // namespace escher
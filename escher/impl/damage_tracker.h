@@ -0,0 +1,116 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/geometry/types.h"
+#include "escher/util/hash.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Tracks which pixels may differ from one frame to the next, so that
+// PaperRenderer need only render those again; the rest of the output image is
+// preserved from the last frame that was rendered into it.  Objects are
+// identified by their contents: an object whose transform, shape, material and
+// clip-group are the same as in the previous frame is assumed to render the
+// same pixels, wherever it appears in the model.  Textures are assumed to be
+// immutable.  Not thread-safe.
+class DamageTracker {
+ public:
+  // Everything other than the objects that affects the pixels of the frame.  If
+  // any of it changes, the whole frame is damaged.
+  struct FrameState {
+    mat4 camera_transform;
+    vec4 clear_color;
+    // Direction, dispersion and intensity of the key light.
+    vec4 key_light;
+    float fill_light_intensity;
+    uint32_t width;
+    uint32_t height;
+    // The uid of the image of the model's Layer, or 0 if there is none; see
+    // Layer.  Unlike the image's address, the uid is never reused.
+    uint64_t layer_image_uid;
+    bool enable_lighting;
+    // The settings of the renderer that affect the pixels, e.g. how SSDO is
+    // computed, appended with AppendToKey().
+    ByteKey renderer_settings;
+
+    bool operator==(const FrameState& other) const;
+    bool operator!=(const FrameState& other) const { return !(*this == other); }
+  };
+
+  // The screen-space rectangle of each changed object is expanded by |margin|
+  // pixels in each direction, to cover e.g. the shadows that it casts.
+  explicit DamageTracker(uint32_t margin);
+  ~DamageTracker();
+
+  // Begin describing the next frame.
+  void BeginFrame(const FrameState& state);
+
+  // Add the objects of the frame.  |transform| maps them to normalized device
+  // coordinates.  Objects that are added with different |pass| values are
+  // distinct, e.g. because they are drawn in different ways.
+  void AddObjects(const std::vector<Object>& objects,
+                  const mat4& transform,
+                  uint32_t pass);
+
+  // Finish describing the frame, and return the rectangle of |target| that
+  // must be rendered again, in pixels.  This is empty if nothing changed since
+  // the last frame that was rendered into |target|, and covers the whole frame
+  // if nothing has been rendered into |target| yet.  The caller must then
+  // render at least that rectangle into |target|, and preserve the rest.
+  vk::Rect2D EndFrame(vk::Image target);
+
+  // Forget everything that has been rendered, so that the next frame is
+  // damaged entirely, e.g. because the contents of the targets were lost.
+  void Reset();
+
+ private:
+  // The objects with the same key in a frame.
+  struct Entry {
+    vk::Rect2D rect;
+    uint32_t count;
+  };
+
+  // The damage that has accumulated since |image| was last rendered.
+  struct Target {
+    vk::Image image;
+    vk::Rect2D damage;
+    uint64_t last_frame;
+  };
+
+  // Return the rectangle of the frame that may be covered by |object| and its
+  // margin, clamped to the frame.
+  vk::Rect2D GetObjectRect(const Object& object, const mat4& transform) const;
+
+  // Expand |damage_| to encompass |rect|.
+  void AddDamage(const vk::Rect2D& rect);
+
+  const uint32_t margin_;
+  uint64_t frame_count_ = 0;
+
+  FrameState state_;
+  bool has_state_ = false;
+  bool is_fully_damaged_ = false;
+  vk::Rect2D damage_;
+
+  std::unordered_map<ByteKey, Entry, ByteKeyHash> previous_objects_;
+  std::unordered_map<ByteKey, Entry, ByteKeyHash> objects_;
+
+  // There are few enough targets (e.g. swapchain images) that a linear search
+  // is fastest.
+  std::vector<Target> targets_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(DamageTracker);
+};
+
+}  // namespace impl
+}  // namespace escher
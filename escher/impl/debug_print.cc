@@ -135,7 +135,12 @@ std::ostream& operator<<(std::ostream& str,
       << ", is_clippee: " << spec.is_clippee
       << ", depth_prepass: " << spec.use_depth_prepass
       << ", has_material: " << spec.has_material
-      << ", is_opaque: " << spec.is_opaque << "]";
+      << ", is_opaque: " << spec.is_opaque
+      << ", disable_depth_test: " << spec.disable_depth_test
+      << ", dynamic_uniform_offset: " << spec.use_dynamic_uniform_offset
+      << ", push_constants: " << spec.use_push_constants
+      << ", instancing: " << spec.use_instancing
+      << "]";
   return str;
 }
 
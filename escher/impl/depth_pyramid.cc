@@ -0,0 +1,250 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/depth_pyramid.h"
+
+#include "escher/escher.h"
+#include "escher/impl/command_buffer.h"
+#include "escher/impl/compute_shader.h"
+#include "escher/impl/occlusion_culler.h"
+#include "escher/renderer/image.h"
+#include "escher/renderer/image_factory.h"
+#include "escher/renderer/texture.h"
+#include "escher/renderer/timestamper.h"
+#include "escher/resources/resource_recycler.h"
+#include "escher/util/trace_macros.h"
+#include "escher/vk/buffer.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// Must match the local size in the shaders.
+constexpr uint32_t kLocalSize = 8;
+
+constexpr char g_depth_kernel_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(binding = 0) uniform sampler2D depthImage;
+  layout(binding = 1, r32f) uniform writeonly image2D resultImage;
+
+  layout(local_size_x = 8, local_size_y = 8) in;
+
+  void main() {
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(dst, imageSize(resultImage)))) {
+      return;
+    }
+    ivec2 src = dst * 2;
+    float depth = max(max(texelFetch(depthImage, src, 0).r,
+                          texelFetch(depthImage, src + ivec2(1, 0), 0).r),
+                      max(texelFetch(depthImage, src + ivec2(0, 1), 0).r,
+                          texelFetch(depthImage, src + ivec2(1, 1), 0).r));
+    imageStore(resultImage, dst, vec4(depth));
+  }
+  )GLSL";
+
+constexpr char g_reduce_kernel_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(binding = 0, r32f) uniform readonly image2D sourceImage;
+  layout(binding = 1, r32f) uniform writeonly image2D resultImage;
+
+  layout(local_size_x = 8, local_size_y = 8) in;
+
+  void main() {
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(dst, imageSize(resultImage)))) {
+      return;
+    }
+    ivec2 src = dst * 2;
+    float depth = max(max(imageLoad(sourceImage, src).r,
+                          imageLoad(sourceImage, src + ivec2(1, 0)).r),
+                      max(imageLoad(sourceImage, src + ivec2(0, 1)).r,
+                          imageLoad(sourceImage, src + ivec2(1, 1)).r));
+    imageStore(resultImage, dst, vec4(depth));
+  }
+  )GLSL";
+
+// Levels are only generated while they exactly halve the previous one, so
+// that every texel of the readback covers the same area of the screen.
+bool CanHalve(uint32_t width, uint32_t height) {
+  return width % 2 == 0 && height % 2 == 0 &&
+         (width > DepthPyramid::kMaxReadbackSize ||
+          height > DepthPyramid::kMaxReadbackSize);
+}
+
+}  // namespace
+
+DepthPyramid::DepthPyramid(Escher* escher, ImageFactory* image_factory)
+    : escher_(escher), image_factory_(image_factory) {
+  // Needed to know when readbacks are safe to read; see
+  // GetPreviousFrameDepth().
+  Register(escher->command_buffer_sequencer());
+}
+
+DepthPyramid::~DepthPyramid() {
+  Unregister(escher_->command_buffer_sequencer());
+}
+
+void DepthPyramid::Generate(CommandBuffer* command_buffer,
+                            const TexturePtr& depth_texture,
+                            const mat4& camera_transform,
+                            Timestamper* timestamper) {
+  TRACE_DURATION("gfx", "escher::DepthPyramid::Generate", "width",
+                 depth_texture->width(), "height", depth_texture->height());
+
+  uint32_t width = depth_texture->width();
+  uint32_t height = depth_texture->height();
+  if (!CanHalve(width, height)) {
+    // Too small to be worth reducing; no readback is generated.
+    return;
+  }
+
+  if (!depth_kernel_) {
+    FTL_DLOG(INFO) << "Lazily instantiating depth_kernel_";
+    depth_kernel_ = std::make_unique<ComputeShader>(
+        escher_,
+        std::vector<vk::ImageLayout>{vk::ImageLayout::eShaderReadOnlyOptimal,
+                                     vk::ImageLayout::eGeneral},
+        std::vector<vk::DescriptorType>{}, 0, g_depth_kernel_src);
+    reduce_kernel_ = std::make_unique<ComputeShader>(
+        escher_,
+        std::vector<vk::ImageLayout>{vk::ImageLayout::eGeneral,
+                                     vk::ImageLayout::eGeneral},
+        std::vector<vk::DescriptorType>{}, 0, g_reduce_kernel_src);
+  }
+
+  // Each level is written by one dispatch, and read by the next.
+  vk::MemoryBarrier barrier;
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+  TexturePtr source = depth_texture;
+  while (CanHalve(width, height)) {
+    if (source != depth_texture) {
+      command_buffer->get().pipelineBarrier(
+          vk::PipelineStageFlagBits::eComputeShader,
+          vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 1,
+          &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    width /= 2;
+    height /= 2;
+    ImagePtr level_image = image_factory_->NewImage(
+        {vk::Format::eR32Sfloat, width, height, 1,
+         vk::ImageUsageFlagBits::eStorage |
+             vk::ImageUsageFlagBits::eTransferSrc});
+    TexturePtr level = ftl::MakeRefCounted<Texture>(
+        escher_->resource_recycler(), level_image, vk::Filter::eNearest,
+        vk::ImageAspectFlagBits::eColor, true);
+    command_buffer->TransitionImageLayout(
+        level_image, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral);
+
+    ComputeShader* kernel =
+        source == depth_texture ? depth_kernel_.get() : reduce_kernel_.get();
+    kernel->Dispatch({source, level}, {}, command_buffer,
+                     (width + kLocalSize - 1) / kLocalSize,
+                     (height + kLocalSize - 1) / kLocalSize, 1, nullptr);
+    source = std::move(level);
+  }
+  timestamper->AddTimestamp("generated depth pyramid");
+
+  // Copy the coarsest level into host-visible memory.
+  const ImagePtr& coarsest = source->image();
+  command_buffer->TransitionImageLayout(coarsest, vk::ImageLayout::eGeneral,
+                                        vk::ImageLayout::eTransferSrcOptimal);
+  BufferPtr buffer = GetReadbackBuffer(width * height * sizeof(float));
+
+  vk::BufferImageCopy region;
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = vk::Offset3D{0, 0, 0};
+  region.imageExtent = vk::Extent3D{width, height, 1};
+  command_buffer->get().copyImageToBuffer(
+      coarsest->get(), vk::ImageLayout::eTransferSrcOptimal, buffer->get(), 1,
+      &region);
+  command_buffer->KeepAlive(buffer);
+
+  vk::BufferMemoryBarrier buffer_barrier;
+  buffer_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  buffer_barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+  buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.buffer = buffer->get();
+  buffer_barrier.offset = 0;
+  buffer_barrier.size = buffer->size();
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost,
+      vk::DependencyFlags(), 0, nullptr, 1, &buffer_barrier, 0, nullptr);
+
+  pending_readbacks_.push_back({std::move(buffer), width, height,
+                                camera_transform,
+                                command_buffer->sequence_number()});
+  timestamper->AddTimestamp("copied depth pyramid for readback");
+}
+
+const OcclusionCuller* DepthPyramid::GetPreviousFrameDepth(
+    const mat4& camera_transform) {
+  // Only the most recent finished readback is of interest; the buffers of any
+  // older ones are simply recycled.
+  auto finished = pending_readbacks_.begin();
+  while (finished != pending_readbacks_.end() &&
+         finished->sequence_number <= last_finished_sequence_number_) {
+    ++finished;
+  }
+  if (finished != pending_readbacks_.begin()) {
+    const Readback& latest = *(finished - 1);
+    if (!previous_frame_depth_ ||
+        previous_frame_depth_->width() != latest.width ||
+        previous_frame_depth_->height() != latest.height) {
+      previous_frame_depth_ =
+          std::make_unique<OcclusionCuller>(latest.width, latest.height);
+    }
+    previous_frame_depth_->LoadDepths(
+        reinterpret_cast<const float*>(latest.buffer->ptr()));
+    previous_frame_camera_transform_ = latest.camera_transform;
+
+    for (auto it = pending_readbacks_.begin(); it != finished; ++it) {
+      free_buffers_.push_back(std::move(it->buffer));
+    }
+    pending_readbacks_.erase(pending_readbacks_.begin(), finished);
+  }
+
+  if (previous_frame_depth_ &&
+      previous_frame_camera_transform_ == camera_transform) {
+    return previous_frame_depth_.get();
+  }
+  return nullptr;
+}
+
+void DepthPyramid::OnCommandBufferFinished(uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number > last_finished_sequence_number_);
+  last_finished_sequence_number_ = sequence_number;
+}
+
+BufferPtr DepthPyramid::GetReadbackBuffer(vk::DeviceSize size) {
+  while (!free_buffers_.empty()) {
+    BufferPtr buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+    if (buffer->size() == size) {
+      return buffer;
+    }
+  }
+  return Buffer::New(escher_->resource_recycler(), escher_->gpu_allocator(),
+                     size, vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+}  // namespace impl
+}  // namespace escher
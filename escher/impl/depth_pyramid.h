@@ -0,0 +1,87 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/geometry/types.h"
+#include "escher/impl/command_buffer_sequencer.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Reduces a depth image to a hierarchical-Z pyramid, where each texel of a
+// level holds the maximum (i.e. farthest) depth of the 2x2 texels beneath it
+// in the previous level.  The coarsest level is copied into host-visible
+// memory, so that once the GPU has finished with it, it can be used on the CPU
+// to cull objects that are hidden in subsequent frames.
+class DepthPyramid : public CommandBufferSequencerListener {
+ public:
+  // Levels are generated until both dimensions are no larger than this, or
+  // until the next level would not exactly halve the previous one.
+  static constexpr uint32_t kMaxReadbackSize = 64;
+
+  DepthPyramid(Escher* escher, ImageFactory* image_factory);
+  ~DepthPyramid() override;
+
+  // Record commands that reduce |depth_texture|, which must be in the
+  // eShaderReadOnlyOptimal layout, and then read back the coarsest level.
+  // |camera_transform| is the transform that was used to render the depth
+  // image; it is kept with the readback so that stale results are not used
+  // after the camera moves.
+  void Generate(CommandBuffer* command_buffer,
+                const TexturePtr& depth_texture,
+                const mat4& camera_transform,
+                Timestamper* timestamper);
+
+  // Return the coarsest level of the most recently generated pyramid that the
+  // GPU has finished, or nullptr if there is none, or if it was rendered with
+  // a transform other than |camera_transform|.  The result remains valid, and
+  // unchanged, until the next call.
+  const OcclusionCuller* GetPreviousFrameDepth(const mat4& camera_transform);
+
+ private:
+  struct Readback {
+    BufferPtr buffer;
+    uint32_t width;
+    uint32_t height;
+    mat4 camera_transform;
+    uint64_t sequence_number;
+  };
+
+  // Implement CommandBufferSequencerListener::OnCommandBufferFinished().
+  // Only records the sequence number; readbacks are consumed lazily by
+  // GetPreviousFrameDepth(), so that the result doesn't change mid-frame.
+  void OnCommandBufferFinished(uint64_t sequence_number) override;
+
+  // Return a host-visible buffer of the specified size, reusing one from a
+  // previous readback if possible.
+  BufferPtr GetReadbackBuffer(vk::DeviceSize size);
+
+  Escher* const escher_;
+  ImageFactory* const image_factory_;
+
+  // Reduces the depth image to the first level of the pyramid.
+  std::unique_ptr<ComputeShader> depth_kernel_;
+  // Reduces each level of the pyramid to the next.
+  std::unique_ptr<ComputeShader> reduce_kernel_;
+
+  uint64_t last_finished_sequence_number_ = 0;
+  std::vector<Readback> pending_readbacks_;
+  std::vector<BufferPtr> free_buffers_;
+
+  // Contents of the most recent finished readback.
+  std::unique_ptr<OcclusionCuller> previous_frame_depth_;
+  mat4 previous_frame_camera_transform_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(DepthPyramid);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,59 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/framebuffer_cache.h"
+
+#include "escher/impl/command_buffer.h"
+#include "escher/renderer/image.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// Framebuffers that have not been used for this many frames are discarded.
+// Must exceed the number of swapchain images, since a framebuffer that renders
+// into one is only used when that image is.
+constexpr uint64_t kMaxFramebufferAge = 8;
+
+}  // namespace
+
+FramebufferCache::FramebufferCache(Escher* escher)
+    : escher_(escher), framebuffers_(kMaxFramebufferAge) {}
+
+FramebufferCache::~FramebufferCache() = default;
+
+FramebufferPtr FramebufferCache::ObtainFramebuffer(
+    vk::RenderPass render_pass,
+    const std::vector<ImagePtr>& images,
+    CommandBuffer* command_buffer) {
+  FTL_DCHECK(!images.empty());
+  const uint32_t width = images[0]->width();
+  const uint32_t height = images[0]->height();
+
+  ByteKey key;
+  AppendToKey(&key, static_cast<VkRenderPass>(render_pass));
+  AppendToKey(&key, width);
+  AppendToKey(&key, height);
+  for (const ImagePtr& image : images) {
+    AppendToKey(&key, image->uid());
+    command_buffer->KeepAlive(image);
+  }
+
+  const FramebufferPtr& framebuffer =
+      framebuffers_.Obtain(std::move(key), [&]() {
+        return ftl::MakeRefCounted<Framebuffer>(escher_, width, height, images,
+                                                render_pass, false);
+      });
+  command_buffer->KeepAlive(framebuffer);
+  return framebuffer;
+}
+
+void FramebufferCache::EndFrame() {
+  // Command buffers that still use an evicted framebuffer keep it alive.
+  framebuffers_.EndRound();
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,59 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/impl/aging_cache.h"
+#include "escher/renderer/framebuffer.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Caches Framebuffers, so that rendering into the same images with the same
+// render pass does not create and destroy a vk::Framebuffer (and its image
+// views) every frame.  Since ImageCache recycles the same Images from frame to
+// frame, the same sets of attachments recur.
+//
+// Framebuffers are identified by the render pass and by the uids of their
+// images, and do not retain the images; otherwise the images could never be
+// returned to their ImageCache.  An Image that is recycled keeps its uid, so
+// its framebuffers remain valid.  One that is destroyed never matches again,
+// and so its framebuffers are never used again, and are evicted by EndFrame()
+// once they are old enough.  Not thread-safe.
+class FramebufferCache {
+ public:
+  explicit FramebufferCache(Escher* escher);
+  ~FramebufferCache();
+
+  // Return a framebuffer that binds |images|, which must all have the same
+  // size, to |render_pass|.  The framebuffer and the images are kept alive by
+  // |command_buffer|.
+  FramebufferPtr ObtainFramebuffer(vk::RenderPass render_pass,
+                                   const std::vector<ImagePtr>& images,
+                                   CommandBuffer* command_buffer);
+
+  // Discard the framebuffers that have not been obtained during the last few
+  // frames.  Called once per frame.
+  void EndFrame();
+
+  // Statistics, for debugging.
+  uint32_t hit_count() const { return framebuffers_.hit_count(); }
+  uint32_t miss_count() const { return framebuffers_.miss_count(); }
+  size_t size() const { return framebuffers_.size(); }
+
+ private:
+  Escher* const escher_;
+  // Each round is a frame.
+  AgingCache<FramebufferPtr> framebuffers_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(FramebufferCache);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,165 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/frustum_culler.h"
+
+#include "escher/impl/command_buffer.h"
+#include "escher/vk/buffer.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+// Must match the local size in the shader.
+constexpr uint32_t kLocalSize = 64;
+
+constexpr char g_frustum_cull_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(push_constant) uniform PushConstants {
+    uint command_count;
+  };
+
+  // Must match FrustumCuller::CullData.
+  struct CullData {
+    mat4 transform;
+    vec4 bounds_min;
+    vec4 bounds_max;
+  };
+
+  // Must match vk::DrawIndexedIndirectCommand.
+  struct DrawCommand {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+  };
+
+  layout(std430, binding = 0) readonly buffer CullDataBuffer {
+    CullData cull_data[];
+  };
+
+  layout(std430, binding = 1) buffer DrawCommandBuffer {
+    DrawCommand commands[];
+  };
+
+  layout(local_size_x = 64) in;
+
+  // Must match FrustumCuller::IsOutsideFrustum().
+  bool IsOutsideFrustum(mat4 transform, vec3 bounds_min, vec3 bounds_max) {
+    if (any(greaterThan(bounds_min, bounds_max))) {
+      return false;
+    }
+    int left = 0, right = 0, bottom = 0, top = 0, front = 0, back = 0;
+    for (int i = 0; i < 8; ++i) {
+      vec3 corner = vec3((i & 1) != 0 ? bounds_max.x : bounds_min.x,
+                         (i & 2) != 0 ? bounds_max.y : bounds_min.y,
+                         (i & 4) != 0 ? bounds_max.z : bounds_min.z);
+      vec4 pos = transform * vec4(corner, 1);
+      left += pos.x < -pos.w ? 1 : 0;
+      right += pos.x > pos.w ? 1 : 0;
+      bottom += pos.y < -pos.w ? 1 : 0;
+      top += pos.y > pos.w ? 1 : 0;
+      front += pos.z < 0.0 ? 1 : 0;
+      back += pos.z > pos.w ? 1 : 0;
+    }
+    return left == 8 || right == 8 || bottom == 8 || top == 8 ||
+           front == 8 || back == 8;
+  }
+
+  void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= command_count) {
+      return;
+    }
+    CullData data = cull_data[index];
+    if (IsOutsideFrustum(data.transform, data.bounds_min.xyz,
+                         data.bounds_max.xyz)) {
+      commands[index].instance_count = 0;
+    }
+  }
+  )GLSL";
+
+}  // namespace
+
+FrustumCuller::FrustumCuller(Escher* escher)
+    : kernel_(escher,
+              std::vector<vk::ImageLayout>{},
+              std::vector<vk::DescriptorType>{
+                  vk::DescriptorType::eStorageBuffer,
+                  vk::DescriptorType::eStorageBuffer},
+              sizeof(uint32_t),
+              g_frustum_cull_src) {}
+
+FrustumCuller::~FrustumCuller() {}
+
+bool FrustumCuller::IsOutsideFrustum(const mat4& transform,
+                                     const BoundingBox& box) {
+  if (box.is_empty()) {
+    return false;
+  }
+  const vec3& min = box.min();
+  const vec3& max = box.max();
+  int left = 0, right = 0, bottom = 0, top = 0, front = 0, back = 0;
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y,
+                (i & 4) ? max.z : min.z);
+    vec4 pos = transform * vec4(corner, 1);
+    left += pos.x < -pos.w ? 1 : 0;
+    right += pos.x > pos.w ? 1 : 0;
+    bottom += pos.y < -pos.w ? 1 : 0;
+    top += pos.y > pos.w ? 1 : 0;
+    front += pos.z < 0.f ? 1 : 0;
+    back += pos.z > pos.w ? 1 : 0;
+  }
+  return left == 8 || right == 8 || bottom == 8 || top == 8 || front == 8 ||
+         back == 8;
+}
+
+void FrustumCuller::CullIndirectDraws(const BufferPtr& cull_data,
+                                      const BufferPtr& indirect_commands,
+                                      uint32_t command_count,
+                                      CommandBuffer* command_buffer) {
+  FTL_DCHECK(command_count * sizeof(CullData) <= cull_data->size());
+  FTL_DCHECK(command_count * sizeof(vk::DrawIndexedIndirectCommand) <=
+             indirect_commands->size());
+
+  vk::BufferMemoryBarrier barriers[2];
+  barriers[0].srcAccessMask = vk::AccessFlagBits::eHostWrite;
+  barriers[0].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].buffer = cull_data->get();
+  barriers[0].offset = 0;
+  barriers[0].size = cull_data->size();
+  barriers[1] = barriers[0];
+  barriers[1].dstAccessMask =
+      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  barriers[1].buffer = indirect_commands->get();
+  barriers[1].size = indirect_commands->size();
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eHost,
+      vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 0,
+      nullptr, 2, barriers, 0, nullptr);
+
+  const uint32_t group_count = (command_count + kLocalSize - 1) / kLocalSize;
+  kernel_.Dispatch(std::vector<TexturePtr>{},
+                   std::vector<BufferPtr>{cull_data, indirect_commands},
+                   command_buffer, group_count, 1, 1, &command_count);
+
+  // The culled commands are consumed by drawIndexedIndirect().
+  vk::BufferMemoryBarrier barrier = barriers[1];
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eDrawIndirect, vk::DependencyFlags(), 0,
+      nullptr, 1, &barrier, 0, nullptr);
+}
+
+}  // namespace impl
+}  // namespace escher
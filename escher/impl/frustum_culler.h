@@ -0,0 +1,57 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "escher/forward_declarations.h"
+#include "escher/geometry/bounding_box.h"
+#include "escher/geometry/types.h"
+#include "escher/impl/compute_shader.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Culls objects whose bounding boxes lie entirely outside of the view frustum.
+// This can be done either on the CPU, one object at a time, or on the GPU by a
+// compute shader that disables indirect draw commands.  Both use the same test.
+class FrustumCuller {
+ public:
+  // Per-draw input to CullIndirectDraws().  Must match the layout of the
+  // struct of the same name in the compute shader.
+  struct CullData {
+    // Transforms the bounding box into clip space.
+    mat4 transform;
+    // Only the xyz components are used.
+    vec4 bounds_min;
+    vec4 bounds_max;
+  };
+
+  explicit FrustumCuller(Escher* escher);
+  ~FrustumCuller();
+
+  // Return true if |box| lies entirely outside of the Vulkan clip volume after
+  // being transformed by |transform|.  The test is conservative: a box is only
+  // culled if all of its corners are outside of the same clip plane, and empty
+  // boxes are never culled.
+  static bool IsOutsideFrustum(const mat4& transform, const BoundingBox& box);
+
+  // Record a compute dispatch that performs the same test for the first
+  // |command_count| vk::DrawIndexedIndirectCommands in |indirect_commands|,
+  // using the corresponding CullData in |cull_data|; the instanceCount of each
+  // culled command is set to zero.  Both buffers must have been written by the
+  // host; the necessary barriers are recorded before and after the dispatch.
+  void CullIndirectDraws(const BufferPtr& cull_data,
+                         const BufferPtr& indirect_commands,
+                         uint32_t command_count,
+                         CommandBuffer* command_buffer);
+
+ private:
+  ComputeShader kernel_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(FrustumCuller);
+};
+
+}  // namespace impl
+}  // namespace escher
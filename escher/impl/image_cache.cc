@@ -29,7 +29,10 @@ ImagePtr ImageCache::NewImage(const ImageInfo& info) {
 
   // Allocate memory and bind it to the image.
   vk::MemoryRequirements reqs = device().getImageMemoryRequirements(image);
-  GpuMemPtr memory = allocator_->Allocate(reqs, info.memory_flags);
+  GpuMemPtr memory = allocator_->Allocate(
+      reqs, GetSupportedMemoryProperties(vulkan_context().physical_device,
+                                         reqs.memoryTypeBits,
+                                         info.memory_flags));
   vk::Result result =
       device().bindImageMemory(image, memory->base(), memory->offset());
   FTL_CHECK(result == vk::Result::eSuccess);
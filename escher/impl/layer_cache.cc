@@ -0,0 +1,95 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/layer_cache.h"
+
+#include <algorithm>
+
+#include "escher/scene/layer.h"
+
+namespace escher {
+namespace impl {
+
+bool LayerCache::Key::operator==(const Key& other) const {
+  return camera_transform == other.camera_transform &&
+         format == other.format && width == other.width &&
+         height == other.height && clear_color == other.clear_color &&
+         key_light == other.key_light &&
+         fill_light_intensity == other.fill_light_intensity &&
+         viewing_volume == other.viewing_volume &&
+         enable_lighting == other.enable_lighting &&
+         renderer_settings == other.renderer_settings &&
+         inner_layers == other.inner_layers;
+}
+
+LayerCache::LayerCache(vk::DeviceSize memory_budget)
+    : memory_budget_(memory_budget) {}
+
+LayerCache::~LayerCache() = default;
+
+TexturePtr LayerCache::Find(const Layer& layer, const Key& key) {
+  auto it = std::find_if(entries_.begin(), entries_.end(),
+                         [&layer](const Entry& entry) {
+                           return entry.layer_id == layer.id();
+                         });
+  if (it != entries_.end()) {
+    if (it->layer_revision == layer.revision() && it->key == key) {
+      it->last_use = ++use_count_;
+      ++stats_.hit_count;
+      return it->texture;
+    }
+    // The image is stale, and will never be used again.
+    stats_.memory_used -= it->size;
+    entries_.erase(it);
+  }
+  ++stats_.miss_count;
+  return TexturePtr();
+}
+
+void LayerCache::Insert(const Layer& layer,
+                        const Key& key,
+                        TexturePtr texture,
+                        vk::DeviceSize size) {
+  auto it = std::find_if(entries_.begin(), entries_.end(),
+                         [&layer](const Entry& entry) {
+                           return entry.layer_id == layer.id();
+                         });
+  if (it != entries_.end()) {
+    stats_.memory_used -= it->size;
+    entries_.erase(it);
+  }
+
+  if (size > memory_budget_) {
+    ++stats_.uncached_count;
+    return;
+  }
+  EvictToSize(memory_budget_ - size);
+
+  entries_.push_back(Entry{layer.id(), layer.revision(), key,
+                           std::move(texture), size, ++use_count_});
+  stats_.memory_used += size;
+}
+
+void LayerCache::set_memory_budget(vk::DeviceSize memory_budget) {
+  memory_budget_ = memory_budget;
+  EvictToSize(memory_budget_);
+}
+
+void LayerCache::EvictToSize(vk::DeviceSize max_size) {
+  while (stats_.memory_used > max_size) {
+    auto lru = std::min_element(entries_.begin(), entries_.end(),
+                                [](const Entry& a, const Entry& b) {
+                                  return a.last_use < b.last_use;
+                                });
+    FTL_DCHECK(lru != entries_.end());
+    // The image may still be in use by pending command buffers; they retain
+    // it until they are finished.
+    stats_.memory_used -= lru->size;
+    entries_.erase(lru);
+    ++stats_.eviction_count;
+  }
+}
+
+}  // namespace impl
+}  // namespace escher
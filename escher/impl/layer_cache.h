@@ -0,0 +1,111 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/geometry/types.h"
+#include "escher/renderer/texture.h"
+#include "escher/util/hash.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Retains the images that PaperRenderer has rendered Layers into, so that they
+// can be composited in subsequent frames instead of being rendered again.  The
+// total memory used by the images is kept within a budget by evicting the
+// least recently used ones.  Not thread-safe.
+class LayerCache {
+ public:
+  // Everything other than the layer's own revision that its image depends
+  // upon; see PaperRenderer::ComputeLayerKey().  The layer's objects are not
+  // part of the key, so that a cached layer costs nothing per object to find.
+  struct Key {
+    mat4 camera_transform;
+    vk::Format format;
+    uint32_t width;
+    uint32_t height;
+    // The clear color, the key light's direction, dispersion and intensity,
+    // the fill light's intensity, and the viewing volume's width, height, top
+    // and bottom.
+    vec4 clear_color;
+    vec4 key_light;
+    float fill_light_intensity;
+    vec4 viewing_volume;
+    bool enable_lighting;
+    // See PaperRenderer::ComputeRendererSettingsKey().
+    ByteKey renderer_settings;
+    // The id and revision of each of the layers beneath the layer, whose
+    // images are composited into its own.
+    std::vector<std::pair<uint64_t, uint64_t>> inner_layers;
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct Stats {
+    // Number of calls to Find() that did and did not return an image.
+    uint32_t hit_count = 0;
+    uint32_t miss_count = 0;
+    // Number of images that were evicted to stay within the budget.
+    uint32_t eviction_count = 0;
+    // Number of images that were not cached, because they alone would exceed
+    // the budget.
+    uint32_t uncached_count = 0;
+    // Total size of the cached images.
+    vk::DeviceSize memory_used = 0;
+  };
+
+  explicit LayerCache(vk::DeviceSize memory_budget);
+  ~LayerCache();
+
+  // Return the image of |layer|, if one was cached with the same |key| since
+  // the layer was last invalidated; otherwise return nullptr, in which case
+  // the caller is expected to render the layer and Insert() the result.
+  TexturePtr Find(const Layer& layer, const Key& key);
+
+  // Cache |texture|, whose image occupies |size| bytes, as the image of |layer|
+  // rendered with |key|, replacing any previous image of the layer, and
+  // evicting the least recently used images of other layers as needed to stay
+  // within the budget.
+  void Insert(const Layer& layer,
+              const Key& key,
+              TexturePtr texture,
+              vk::DeviceSize size);
+
+  // Evicts images as needed to stay within the new budget.
+  void set_memory_budget(vk::DeviceSize memory_budget);
+  vk::DeviceSize memory_budget() const { return memory_budget_; }
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Entry {
+    uint64_t layer_id;
+    uint64_t layer_revision;
+    Key key;
+    TexturePtr texture;
+    vk::DeviceSize size;
+    uint64_t last_use;
+  };
+
+  // Evict the least recently used images until no more than |max_size| bytes
+  // are used.
+  void EvictToSize(vk::DeviceSize max_size);
+
+  vk::DeviceSize memory_budget_;
+  // There are few enough layers that a linear search is fastest.
+  std::vector<Entry> entries_;
+  uint64_t use_count_ = 0;
+  Stats stats_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(LayerCache);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -7,6 +7,7 @@
 #include <iterator>
 
 #include "escher/geometry/types.h"
+#include "escher/impl/command_buffer.h"
 #include "escher/impl/command_buffer_pool.h"
 #include "escher/impl/vulkan_utils.h"
 #include "escher/resources/resource_recycler.h"
@@ -42,6 +43,72 @@ MeshBuilderPtr MeshManager::NewMeshBuilder(const MeshSpec& spec,
       uploader_->GetWriter(max_index_count * sizeof(uint32_t))));
 }
 
+std::vector<MeshPtr> MeshManager::NewMeshesWithSharedBuffers(
+    const std::vector<MeshPtr>& meshes) {
+  FTL_DCHECK(!meshes.empty());
+  const MeshSpec& spec = meshes[0]->spec();
+  const size_t stride = spec.GetStride();
+
+  // Each mesh's vertices are placed at a multiple of the vertex stride, so that
+  // indirect draws can address them via vertexOffset.
+  vk::DeviceSize vertex_buffer_size = 0;
+  vk::DeviceSize index_buffer_size = 0;
+  for (auto& mesh : meshes) {
+    FTL_DCHECK(mesh->spec() == spec);
+    vertex_buffer_size += mesh->num_vertices() * stride;
+    index_buffer_size += mesh->num_indices() * sizeof(uint32_t);
+  }
+
+  auto vertex_buffer = Buffer::New(resource_recycler_, allocator_,
+                                   vertex_buffer_size,
+                                   vk::BufferUsageFlagBits::eVertexBuffer |
+                                       vk::BufferUsageFlagBits::eTransferSrc |
+                                       vk::BufferUsageFlagBits::eTransferDst,
+                                   vk::MemoryPropertyFlagBits::eDeviceLocal);
+  auto index_buffer = Buffer::New(resource_recycler_, allocator_,
+                                  index_buffer_size,
+                                  vk::BufferUsageFlagBits::eIndexBuffer |
+                                      vk::BufferUsageFlagBits::eTransferSrc |
+                                      vk::BufferUsageFlagBits::eTransferDst,
+                                  vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+  CommandBuffer* command_buffer = command_buffer_pool_->GetCommandBuffer();
+  std::vector<MeshPtr> result;
+  result.reserve(meshes.size());
+  vk::DeviceSize vertex_offset = 0;
+  vk::DeviceSize index_offset = 0;
+  for (auto& mesh : meshes) {
+    command_buffer->TakeWaitSemaphore(mesh,
+                                      vk::PipelineStageFlagBits::eTransfer);
+    command_buffer->KeepAlive(mesh);
+
+    vk::BufferCopy vertex_region(mesh->vertex_buffer_offset(), vertex_offset,
+                                 mesh->num_vertices() * stride);
+    command_buffer->get().copyBuffer(mesh->vk_vertex_buffer(),
+                                     vertex_buffer->get(), 1, &vertex_region);
+    vk::BufferCopy index_region(mesh->index_buffer_offset(), index_offset,
+                                mesh->num_indices() * sizeof(uint32_t));
+    command_buffer->get().copyBuffer(mesh->vk_index_buffer(),
+                                     index_buffer->get(), 1, &index_region);
+
+    auto shared_mesh = ftl::MakeRefCounted<Mesh>(
+        resource_recycler_, spec, mesh->bounding_box(), mesh->num_vertices(),
+        mesh->num_indices(), vertex_buffer, index_buffer, vertex_offset,
+        index_offset);
+    // A semaphore can only be waited upon once, so each mesh needs its own.
+    auto semaphore = Semaphore::New(device_);
+    command_buffer->AddSignalSemaphore(semaphore);
+    shared_mesh->SetWaitSemaphore(std::move(semaphore));
+    result.push_back(std::move(shared_mesh));
+
+    vertex_offset += mesh->num_vertices() * stride;
+    index_offset += mesh->num_indices() * sizeof(uint32_t);
+  }
+  command_buffer->Submit(queue_, nullptr);
+
+  return result;
+}
+
 MeshManager::MeshBuilder::MeshBuilder(MeshManager* manager,
                                       const MeshSpec& spec,
                                       size_t max_vertex_count,
@@ -124,6 +191,7 @@ MeshPtr MeshManager::MeshBuilder::Build() {
   auto index_buffer = Buffer::New(manager_->resource_recycler(), allocator,
                                   index_count_ * sizeof(uint32_t),
                                   vk::BufferUsageFlagBits::eIndexBuffer |
+                                      vk::BufferUsageFlagBits::eTransferSrc |
                                       vk::BufferUsageFlagBits::eTransferDst,
                                   vk::MemoryPropertyFlagBits::eDeviceLocal);
 
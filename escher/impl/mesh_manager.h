@@ -8,6 +8,7 @@
 #include <list>
 #include <queue>
 #include <unordered_map>
+#include <vector>
 
 #include <vulkan/vulkan.hpp>
 
@@ -38,6 +39,15 @@ class MeshManager : public MeshBuilderFactory {
                                 size_t max_vertex_count,
                                 size_t max_index_count) override;
 
+  // Return a new Mesh for each of |meshes|, all of which must have the same
+  // MeshSpec.  The new meshes share a single vertex buffer and a single index
+  // buffer, and are distinguished only by their offsets within them; this
+  // allows draws of different meshes to be batched into a single indirect
+  // draw.  The data is copied on the GPU; each new mesh has a wait semaphore
+  // that is signaled when its copy is finished.
+  std::vector<MeshPtr> NewMeshesWithSharedBuffers(
+      const std::vector<MeshPtr>& meshes);
+
   ResourceRecycler* resource_recycler() const { return resource_recycler_; }
 
  private:
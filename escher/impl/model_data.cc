@@ -4,6 +4,8 @@
 
 #include "escher/impl/model_data.h"
 
+#include <cstddef>
+
 #include "escher/escher.h"
 #include "escher/impl/command_buffer.h"
 #include "escher/impl/mesh_shader_binding.h"
@@ -17,17 +19,36 @@ namespace impl {
 // deal.
 constexpr uint32_t kInitialPerModelDescriptorSetCount = 50;
 constexpr uint32_t kInitialPerObjectDescriptorSetCount = 200;
+// Shared descriptor sets are only needed once per texture, not per object.
+constexpr uint32_t kInitialPerObjectDynamicDescriptorSetCount = 50;
 
 ModelData::ModelData(Escher* escher, GpuAllocator* allocator)
     : device_(escher->vulkan_context().device),
       uniform_buffer_pool_(escher, allocator),
+      per_instance_buffer_pool_(escher,
+                                allocator,
+                                vk::MemoryPropertyFlags(),
+                                vk::BufferUsageFlagBits::eVertexBuffer),
+      indirect_buffer_pool_(escher,
+                            allocator,
+                            vk::MemoryPropertyFlags(),
+                            vk::BufferUsageFlagBits::eIndirectBuffer |
+                                vk::BufferUsageFlagBits::eStorageBuffer),
+      cull_data_buffer_pool_(escher,
+                             allocator,
+                             vk::MemoryPropertyFlags(),
+                             vk::BufferUsageFlagBits::eStorageBuffer),
       per_model_descriptor_set_pool_(escher,
                                      GetPerModelDescriptorSetLayoutCreateInfo(),
                                      kInitialPerModelDescriptorSetCount),
       per_object_descriptor_set_pool_(
           escher,
           GetPerObjectDescriptorSetLayoutCreateInfo(),
-          kInitialPerObjectDescriptorSetCount) {}
+          kInitialPerObjectDescriptorSetCount),
+      per_object_dynamic_descriptor_set_pool_(
+          escher,
+          GetPerObjectDynamicDescriptorSetLayoutCreateInfo(),
+          kInitialPerObjectDynamicDescriptorSetCount) {}
 
 ModelData::~ModelData() {}
 
@@ -81,6 +102,76 @@ ModelData::GetPerObjectDescriptorSetLayoutCreateInfo() {
   return *ptr;
 }
 
+const vk::DescriptorSetLayoutCreateInfo&
+ModelData::GetPerObjectDynamicDescriptorSetLayoutCreateInfo() {
+  constexpr uint32_t kNumBindings = 2;
+  static vk::DescriptorSetLayoutBinding bindings[kNumBindings];
+  static vk::DescriptorSetLayoutCreateInfo info;
+  static vk::DescriptorSetLayoutCreateInfo* ptr = nullptr;
+  if (!ptr) {
+    auto& uniform_binding = bindings[0];
+    auto& texture_binding = bindings[1];
+    uniform_binding.binding = 0;
+    uniform_binding.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+    uniform_binding.descriptorCount = 1;
+    uniform_binding.stageFlags =
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    texture_binding.binding = 1;
+    texture_binding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    texture_binding.descriptorCount = 1;
+    texture_binding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+    info.bindingCount = kNumBindings;
+    info.pBindings = bindings;
+    ptr = &info;
+  }
+  return *ptr;
+}
+
+vk::PushConstantRange ModelData::GetPerObjectPushConstantRange() {
+  vk::PushConstantRange range;
+  range.stageFlags =
+      vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+  range.offset = 0;
+  range.size = sizeof(PerObjectPushConstants);
+  return range;
+}
+
+const vk::VertexInputBindingDescription&
+ModelData::GetPerInstanceBindingDescription() {
+  static vk::VertexInputBindingDescription binding;
+  static vk::VertexInputBindingDescription* ptr = nullptr;
+  if (!ptr) {
+    binding.binding = PerInstance::kBinding;
+    binding.stride = sizeof(PerInstance);
+    binding.inputRate = vk::VertexInputRate::eInstance;
+    ptr = &binding;
+  }
+  return *ptr;
+}
+
+const std::vector<vk::VertexInputAttributeDescription>&
+ModelData::GetPerInstanceAttributeDescriptions() {
+  static std::vector<vk::VertexInputAttributeDescription> attributes;
+  if (attributes.empty()) {
+    // One attribute for each column of the transform matrix.
+    for (uint32_t i = 0; i < 4; ++i) {
+      vk::VertexInputAttributeDescription attribute;
+      attribute.location = PerInstance::kTransformAttributeLocation + i;
+      attribute.binding = PerInstance::kBinding;
+      attribute.format = vk::Format::eR32G32B32A32Sfloat;
+      attribute.offset = offsetof(PerInstance, transform) + i * sizeof(vec4);
+      attributes.push_back(attribute);
+    }
+    vk::VertexInputAttributeDescription attribute;
+    attribute.location = PerInstance::kColorAttributeLocation;
+    attribute.binding = PerInstance::kBinding;
+    attribute.format = vk::Format::eR32G32B32A32Sfloat;
+    attribute.offset = offsetof(PerInstance, color);
+    attributes.push_back(attribute);
+  }
+  return attributes;
+}
+
 const MeshShaderBinding& ModelData::GetMeshShaderBinding(MeshSpec spec) {
   auto ptr = mesh_shader_binding_cache_[spec].get();
   if (ptr) {
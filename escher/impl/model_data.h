@@ -6,6 +6,7 @@
 
 #include <cstdint>
 #include <unordered_map>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "escher/geometry/types.h"
@@ -56,6 +57,9 @@ class ModelData {
     static constexpr uint32_t kDescriptorSetUniformBinding = 0;
     // layout(set = 1, binding = 1) sampler2D PerObjectSampler;
     static constexpr uint32_t kDescriptorSetSamplerBinding = 1;
+    // When descriptor sets are shared between objects, the uniform binding is
+    // a dynamic uniform buffer, and one offset must be provided when binding.
+    static constexpr uint32_t kDynamicOffsetCount = 1;
 
     mat4 transform;
     vec4 color;
@@ -64,6 +68,40 @@ class ModelData {
     ModifierWobble wobble;
   };
 
+  // Per-object data for objects that have neither a texture nor any shape
+  // modifiers.  This is small enough to fit within the 128 bytes of push
+  // constants guaranteed by Vulkan, so such objects don't need a PerObject
+  // descriptor set.
+  struct PerObjectPushConstants {
+    mat4 transform;
+    vec4 color;
+  };
+  static_assert(sizeof(PerObjectPushConstants) <= 128,
+                "exceeds minimum guaranteed push-constant size.");
+
+  // Return the push-constant range used by pipelines that obtain per-object
+  // data via PerObjectPushConstants.
+  static vk::PushConstantRange GetPerObjectPushConstantRange();
+
+  // Per-instance data for instanced draws, read from a vertex buffer that is
+  // bound at kBinding.
+  struct PerInstance {
+    static constexpr uint32_t kBinding = 1;
+    // The transform occupies 4 consecutive attribute locations; one per column.
+    static constexpr uint32_t kTransformAttributeLocation = 4;
+    static constexpr uint32_t kColorAttributeLocation = 8;
+
+    mat4 transform;
+    vec4 color;
+  };
+
+  // Return the binding and attribute descriptions that pipelines use to read
+  // PerInstance data.
+  static const vk::VertexInputBindingDescription&
+  GetPerInstanceBindingDescription();
+  static const std::vector<vk::VertexInputAttributeDescription>&
+  GetPerInstanceAttributeDescriptions();
+
   // If no allocator is provided, Escher's default one will be used.
   explicit ModelData(Escher* escher, GpuAllocator* allocator = nullptr);
   ~ModelData();
@@ -72,6 +110,21 @@ class ModelData {
 
   UniformBufferPool* uniform_buffer_pool() { return &uniform_buffer_pool_; }
 
+  // Vends host-visible buffers that can be bound as vertex buffers, for
+  // PerInstance data.
+  UniformBufferPool* per_instance_buffer_pool() {
+    return &per_instance_buffer_pool_;
+  }
+
+  // Vends host-visible buffers that can be used as the source of indirect draw
+  // commands.  They can also be bound as storage buffers, so that the commands
+  // can be modified by compute shaders.
+  UniformBufferPool* indirect_buffer_pool() { return &indirect_buffer_pool_; }
+
+  // Vends host-visible buffers that can be bound as storage buffers, for
+  // FrustumCuller::CullData.
+  UniformBufferPool* cull_data_buffer_pool() { return &cull_data_buffer_pool_; }
+
   DescriptorSetPool* per_model_descriptor_set_pool() {
     return &per_model_descriptor_set_pool_;
   }
@@ -80,6 +133,14 @@ class ModelData {
     return &per_object_descriptor_set_pool_;
   }
 
+  // Like per_object_descriptor_set_pool(), except that the uniform binding is
+  // a dynamic uniform buffer.  This allows a single descriptor set to be shared
+  // by many objects, by providing a different offset for each object when the
+  // descriptor set is bound.
+  DescriptorSetPool* per_object_dynamic_descriptor_set_pool() {
+    return &per_object_dynamic_descriptor_set_pool_;
+  }
+
   vk::DescriptorSetLayout per_model_layout() const {
     return per_model_descriptor_set_pool_.layout();
   }
@@ -88,6 +149,10 @@ class ModelData {
     return per_object_descriptor_set_pool_.layout();
   }
 
+  vk::DescriptorSetLayout per_object_dynamic_layout() const {
+    return per_object_dynamic_descriptor_set_pool_.layout();
+  }
+
   const MeshShaderBinding& GetMeshShaderBinding(MeshSpec spec);
 
  private:
@@ -97,11 +162,17 @@ class ModelData {
   GetPerModelDescriptorSetLayoutCreateInfo();
   static const vk::DescriptorSetLayoutCreateInfo&
   GetPerObjectDescriptorSetLayoutCreateInfo();
+  static const vk::DescriptorSetLayoutCreateInfo&
+  GetPerObjectDynamicDescriptorSetLayoutCreateInfo();
 
   vk::Device device_;
   UniformBufferPool uniform_buffer_pool_;
+  UniformBufferPool per_instance_buffer_pool_;
+  UniformBufferPool indirect_buffer_pool_;
+  UniformBufferPool cull_data_buffer_pool_;
   DescriptorSetPool per_model_descriptor_set_pool_;
   DescriptorSetPool per_object_descriptor_set_pool_;
+  DescriptorSetPool per_object_dynamic_descriptor_set_pool_;
 
   std::unordered_map<MeshSpec,
                      std::unique_ptr<MeshShaderBinding>,
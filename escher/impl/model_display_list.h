@@ -22,6 +22,31 @@ class ModelDisplayList : public Resource {
     ModelPipeline* pipeline;
     MeshPtr mesh;
     uint32_t stencil_reference;
+    // Drawing is restricted to this rectangle of the framebuffer.  Used to
+    // clip objects by screen-aligned rectangles without using the stencil
+    // buffer.
+    vk::Rect2D scissor;
+    // Offset of the item's PerObject data within the uniform buffer bound to
+    // |descriptor_set|.  Only used if the pipeline HasDynamicUniformOffset().
+    uint32_t uniform_offset = 0;
+    // The object's transform and color.  Provided to shaders via push
+    // constants if the pipeline UsesPushConstants() (in this case
+    // |descriptor_set| is null), and otherwise via the PerObject uniforms.
+    ModelData::PerObjectPushConstants push_constants;
+    // Only used if the pipeline UsesInstancing(): |instance_count| instances
+    // are drawn, using PerInstance data starting at |instance_buffer_offset|
+    // within |instance_buffer|.
+    vk::Buffer instance_buffer;
+    vk::DeviceSize instance_buffer_offset = 0;
+    uint32_t instance_count = 1;
+    // If non-zero, the item is drawn by |indirect_draw_count| indirect draw
+    // commands starting at |indirect_buffer_offset| within |indirect_buffer|,
+    // instead of by drawing |mesh|.  Each command draws a mesh that shares
+    // |mesh|'s vertex and index buffers; the commands' firstInstance indexes
+    // the PerInstance data in |instance_buffer| (|instance_count| is unused).
+    vk::Buffer indirect_buffer;
+    vk::DeviceSize indirect_buffer_offset = 0;
+    uint32_t indirect_draw_count = 0;
   };
 
   ModelDisplayList(ResourceRecycler* resource_recycler,
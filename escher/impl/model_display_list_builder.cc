@@ -4,13 +4,21 @@
 
 #include "escher/impl/model_display_list_builder.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <glm/gtx/transform.hpp>
 
 #include "escher/impl/command_buffer.h"
+#include "escher/impl/frustum_culler.h"
+#include "escher/impl/model_pipeline.h"
 #include "escher/impl/model_pipeline_cache.h"
 #include "escher/impl/model_renderer.h"
 #include "escher/scene/camera.h"
+#include "escher/scene/retained_model.h"
 #include "escher/util/align.h"
+#include "escher/util/trace_macros.h"
 
 namespace escher {
 namespace impl {
@@ -19,6 +27,49 @@ namespace {
 // TODO: should be queried from device.
 constexpr vk::DeviceSize kMinUniformBufferOffsetAlignment = 256;
 
+// Resolution of the software depth buffer used for occlusion culling, and the
+// maximum number of occluders that are rasterized into it.
+constexpr uint32_t kOcclusionBufferWidth = 64;
+constexpr uint32_t kOcclusionBufferHeight = 64;
+constexpr size_t kMaxOccluderCount = 16;
+
+// Return true if |transform| maps the xy-plane onto the screen without
+// rotation, shear or perspective, so that axis-aligned rectangles remain
+// axis-aligned rectangles.
+bool IsScreenAligned(const mat4& transform) {
+  return transform[0][1] == 0.f && transform[1][0] == 0.f &&
+         transform[0][3] == 0.f && transform[1][3] == 0.f &&
+         transform[2][3] == 0.f && transform[3][3] == 1.f;
+}
+
+vk::Rect2D IntersectScissors(const vk::Rect2D& a, const vk::Rect2D& b) {
+  const int32_t x0 = std::max(a.offset.x, b.offset.x);
+  const int32_t y0 = std::max(a.offset.y, b.offset.y);
+  const int32_t x1 =
+      std::min(a.offset.x + static_cast<int32_t>(a.extent.width),
+               b.offset.x + static_cast<int32_t>(b.extent.width));
+  const int32_t y1 =
+      std::min(a.offset.y + static_cast<int32_t>(a.extent.height),
+               b.offset.y + static_cast<int32_t>(b.extent.height));
+  vk::Rect2D result;
+  result.offset = vk::Offset2D{x0, y0};
+  result.extent = vk::Extent2D{static_cast<uint32_t>(std::max(x1 - x0, 0)),
+                               static_cast<uint32_t>(std::max(y1 - y0, 0))};
+  return result;
+}
+
+// Return true if any of the objects, or their clippers or clippees, has a shape
+// modifier that animates it, and therefore needs PerModel::time.
+bool IsAnimated(const std::vector<Object>& objects) {
+  for (const Object& object : objects) {
+    if ((object.shape().modifiers() & ShapeModifier::kWobble) ||
+        IsAnimated(object.clippers()) || IsAnimated(object.clippees())) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 static mat4 AdjustCameraTransform(const Stage& stage,
@@ -52,73 +103,69 @@ ModelDisplayListBuilder::ModelDisplayListBuilder(
     : device_(device),
       volume_(stage.viewing_volume()),
       camera_transform_(AdjustCameraTransform(stage, camera, scale)),
+      unscaled_camera_transform_(AdjustCameraTransform(stage, camera, 1.f)),
       use_material_textures_(!(flags & ModelDisplayListFlag::kUseDepthPrepass)),
       disable_depth_test_(flags & ModelDisplayListFlag::kDisableDepthTest),
+      share_descriptor_sets_(
+          flags & ModelDisplayListFlag::kShareDescriptorSetsBetweenObjects),
+      use_multi_draw_indirect_(flags &
+                               ModelDisplayListFlag::kUseMultiDrawIndirect),
+      cull_on_cpu_(flags & ModelDisplayListFlag::kUseCpuFrustumCulling),
+      cull_on_gpu_(flags & ModelDisplayListFlag::kUseGpuFrustumCulling),
+      skip_final_stencil_restore_(
+          flags & ModelDisplayListFlag::kSkipFinalStencilRestore),
       white_texture_(white_texture),
       illumination_texture_(illumination_texture ? illumination_texture
                                                  : white_texture),
+      retained_model_(model.retained_model()),
       renderer_(renderer),
       uniform_buffer_pool_(model_data->uniform_buffer_pool()),
-      per_model_descriptor_set_pool_(
-          model_data->per_model_descriptor_set_pool()),
+      per_instance_buffer_pool_(model_data->per_instance_buffer_pool()),
+      indirect_buffer_pool_(model_data->indirect_buffer_pool()),
+      cull_data_buffer_pool_(model_data->cull_data_buffer_pool()),
       per_object_descriptor_set_pool_(
-          model_data->per_object_descriptor_set_pool()),
+          share_descriptor_sets_
+              ? model_data->per_object_dynamic_descriptor_set_pool()
+              : model_data->per_object_descriptor_set_pool()),
       pipeline_cache_(pipeline_cache) {
   FTL_DCHECK(white_texture_);
+  FTL_DCHECK(!cull_on_gpu_ || use_multi_draw_indirect_);
 
   // These fields of the pipeline spec are the same for the entire display list.
   pipeline_spec_.sample_count = sample_count;
   pipeline_spec_.use_depth_prepass =
       bool(flags & ModelDisplayListFlag::kUseDepthPrepass);
+  pipeline_spec_.use_dynamic_uniform_offset = share_descriptor_sets_;
+
+  // Until a clip group narrows it, the scissor covers the whole viewport.
+  scissor_.offset = vk::Offset2D{0, 0};
+  scissor_.extent =
+      vk::Extent2D{static_cast<uint32_t>(std::ceil(volume_.width())),
+                   static_cast<uint32_t>(std::ceil(volume_.height()))};
 
-  // Obtain a uniform buffer and write the PerModel data to it.
-  PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerModel), 0);
-  auto per_model =
-      reinterpret_cast<ModelData::PerModel*>(uniform_buffer_->ptr());
-  per_model->frag_coord_to_uv_multiplier =
-      vec2(1.f / volume_.width(), 1.f / volume_.height());
-  per_model->time = model.time();
-  uniform_buffer_write_index_ += sizeof(ModelData::PerModel);
-
-  // Obtain the single per-Model descriptor set.
-  DescriptorSetAllocationPtr per_model_descriptor_set_allocation =
-      per_model_descriptor_set_pool_->Allocate(1, nullptr);
+  // Obtain the single per-Model descriptor set.  Time is only needed by
+  // animated shape modifiers; otherwise it is left at zero, so that the
+  // descriptor set can be shared with the display lists of later frames.
+  // The illumination texture has one texel per fragment, so the model may be
+  // drawn at a reduced scale into an attachment of the same size.
+  ModelData::PerModel per_model;
+  per_model.frag_coord_to_uv_multiplier =
+      illumination_texture
+          ? vec2(1.f / illumination_texture->width(),
+                 1.f / illumination_texture->height())
+          : vec2(1.f / volume_.width(), 1.f / volume_.height());
+  per_model.time = IsAnimated(model.objects()) ? model.time() : 0.f;
+  const ModelRenderer::PerModelDescriptorSet& per_model_descriptor_set =
+      renderer_->ObtainPerModelDescriptorSet(per_model, illumination_texture_);
   {
     // It would be inconvenient to set this in the initializer, so we briefly
     // cast it to set its permanent value.
     auto& unconst = const_cast<vk::DescriptorSet&>(per_model_descriptor_set_);
-    unconst = per_model_descriptor_set_allocation->get(0);
-  }
-  resources_.push_back(std::move(per_model_descriptor_set_allocation));
-
-  // Update each descriptor in the PerModel descriptor set.
-  vk::WriteDescriptorSet writes[ModelData::PerModel::kDescriptorCount];
-
-  auto& buffer_write = writes[0];
-  buffer_write.dstSet = per_model_descriptor_set_;
-  buffer_write.dstBinding = ModelData::PerModel::kDescriptorSetUniformBinding;
-  buffer_write.dstArrayElement = 0;
-  buffer_write.descriptorCount = 1;
-  buffer_write.descriptorType = vk::DescriptorType::eUniformBuffer;
-  vk::DescriptorBufferInfo buffer_info;
-  buffer_info.buffer = uniform_buffer_->get();
-  buffer_info.range = sizeof(ModelData::PerModel);
-  buffer_info.offset = 0;
-  buffer_write.pBufferInfo = &buffer_info;
-
-  auto& image_write = writes[1];
-  image_write.dstSet = per_model_descriptor_set_;
-  image_write.dstBinding = ModelData::PerModel::kDescriptorSetSamplerBinding;
-  image_write.dstArrayElement = 0;
-  image_write.descriptorCount = 1;
-  image_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
-  vk::DescriptorImageInfo image_info;
-  image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-  image_info.imageView = illumination_texture_->image_view();
-  image_info.sampler = illumination_texture_->sampler();
-  image_write.pImageInfo = &image_info;
-
-  device_.updateDescriptorSets(2, writes, 0, nullptr);
+    unconst = per_model_descriptor_set.allocation->get(0);
+  }
+  resources_.push_back(per_model_descriptor_set.allocation);
+  // The uniform buffer is flushed and retained along with the others.
+  uniform_buffers_.push_back(per_model_descriptor_set.uniform_buffer);
 }
 
 void ModelDisplayListBuilder::AddClipperObject(const Object& object) {
@@ -129,14 +176,11 @@ void ModelDisplayListBuilder::AddClipperObject(const Object& object) {
 
   FTL_DCHECK(object.shape().modifiers() == ShapeModifiers());
 
-  PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerObject),
-                                     kMinUniformBufferOffsetAlignment);
-  vk::DescriptorSet descriptor_set = ObtainPerObjectDescriptorSet();
-  UpdateDescriptorSetForObject(object, descriptor_set);
-
   ModelDisplayList::Item item;
-  item.descriptor_set = descriptor_set;
-  item.mesh = renderer_->GetMeshForShape(object.shape());
+  PrepareItemForObject(object, &item);
+
+  item.mesh =
+      renderer_->GetMeshForShape(object.shape(), use_multi_draw_indirect_);
   pipeline_spec_.mesh_spec = item.mesh->spec();
   pipeline_spec_.shape_modifiers = object.shape().modifiers();
   pipeline_spec_.is_clippee = clip_depth_ > 0;
@@ -157,6 +201,28 @@ void ModelDisplayListBuilder::AddClipperObject(const Object& object) {
 
 void ModelDisplayListBuilder::AddClipperAndClippeeObjects(
     const Object& object) {
+  vk::Rect2D clip_scissor;
+  if (GetClipScissor(object, &clip_scissor)) {
+    // The clippers are drawn like any other object; the clippees are clipped
+    // by narrowing the scissor instead of by the stencil buffer.
+    AddNonClipperObject(object);
+    for (auto& clipper : object.clippers()) {
+      FTL_DCHECK(clipper.clippers().empty());
+      FTL_DCHECK(clipper.clippees().empty());
+      AddNonClipperObject(clipper);
+    }
+
+    const vk::Rect2D parent_scissor = scissor_;
+    scissor_ = IntersectScissors(parent_scissor, clip_scissor);
+    if (scissor_.extent.width > 0 && scissor_.extent.height > 0) {
+      for (auto& o : object.clippees()) {
+        AddObject(o);
+      }
+    }
+    scissor_ = parent_scissor;
+    return;
+  }
+
   const bool is_clippee = clip_depth_ > 0;
 
   // Remember the beginning and end of clipper-items, so that we can later
@@ -182,9 +248,9 @@ void ModelDisplayListBuilder::AddClipperAndClippeeObjects(
     AddObject(o);
   }
 
-  // Revert the stencil buffer to the previous state.
-  // TODO: if we knew that no subsequent children were to be clipped, we
-  // could avoid this.
+  // Revert the stencil buffer to the previous state.  If nothing that is
+  // drawn later tests the stencil buffer, RemoveUnnecessaryStencilRestores()
+  // may remove these items again.
   for (size_t index = clipper_start_index; index < clipper_end_index; ++index) {
     ModelDisplayList::Item item = items_[index];
     pipeline_spec_.mesh_spec = item.mesh->spec();
@@ -197,6 +263,9 @@ void ModelDisplayListBuilder::AddClipperAndClippeeObjects(
     pipeline_spec_.has_material = false;
     pipeline_spec_.is_opaque = false;
     pipeline_spec_.disable_depth_test = disable_depth_test_;
+    // The item's per-object data is reused, so it must be accessed the same
+    // way as before.
+    pipeline_spec_.use_push_constants = item.pipeline->UsesPushConstants();
     item.pipeline = pipeline_cache_->GetPipeline(pipeline_spec_);
     item.stencil_reference = clip_depth_;
 
@@ -207,17 +276,15 @@ void ModelDisplayListBuilder::AddClipperAndClippeeObjects(
 }
 
 void ModelDisplayListBuilder::AddNonClipperObject(const Object& object) {
-  FTL_DCHECK(object.clippees().empty());
-  if (object.material()) {
+  if (object.material() &&
+      !(cull_on_cpu_ && IsObjectOutsideFrustum(object)) &&
+      !IsObjectOccluded(object)) {
     // Simply push the item.
-    PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerObject),
-                                       kMinUniformBufferOffsetAlignment);
-    vk::DescriptorSet descriptor_set = ObtainPerObjectDescriptorSet();
-    UpdateDescriptorSetForObject(object, descriptor_set);
-
     ModelDisplayList::Item item;
-    item.descriptor_set = descriptor_set;
-    item.mesh = renderer_->GetMeshForShape(object.shape());
+    PrepareItemForObject(object, &item);
+
+    item.mesh =
+        renderer_->GetMeshForShape(object.shape(), use_multi_draw_indirect_);
     pipeline_spec_.mesh_spec = item.mesh->spec();
     pipeline_spec_.shape_modifiers = object.shape().modifiers();
     pipeline_spec_.is_clippee = clip_depth_ > 0;
@@ -237,6 +304,15 @@ void ModelDisplayListBuilder::AddObject(const Object& object) {
   const bool has_clippees = !object.clippees().empty();
 
   if (has_clippees) {
+    // Clippees are only visible within the clippers, so if all of the clippers
+    // are outside of the frustum, then so is the whole clip group.
+    if (cull_on_cpu_ && IsObjectOutsideFrustum(object) &&
+        std::all_of(object.clippers().begin(), object.clippers().end(),
+                    [this](const Object& clipper) {
+                      return IsObjectOutsideFrustum(clipper);
+                    })) {
+      return;
+    }
     AddClipperAndClippeeObjects(object);
   } else {
     // Some of these may need to be drawn (i.e. if they have both shape and
@@ -249,9 +325,295 @@ void ModelDisplayListBuilder::AddObject(const Object& object) {
   }
 }
 
+bool ModelDisplayListBuilder::IsObjectOutsideFrustum(
+    const Object& object) const {
+  if (object.shape().type() == Shape::Type::kNone ||
+      object.shape().modifiers() != ShapeModifiers()) {
+    return false;
+  }
+  return FrustumCuller::IsOutsideFrustum(
+      camera_transform_ * object.transform(),
+      renderer_->GetMeshForShape(object.shape())->bounding_box());
+}
+
+void ModelDisplayListBuilder::AddOccluders(const std::vector<Object>& objects) {
+  TRACE_DURATION("gfx", "escher::ModelDisplayListBuilder::AddOccluders");
+  FTL_DCHECK(items_.empty());
+
+  struct Occluder {
+    vec2 min;
+    vec2 max;
+    float depth;
+    float area;
+  };
+  std::vector<Occluder> occluders;
+  for (auto& object : objects) {
+    Occluder occluder;
+    if (GetOccluderBounds(object, &occluder.min, &occluder.max,
+                          &occluder.depth)) {
+      vec2 size = occluder.max - occluder.min;
+      occluder.area = size.x * size.y;
+      occluders.push_back(occluder);
+    }
+  }
+
+  // Only the largest occluders are worth rasterizing.  Ties are broken by
+  // order of appearance, so that the result is deterministic.
+  std::stable_sort(occluders.begin(), occluders.end(),
+                   [](const Occluder& a, const Occluder& b) {
+                     return a.area > b.area;
+                   });
+  occluders.resize(std::min(occluders.size(), kMaxOccluderCount));
+
+  occlusion_culler_ = std::make_unique<OcclusionCuller>(kOcclusionBufferWidth,
+                                                        kOcclusionBufferHeight);
+  for (auto& occluder : occluders) {
+    occlusion_culler_->AddOccluder(occluder.min, occluder.max, occluder.depth);
+  }
+}
+
+bool ModelDisplayListBuilder::GetOccluderBounds(const Object& object,
+                                                vec2* min,
+                                                vec2* max,
+                                                float* depth) const {
+  const Shape& shape = object.shape();
+  if (!object.material() || !object.material()->opaque() ||
+      shape.modifiers() != ShapeModifiers() ||
+      (shape.type() != Shape::Type::kRect &&
+       shape.type() != Shape::Type::kCircle)) {
+    return false;
+  }
+
+  // Only screen-aligned occluders without perspective are supported, so that
+  // the screen-space rectangle is exactly the transformed model-space one.
+  const mat4 transform = camera_transform_ * object.transform();
+  if (!IsScreenAligned(transform)) {
+    return false;
+  }
+
+  const BoundingBox& box = renderer_->GetMeshForShape(shape)->bounding_box();
+  vec3 box_min = box.min();
+  vec3 box_max = box.max();
+  if (shape.type() == Shape::Type::kCircle) {
+    // Use the square that is inscribed in the circle.
+    const vec3 center = 0.5f * (box_min + box_max);
+    const vec3 half_size = (0.5f / std::sqrt(2.f)) * (box_max - box_min);
+    box_min = vec3(vec2(center - half_size), box_min.z);
+    box_max = vec3(vec2(center + half_size), box_max.z);
+  }
+
+  vec4 corner0 = transform * vec4(box_min, 1);
+  vec4 corner1 = transform * vec4(box_max, 1);
+  *min = glm::min(vec2(corner0), vec2(corner1));
+  *max = glm::max(vec2(corner0), vec2(corner1));
+  // The z-axis may be sheared by the transform, so use the farthest corner.
+  *depth = std::numeric_limits<float>::lowest();
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner((i & 1) ? box_max.x : box_min.x,
+                (i & 2) ? box_max.y : box_min.y,
+                (i & 4) ? box_max.z : box_min.z);
+    *depth = std::max(*depth, (transform * vec4(corner, 1)).z);
+  }
+  return true;
+}
+
+bool ModelDisplayListBuilder::GetClipScissor(const Object& object,
+                                             vk::Rect2D* scissor) const {
+  // Exactly one of the clippers must have a shape, since the stencil buffer
+  // clips to the union of their shapes.
+  const Object* clipper = nullptr;
+  if (object.shape().type() != Shape::Type::kNone) {
+    clipper = &object;
+  }
+  for (auto& o : object.clippers()) {
+    if (o.shape().type() != Shape::Type::kNone) {
+      if (clipper) {
+        return false;
+      }
+      clipper = &o;
+    }
+  }
+  if (!clipper || clipper->shape().type() != Shape::Type::kRect ||
+      clipper->shape().modifiers() != ShapeModifiers()) {
+    return false;
+  }
+
+  const mat4 transform = camera_transform_ * clipper->transform();
+  if (!IsScreenAligned(transform)) {
+    return false;
+  }
+
+  const BoundingBox& box =
+      renderer_->GetMeshForShape(clipper->shape())->bounding_box();
+  const vec4 corner0 = transform * vec4(box.min(), 1);
+  const vec4 corner1 = transform * vec4(box.max(), 1);
+  // A clipper that is cut by the near or far plane would not cover its whole
+  // rectangle in the stencil buffer.
+  if (std::min(corner0.z, corner1.z) < 0.f ||
+      std::max(corner0.z, corner1.z) > 1.f) {
+    return false;
+  }
+
+  // Convert to framebuffer pixels.  As when rasterizing the clipper, a pixel
+  // is covered if its center is within the rectangle.
+  const vec2 viewport_size(volume_.width(), volume_.height());
+  const vec2 min =
+      (glm::min(vec2(corner0), vec2(corner1)) + 1.f) * 0.5f * viewport_size;
+  const vec2 max =
+      (glm::max(vec2(corner0), vec2(corner1)) + 1.f) * 0.5f * viewport_size;
+  const int32_t x0 = std::max(static_cast<int32_t>(std::ceil(min.x - 0.5f)), 0);
+  const int32_t y0 = std::max(static_cast<int32_t>(std::ceil(min.y - 0.5f)), 0);
+  const int32_t x1 = std::max(static_cast<int32_t>(std::ceil(max.x - 0.5f)), 0);
+  const int32_t y1 = std::max(static_cast<int32_t>(std::ceil(max.y - 0.5f)), 0);
+  scissor->offset = vk::Offset2D{x0, y0};
+  scissor->extent = vk::Extent2D{static_cast<uint32_t>(std::max(x1 - x0, 0)),
+                                 static_cast<uint32_t>(std::max(y1 - y0, 0))};
+  return true;
+}
+
+void ModelDisplayListBuilder::SetPreviousFrameDepth(
+    const OcclusionCuller* depth) {
+  FTL_DCHECK(items_.empty());
+  previous_frame_depth_ = depth;
+}
+
+void ModelDisplayListBuilder::SetScissor(const vk::Rect2D& scissor) {
+  FTL_DCHECK(items_.empty());
+  scissor_ = IntersectScissors(scissor_, scissor);
+}
+
+void ModelDisplayListBuilder::SetObjectUniformCache(ObjectUniformCache* cache) {
+  FTL_DCHECK(retained_model_);
+  FTL_DCHECK(items_.empty());
+  object_uniform_cache_ = cache;
+  object_uniform_cache_->BeginDisplayList(camera_transform_);
+}
+
+void ModelDisplayListBuilder::AddRetainedObject(size_t index) {
+  FTL_DCHECK(object_uniform_cache_);
+  const Object& object = retained_model_->model().objects()[index];
+
+  // Every object obtains its entry, even if it is culled, so that the cache
+  // can tell which objects were removed from the model.
+  ObjectUniformCache::Entry* entry =
+      object_uniform_cache_->GetEntry(retained_model_->GetHandle(index));
+  const ObjectDirtyFlags dirty_flags = retained_model_->GetDirtyFlags(
+      index, object_uniform_cache_->revision());
+  if (dirty_flags & (ObjectDirtyFlag::kTransform | ObjectDirtyFlag::kMaterial |
+                     ObjectDirtyFlag::kShapeModifierData)) {
+    entry->uniform_buffer = nullptr;
+    entry->descriptor_set_allocation = nullptr;
+  }
+
+  // Each entry holds the uniforms of a single object, so clip groups (and
+  // objects with additional clippers) are not cached.
+  if (!object.clippers().empty() || !object.clippees().empty()) {
+    AddObject(object);
+    return;
+  }
+  cache_entry_ = entry;
+  AddObject(object);
+  cache_entry_ = nullptr;
+}
+
+bool ModelDisplayListBuilder::IsObjectOccluded(const Object& object) const {
+  if ((!occlusion_culler_ && !previous_frame_depth_) ||
+      object.shape().type() == Shape::Type::kNone ||
+      object.shape().modifiers() != ShapeModifiers()) {
+    return false;
+  }
+  const BoundingBox& box =
+      renderer_->GetMeshForShape(object.shape())->bounding_box();
+  return (occlusion_culler_ &&
+          occlusion_culler_->IsOccluded(camera_transform_ * object.transform(),
+                                        box)) ||
+         (previous_frame_depth_ &&
+          previous_frame_depth_->IsOccluded(
+              unscaled_camera_transform_ * object.transform(), box));
+}
+
+bool ModelDisplayListBuilder::CanUsePushConstants(const Object& object) const {
+  if (object.shape().modifiers() != ShapeModifiers()) {
+    return false;
+  }
+  auto& mat = object.material();
+  return !use_material_textures_ || !mat || !mat->texture();
+}
+
+void ModelDisplayListBuilder::PrepareItemForObject(
+    const Object& object,
+    ModelDisplayList::Item* item) {
+  // These are also used to generate per-instance data, if the item is later
+  // collapsed into an instanced draw by CollapseInstancedItems().
+  auto& mat = object.material();
+  item->push_constants.transform = camera_transform_ * object.transform();
+  item->push_constants.color = mat ? mat->color() : vec4(1, 1, 1, 1);
+  item->scissor = scissor_;
+
+  if (CanUsePushConstants(object)) {
+    pipeline_spec_.use_push_constants = true;
+  } else if (ReuseCachedUniformsForObject(object, item)) {
+    pipeline_spec_.use_push_constants = false;
+  } else {
+    PrepareUniformBufferForWriteOfSize(sizeof(ModelData::PerObject),
+                                       kMinUniformBufferOffsetAlignment);
+    UpdateDescriptorSetForObject(object, item);
+    pipeline_spec_.use_push_constants = false;
+  }
+}
+
+bool ModelDisplayListBuilder::ReuseCachedUniformsForObject(
+    const Object& object,
+    ModelDisplayList::Item* item) {
+  if (!cache_entry_ || !cache_entry_->uniform_buffer) {
+    return false;
+  }
+  // Must match the texture selection in UpdateDescriptorSetForObject().
+  auto& mat = object.material();
+  const bool use_texture = use_material_textures_ && mat && mat->texture();
+  const vk::ImageView image_view =
+      use_texture ? mat->image_view() : white_texture_->image_view();
+  if (cache_entry_->color != item->push_constants.color ||
+      cache_entry_->image_view != image_view) {
+    return false;
+  }
+
+  item->descriptor_set = cache_entry_->descriptor_set;
+  item->uniform_offset = cache_entry_->uniform_offset;
+  if (use_texture) {
+    textures_.push_back(mat->texture());
+  }
+  // The display list may still be in use after the entry is discarded.
+  RetainCachedResource(cache_entry_->uniform_buffer.get());
+  RetainCachedResource(cache_entry_->descriptor_set_allocation.get());
+  return true;
+}
+
+void ModelDisplayListBuilder::RetainCachedResource(Resource* resource) {
+  if (retained_cached_resources_.insert(resource).second) {
+    resources_.push_back(ResourcePtr(resource));
+  }
+}
+
+void ModelDisplayListBuilder::CacheUniformsForObject(
+    const ModelDisplayList::Item& item,
+    vk::ImageView image_view,
+    DescriptorSetAllocation* allocation) {
+  if (!cache_entry_) {
+    return;
+  }
+  cache_entry_->uniform_buffer = uniform_buffer_;
+  cache_entry_->uniform_offset = item.uniform_offset;
+  cache_entry_->descriptor_set = item.descriptor_set;
+  cache_entry_->descriptor_set_allocation =
+      DescriptorSetAllocationPtr(allocation);
+  cache_entry_->color = item.push_constants.color;
+  cache_entry_->image_view = image_view;
+}
+
 void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
     const Object& object,
-    vk::DescriptorSet descriptor_set) {
+    ModelDisplayList::Item* item) {
   auto per_object = reinterpret_cast<ModelData::PerObject*>(
       &(uniform_buffer_->ptr()[uniform_buffer_write_index_]));
   *per_object = ModelData::PerObject();  // initialize with default values
@@ -259,8 +621,8 @@ void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
   auto& mat = object.material();
 
   // Push uniforms for scale/translation and color.
-  per_object->transform = camera_transform_ * object.transform();
-  per_object->color = mat ? mat->color() : vec4(1, 1, 1, 1);  // always opaque
+  per_object->transform = item->push_constants.transform;
+  per_object->color = item->push_constants.color;
 
   // Find the texture to use, either the object's material's texture, or
   // the default texture if the material doesn't have one.
@@ -288,6 +650,28 @@ void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
     per_object->wobble = wobble ? *wobble : ModifierWobble();
   }
 
+  vk::DescriptorSet descriptor_set;
+  if (share_descriptor_sets_) {
+    // The object's uniforms are selected by a dynamic offset when the
+    // descriptor set is bound, so the descriptor set only needs to be written
+    // the first time that the texture is encountered.
+    item->uniform_offset = uniform_buffer_write_index_;
+    auto it =
+        shared_descriptor_sets_.find(static_cast<VkImageView>(image_view));
+    if (it != shared_descriptor_sets_.end()) {
+      item->descriptor_set = it->second.descriptor_set;
+      uniform_buffer_write_index_ += sizeof(ModelData::PerObject);
+      CacheUniformsForObject(*item, image_view, it->second.allocation);
+      return;
+    }
+    descriptor_set = ObtainPerObjectDescriptorSet();
+    shared_descriptor_sets_[static_cast<VkImageView>(image_view)] = {
+        descriptor_set, per_object_descriptor_set_allocation_.get()};
+  } else {
+    descriptor_set = ObtainPerObjectDescriptorSet();
+  }
+  item->descriptor_set = descriptor_set;
+
   // Update each descriptor in the PerObject descriptor set.
   {
     // A pair of writes; order doesn't matter.
@@ -299,11 +683,14 @@ void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
         ModelData::PerObject::kDescriptorSetUniformBinding;
     buffer_write.dstArrayElement = 0;
     buffer_write.descriptorCount = 1;
-    buffer_write.descriptorType = vk::DescriptorType::eUniformBuffer;
+    buffer_write.descriptorType =
+        share_descriptor_sets_ ? vk::DescriptorType::eUniformBufferDynamic
+                               : vk::DescriptorType::eUniformBuffer;
     vk::DescriptorBufferInfo buffer_info;
     buffer_info.buffer = uniform_buffer_->get();
     buffer_info.range = sizeof(ModelData::PerObject);
-    buffer_info.offset = uniform_buffer_write_index_;
+    buffer_info.offset =
+        share_descriptor_sets_ ? 0 : uniform_buffer_write_index_;
     buffer_write.pBufferInfo = &buffer_info;
 
     auto& image_write = writes[1];
@@ -322,10 +709,354 @@ void ModelDisplayListBuilder::UpdateDescriptorSetForObject(
   }
 
   uniform_buffer_write_index_ += sizeof(ModelData::PerObject);
+  CacheUniformsForObject(*item, image_view,
+                         per_object_descriptor_set_allocation_.get());
+}
+
+void ModelDisplayListBuilder::RemoveUnnecessaryStencilRestores() {
+  // Walk backward, so that it is known whether any later item tests the
+  // stencil buffer.  Removed restores are not counted, since they neither
+  // test nor modify it.
+  bool is_stencil_tested_later = false;
+  std::vector<ModelDisplayList::Item> items;
+  items.reserve(items_.size());
+  for (auto it = items_.rbegin(); it != items_.rend(); ++it) {
+    if (it->pipeline->spec().clipper_state ==
+            ModelPipelineSpec::ClipperState::kEndClipChildren &&
+        !is_stencil_tested_later) {
+      continue;
+    }
+    // Only pipelines that test the stencil buffer set its reference value.
+    if (it->pipeline->HasDynamicStencilState()) {
+      is_stencil_tested_later = true;
+    }
+    items.push_back(std::move(*it));
+  }
+  std::reverse(items.begin(), items.end());
+  items_ = std::move(items);
+}
+
+bool ModelDisplayListBuilder::CanCollapseItems(
+    const ModelDisplayList::Item& first,
+    const ModelDisplayList::Item& next) {
+  const ModelPipelineSpec& spec = first.pipeline->spec();
+  // Clippers cannot be instanced, since overlapping instances would modify the
+  // stencil buffer more than once.
+  return spec.clipper_state ==
+             ModelPipelineSpec::ClipperState::kNoClipChildren &&
+         spec.shape_modifiers == ShapeModifiers() && !spec.use_instancing &&
+         first.pipeline == next.pipeline && first.mesh == next.mesh &&
+         first.descriptor_set == next.descriptor_set &&
+         first.stencil_reference == next.stencil_reference &&
+         first.scissor == next.scissor;
+}
+
+void ModelDisplayListBuilder::CollapseInstancedItems() {
+  TRACE_DURATION("gfx",
+                 "escher::ModelDisplayListBuilder::CollapseInstancedItems");
+
+  // The shortest run of consecutive identical items that is collapsed into an
+  // instanced draw.  This is simply the smallest run that saves a draw call;
+  // it has not been tuned against the cost of writing the per-instance data
+  // (a transform and a color per item) that push constants would otherwise
+  // carry.
+  constexpr size_t kMinInstanceCount = 2;
+
+  std::vector<ModelDisplayList::Item> items;
+  items.reserve(items_.size());
+  size_t run_start = 0;
+  while (run_start < items_.size()) {
+    size_t run_end = run_start + 1;
+    while (run_end < items_.size() &&
+           CanCollapseItems(items_[run_start], items_[run_end])) {
+      ++run_end;
+    }
+
+    if (run_end - run_start < kMinInstanceCount) {
+      for (size_t i = run_start; i < run_end; ++i) {
+        items.push_back(std::move(items_[i]));
+      }
+      run_start = run_end;
+      continue;
+    }
+
+    ModelPipelineSpec spec = items_[run_start].pipeline->spec();
+    spec.use_instancing = true;
+    ModelPipeline* instanced_pipeline = pipeline_cache_->GetPipeline(spec);
+
+    // The run may not fit into the remaining space of the current per-instance
+    // buffer; if not, it is split into multiple instanced draws.
+    while (run_start < run_end) {
+      PreparePerInstanceBufferForWrite();
+      const uint32_t available = static_cast<uint32_t>(
+          (per_instance_buffer_->size() - per_instance_buffer_write_index_) /
+          sizeof(ModelData::PerInstance));
+      const uint32_t instance_count =
+          std::min(available, static_cast<uint32_t>(run_end - run_start));
+
+      ModelDisplayList::Item item = items_[run_start];
+      item.pipeline = instanced_pipeline;
+      item.instance_buffer = per_instance_buffer_->get();
+      item.instance_buffer_offset = per_instance_buffer_write_index_;
+      item.instance_count = instance_count;
+
+      auto per_instance = reinterpret_cast<ModelData::PerInstance*>(
+          &(per_instance_buffer_->ptr()[per_instance_buffer_write_index_]));
+      for (uint32_t i = 0; i < instance_count; ++i) {
+        auto& data = items_[run_start + i].push_constants;
+        per_instance[i].transform = data.transform;
+        per_instance[i].color = data.color;
+      }
+      per_instance_buffer_write_index_ +=
+          instance_count * sizeof(ModelData::PerInstance);
+
+      items.push_back(std::move(item));
+      run_start += instance_count;
+    }
+  }
+  items_ = std::move(items);
+}
+
+bool ModelDisplayListBuilder::CanDrawItemsIndirectly(
+    const ModelDisplayList::Item& first,
+    const ModelDisplayList::Item& next) {
+  const ModelPipelineSpec& spec = first.pipeline->spec();
+  // The same restrictions apply as for instancing, except that the meshes only
+  // need to share vertex and index buffers.
+  return spec.clipper_state ==
+             ModelPipelineSpec::ClipperState::kNoClipChildren &&
+         spec.shape_modifiers == ShapeModifiers() && !spec.use_instancing &&
+         first.pipeline == next.pipeline &&
+         first.mesh->vk_vertex_buffer() == next.mesh->vk_vertex_buffer() &&
+         first.mesh->vk_index_buffer() == next.mesh->vk_index_buffer() &&
+         first.descriptor_set == next.descriptor_set &&
+         first.stencil_reference == next.stencil_reference &&
+         first.scissor == next.scissor;
+}
+
+void ModelDisplayListBuilder::BuildMultiDrawIndirectItems() {
+  TRACE_DURATION("gfx",
+                 "escher::ModelDisplayListBuilder::BuildMultiDrawIndirectItems");
+
+  std::vector<ModelDisplayList::Item> items;
+  items.reserve(items_.size());
+  size_t run_start = 0;
+  while (run_start < items_.size()) {
+    size_t run_end = run_start + 1;
+    while (run_end < items_.size() &&
+           CanDrawItemsIndirectly(items_[run_start], items_[run_end])) {
+      ++run_end;
+    }
+
+    // A lone item is only drawn indirectly if it can then be culled on the
+    // GPU.  Note: comparing an item with itself checks whether it can be drawn
+    // indirectly at all.
+    if (run_end - run_start == 1 &&
+        !(cull_on_gpu_ &&
+          CanDrawItemsIndirectly(items_[run_start], items_[run_start]))) {
+      items.push_back(std::move(items_[run_start]));
+      run_start = run_end;
+      continue;
+    }
+
+    // Per-draw data is provided by the instanced variant of the pipeline; the
+    // firstInstance of each draw command selects its PerInstance data.
+    ModelPipelineSpec spec = items_[run_start].pipeline->spec();
+    spec.use_instancing = true;
+    ModelPipeline* instanced_pipeline = pipeline_cache_->GetPipeline(spec);
+    const size_t stride = spec.mesh_spec.GetStride();
+
+    // The run may not fit into the remaining space of the current per-instance
+    // and indirect buffers; if not, it is split into multiple items.
+    while (run_start < run_end) {
+      PreparePerInstanceBufferForWrite();
+      PrepareIndirectBufferForWrite();
+      const size_t available = std::min(
+          (per_instance_buffer_->size() - per_instance_buffer_write_index_) /
+              sizeof(ModelData::PerInstance),
+          GetAvailableIndirectCommandCount());
+      const uint32_t count =
+          static_cast<uint32_t>(std::min(available, run_end - run_start));
+
+      ModelDisplayList::Item item = items_[run_start];
+      item.pipeline = instanced_pipeline;
+      item.instance_buffer = per_instance_buffer_->get();
+      item.instance_buffer_offset = per_instance_buffer_write_index_;
+      item.indirect_buffer = indirect_buffer_->get();
+      item.indirect_buffer_offset = indirect_buffer_write_index_;
+
+      auto per_instance = reinterpret_cast<ModelData::PerInstance*>(
+          &(per_instance_buffer_->ptr()[per_instance_buffer_write_index_]));
+      auto commands = reinterpret_cast<vk::DrawIndexedIndirectCommand*>(
+          &(indirect_buffer_->ptr()[indirect_buffer_write_index_]));
+      FrustumCuller::CullData* cull_data = nullptr;
+      if (cull_on_gpu_) {
+        const CullBatch& batch = cull_batches_.back();
+        auto batch_data = reinterpret_cast<FrustumCuller::CullData*>(
+            batch.cull_data_buffer->ptr());
+        cull_data = &batch_data[batch.command_count];
+      }
+      uint32_t draw_count = 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        const ModelDisplayList::Item& source = items_[run_start + i];
+        per_instance[i].transform = source.push_constants.transform;
+        per_instance[i].color = source.push_constants.color;
+
+        // Consecutive draws of the same mesh become instances of one command,
+        // unless each object must be culled separately.
+        if (!cull_on_gpu_ && i > 0 &&
+            source.mesh == items_[run_start + i - 1].mesh) {
+          ++commands[draw_count - 1].instanceCount;
+          continue;
+        }
+        if (source.mesh != item.mesh) {
+          indirect_meshes_.push_back(source.mesh);
+        }
+        const Mesh* mesh = source.mesh.get();
+        auto& command = commands[draw_count++];
+        command.indexCount = mesh->num_indices();
+        command.instanceCount = 1;
+        command.firstIndex = static_cast<uint32_t>(
+            mesh->index_buffer_offset() / sizeof(uint32_t));
+        command.vertexOffset =
+            static_cast<int32_t>(mesh->vertex_buffer_offset() / stride);
+        command.firstInstance = i;
+
+        if (cull_data) {
+          auto& data = cull_data[draw_count - 1];
+          data.transform = source.push_constants.transform;
+          data.bounds_min = vec4(mesh->bounding_box().min(), 0);
+          data.bounds_max = vec4(mesh->bounding_box().max(), 0);
+        }
+      }
+      item.indirect_draw_count = draw_count;
+      if (cull_on_gpu_) {
+        cull_batches_.back().command_count += draw_count;
+      }
+
+      per_instance_buffer_write_index_ +=
+          count * sizeof(ModelData::PerInstance);
+      indirect_buffer_write_index_ +=
+          draw_count * sizeof(vk::DrawIndexedIndirectCommand);
+
+      items.push_back(std::move(item));
+      run_start += count;
+    }
+  }
+  items_ = std::move(items);
+}
+
+void ModelDisplayListBuilder::PrepareIndirectBufferForWrite() {
+  if (!indirect_buffer_ || GetAvailableIndirectCommandCount() == 0) {
+    indirect_buffer_ = indirect_buffer_pool_->Allocate();
+    indirect_buffer_write_index_ = 0;
+    indirect_buffers_.push_back(indirect_buffer_);
+    if (cull_on_gpu_) {
+      cull_batches_.push_back(
+          CullBatch{indirect_buffer_, cull_data_buffer_pool_->Allocate(), 0});
+    }
+  }
+}
+
+size_t ModelDisplayListBuilder::GetAvailableIndirectCommandCount() const {
+  size_t capacity =
+      indirect_buffer_->size() / sizeof(vk::DrawIndexedIndirectCommand);
+  if (cull_on_gpu_) {
+    capacity =
+        std::min(capacity, cull_batches_.back().cull_data_buffer->size() /
+                               sizeof(FrustumCuller::CullData));
+  }
+  return capacity -
+         indirect_buffer_write_index_ / sizeof(vk::DrawIndexedIndirectCommand);
+}
+
+void ModelDisplayListBuilder::PreparePerInstanceBufferForWrite() {
+  if (!per_instance_buffer_ ||
+      per_instance_buffer_write_index_ + sizeof(ModelData::PerInstance) >
+          per_instance_buffer_->size()) {
+    per_instance_buffer_ = per_instance_buffer_pool_->Allocate();
+    per_instance_buffer_write_index_ = 0;
+    per_instance_buffers_.push_back(per_instance_buffer_);
+  }
 }
 
 ModelDisplayListPtr ModelDisplayListBuilder::Build(
     CommandBuffer* command_buffer) {
+  if (object_uniform_cache_) {
+    object_uniform_cache_->EndDisplayList(*retained_model_);
+  }
+  if (skip_final_stencil_restore_) {
+    RemoveUnnecessaryStencilRestores();
+  }
+  if (use_multi_draw_indirect_) {
+    BuildMultiDrawIndirectItems();
+  } else {
+    CollapseInstancedItems();
+  }
+
+  // Indirectly-drawn meshes are not bound by ModelRenderer::Draw(), so wait
+  // for them here.  Each is only waited upon and retained once.
+  std::sort(indirect_meshes_.begin(), indirect_meshes_.end());
+  indirect_meshes_.erase(
+      std::unique(indirect_meshes_.begin(), indirect_meshes_.end()),
+      indirect_meshes_.end());
+  for (auto& mesh : indirect_meshes_) {
+    command_buffer->TakeWaitSemaphore(mesh,
+                                      vk::PipelineStageFlagBits::eVertexInput);
+    resources_.push_back(std::move(mesh));
+  }
+  indirect_meshes_.clear();
+
+  // FrustumCuller records the barriers that make the culled commands visible
+  // to drawIndexedIndirect().
+  for (auto& batch : cull_batches_) {
+    if (batch.command_count > 0) {
+      renderer_->GetFrustumCuller()->CullIndirectDraws(
+          batch.cull_data_buffer, batch.indirect_buffer, batch.command_count,
+          command_buffer);
+    }
+    resources_.push_back(std::move(batch.cull_data_buffer));
+  }
+  cull_batches_.clear();
+
+  for (auto& indirect_buffer : indirect_buffers_) {
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eHostWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = indirect_buffer->get();
+    barrier.offset = 0;
+    barrier.size = indirect_buffer->size();
+
+    command_buffer->get().pipelineBarrier(
+        vk::PipelineStageFlagBits::eHost,
+        vk::PipelineStageFlagBits::eDrawIndirect, vk::DependencyFlags(), 0,
+        nullptr, 1, &barrier, 0, nullptr);
+
+    resources_.push_back(std::move(indirect_buffer));
+  }
+  indirect_buffers_.clear();
+
+  for (auto& per_instance_buffer : per_instance_buffers_) {
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessFlagBits::eHostWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = per_instance_buffer->get();
+    barrier.offset = 0;
+    barrier.size = per_instance_buffer->size();
+
+    command_buffer->get().pipelineBarrier(
+        vk::PipelineStageFlagBits::eHost,
+        vk::PipelineStageFlagBits::eVertexInput, vk::DependencyFlags(), 0,
+        nullptr, 1, &barrier, 0, nullptr);
+
+    resources_.push_back(std::move(per_instance_buffer));
+  }
+  per_instance_buffers_.clear();
+
   for (auto& uniform_buffer : uniform_buffers_) {
     vk::BufferMemoryBarrier barrier;
     barrier.srcAccessMask = vk::AccessFlagBits::eHostWrite;
@@ -386,6 +1117,8 @@ void ModelDisplayListBuilder::PrepareUniformBufferForWriteOfSize(
     uniform_buffer_ = uniform_buffer_pool_->Allocate();
     uniform_buffer_write_index_ = 0;
     uniform_buffers_.push_back(uniform_buffer_);
+    // Existing shared descriptor sets refer to the previous uniform buffer.
+    shared_descriptor_sets_.clear();
   }
 }
 
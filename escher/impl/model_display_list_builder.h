@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vulkan/vulkan.hpp>
 
 #include "escher/forward_declarations.h"
@@ -11,6 +14,8 @@
 #include "escher/impl/model_display_list.h"
 #include "escher/impl/model_display_list_flags.h"
 #include "escher/impl/model_pipeline_spec.h"
+#include "escher/impl/object_uniform_cache.h"
+#include "escher/impl/occlusion_culler.h"
 #include "escher/scene/model.h"
 #include "escher/scene/stage.h"
 
@@ -38,6 +43,32 @@ class ModelDisplayListBuilder {
 
   void AddObject(const Object& object);
 
+  // Rasterize the largest opaque, axis-aligned rects and circles in |objects|
+  // into a software depth buffer.  Subsequently-added objects that are hidden
+  // behind them are culled.  Must be called before AddObject().
+  void AddOccluders(const std::vector<Object>& objects);
+
+  // Also cull subsequently-added objects that are hidden according to |depth|,
+  // which was read back from the depth buffer of a previous frame that was
+  // rendered at full scale by the same camera; see DepthPyramid.  |depth| must
+  // outlive the builder.  Must be called before AddObject().
+  void SetPreviousFrameDepth(const OcclusionCuller* depth);
+
+  // Restrict drawing to |scissor|, in framebuffer pixels, e.g. because only
+  // part of the framebuffer is being rendered.  Clip groups narrow it further.
+  // Must be called before AddObject().
+  void SetScissor(const vk::Rect2D& scissor);
+
+  // The model must belong to a RetainedModel.  The uniforms and descriptor sets
+  // of objects that are added by AddRetainedObject() are retained in |cache|,
+  // and reused by subsequent display lists until the objects change.  |cache|
+  // must outlive the builder.  Must be called before AddObject().
+  void SetObjectUniformCache(ObjectUniformCache* cache);
+
+  // Add the object at |index| in the model's objects, reusing its cached
+  // uniforms if possible; see SetObjectUniformCache().
+  void AddRetainedObject(size_t index);
+
   ModelDisplayListPtr Build(CommandBuffer* command_buffer);
 
  private:
@@ -46,19 +77,104 @@ class ModelDisplayListBuilder {
   // AddObject() each of the clippees (note: this may be recursive, since each
   // clippee may be a clipper of its own list of clippees).  Finally, the
   // clippers are redrawn to return the stencil buffer to its original state.
+  // If the clip is a screen-aligned rectangle (see GetClipScissor()), the
+  // stencil buffer is left untouched, and the clippees are clipped by the
+  // scissor rectangle instead.
   void AddClipperAndClippeeObjects(const Object& object);
   // Leaf helper called by AddClipperAndClippeeObjects(); actually writes data
   // to uniform buffers, updates descriptor sets, and adds an item to the
   // display list.
   void AddClipperObject(const Object& object);
-  // Leaf helper called by AddObject(); actually writes data to uniform buffers,
-  // updates descriptor sets, and adds an item to the display list.
+  // Leaf helper called by AddObject() and AddClipperAndClippeeObjects();
+  // actually writes data to uniform buffers, updates descriptor sets, and adds
+  // an item to the display list.  Does not update the stencil buffer.
   void AddNonClipperObject(const Object& object);
 
+  // If the region that the object's clippers would mark in the stencil buffer
+  // is a single screen-aligned rectangle, return true and compute that
+  // rectangle in framebuffer pixels.
+  bool GetClipScissor(const Object& object, vk::Rect2D* scissor) const;
+
+  // Return true if the object is entirely outside of the view frustum.  Only
+  // used for CPU culling; conservatively returns false for objects whose
+  // bounds are unknown, e.g. because they have shape modifiers.
+  bool IsObjectOutsideFrustum(const Object& object) const;
+
+  // Return true if the object is hidden behind occluders that were added by
+  // AddOccluders(), or according to the depth passed to
+  // SetPreviousFrameDepth().
+  bool IsObjectOccluded(const Object& object) const;
+
+  // If the object can be used as an occluder, return true and compute the
+  // screen-space rectangle that it is guaranteed to cover (in normalized device
+  // coordinates), and the farthest depth within that rectangle.
+  bool GetOccluderBounds(const Object& object,
+                         vec2* min,
+                         vec2* max,
+                         float* depth) const;
+
+  // Return true if the object's per-object data can be delivered via push
+  // constants, i.e. if it neither uses a texture nor has shape modifiers.
+  bool CanUsePushConstants(const Object& object) const;
+  // Set up the item's per-object data, either via push constants or by writing
+  // uniforms and updating a descriptor set.  Also sets the corresponding field
+  // of |pipeline_spec_|.
+  void PrepareItemForObject(const Object& object, ModelDisplayList::Item* item);
+  // If uniforms and a descriptor set for the object are in |cache_entry_|, and
+  // still up to date, set up the item to use them and return true.
+  bool ReuseCachedUniformsForObject(const Object& object,
+                                    ModelDisplayList::Item* item);
+  // Record the uniforms and descriptor set that were just written for the
+  // object in |cache_entry_|, if any.
+  void CacheUniformsForObject(const ModelDisplayList::Item& item,
+                              vk::ImageView image_view,
+                              DescriptorSetAllocation* allocation);
+  // Add a resource that is referenced by a cache entry to |resources_|, unless
+  // it was already added.
+  void RetainCachedResource(Resource* resource);
+
+  // Called by Build() if |skip_final_stencil_restore_|.  Removes the items that
+  // revert the stencil buffer after a clip group, unless a later item tests
+  // the stencil buffer.
+  void RemoveUnnecessaryStencilRestores();
+
+  // Called by Build().  Replaces each run of consecutive items that have the
+  // same mesh, pipeline, descriptor set, stencil reference and scissor with a
+  // single instanced item.
+  void CollapseInstancedItems();
+  // Return true if |next| can be drawn as an instance of the same instanced
+  // draw as |first|.
+  static bool CanCollapseItems(const ModelDisplayList::Item& first,
+                               const ModelDisplayList::Item& next);
+
+  // Called by Build() instead of CollapseInstancedItems() when multi-draw-
+  // indirect is enabled.  Replaces each run of consecutive items that have the
+  // same pipeline, descriptor set, stencil reference and scissor, and whose
+  // meshes share vertex and index buffers, with a single item that is drawn by
+  // a list of indirect draw commands.  If culling on the GPU, each object gets
+  // its own command, and CullData is written for each command.
+  void BuildMultiDrawIndirectItems();
+  // Return true if |next| can be drawn by the same indirect draw as |first|.
+  static bool CanDrawItemsIndirectly(const ModelDisplayList::Item& first,
+                                     const ModelDisplayList::Item& next);
+
   void PrepareUniformBufferForWriteOfSize(size_t size, size_t alignment);
+  // Ensure that there is room in |per_instance_buffer_| for at least one
+  // PerInstance.
+  void PreparePerInstanceBufferForWrite();
+  // Ensure that there is room in |indirect_buffer_| for at least one
+  // vk::DrawIndexedIndirectCommand (and in the current CullBatch's buffer for
+  // one FrustumCuller::CullData, if culling on the GPU).
+  void PrepareIndirectBufferForWrite();
+  // Return the number of commands that can still be written to the current
+  // |indirect_buffer_|.
+  size_t GetAvailableIndirectCommandCount() const;
   vk::DescriptorSet ObtainPerObjectDescriptorSet();
+  // Write the object's PerObject data to the current uniform buffer, and set
+  // the item's descriptor set (and uniform offset, if descriptor sets are
+  // shared between objects) so that the data can be accessed by shaders.
   void UpdateDescriptorSetForObject(const Object& object,
-                                    vk::DescriptorSet descriptor_set);
+                                    ModelDisplayList::Item* item);
 
   const vk::Device device_;
 
@@ -68,6 +184,10 @@ class ModelDisplayListBuilder {
   // particular display list.
   const mat4 camera_transform_;
 
+  // Camera view/projection matrix without adjustment for downsampled render
+  // passes; used to test objects against |previous_frame_depth_|.
+  const mat4 unscaled_camera_transform_;
+
   // If this is false, use |default_white_texture_| instead of a material's
   // existing texture (e.g. to save bandwidth during depth-only passes).
   const bool use_material_textures_;
@@ -75,6 +195,27 @@ class ModelDisplayListBuilder {
   // If this is true, entirely disable all depth-testing.
   const bool disable_depth_test_;
 
+  // If this is true, objects that use the same texture also share the same
+  // PerObject descriptor set; each object's uniforms are selected via a
+  // dynamic offset when the descriptor set is bound.
+  const bool share_descriptor_sets_;
+
+  // If this is true, runs of compatible items are drawn via indirect draw
+  // commands; see BuildMultiDrawIndirectItems().
+  const bool use_multi_draw_indirect_;
+
+  // If true, objects that are outside of the view frustum are not added to the
+  // display list.
+  const bool cull_on_cpu_;
+
+  // If true, a compute shader disables the indirect draw commands of objects
+  // that are outside of the view frustum.  Requires |use_multi_draw_indirect_|.
+  const bool cull_on_gpu_;
+
+  // If true, the stencil buffer is not needed after the display list is drawn;
+  // see RemoveUnnecessaryStencilRestores().
+  const bool skip_final_stencil_restore_;
+
   const TexturePtr white_texture_;
   const TexturePtr illumination_texture_;
 
@@ -90,13 +231,55 @@ class ModelDisplayListBuilder {
   // must be flushed before they can be used by a display list.
   std::vector<BufferPtr> uniform_buffers_;
 
+  // Per-instance buffers are also flushed before they are used.
+  std::vector<BufferPtr> per_instance_buffers_;
+
+  // Indirect buffers are also flushed before they are used.
+  std::vector<BufferPtr> indirect_buffers_;
+
+  // Meshes that are drawn by indirect draw commands, other than the mesh of
+  // the item that the commands belong to.  The display list must wait for and
+  // retain these.
+  std::vector<MeshPtr> indirect_meshes_;
+
+  // The commands in each indirect buffer are culled by a single dispatch, using
+  // CullData from the corresponding buffer.  Only used if |cull_on_gpu_|.
+  struct CullBatch {
+    BufferPtr indirect_buffer;
+    BufferPtr cull_data_buffer;
+    uint32_t command_count;
+  };
+  std::vector<CullBatch> cull_batches_;
+
+  // Only non-null if AddOccluders() was called.
+  std::unique_ptr<OcclusionCuller> occlusion_culler_;
+
+  // Only non-null if SetPreviousFrameDepth() was called.
+  const OcclusionCuller* previous_frame_depth_ = nullptr;
+
+  // Non-null if the model belongs to a RetainedModel.
+  const RetainedModel* const retained_model_;
+
+  // Only non-null if SetObjectUniformCache() was called.
+  ObjectUniformCache* object_uniform_cache_ = nullptr;
+
+  // Entry of the object that is being added by AddRetainedObject(), if its
+  // uniforms can be cached.
+  ObjectUniformCache::Entry* cache_entry_ = nullptr;
+
+  // Cached resources that have been added to |resources_|, so that each is
+  // only retained once.
+  std::unordered_set<Resource*> retained_cached_resources_;
+
   // A list of resources that must be retained until the display list is no
   // longer needed.
   std::vector<ResourcePtr> resources_;
 
   ModelRenderer* const renderer_;
   UniformBufferPool* const uniform_buffer_pool_;
-  DescriptorSetPool* const per_model_descriptor_set_pool_;
+  UniformBufferPool* const per_instance_buffer_pool_;
+  UniformBufferPool* const indirect_buffer_pool_;
+  UniformBufferPool* const cull_data_buffer_pool_;
   DescriptorSetPool* const per_object_descriptor_set_pool_;
   ModelPipelineCache* const pipeline_cache_;
 
@@ -104,10 +287,28 @@ class ModelDisplayListBuilder {
 
   BufferPtr uniform_buffer_;
   uint32_t uniform_buffer_write_index_ = 0;
+  BufferPtr per_instance_buffer_;
+  uint32_t per_instance_buffer_write_index_ = 0;
+  BufferPtr indirect_buffer_;
+  uint32_t indirect_buffer_write_index_ = 0;
   uint32_t per_object_descriptor_set_index_ = 0;
 
+  // Descriptor sets that refer to the current |uniform_buffer_|, keyed by the
+  // image view of the texture that they bind.  Only used when
+  // |share_descriptor_sets_| is true; cleared whenever a new uniform buffer is
+  // obtained.
+  struct SharedDescriptorSet {
+    vk::DescriptorSet descriptor_set;
+    // Retained by |resources_|.
+    DescriptorSetAllocation* allocation;
+  };
+  std::unordered_map<VkImageView, SharedDescriptorSet> shared_descriptor_sets_;
+
   ModelPipelineSpec pipeline_spec_;
   uint32_t clip_depth_ = 0;
+  // Scissor rectangle of the items that are currently being added; narrowed by
+  // clip groups that are clipped without the stencil buffer.
+  vk::Rect2D scissor_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(ModelDisplayListBuilder);
 };
@@ -17,7 +17,15 @@ enum class ModelDisplayListFlag {
   kSortByPipeline = 1 << 0,
   kUseDepthPrepass = 1 << 1,
   kDisableDepthTest = 1 << 2,
-  kShareDescriptorSetsBetweenObjects = 1 << 3
+  kShareDescriptorSetsBetweenObjects = 1 << 3,
+  kUseMultiDrawIndirect = 1 << 4,
+  kUseCpuFrustumCulling = 1 << 5,
+  kUseGpuFrustumCulling = 1 << 6,
+  kUseOcclusionCulling = 1 << 7,
+  // The stencil buffer is not used after the display list is drawn, so clip
+  // groups that are not followed by any clipped objects need not clear their
+  // clippers from it.
+  kSkipFinalStencilRestore = 1 << 8
 };
 
 using ModelDisplayListFlags = vk::Flags<ModelDisplayListFlag>;
@@ -48,7 +56,17 @@ struct FlagTraits<escher::impl::ModelDisplayListFlag> {
                VkFlags(escher::impl::ModelDisplayListFlag::kUseDepthPrepass) |
                VkFlags(escher::impl::ModelDisplayListFlag::kDisableDepthTest) |
                VkFlags(escher::impl::ModelDisplayListFlag::
-                           kShareDescriptorSetsBetweenObjects)
+                           kShareDescriptorSetsBetweenObjects) |
+               VkFlags(
+                   escher::impl::ModelDisplayListFlag::kUseMultiDrawIndirect) |
+               VkFlags(
+                   escher::impl::ModelDisplayListFlag::kUseCpuFrustumCulling) |
+               VkFlags(
+                   escher::impl::ModelDisplayListFlag::kUseGpuFrustumCulling) |
+               VkFlags(
+                   escher::impl::ModelDisplayListFlag::kUseOcclusionCulling) |
+               VkFlags(escher::impl::ModelDisplayListFlag::
+                           kSkipFinalStencilRestore)
   };
 };
 
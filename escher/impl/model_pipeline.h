@@ -27,6 +27,24 @@ class ModelPipeline {
   // VK_DYNAMIC_STATE_STENCIL_REFERENCE.
   bool HasDynamicStencilState() const { return spec_.is_clippee; }
 
+  // Return true if this pipeline's PerObject descriptor set has a dynamic
+  // uniform buffer binding, which requires an offset to be provided when the
+  // descriptor set is bound.
+  bool HasDynamicUniformOffset() const {
+    return spec_.use_dynamic_uniform_offset;
+  }
+
+  // Return true if this pipeline obtains per-object data via push constants
+  // (see ModelData::PerObjectPushConstants) instead of a PerObject descriptor
+  // set.
+  bool UsesPushConstants() const { return spec_.use_push_constants; }
+
+  // Return true if this pipeline draws multiple instances at once, reading
+  // per-instance data from vertex attributes (see ModelData::PerInstance).
+  bool UsesInstancing() const { return spec_.use_instancing; }
+
+  const ModelPipelineSpec& spec() const { return spec_; }
+
  private:
   friend class ModelPipelineCache;
 
@@ -44,6 +44,57 @@ constexpr char g_vertex_src[] = R"GLSL(
   }
   )GLSL";
 
+// Variant of |g_vertex_src| for objects that have no texture or shape
+// modifiers; the per-object data is provided via push constants (see
+// ModelData::PerObjectPushConstants), so no PerObject descriptor set is needed.
+constexpr char g_vertex_push_constants_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  // Attribute locations must match constants in model_data.h
+  layout(location = 0) in vec3 inPosition;
+
+  layout(push_constant) uniform PerObject {
+    mat4 transform;
+    vec4 color;
+  };
+
+  out gl_PerVertex {
+    vec4 gl_Position;
+  };
+
+  void main() {
+    gl_Position = transform * vec4(inPosition, 1);
+  }
+  )GLSL";
+
+// Variant of |g_vertex_src| that draws many instances at once; each instance's
+// transform and color are read from per-instance vertex attributes (see
+// ModelData::PerInstance).
+constexpr char g_vertex_instanced_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  // Attribute locations must match constants in model_data.h
+  layout(location = 0) in vec3 inPosition;
+  layout(location = 2) in vec2 inUV;
+  layout(location = 4) in mat4 inTransform;
+  layout(location = 8) in vec4 inColor;
+
+  layout(location = 0) out vec2 fragUV;
+  layout(location = 1) flat out vec4 fragColor;
+
+  out gl_PerVertex {
+    vec4 gl_Position;
+  };
+
+  void main() {
+    gl_Position = inTransform * vec4(inPosition, 1);
+    fragUV = inUV;
+    fragColor = inColor;
+  }
+  )GLSL";
+
 constexpr char g_vertex_wobble_src[] = R"GLSL(
     #version 450
     #extension GL_ARB_separate_shader_objects : enable
@@ -157,6 +208,79 @@ constexpr char g_fragment_src[] = R"GLSL(
   }
   )GLSL";
 
+// Variant of |g_fragment_src| for untextured objects whose color is provided
+// via push constants.
+constexpr char g_fragment_push_constants_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(set = 0, binding = 0) uniform PerModel {
+    vec2 frag_coord_to_uv_multiplier;
+    float time;
+  };
+
+  layout(set = 0, binding = 1) uniform sampler2D light_tex;
+
+  layout(push_constant) uniform PerObject {
+    mat4 transform;
+    vec4 color;
+  };
+
+  layout(location = 0) out vec4 outColor;
+
+  void main() {
+    vec4 light = texture(light_tex, gl_FragCoord.xy * frag_coord_to_uv_multiplier);
+    outColor = light.r * color;
+  }
+  )GLSL";
+
+// Fragment shaders used with |g_vertex_instanced_src|, for textured and
+// untextured objects respectively.
+constexpr char g_fragment_instanced_textured_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(location = 0) in vec2 inUV;
+  layout(location = 1) flat in vec4 inColor;
+
+  layout(set = 0, binding = 0) uniform PerModel {
+    vec2 frag_coord_to_uv_multiplier;
+    float time;
+  };
+
+  layout(set = 0, binding = 1) uniform sampler2D light_tex;
+
+  layout(set = 1, binding = 1) uniform sampler2D material_tex;
+
+  layout(location = 0) out vec4 outColor;
+
+  void main() {
+    vec4 light = texture(light_tex, gl_FragCoord.xy * frag_coord_to_uv_multiplier);
+    outColor = light.r * inColor * texture(material_tex, inUV);
+  }
+  )GLSL";
+
+constexpr char g_fragment_instanced_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(location = 1) flat in vec4 inColor;
+
+  layout(set = 0, binding = 0) uniform PerModel {
+    vec2 frag_coord_to_uv_multiplier;
+    float time;
+  };
+
+  layout(set = 0, binding = 1) uniform sampler2D light_tex;
+
+  layout(location = 0) out vec4 outColor;
+
+  void main() {
+    vec4 light = texture(light_tex, gl_FragCoord.xy * frag_coord_to_uv_multiplier);
+    outColor = light.r * inColor;
+  }
+  )GLSL";
+
 }  // namespace
 
 ModelPipelineCache::ModelPipelineCache(ModelData* model_data,
@@ -219,16 +343,38 @@ std::pair<vk::Pipeline, vk::PipelineLayout> NewPipelineHelper(
                                                        fragment_stage_info};
 
   vk::PipelineVertexInputStateCreateInfo vertex_input_info;
+  // Only used by instanced pipelines, which have a second vertex binding for
+  // per-instance data.
+  std::vector<vk::VertexInputBindingDescription> instanced_bindings;
+  std::vector<vk::VertexInputAttributeDescription> instanced_attributes;
   {
     auto& mesh_shader_binding =
         model_data->GetMeshShaderBinding(spec.mesh_spec);
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.pVertexBindingDescriptions =
-        mesh_shader_binding.binding();
-    vertex_input_info.vertexAttributeDescriptionCount =
-        mesh_shader_binding.attributes().size();
-    vertex_input_info.pVertexAttributeDescriptions =
-        mesh_shader_binding.attributes().data();
+    if (!spec.use_instancing) {
+      vertex_input_info.vertexBindingDescriptionCount = 1;
+      vertex_input_info.pVertexBindingDescriptions =
+          mesh_shader_binding.binding();
+      vertex_input_info.vertexAttributeDescriptionCount =
+          mesh_shader_binding.attributes().size();
+      vertex_input_info.pVertexAttributeDescriptions =
+          mesh_shader_binding.attributes().data();
+    } else {
+      auto& instance_attributes =
+          ModelData::GetPerInstanceAttributeDescriptions();
+      instanced_bindings = {*mesh_shader_binding.binding(),
+                            ModelData::GetPerInstanceBindingDescription()};
+      instanced_attributes = mesh_shader_binding.attributes();
+      instanced_attributes.insert(instanced_attributes.end(),
+                                  instance_attributes.begin(),
+                                  instance_attributes.end());
+      vertex_input_info.vertexBindingDescriptionCount =
+          static_cast<uint32_t>(instanced_bindings.size());
+      vertex_input_info.pVertexBindingDescriptions = instanced_bindings.data();
+      vertex_input_info.vertexAttributeDescriptionCount =
+          static_cast<uint32_t>(instanced_attributes.size());
+      vertex_input_info.pVertexAttributeDescriptions =
+          instanced_attributes.data();
+    }
   }
 
   vk::PipelineInputAssemblyStateCreateInfo input_assembly_info;
@@ -378,7 +524,14 @@ std::pair<vk::Pipeline, vk::PipelineLayout> NewPipelineHelper(
   pipeline_layout_info.setLayoutCount =
       static_cast<uint32_t>(descriptor_set_layouts.size());
   pipeline_layout_info.pSetLayouts = descriptor_set_layouts.data();
-  pipeline_layout_info.pushConstantRangeCount = 0;
+  vk::PushConstantRange push_constant_range;
+  if (spec.use_push_constants && !spec.use_instancing) {
+    push_constant_range = ModelData::GetPerObjectPushConstantRange();
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  } else {
+    pipeline_layout_info.pushConstantRangeCount = 0;
+  }
 
   vk::PipelineLayout pipeline_layout = ESCHER_CHECKED_VK_RESULT(
       device.createPipelineLayout(pipeline_layout_info, nullptr));
@@ -422,7 +575,20 @@ std::unique_ptr<ModelPipeline> ModelPipelineCache::NewPipeline(
   std::future<SpirvData> vertex_spirv_future;
   std::future<SpirvData> fragment_spirv_future;
 
-  if (spec.shape_modifiers & ShapeModifier::kWobble) {
+  // Push constants and instancing are only used by objects without shape
+  // modifiers.
+  FTL_DCHECK(!(spec.use_push_constants || spec.use_instancing) ||
+             spec.shape_modifiers == ShapeModifiers());
+
+  if (spec.use_instancing) {
+    vertex_spirv_future =
+        compiler_.Compile(vk::ShaderStageFlagBits::eVertex,
+                          {{g_vertex_instanced_src}}, std::string(), "main");
+  } else if (spec.use_push_constants) {
+    vertex_spirv_future = compiler_.Compile(
+        vk::ShaderStageFlagBits::eVertex, {{g_vertex_push_constants_src}},
+        std::string(), "main");
+  } else if (spec.shape_modifiers & ShapeModifier::kWobble) {
     vertex_spirv_future =
         compiler_.Compile(vk::ShaderStageFlagBits::eVertex,
                           {{g_vertex_wobble_src}}, std::string(), "main");
@@ -447,9 +613,18 @@ std::unique_ptr<ModelPipeline> ModelPipelineCache::NewPipeline(
     }
   } else {
     render_pass = lighting_pass_;
+    const char* fragment_src;
+    if (spec.use_instancing) {
+      fragment_src = spec.use_push_constants
+                         ? g_fragment_instanced_src
+                         : g_fragment_instanced_textured_src;
+    } else {
+      fragment_src = spec.use_push_constants ? g_fragment_push_constants_src
+                                             : g_fragment_src;
+    }
     fragment_spirv_future =
-        compiler_.Compile(vk::ShaderStageFlagBits::eFragment,
-                          {{g_fragment_src}}, std::string(), "main");
+        compiler_.Compile(vk::ShaderStageFlagBits::eFragment, {{fragment_src}},
+                          std::string(), "main");
   }
 
   // Wait for completion of asynchronous shader compilation.
@@ -475,10 +650,20 @@ std::unique_ptr<ModelPipeline> ModelPipelineCache::NewPipeline(
         ESCHER_CHECKED_VK_RESULT(device.createShaderModule(module_info));
   }
 
+  // Pipelines that use push constants don't need a PerObject descriptor set.
+  std::vector<vk::DescriptorSetLayout> descriptor_set_layouts{
+      model_data_->per_model_layout()};
+  if (!spec.use_push_constants) {
+    descriptor_set_layouts.push_back(
+        spec.use_dynamic_uniform_offset
+            ? model_data_->per_object_dynamic_layout()
+            : model_data_->per_object_layout());
+  }
+
   auto pipeline_and_layout = NewPipelineHelper(
       model_data_, vertex_module, fragment_module, enable_depth_write,
       enable_blending, depth_compare_op, render_pass,
-      {model_data_->per_model_layout(), model_data_->per_object_layout()}, spec,
+      std::move(descriptor_set_layouts), spec,
       SampleCountFlagBitsFromInt(spec.sample_count));
 
   device.destroyShaderModule(vertex_module);
@@ -39,6 +39,18 @@ struct ModelPipelineSpec {
   bool is_opaque = false;
   // Entirely disable depth test and depth write.
   bool disable_depth_test = false;
+  // If true, the PerObject descriptor set uses a dynamic uniform buffer, so
+  // that it can be shared between objects that use the same texture.
+  bool use_dynamic_uniform_offset = false;
+  // If true, the object's transform and color are provided via push constants
+  // instead of a PerObject descriptor set.  Only valid for objects that have
+  // neither a texture nor any shape modifiers.  If |use_instancing| is also
+  // true, this only indicates that there is no PerObject descriptor set.
+  bool use_push_constants = false;
+  // If true, multiple instances are drawn at once, and each instance's
+  // transform and color are read from per-instance vertex attributes (see
+  // ModelData::PerInstance).  Only valid for objects without shape modifiers.
+  bool use_instancing = false;
 };
 #pragma pack(pop)
 
@@ -53,7 +65,12 @@ inline bool operator==(const ModelPipelineSpec& spec1,
          spec1.is_clippee == spec2.is_clippee &&
          spec1.use_depth_prepass == spec2.use_depth_prepass &&
          spec1.has_material == spec2.has_material &&
-         spec1.is_opaque == spec2.is_opaque;
+         spec1.is_opaque == spec2.is_opaque &&
+         spec1.disable_depth_test == spec2.disable_depth_test &&
+         spec1.use_dynamic_uniform_offset ==
+             spec2.use_dynamic_uniform_offset &&
+         spec1.use_push_constants == spec2.use_push_constants &&
+         spec1.use_instancing == spec2.use_instancing;
 }
 
 inline bool operator!=(const ModelPipelineSpec& spec1,
@@ -4,10 +4,14 @@
 
 #include "escher/impl/model_renderer.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <glm/gtx/transform.hpp>
 #include "escher/geometry/tessellation.h"
 #include "escher/impl/command_buffer.h"
 #include "escher/impl/escher_impl.h"
+#include "escher/impl/frustum_culler.h"
 #include "escher/impl/image_cache.h"
 #include "escher/impl/mesh_manager.h"
 #include "escher/impl/model_data.h"
@@ -15,24 +19,86 @@
 #include "escher/impl/model_display_list_builder.h"
 #include "escher/impl/model_pipeline.h"
 #include "escher/impl/model_pipeline_cache.h"
+#include "escher/impl/object_uniform_cache.h"
+#include "escher/impl/secondary_command_buffer_cache.h"
 #include "escher/impl/vulkan_utils.h"
 #include "escher/renderer/image.h"
 #include "escher/scene/model.h"
+#include "escher/scene/retained_model.h"
 #include "escher/scene/shape.h"
 #include "escher/scene/stage.h"
+#include "escher/util/hash.h"
 #include "escher/util/image_utils.h"
 #include "escher/util/trace_macros.h"
 
 namespace escher {
 namespace impl {
 
+namespace {
+
+// Enough for the display lists of a typical frame, i.e. those of two depth
+// prepasses at different scales and a lighting pass.
+constexpr size_t kMaxObjectUniformCacheCount = 4;
+
+// Sets are normally evicted by EndFrame(); this bounds their number if it is
+// not called, e.g. when the illumination texture changes every frame.
+constexpr size_t kMaxPerModelDescriptorSetCount = 8;
+
+// Runs of display-list items that are drawn by a single secondary command
+// buffer end after an item whose hash is divisible by kMeanItemsPerRun, so
+// that the boundaries depend only on the items themselves: adding, removing or
+// changing an item only invalidates the run that contains it (and possibly
+// merges it with the following run).
+constexpr size_t kMeanItemsPerRun = 16;
+constexpr size_t kMaxItemsPerRun = 64;
+
+// Everything that the commands recorded for a display-list item depend upon.
+// The pipeline and mesh are identified by address; this is safe because
+// pipelines are never destroyed by ModelPipelineCache, and the display list
+// that retains the mesh is kept alive by SecondaryCommandBufferCache for as
+// long as the commands are cached.  Tightly packed, since it is hashed and
+// compared bytewise.
+struct ItemKey {
+  const ModelPipeline* pipeline;
+  const Mesh* mesh;
+  vk::DescriptorSet descriptor_set;
+  vk::Buffer instance_buffer;
+  vk::DeviceSize instance_buffer_offset;
+  vk::Buffer indirect_buffer;
+  vk::DeviceSize indirect_buffer_offset;
+  ModelData::PerObjectPushConstants push_constants;
+  vk::Rect2D scissor;
+  uint32_t stencil_reference;
+  uint32_t uniform_offset;
+  uint32_t instance_count;
+  uint32_t indirect_draw_count;
+};
+
+vk::Viewport GetViewportForStage(const Stage& stage) {
+  vk::Viewport viewport;
+  viewport.width = stage.viewing_volume().width();
+  viewport.height = stage.viewing_volume().height();
+  // We normalize all depths to the range [0,1].  If we didn't, then Vulkan
+  // would clip them anyway.  NOTE: this is only true because we are using an
+  // orthonormal projection; otherwise the depth computed by the vertex shader
+  // could be outside [0,1] as long as the perspective division brought it back.
+  // In this case, it might make sense to use different values for viewport
+  // min/max depth.
+  viewport.minDepth = 0.f;
+  viewport.maxDepth = 1.f;
+  return viewport;
+}
+
+}  // namespace
+
 ModelRenderer::ModelRenderer(EscherImpl* escher,
                              ModelData* model_data,
                              vk::Format pre_pass_color_format,
                              vk::Format lighting_pass_color_format,
                              uint32_t lighting_pass_sample_count,
                              vk::Format depth_format)
-    : device_(escher->vulkan_context().device),
+    : escher_(escher),
+      device_(escher->vulkan_context().device),
       resource_recycler_(escher->resource_recycler()),
       mesh_manager_(escher->mesh_manager()),
       model_data_(model_data) {
@@ -47,8 +113,11 @@ ModelRenderer::ModelRenderer(EscherImpl* escher,
 }
 
 ModelRenderer::~ModelRenderer() {
+  // Cached command buffers refer to the render passes.
+  secondary_command_buffer_cache_.reset();
   device_.destroyRenderPass(depth_prepass_);
   device_.destroyRenderPass(lighting_pass_);
+  device_.destroyRenderPass(partial_lighting_pass_);
 }
 
 ModelDisplayListPtr ModelRenderer::CreateDisplayList(
@@ -59,16 +128,25 @@ ModelDisplayListPtr ModelRenderer::CreateDisplayList(
     float scale,
     uint32_t sample_count,
     const TexturePtr& illumination_texture,
+    const OcclusionCuller* previous_frame_depth,
+    const vk::Rect2D* scissor,
     CommandBuffer* command_buffer) {
   TRACE_DURATION("gfx", "escher::ModelRenderer::CreateDisplayList",
                  "object_count", model.objects().size());
 
-  const std::vector<Object>& objects = model.objects();
+  const bool use_multi_draw_indirect(
+      flags & ModelDisplayListFlag::kUseMultiDrawIndirect);
+  if (use_multi_draw_indirect && !shared_rectangle_) {
+    // Rectangles and circles can only be drawn by the same multi-draw-indirect
+    // command if they share vertex and index buffers.  The copy is only made
+    // once it is needed, since it costs a GPU copy and twice the memory.
+    auto meshes =
+        mesh_manager_->NewMeshesWithSharedBuffers({rectangle_, circle_});
+    shared_rectangle_ = std::move(meshes[0]);
+    shared_circle_ = std::move(meshes[1]);
+  }
 
-  // TODO(ES-29): not low-hanging fruit, but maybe someday...
-  FTL_DCHECK(
-      !(flags & ModelDisplayListFlag::kShareDescriptorSetsBetweenObjects))
-      << "unimplemented (ES-29).";
+  const std::vector<Object>& objects = model.objects();
 
   // Used to accumulate indices of objects in render-order.
   std::vector<uint32_t> opaque_objects;
@@ -124,20 +202,140 @@ ModelDisplayListPtr ModelRenderer::CreateDisplayList(
                                   white_texture_, illumination_texture,
                                   model_data_, this, pipeline_cache_.get(),
                                   flags, sample_count);
-  for (uint32_t object_index : opaque_objects) {
-    builder.AddObject(objects[object_index]);
+  if (flags & ModelDisplayListFlag::kUseOcclusionCulling) {
+    builder.AddOccluders(objects);
+  }
+  if (previous_frame_depth) {
+    builder.SetPreviousFrameDepth(previous_frame_depth);
+  }
+  if (scissor) {
+    builder.SetScissor(*scissor);
+  }
+  if (model.retained_model()) {
+    builder.SetObjectUniformCache(GetObjectUniformCache(flags, scale));
+    for (uint32_t object_index : opaque_objects) {
+      builder.AddRetainedObject(object_index);
+    }
+  } else {
+    for (uint32_t object_index : opaque_objects) {
+      builder.AddObject(objects[object_index]);
+    }
   }
   return builder.Build(command_buffer);
 }
 
+ObjectUniformCache* ModelRenderer::GetObjectUniformCache(
+    ModelDisplayListFlags flags,
+    float scale) {
+  auto it = std::find_if(
+      object_uniform_caches_.begin(), object_uniform_caches_.end(),
+      [flags, scale](const std::unique_ptr<ObjectUniformCache>& cache) {
+        return cache->IsCompatible(flags, scale);
+      });
+  std::unique_ptr<ObjectUniformCache> cache;
+  if (it != object_uniform_caches_.end()) {
+    cache = std::move(*it);
+    object_uniform_caches_.erase(it);
+  } else {
+    if (object_uniform_caches_.size() == kMaxObjectUniformCacheCount) {
+      object_uniform_caches_.erase(object_uniform_caches_.begin());
+    }
+    cache = std::make_unique<ObjectUniformCache>(flags, scale);
+  }
+  object_uniform_caches_.push_back(std::move(cache));
+  return object_uniform_caches_.back().get();
+}
+
+const ModelRenderer::PerModelDescriptorSet&
+ModelRenderer::ObtainPerModelDescriptorSet(
+    const ModelData::PerModel& per_model,
+    const TexturePtr& illumination_texture) {
+  for (auto& set : per_model_descriptor_sets_) {
+    if (set.illumination_texture == illumination_texture &&
+        set.per_model.frag_coord_to_uv_multiplier ==
+            per_model.frag_coord_to_uv_multiplier &&
+        set.per_model.time == per_model.time) {
+      set.is_used = true;
+      return set;
+    }
+  }
+
+  PerModelDescriptorSet set;
+  set.per_model = per_model;
+  set.illumination_texture = illumination_texture;
+  set.is_used = true;
+
+  // Obtain a uniform buffer and write the PerModel data to it.  The buffer is
+  // made visible to shaders by the barrier that display lists issue for their
+  // uniform buffers.
+  set.uniform_buffer = model_data_->uniform_buffer_pool()->Allocate();
+  *reinterpret_cast<ModelData::PerModel*>(set.uniform_buffer->ptr()) =
+      per_model;
+
+  set.allocation = model_data_->per_model_descriptor_set_pool()->Allocate(
+      1, nullptr);
+  vk::DescriptorSet descriptor_set = set.allocation->get(0);
+
+  // Update each descriptor in the PerModel descriptor set.
+  vk::WriteDescriptorSet writes[ModelData::PerModel::kDescriptorCount];
+
+  auto& buffer_write = writes[0];
+  buffer_write.dstSet = descriptor_set;
+  buffer_write.dstBinding = ModelData::PerModel::kDescriptorSetUniformBinding;
+  buffer_write.dstArrayElement = 0;
+  buffer_write.descriptorCount = 1;
+  buffer_write.descriptorType = vk::DescriptorType::eUniformBuffer;
+  vk::DescriptorBufferInfo buffer_info;
+  buffer_info.buffer = set.uniform_buffer->get();
+  buffer_info.range = sizeof(ModelData::PerModel);
+  buffer_info.offset = 0;
+  buffer_write.pBufferInfo = &buffer_info;
+
+  auto& image_write = writes[1];
+  image_write.dstSet = descriptor_set;
+  image_write.dstBinding = ModelData::PerModel::kDescriptorSetSamplerBinding;
+  image_write.dstArrayElement = 0;
+  image_write.descriptorCount = 1;
+  image_write.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  vk::DescriptorImageInfo image_info;
+  image_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  image_info.imageView = illumination_texture->image_view();
+  image_info.sampler = illumination_texture->sampler();
+  image_write.pImageInfo = &image_info;
+
+  device_.updateDescriptorSets(2, writes, 0, nullptr);
+
+  if (per_model_descriptor_sets_.size() == kMaxPerModelDescriptorSetCount) {
+    // Display lists retain the sets that they use, so this is safe.
+    per_model_descriptor_sets_.erase(per_model_descriptor_sets_.begin());
+  }
+  per_model_descriptor_sets_.push_back(std::move(set));
+  return per_model_descriptor_sets_.back();
+}
+
+void ModelRenderer::EndFrame() {
+  per_model_descriptor_sets_.erase(
+      std::remove_if(per_model_descriptor_sets_.begin(),
+                     per_model_descriptor_sets_.end(),
+                     [](const PerModelDescriptorSet& set) {
+                       return !set.is_used;
+                     }),
+      per_model_descriptor_sets_.end());
+  for (auto& set : per_model_descriptor_sets_) {
+    set.is_used = false;
+  }
+
+  if (secondary_command_buffer_cache_) {
+    secondary_command_buffer_cache_->EvictUnusedCommandBuffers();
+  }
+}
+
 // TODO: stage shouldn't be necessary.
 void ModelRenderer::Draw(const Stage& stage,
                          const ModelDisplayListPtr& display_list,
                          CommandBuffer* command_buffer) {
   TRACE_DURATION("gfx", "escher::ModelRenderer::Draw");
 
-  vk::CommandBuffer vk_command_buffer = command_buffer->get();
-
   for (const TexturePtr& texture : display_list->textures()) {
     // TODO: it would be nice if Resource::TakeWaitSemaphore() were virtual
     // so that we could say texture->TakeWaitSemaphore(), instead of needing
@@ -153,82 +351,163 @@ void ModelRenderer::Draw(const Stage& stage,
         vk::PipelineStageFlagBits::eFragmentShader);
   }
 
-  vk::Viewport viewport;
-  viewport.width = stage.viewing_volume().width();
-  viewport.height = stage.viewing_volume().height();
-  // We normalize all depths to the range [0,1].  If we didn't, then Vulkan
-  // would clip them anyway.  NOTE: this is only true because we are using an
-  // orthonormal projection; otherwise the depth computed by the vertex shader
-  // could be outside [0,1] as long as the perspective division brought it back.
-  // In this case, it might make sense to use different values for viewport
-  // min/max depth.
-  viewport.minDepth = 0.f;
-  viewport.maxDepth = 1.f;
-  vk_command_buffer.setViewport(0, 1, &viewport);
+  vk::Viewport viewport = GetViewportForStage(stage);
+  command_buffer->get().setViewport(0, 1, &viewport);
 
   // Retain all display-list resources until the frame is finished rendering.
   command_buffer->KeepAlive(display_list);
 
-  vk::Pipeline current_pipeline;
-  vk::PipelineLayout current_pipeline_layout;
-  uint32_t current_stencil_reference = 0;
-  vk_command_buffer.setStencilReference(vk::StencilFaceFlagBits::eFront, 0);
+  command_buffer->SetStencilReference(0);
   for (const ModelDisplayList::Item& item : display_list->items()) {
-    // Bind new pipeline and PerModel descriptor set, if necessary.
-    if (current_pipeline != item.pipeline->pipeline()) {
-      current_pipeline = item.pipeline->pipeline();
-      vk_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
-                                     current_pipeline);
-
-      // According to my reading of the Vulkan spec, the "valid usage"
-      // requirements for vkCmdSetStencilReference() imply that it must be
-      // called after binding a new pipeline:
-      //   "The currently bound graphics pipeline MUST have been created with
-      //    the VK_DYNAMIC_STATE_STENCIL_REFERENCE dynamic state enabled".
-      // ... this implies that it will not simply be ignored if the pipeline
-      // doesn't have dynamic state (i.e. it can have bad effects, which we
-      // verified by experiment), which implies that the reference state is
-      // stored into memory associated with the pipeline, which implies that
-      // we must set it when binding a new pipeline.
-      if (item.pipeline->HasDynamicStencilState()) {
-        current_stencil_reference = item.stencil_reference;
-        vk_command_buffer.setStencilReference(vk::StencilFaceFlagBits::eFront,
-                                              current_stencil_reference);
-      }
+    DrawItem(item, display_list->stage_data(), command_buffer);
+  }
+}
+
+void ModelRenderer::DrawWithSecondaryCommandBuffers(
+    const Stage& stage,
+    const ModelDisplayListPtr& display_list,
+    vk::RenderPass render_pass,
+    CommandBuffer* command_buffer) {
+  TRACE_DURATION("gfx", "escher::ModelRenderer::DrawWithSecondaryCommandBuffers",
+                 "item_count", display_list->items().size());
+
+  if (!secondary_command_buffer_cache_) {
+    secondary_command_buffer_cache_ =
+        std::make_unique<SecondaryCommandBufferCache>(escher_->escher());
+  }
+
+  // See Draw().
+  for (const TexturePtr& texture : display_list->textures()) {
+    command_buffer->AddWaitSemaphore(
+        texture->image()->TakeWaitSemaphore(),
+        vk::PipelineStageFlagBits::eFragmentShader);
+  }
+  command_buffer->KeepAlive(display_list);
 
-      // Whenever the pipeline changes, it is possible that the pipeline layout
-      // must also change.
-      if (current_pipeline_layout != item.pipeline->pipeline_layout()) {
-        current_pipeline_layout = item.pipeline->pipeline_layout();
-        vk::DescriptorSet ds = display_list->stage_data();
-        vk_command_buffer.bindDescriptorSets(
-            vk::PipelineBindPoint::eGraphics, current_pipeline_layout,
-            ModelData::PerModel::kDescriptorSetIndex, 1, &ds, 0, nullptr);
+  const vk::Viewport viewport = GetViewportForStage(stage);
+  const vk::DescriptorSet stage_data = display_list->stage_data();
+  const std::vector<ModelDisplayList::Item>& items = display_list->items();
+
+  size_t run_start = 0;
+  while (run_start < items.size()) {
+    // The key begins with the state that is shared by every item of the run.
+    SecondaryCommandBufferCache::Key key;
+    AppendToKey(&key, render_pass);
+    AppendToKey(&key, viewport);
+    AppendToKey(&key, stage_data);
+
+    size_t run_end = run_start;
+    while (run_end < items.size()) {
+      const ModelDisplayList::Item& item = items[run_end++];
+      ItemKey item_key;
+      std::memset(&item_key, 0, sizeof(item_key));
+      item_key.pipeline = item.pipeline;
+      item_key.mesh = item.mesh.get();
+      item_key.descriptor_set = item.descriptor_set;
+      item_key.instance_buffer = item.instance_buffer;
+      item_key.instance_buffer_offset = item.instance_buffer_offset;
+      item_key.indirect_buffer = item.indirect_buffer;
+      item_key.indirect_buffer_offset = item.indirect_buffer_offset;
+      item_key.push_constants = item.push_constants;
+      item_key.scissor = item.scissor;
+      item_key.stencil_reference = item.stencil_reference;
+      item_key.uniform_offset = item.uniform_offset;
+      item_key.instance_count = item.instance_count;
+      item_key.indirect_draw_count = item.indirect_draw_count;
+      AppendToKey(&key, item_key);
+
+      size_t hash = HashBytes(reinterpret_cast<const uint8_t*>(&item_key),
+                              sizeof(item_key));
+      if (hash % kMeanItemsPerRun == 0 ||
+          run_end - run_start == kMaxItemsPerRun) {
+        break;
       }
     }
 
-    if (item.pipeline->HasDynamicStencilState() &&
-        current_stencil_reference != item.stencil_reference) {
-      current_stencil_reference = item.stencil_reference;
-      vk_command_buffer.setStencilReference(vk::StencilFaceFlagBits::eFront,
-                                            current_stencil_reference);
-    }
+    secondary_command_buffer_cache_->Execute(
+        command_buffer, render_pass, std::move(key), display_list,
+        [&](CommandBuffer* secondary) {
+          // Secondary buffers inherit no dynamic state.
+          secondary->get().setViewport(0, 1, &viewport);
+          for (size_t i = run_start; i < run_end; ++i) {
+            DrawItem(items[i], stage_data, secondary);
+          }
+        });
+    run_start = run_end;
+  }
+}
 
-    vk::DescriptorSet ds = item.descriptor_set;
-    vk_command_buffer.bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics, current_pipeline_layout,
-        ModelData::PerObject::kDescriptorSetIndex, 1, &ds, 0, nullptr);
+void ModelRenderer::DrawItem(const ModelDisplayList::Item& item,
+                             vk::DescriptorSet stage_data,
+                             CommandBuffer* command_buffer) {
+  command_buffer->BindGraphicsPipeline(item.pipeline->pipeline());
+  const vk::PipelineLayout current_pipeline_layout =
+      item.pipeline->pipeline_layout();
+
+  // According to my reading of the Vulkan spec, the "valid usage"
+  // requirements for vkCmdSetStencilReference() imply that it must be
+  // called after binding a new pipeline:
+  //   "The currently bound graphics pipeline MUST have been created with
+  //    the VK_DYNAMIC_STATE_STENCIL_REFERENCE dynamic state enabled".
+  // ... this implies that it will not simply be ignored if the pipeline
+  // doesn't have dynamic state (i.e. it can have bad effects, which we
+  // verified by experiment), which implies that the reference state is
+  // stored into memory associated with the pipeline, which implies that
+  // we must set it when binding a new pipeline.  CommandBuffer takes care of
+  // this by forgetting the stencil reference whenever the pipeline changes.
+  if (item.pipeline->HasDynamicStencilState()) {
+    command_buffer->SetStencilReference(item.stencil_reference);
+  }
+  // All model pipelines have a dynamic scissor.
+  command_buffer->SetScissor(item.scissor);
+
+  // Whenever the pipeline changes, it is possible that the pipeline layout
+  // must also change, in which case the PerModel descriptor set is rebound.
+  command_buffer->BindGraphicsDescriptorSet(
+      current_pipeline_layout, ModelData::PerModel::kDescriptorSetIndex,
+      stage_data);
+
+  if (item.pipeline->UsesPushConstants()) {
+    // Untextured objects don't need a PerObject descriptor set.  Instanced
+    // pipelines obtain per-object data from vertex attributes instead.
+    if (!item.pipeline->UsesInstancing()) {
+      command_buffer->get().pushConstants(
+          current_pipeline_layout,
+          vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+          0, sizeof(ModelData::PerObjectPushConstants), &item.push_constants);
+    }
+  } else {
+    const uint32_t dynamic_offset_count =
+        item.pipeline->HasDynamicUniformOffset()
+            ? ModelData::PerObject::kDynamicOffsetCount
+            : 0;
+    command_buffer->BindGraphicsDescriptorSet(
+        current_pipeline_layout, ModelData::PerObject::kDescriptorSetIndex,
+        item.descriptor_set, dynamic_offset_count, &item.uniform_offset);
+  }
 
+  if (item.indirect_draw_count > 0) {
+    command_buffer->DrawMeshesIndirect(
+        item.mesh, ModelData::PerInstance::kBinding, item.instance_buffer,
+        item.instance_buffer_offset, item.indirect_buffer,
+        item.indirect_buffer_offset, item.indirect_draw_count);
+  } else if (item.pipeline->UsesInstancing()) {
+    command_buffer->DrawMeshInstances(
+        item.mesh, ModelData::PerInstance::kBinding, item.instance_buffer,
+        item.instance_buffer_offset, item.instance_count);
+  } else {
     command_buffer->DrawMesh(item.mesh);
   }
 }
 
-const MeshPtr& ModelRenderer::GetMeshForShape(const Shape& shape) const {
+const MeshPtr& ModelRenderer::GetMeshForShape(const Shape& shape,
+                                              bool shared_buffers) const {
+  FTL_DCHECK(!shared_buffers || shared_rectangle_);
   switch (shape.type()) {
     case Shape::Type::kRect:
-      return rectangle_;
+      return shared_buffers ? shared_rectangle_ : rectangle_;
     case Shape::Type::kCircle:
-      return circle_;
+      return shared_buffers ? shared_circle_ : circle_;
     case Shape::Type::kMesh:
       return shape.mesh();
     case Shape::Type::kNone: {
@@ -239,6 +518,13 @@ const MeshPtr& ModelRenderer::GetMeshForShape(const Shape& shape) const {
   }
 }
 
+FrustumCuller* ModelRenderer::GetFrustumCuller() {
+  if (!frustum_culler_) {
+    frustum_culler_ = std::make_unique<FrustumCuller>(escher_->escher());
+  }
+  return frustum_culler_.get();
+}
+
 MeshPtr ModelRenderer::CreateRectangle() {
   return NewSimpleRectangleMesh(mesh_manager_);
 }
@@ -262,12 +548,15 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
                                        vk::Format lighting_pass_color_format,
                                        uint32_t lighting_pass_sample_count,
                                        vk::Format depth_format) {
-  constexpr uint32_t kAttachmentCount = 2;
+  // The resolve attachment is only used by a multisampled lighting pass.
+  constexpr uint32_t kAttachmentCount = 3;
   const uint32_t kColorAttachment = 0;
   const uint32_t kDepthAttachment = 1;
+  const uint32_t kResolveAttachment = 2;
   vk::AttachmentDescription attachments[kAttachmentCount];
   auto& color_attachment = attachments[kColorAttachment];
   auto& depth_attachment = attachments[kDepthAttachment];
+  auto& resolve_attachment = attachments[kResolveAttachment];
 
   // Load/store ops and image layouts differ between passes; see below.
   depth_attachment.format = depth_format;
@@ -282,6 +571,10 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   depth_reference.attachment = kDepthAttachment;
   depth_reference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
+  vk::AttachmentReference resolve_reference;
+  resolve_reference.attachment = kResolveAttachment;
+  resolve_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
   // Every vk::RenderPass needs at least one subpass.
   vk::SubpassDescription subpass;
   subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
@@ -324,7 +617,7 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   // We're almost ready to create the render-passes... we just need to fill in
   // some final values that differ between the passes.
   vk::RenderPassCreateInfo info;
-  info.attachmentCount = kAttachmentCount;
+  info.attachmentCount = kAttachmentCount - 1;
   info.pAttachments = attachments;
   info.subpassCount = 1;
   info.pSubpasses = &subpass;
@@ -346,13 +639,18 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
       vk::ImageLayout::eDepthStencilAttachmentOptimal;
   depth_prepass_ = ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
 
-  // Create the illumination RenderPass.
+  // Create the illumination RenderPass.  If it is multisampled, the color
+  // attachment is resolved into the resolve attachment at the end of the
+  // subpass, so neither of the multisampled attachments need be stored; on a
+  // tile-based GPU, they then need never leave tile memory.
+  const bool is_multisampled = lighting_pass_sample_count > 1;
   color_attachment.format = lighting_pass_color_format;
   color_attachment.samples =
       SampleCountFlagBitsFromInt(lighting_pass_sample_count);
   color_attachment.loadOp = vk::AttachmentLoadOp::eClear;
-  // TODO: necessary to store if we resolve as part of the render-pass?
-  color_attachment.storeOp = vk::AttachmentStoreOp::eStore;
+  color_attachment.storeOp = is_multisampled
+                                 ? vk::AttachmentStoreOp::eDontCare
+                                 : vk::AttachmentStoreOp::eStore;
   color_attachment.initialLayout = vk::ImageLayout::eUndefined;
   color_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
   depth_attachment.samples =
@@ -362,7 +660,32 @@ void ModelRenderer::CreateRenderPasses(vk::Format pre_pass_color_format,
   depth_attachment.initialLayout = vk::ImageLayout::eUndefined;
   depth_attachment.finalLayout =
       vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  if (is_multisampled) {
+    resolve_attachment.format = lighting_pass_color_format;
+    resolve_attachment.samples = vk::SampleCountFlagBits::e1;
+    resolve_attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+    resolve_attachment.storeOp = vk::AttachmentStoreOp::eStore;
+    resolve_attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+    resolve_attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+    resolve_attachment.initialLayout = vk::ImageLayout::eUndefined;
+    resolve_attachment.finalLayout = vk::ImageLayout::eColorAttachmentOptimal;
+    subpass.pResolveAttachments = &resolve_reference;
+    info.attachmentCount = kAttachmentCount;
+  }
   lighting_pass_ = ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
+
+  // Create the partial illumination RenderPass, which preserves the output
+  // (i.e. the color or resolve attachment) outside of the render area.  Only
+  // the initial layout differs, so it is compatible with the illumination
+  // RenderPass.
+  if (is_multisampled) {
+    resolve_attachment.initialLayout =
+        vk::ImageLayout::eColorAttachmentOptimal;
+  } else {
+    color_attachment.initialLayout = vk::ImageLayout::eColorAttachmentOptimal;
+  }
+  partial_lighting_pass_ =
+      ESCHER_CHECKED_VK_RESULT(device_.createRenderPass(info));
 }
 
 }  // namespace impl
@@ -6,6 +6,7 @@
 
 #include "escher/forward_declarations.h"
 #include "escher/impl/model_data.h"
+#include "escher/impl/model_display_list.h"
 #include "escher/impl/model_display_list_flags.h"
 #include "escher/renderer/texture.h"
 #include "escher/shape/mesh.h"
@@ -13,6 +14,7 @@
 namespace escher {
 namespace impl {
 
+class FrustumCuller;
 class ModelData;
 
 // ModelRenderer is a subcomponent used by PaperRenderer.
@@ -29,11 +31,35 @@ class ModelRenderer {
             const ModelDisplayListPtr& display_list,
             CommandBuffer* command_buffer);
 
+  // Like Draw(), except that the items are drawn by secondary command buffers,
+  // which are cached so that runs of items that are unchanged since a previous
+  // frame need not be recorded again; see SecondaryCommandBufferCache.  The
+  // first subpass of |render_pass| must have been begun on |command_buffer|
+  // with vk::SubpassContents::eSecondaryCommandBuffers.
+  void DrawWithSecondaryCommandBuffers(const Stage& stage,
+                                       const ModelDisplayListPtr& display_list,
+                                       vk::RenderPass render_pass,
+                                       CommandBuffer* command_buffer);
+
+  // Discard cached descriptor sets and command buffers that were not used
+  // since the previous call.  Called once per frame.
+  void EndFrame();
+
   // TODO: remove
   bool hack_use_depth_prepass = false;
 
   vk::RenderPass depth_prepass() const { return depth_prepass_; }
+  // If the lighting pass is multisampled, its framebuffer has a third,
+  // single-sampled attachment into which the color attachment is resolved at
+  // the end of the pass; the multisampled attachments are not stored.
   vk::RenderPass lighting_pass() const { return lighting_pass_; }
+  // Compatible with lighting_pass(), except that the existing contents of the
+  // output (the resolve attachment if multisampled, otherwise the color
+  // attachment) are preserved outside of the render area; the output must
+  // already be in eColorAttachmentOptimal layout.
+  vk::RenderPass partial_lighting_pass() const {
+    return partial_lighting_pass_;
+  }
 
   // Returns a single-pixel white texture.  Do with it what you will.
   const TexturePtr& white_texture() const { return white_texture_; }
@@ -44,32 +70,89 @@ class ModelRenderer {
 
   ResourceRecycler* resource_recycler() const { return resource_recycler_; }
 
-  ModelDisplayListPtr CreateDisplayList(const Stage& stage,
-                                        const Model& model,
-                                        const Camera& camera,
-                                        ModelDisplayListFlags flags,
-                                        float scale,
-                                        uint32_t sample_count,
-                                        const TexturePtr& illumination_texture,
-                                        CommandBuffer* command_buffer);
-
-  const MeshPtr& GetMeshForShape(const Shape& shape) const;
+  // If |previous_frame_depth| is not null, objects that it shows to be hidden
+  // are culled; see ModelDisplayListBuilder::SetPreviousFrameDepth().  If
+  // |scissor| is not null, drawing is restricted to it.  If the model belongs
+  // to a RetainedModel, the uniforms of objects that have not changed since
+  // the previous display list of the same kind are reused.
+  ModelDisplayListPtr CreateDisplayList(
+      const Stage& stage,
+      const Model& model,
+      const Camera& camera,
+      ModelDisplayListFlags flags,
+      float scale,
+      uint32_t sample_count,
+      const TexturePtr& illumination_texture,
+      const OcclusionCuller* previous_frame_depth,
+      const vk::Rect2D* scissor,
+      CommandBuffer* command_buffer);
+
+  // Return the mesh that |shape| is drawn with.  If |shared_buffers|, the
+  // built-in rectangle and circle meshes share vertex and index buffers, so
+  // that they can be drawn by the same multi-draw-indirect command; these are
+  // only available once a display list that uses multi-draw-indirect has been
+  // created.
+  const MeshPtr& GetMeshForShape(const Shape& shape,
+                                 bool shared_buffers = false) const;
+
+  // A PerModel descriptor set, along with the resources that it refers to.
+  // Display lists must retain these while they use the descriptor set.
+  struct PerModelDescriptorSet {
+    ModelData::PerModel per_model;
+    TexturePtr illumination_texture;
+    BufferPtr uniform_buffer;
+    DescriptorSetAllocationPtr allocation;
+    bool is_used = false;
+  };
+
+  // Return a descriptor set that binds |per_model| and |illumination_texture|.
+  // Sets are cached and never modified, so that consecutive display lists can
+  // share the same set, and therefore the same draw commands; see
+  // DrawWithSecondaryCommandBuffers().  The result is valid until the next
+  // call.
+  const PerModelDescriptorSet& ObtainPerModelDescriptorSet(
+      const ModelData::PerModel& per_model,
+      const TexturePtr& illumination_texture);
+
+  // Return the FrustumCuller that is used by display lists that cull objects on
+  // the GPU.  It is lazily created, so that its compute shader is only compiled
+  // if GPU culling is actually used.
+  FrustumCuller* GetFrustumCuller();
 
  private:
+  // Record the commands that draw |item| into |command_buffer|.  Redundant
+  // state changes are elided by |command_buffer|.
+  void DrawItem(const ModelDisplayList::Item& item,
+                vk::DescriptorSet stage_data,
+                CommandBuffer* command_buffer);
+
+  // Return the cache of per-object uniforms that is used by display lists with
+  // the specified flags and scale, creating it if necessary.
+  ObjectUniformCache* GetObjectUniformCache(ModelDisplayListFlags flags,
+                                            float scale);
+
   void CreateRenderPasses(vk::Format pre_pass_color_format,
                           vk::Format lighting_pass_color_format,
                           uint32_t lighting_pass_sample_count,
                           vk::Format depth_format);
 
+  EscherImpl* const escher_;
   vk::Device device_;
   vk::RenderPass depth_prepass_;
   vk::RenderPass lighting_pass_;
+  vk::RenderPass partial_lighting_pass_;
 
   ResourceRecycler* const resource_recycler_;
   MeshManager* const mesh_manager_;
   ModelData* const model_data_;
 
   std::unique_ptr<impl::ModelPipelineCache> pipeline_cache_;
+  std::unique_ptr<FrustumCuller> frustum_culler_;
+  // Ordered from least to most recently used.
+  std::vector<std::unique_ptr<ObjectUniformCache>> object_uniform_caches_;
+  std::vector<PerModelDescriptorSet> per_model_descriptor_sets_;
+  // Lazily created by DrawWithSecondaryCommandBuffers().
+  std::unique_ptr<SecondaryCommandBufferCache> secondary_command_buffer_cache_;
 
   MeshPtr CreateRectangle();
   MeshPtr CreateCircle();
@@ -78,6 +161,10 @@ class ModelRenderer {
 
   MeshPtr rectangle_;
   MeshPtr circle_;
+  // Copies of |rectangle_| and |circle_| that share buffers; created by the
+  // first call to CreateDisplayList() that uses multi-draw-indirect.
+  MeshPtr shared_rectangle_;
+  MeshPtr shared_circle_;
 
   TexturePtr white_texture_;
 };
@@ -0,0 +1,49 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/object_key.h"
+
+#include <algorithm>
+
+#include "escher/scene/object.h"
+
+namespace escher {
+namespace impl {
+
+void AppendObjectToKey(ByteKey* key, const Object& object) {
+  AppendToKey(key, object.transform());
+  AppendToKey(key, object.shape().type());
+  AppendToKey(key, static_cast<uint32_t>(object.shape().modifiers()));
+  if (object.shape().type() == Shape::Type::kMesh) {
+    AppendToKey(key, object.shape().mesh().get());
+  }
+  const Material* material = object.material().get();
+  AppendToKey(key, material);
+  if (material) {
+    AppendToKey(key, material->color());
+    AppendToKey(key, material->texture().get());
+  }
+  AppendToKey(key, object.clippers().size());
+  for (const Object& clipper : object.clippers()) {
+    AppendObjectToKey(key, clipper);
+  }
+  AppendToKey(key, object.clippees().size());
+  for (const Object& clippee : object.clippees()) {
+    AppendObjectToKey(key, clippee);
+  }
+}
+
+bool HasShapeModifiers(const Object& object) {
+  return object.shape().modifiers() != ShapeModifiers() ||
+         HasShapeModifiers(object.clippers()) ||
+         HasShapeModifiers(object.clippees());
+}
+
+bool HasShapeModifiers(const std::vector<Object>& objects) {
+  return std::any_of(objects.begin(), objects.end(),
+                     [](const Object& o) { return HasShapeModifiers(o); });
+}
+
+}  // namespace impl
+}  // namespace escher
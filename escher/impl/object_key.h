@@ -0,0 +1,25 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "escher/forward_declarations.h"
+#include "escher/util/hash.h"
+
+namespace escher {
+namespace impl {
+
+// Append everything about |object| that affects the pixels that it renders.
+// Meshes, materials and textures are identified by address, as well as by
+// their (mutable) properties; this is safe because |object| retains them.
+// Model::time() is not included; see HasShapeModifiers().
+void AppendObjectToKey(ByteKey* key, const Object& object);
+
+// Return true if |object|, or any of its clippers or clippees, has shape
+// modifiers (e.g. kWobble), which animate the shape over Model::time().
+bool HasShapeModifiers(const Object& object);
+bool HasShapeModifiers(const std::vector<Object>& objects);
+
+}  // namespace impl
+}  // namespace escher
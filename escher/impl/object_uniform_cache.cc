@@ -0,0 +1,72 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/object_uniform_cache.h"
+
+#include "escher/vk/buffer.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+ModelDisplayListFlags GetRelevantFlags(ModelDisplayListFlags flags) {
+  // Depth prepasses use the white texture instead of material textures, and
+  // shared descriptor sets use a different layout.
+  return flags & (ModelDisplayListFlag::kUseDepthPrepass |
+                  ModelDisplayListFlag::kShareDescriptorSetsBetweenObjects);
+}
+
+}  // namespace
+
+ObjectUniformCache::ObjectUniformCache(ModelDisplayListFlags flags,
+                                       float scale)
+    : flags_(GetRelevantFlags(flags)),
+      scale_(scale),
+      camera_transform_(0.f) {}
+
+ObjectUniformCache::~ObjectUniformCache() = default;
+
+bool ObjectUniformCache::IsCompatible(ModelDisplayListFlags flags,
+                                      float scale) const {
+  return GetRelevantFlags(flags) == flags_ && scale == scale_;
+}
+
+void ObjectUniformCache::BeginDisplayList(const mat4& camera_transform) {
+  // Each object's transform is premultiplied by the camera transform.
+  if (camera_transform != camera_transform_) {
+    entries_.clear();
+    camera_transform_ = camera_transform;
+  }
+  ++display_list_count_;
+  used_entry_count_ = 0;
+}
+
+void ObjectUniformCache::EndDisplayList(const RetainedModel& model) {
+  // Every object of the model obtains its entry, so there are stale entries
+  // only if there are more entries than were used.
+  if (entries_.size() > used_entry_count_) {
+    for (auto it = entries_.begin(); it != entries_.end();) {
+      if (it->second.last_used != display_list_count_) {
+        it = entries_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  revision_ = model.revision();
+}
+
+ObjectUniformCache::Entry* ObjectUniformCache::GetEntry(
+    RetainedModel::ObjectHandle handle) {
+  Entry& entry = entries_[handle];
+  if (entry.last_used != display_list_count_) {
+    entry.last_used = display_list_count_;
+    ++used_entry_count_;
+  }
+  return &entry;
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,82 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/geometry/types.h"
+#include "escher/impl/descriptor_set_pool.h"
+#include "escher/impl/model_display_list_flags.h"
+#include "escher/scene/retained_model.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Retains the PerObject uniforms and descriptor sets that were written by a
+// ModelDisplayListBuilder for the objects of a RetainedModel, so that
+// subsequent display lists only need to rewrite them for objects that have
+// changed.  The uniforms depend upon the camera transform, and the descriptor
+// sets upon the flags of the display list, so ModelRenderer keeps a separate
+// cache for each kind of display list that it builds.  Cached uniform buffers
+// are never written again, so they can safely be shared by display lists that
+// are still in use by the GPU.
+class ObjectUniformCache {
+ public:
+  struct Entry {
+    // Null if no uniforms have been written for the object.
+    BufferPtr uniform_buffer;
+    uint32_t uniform_offset = 0;
+    vk::DescriptorSet descriptor_set;
+    // Retains |descriptor_set|.
+    DescriptorSetAllocationPtr descriptor_set_allocation;
+    // Materials are shared between objects, and can be modified in place
+    // without marking any object as dirty, so these are compared as well.
+    vec4 color;
+    vk::ImageView image_view;
+    // Number of the last display list that contained the object.
+    uint64_t last_used = 0;
+  };
+
+  ObjectUniformCache(ModelDisplayListFlags flags, float scale);
+  ~ObjectUniformCache();
+
+  // Return true if the cache can be used by display lists that are built with
+  // the specified flags and scale.
+  bool IsCompatible(ModelDisplayListFlags flags, float scale) const;
+
+  // Called when a display list begins to use the cache.  Entries are discarded
+  // if |camera_transform| is not the one with which they were written.
+  void BeginDisplayList(const mat4& camera_transform);
+  // Called when the display list is built; discards the entries of objects
+  // that were removed from |model|.
+  void EndDisplayList(const RetainedModel& model);
+
+  // Return the entry for the object, creating an empty one if necessary.
+  Entry* GetEntry(RetainedModel::ObjectHandle handle);
+
+  // The model revision as of the previous display list; objects that have
+  // changed since must have their entries rewritten.
+  uint64_t revision() const { return revision_; }
+
+ private:
+  // Flags that affect the contents of the descriptor sets.
+  const ModelDisplayListFlags flags_;
+  const float scale_;
+
+  mat4 camera_transform_;
+  std::unordered_map<RetainedModel::ObjectHandle, Entry> entries_;
+  uint64_t revision_ = 0;
+  uint64_t display_list_count_ = 0;
+  // Number of entries that were obtained by the current display list.
+  size_t used_entry_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(ObjectUniformCache);
+};
+
+}  // namespace impl
+}  // namespace escher
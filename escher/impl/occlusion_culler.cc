@@ -0,0 +1,133 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/occlusion_culler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "escher/util/align.h"
+#include "lib/ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+constexpr float kFarDepth = 1.f;
+
+// Convert a normalized device coordinate to a (fractional) cell coordinate.
+float CellCoordinate(float ndc, uint32_t cell_count) {
+  return (ndc + 1.f) * 0.5f * cell_count;
+}
+
+// Clamp a cell coordinate to [0, cell_count].
+uint32_t ClampCell(float cell, uint32_t cell_count) {
+  if (cell <= 0.f) {
+    return 0;
+  } else if (cell >= cell_count) {
+    return cell_count;
+  }
+  return static_cast<uint32_t>(cell);
+}
+
+}  // namespace
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height)
+    : width_(width),
+      height_(height),
+      stride_(static_cast<uint32_t>(AlignedToNext(width, kLaneCount))),
+      depths_(stride_ * height_, kFarDepth) {
+  FTL_DCHECK(width_ > 0 && height_ > 0);
+}
+
+void OcclusionCuller::Clear() {
+  std::fill(depths_.begin(), depths_.end(), kFarDepth);
+}
+
+void OcclusionCuller::AddOccluder(const vec2& min,
+                                  const vec2& max,
+                                  float depth) {
+  // Only cells that are entirely covered by the occluder are written.
+  const uint32_t x0 = ClampCell(std::ceil(CellCoordinate(min.x, width_)),
+                                width_);
+  const uint32_t x1 = ClampCell(std::floor(CellCoordinate(max.x, width_)),
+                                width_);
+  const uint32_t y0 = ClampCell(std::ceil(CellCoordinate(min.y, height_)),
+                                height_);
+  const uint32_t y1 = ClampCell(std::floor(CellCoordinate(max.y, height_)),
+                                height_);
+
+  for (uint32_t y = y0; y < y1; ++y) {
+    float* row = &depths_[y * stride_];
+    for (uint32_t x = x0; x < x1; ++x) {
+      row[x] = std::min(row[x], depth);
+    }
+  }
+}
+
+bool OcclusionCuller::IsOccluded(const vec2& min,
+                                 const vec2& max,
+                                 float min_depth) const {
+  // Every cell that is touched by the occludee is tested.
+  const uint32_t x0 = ClampCell(std::floor(CellCoordinate(min.x, width_)),
+                                width_);
+  const uint32_t x1 = ClampCell(std::ceil(CellCoordinate(max.x, width_)),
+                                width_);
+  const uint32_t y0 = ClampCell(std::floor(CellCoordinate(min.y, height_)),
+                                height_);
+  const uint32_t y1 = ClampCell(std::ceil(CellCoordinate(max.y, height_)),
+                                height_);
+  if (x0 >= x1 || y0 >= y1) {
+    return false;
+  }
+
+  for (uint32_t y = y0; y < y1; ++y) {
+    const float* row = &depths_[y * stride_];
+    float farthest = 0.f;
+    for (uint32_t x = x0; x < x1; ++x) {
+      farthest = std::max(farthest, row[x]);
+    }
+    if (farthest >= min_depth) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool OcclusionCuller::IsOccluded(const mat4& transform,
+                                 const BoundingBox& box) const {
+  if (box.is_empty()) {
+    return false;
+  }
+
+  const vec3& box_min = box.min();
+  const vec3& box_max = box.max();
+  vec3 ndc_min(std::numeric_limits<float>::max());
+  vec3 ndc_max(std::numeric_limits<float>::lowest());
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner((i & 1) ? box_max.x : box_min.x,
+                (i & 2) ? box_max.y : box_min.y,
+                (i & 4) ? box_max.z : box_min.z);
+    vec4 pos = transform * vec4(corner, 1);
+    if (pos.w <= 0.f) {
+      return false;
+    }
+    vec3 ndc = vec3(pos) / pos.w;
+    ndc_min = glm::min(ndc_min, ndc);
+    ndc_max = glm::max(ndc_max, ndc);
+  }
+  return IsOccluded(vec2(ndc_min), vec2(ndc_max), ndc_min.z);
+}
+
+void OcclusionCuller::LoadDepths(const float* depths) {
+  for (uint32_t y = 0; y < height_; ++y) {
+    std::copy(depths + y * width_, depths + (y + 1) * width_,
+              &depths_[y * stride_]);
+  }
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,78 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "escher/geometry/bounding_box.h"
+#include "escher/geometry/types.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// A low-resolution software depth buffer, used to cull objects that are hidden
+// behind large opaque occluders.  Positions are given in normalized device
+// coordinates: x and y range from -1 to 1, and depth ranges from 0 (nearest)
+// to 1 (farthest), matching the eLess depth test used by ModelRenderer.
+//
+// Occluders are rasterized conservatively: a cell only records the depth of an
+// occluder that covers it entirely.  Occludees are also tested conservatively,
+// against every cell that they overlap.  Everything is computed on the CPU, and
+// results are deterministic.
+//
+// Rows are padded to a multiple of kLaneCount cells, and each row is processed
+// by a simple loop over contiguous floats that the compiler can vectorize.
+//
+// Not thread-safe.
+class OcclusionCuller {
+ public:
+  static constexpr uint32_t kLaneCount = 4;
+
+  OcclusionCuller(uint32_t width, uint32_t height);
+
+  // Reset every cell to the far plane, i.e. remove all occluders.
+  void Clear();
+
+  // Rasterize an axis-aligned occluder covering the rectangle from |min| to
+  // |max|, none of which is farther than |depth|.
+  void AddOccluder(const vec2& min, const vec2& max, float depth);
+
+  // Return true if every cell that overlaps the rectangle from |min| to |max|
+  // contains an occluder that is strictly nearer than |min_depth|.  Parts of
+  // the rectangle that are outside of the buffer are ignored; returns false if
+  // the rectangle is entirely outside.
+  bool IsOccluded(const vec2& min, const vec2& max, float min_depth) const;
+
+  // Return true if |box| is occluded after being transformed into clip space
+  // by |transform|.  Returns false if the box is empty, or if any part of it
+  // is behind the eye.
+  bool IsOccluded(const mat4& transform, const BoundingBox& box) const;
+
+  // Replace the contents of every cell with |depths|, which holds height()
+  // tightly-packed rows of width() values each.  For example, this can be the
+  // max-depth reduction of a depth buffer; see DepthPyramid.
+  void LoadDepths(const float* depths);
+
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+
+  // Return the depth stored in the specified cell.
+  float depth_at(uint32_t x, uint32_t y) const {
+    return depths_[y * stride_ + x];
+  }
+
+ private:
+  const uint32_t width_;
+  const uint32_t height_;
+  // Number of floats per row, including padding.
+  const uint32_t stride_;
+  std::vector<float> depths_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(OcclusionCuller);
+};
+
+}  // namespace impl
+}  // namespace escher
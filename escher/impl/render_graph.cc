@@ -0,0 +1,376 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/render_graph.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "escher/impl/command_buffer.h"
+#include "escher/renderer/image_factory.h"
+#include "escher/util/trace_macros.h"
+
+namespace escher {
+namespace impl {
+
+namespace {
+
+const vk::AccessFlags kWriteAccess =
+    vk::AccessFlagBits::eShaderWrite |
+    vk::AccessFlagBits::eColorAttachmentWrite |
+    vk::AccessFlagBits::eDepthStencilAttachmentWrite |
+    vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eHostWrite |
+    vk::AccessFlagBits::eMemoryWrite;
+
+}  // namespace
+
+bool ImageAccess::writes() const {
+  return static_cast<bool>(access & kWriteAccess);
+}
+
+ImageAccess ImageAccess::ColorAttachment(bool discard,
+                                         vk::ImageLayout final_layout) {
+  ImageAccess result;
+  result.layout = vk::ImageLayout::eColorAttachmentOptimal;
+  result.final_layout = final_layout;
+  result.stages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+  result.access = vk::AccessFlagBits::eColorAttachmentRead |
+                  vk::AccessFlagBits::eColorAttachmentWrite;
+  result.discard = discard;
+  return result;
+}
+
+ImageAccess ImageAccess::DepthAttachment(bool discard) {
+  ImageAccess result;
+  result.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+  result.stages = vk::PipelineStageFlagBits::eEarlyFragmentTests |
+                  vk::PipelineStageFlagBits::eLateFragmentTests;
+  result.access = vk::AccessFlagBits::eDepthStencilAttachmentRead |
+                  vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+  result.discard = discard;
+  return result;
+}
+
+ImageAccess ImageAccess::Sampled(vk::PipelineStageFlags stages) {
+  ImageAccess result;
+  result.layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  result.stages = stages;
+  result.access = vk::AccessFlagBits::eShaderRead;
+  return result;
+}
+
+ImageAccess ImageAccess::Storage(vk::AccessFlags access,
+                                 vk::PipelineStageFlags stages) {
+  ImageAccess result;
+  result.layout = vk::ImageLayout::eGeneral;
+  result.stages = stages;
+  result.access = access;
+  return result;
+}
+
+ImageAccess ImageAccess::Transfer(vk::AccessFlags access,
+                                  vk::ImageLayout layout) {
+  ImageAccess result;
+  result.layout = layout;
+  result.stages = vk::PipelineStageFlagBits::eTransfer;
+  result.access = access;
+  return result;
+}
+
+ImageAccess ImageAccess::Present() {
+  ImageAccess result;
+  result.layout = vk::ImageLayout::ePresentSrcKHR;
+  result.stages = vk::PipelineStageFlagBits::eBottomOfPipe;
+  return result;
+}
+
+ImageSyncState::ImageSyncState(vk::ImageLayout layout,
+                               vk::PipelineStageFlags stages)
+    : layout_(layout), write_stages_(stages) {}
+
+bool ImageSyncState::Access(const ImageAccess& access,
+                            vk::ImageMemoryBarrier* barrier,
+                            vk::PipelineStageFlags* src_stages,
+                            vk::PipelineStageFlags* dst_stages) {
+  const bool transition = access.layout != layout_;
+
+  // Writes and layout transitions must wait for every previous access.  Reads
+  // must only wait for the last write, and then only if it has not already
+  // been made visible to the reading stages.
+  bool needs_barrier = transition;
+  if (access.writes() || transition) {
+    needs_barrier |= static_cast<bool>(write_stages_ | read_stages_);
+  } else if (write_stages_ && (access.stages & ~read_stages_)) {
+    needs_barrier = true;
+  }
+
+  if (needs_barrier) {
+    // Chaining through the stages that have read the image since the last
+    // write ensures that the barrier is ordered after them as well.
+    const vk::PipelineStageFlags wait_stages = write_stages_ | read_stages_;
+    barrier->oldLayout =
+        access.discard ? vk::ImageLayout::eUndefined : layout_;
+    barrier->newLayout = access.layout;
+    barrier->srcAccessMask = write_access_;
+    barrier->dstAccessMask = access.access;
+    *src_stages |= wait_stages ? wait_stages
+                               : vk::PipelineStageFlags(
+                                     vk::PipelineStageFlagBits::eTopOfPipe);
+    *dst_stages |= access.stages;
+  }
+
+  const bool changes_layout =
+      transition || (access.final_layout != vk::ImageLayout::eUndefined &&
+                     access.final_layout != access.layout);
+  layout_ = access.final_layout != vk::ImageLayout::eUndefined
+                ? access.final_layout
+                : access.layout;
+  if (access.writes() || changes_layout) {
+    // Layout transitions count as writes, with no memory to make available.
+    write_stages_ = access.stages;
+    write_access_ = access.access & kWriteAccess;
+    read_stages_ = access.writes() ? vk::PipelineStageFlags() : access.stages;
+  } else {
+    read_stages_ |= access.stages;
+  }
+  return needs_barrier;
+}
+
+RenderGraph::RenderGraph(ImageFactory* image_factory)
+    : image_factory_(image_factory) {}
+
+RenderGraph::~RenderGraph() = default;
+
+RenderGraph::ImageId RenderGraph::CreateImage(const ImageInfo& info) {
+  FTL_DCHECK(!executed_);
+  Resource resource;
+  resource.is_transient = true;
+  resource.info = info;
+  resources_.push_back(std::move(resource));
+  return resources_.size() - 1;
+}
+
+RenderGraph::ImageId RenderGraph::ImportImage(const ImagePtr& image,
+                                              vk::ImageLayout layout,
+                                              vk::PipelineStageFlags stages) {
+  FTL_DCHECK(image);
+  auto it = imported_images_.find(image.get());
+  if (it != imported_images_.end()) {
+    return it->second;
+  }
+  Resource resource;
+  resource.image = image;
+  resource.state_index = states_.size();
+  states_.emplace_back(layout, stages);
+  resources_.push_back(std::move(resource));
+  imported_images_[image.get()] = resources_.size() - 1;
+  return resources_.size() - 1;
+}
+
+RenderGraph::ImageId RenderGraph::DeclareImage() {
+  Resource resource;
+  resource.state_index = states_.size();
+  states_.emplace_back();
+  resources_.push_back(std::move(resource));
+  return resources_.size() - 1;
+}
+
+void RenderGraph::SetImage(ImageId id, const ImagePtr& image) {
+  FTL_DCHECK(id < resources_.size());
+  FTL_DCHECK(!resources_[id].image && !resources_[id].is_transient);
+  resources_[id].image = image;
+}
+
+const ImagePtr& RenderGraph::GetImage(ImageId id) const {
+  FTL_DCHECK(id < resources_.size());
+  return resources_[id].image;
+}
+
+void RenderGraph::AddPass(const char* name,
+                          std::vector<ImageUse> uses,
+                          RecordFunc record) {
+  FTL_DCHECK(!executed_);
+  passes_.push_back(Pass{name, std::move(uses), std::move(record), false});
+}
+
+void RenderGraph::AddSubmitPoint() {
+  if (!passes_.empty()) {
+    passes_.back().submit_after = true;
+  }
+}
+
+void RenderGraph::Execute(CommandBuffer* command_buffer,
+                          const SubmitFunc& submit) {
+  TRACE_DURATION("gfx", "escher::RenderGraph::Execute", "passes",
+                 passes_.size());
+  FTL_DCHECK(!executed_);
+  executed_ = true;
+
+  AllocateTransientImages();
+
+  stats_.pass_count = static_cast<uint32_t>(passes_.size());
+  stats_.submission_count = 1;
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    const Pass& pass = passes_[i];
+    RecordBarriers(pass, command_buffer);
+    if (pass.record) {
+      TRACE_DURATION("gfx", "escher::RenderGraph::RecordPass", "name",
+                     pass.name);
+      pass.record(this, command_buffer);
+    }
+    if (pass.submit_after && submit && i + 1 < passes_.size()) {
+      command_buffer = submit();
+      ++stats_.submission_count;
+    }
+  }
+}
+
+void RenderGraph::AllocateTransientImages() {
+  std::vector<ImageId> ids;
+  std::vector<ImageInfo> infos;
+  std::vector<std::pair<size_t, size_t>> lifetimes;
+  for (ImageId id = 0; id < resources_.size(); ++id) {
+    if (!resources_[id].is_transient) {
+      continue;
+    }
+    size_t first = passes_.size();
+    size_t last = 0;
+    for (size_t i = 0; i < passes_.size(); ++i) {
+      for (const ImageUse& use : passes_[i].uses) {
+        if (use.image == id) {
+          first = std::min(first, i);
+          last = std::max(last, i);
+        }
+      }
+    }
+    if (first == passes_.size()) {
+      // Never used, so never allocated.
+      continue;
+    }
+    ids.push_back(id);
+    infos.push_back(resources_[id].info);
+    lifetimes.push_back({first, last});
+  }
+
+  std::vector<size_t> physical = AliasTransientImages(infos, lifetimes);
+  std::vector<ImagePtr> images;
+  std::vector<size_t> state_indices;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const size_t index = physical[i];
+    if (index >= images.size()) {
+      images.resize(index + 1);
+      state_indices.resize(index + 1);
+    }
+    if (!images[index]) {
+      images[index] = image_factory_->NewImage(infos[i]);
+      state_indices[index] = states_.size();
+      states_.emplace_back();
+    }
+    resources_[ids[i]].image = images[index];
+    resources_[ids[i]].state_index = state_indices[index];
+  }
+  stats_.transient_image_count = static_cast<uint32_t>(ids.size());
+  stats_.allocated_image_count = static_cast<uint32_t>(images.size());
+}
+
+std::vector<size_t> RenderGraph::AliasTransientImages(
+    const std::vector<ImageInfo>& infos,
+    const std::vector<std::pair<size_t, size_t>>& lifetimes) {
+  FTL_DCHECK(infos.size() == lifetimes.size());
+
+  // Greedily reuse the first compatible image that is free by the time that
+  // each image is first used, in order of first use.
+  std::vector<size_t> order(infos.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return lifetimes[a].first < lifetimes[b].first;
+  });
+
+  struct PhysicalImage {
+    ImageInfo info;
+    size_t last_use;
+  };
+  std::vector<PhysicalImage> physical_images;
+  std::vector<size_t> result(infos.size());
+  for (size_t i : order) {
+    bool found = false;
+    for (size_t p = 0; p < physical_images.size(); ++p) {
+      if (physical_images[p].info == infos[i] &&
+          physical_images[p].last_use < lifetimes[i].first) {
+        physical_images[p].last_use = lifetimes[i].second;
+        result[i] = p;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      result[i] = physical_images.size();
+      physical_images.push_back({infos[i], lifetimes[i].second});
+    }
+  }
+  return result;
+}
+
+void RenderGraph::RecordBarriers(const Pass& pass,
+                                 CommandBuffer* command_buffer) {
+  std::vector<vk::ImageMemoryBarrier> barriers;
+  vk::PipelineStageFlags src_stages;
+  vk::PipelineStageFlags dst_stages;
+  for (const ImageUse& use : pass.uses) {
+    FTL_DCHECK(use.image < resources_.size());
+    const Resource& resource = resources_[use.image];
+    FTL_DCHECK(!resource.is_transient || resource.image);
+    FTL_DCHECK(!resource.is_transient || use.access.writes() ||
+               states_[resource.state_index].layout() !=
+                   vk::ImageLayout::eUndefined);
+
+    vk::ImageMemoryBarrier barrier;
+    vk::PipelineStageFlags barrier_src_stages;
+    vk::PipelineStageFlags barrier_dst_stages;
+    const bool needs_barrier = states_[resource.state_index].Access(
+        use.access, &barrier, &barrier_src_stages, &barrier_dst_stages);
+    // Images that are created by this pass are synchronized by it.
+    if (!resource.image) {
+      continue;
+    }
+    command_buffer->KeepAlive(resource.image);
+    if (!needs_barrier) {
+      continue;
+    }
+
+    const ImagePtr& image = resource.image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image->get();
+    if (image->has_depth() || image->has_stencil()) {
+      if (image->has_depth()) {
+        barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+      }
+      if (image->has_stencil()) {
+        barrier.subresourceRange.aspectMask |=
+            vk::ImageAspectFlagBits::eStencil;
+      }
+    } else {
+      barrier.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+    }
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barriers.push_back(barrier);
+    src_stages |= barrier_src_stages;
+    dst_stages |= barrier_dst_stages;
+  }
+
+  if (!barriers.empty()) {
+    command_buffer->get().pipelineBarrier(
+        src_stages, dst_stages, vk::DependencyFlags(), 0, nullptr, 0, nullptr,
+        static_cast<uint32_t>(barriers.size()), barriers.data());
+    stats_.barrier_count += static_cast<uint32_t>(barriers.size());
+    ++stats_.pipeline_barrier_count;
+  }
+}
+
+}  // namespace impl
+}  // namespace escher
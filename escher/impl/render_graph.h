@@ -0,0 +1,208 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/renderer/image.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Describes how a pass of a RenderGraph accesses an image.
+struct ImageAccess {
+  // The layout that the image must be in when the pass begins.
+  vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+  // The layout that the pass leaves the image in, if the pass transitions it
+  // itself (e.g. via the final layout of a render-pass attachment).  If
+  // eUndefined, the image is left in |layout|.
+  vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
+  vk::PipelineStageFlags stages;
+  vk::AccessFlags access;
+  // True if the pass overwrites the image without reading its previous
+  // contents, which therefore need not be preserved by the layout transition.
+  bool discard = false;
+
+  bool writes() const;
+
+  // Rendered into as a color or depth-stencil attachment.
+  static ImageAccess ColorAttachment(
+      bool discard,
+      vk::ImageLayout final_layout = vk::ImageLayout::eUndefined);
+  static ImageAccess DepthAttachment(bool discard);
+  // Read through a sampler by the specified shader stages.
+  static ImageAccess Sampled(vk::PipelineStageFlags stages =
+                                 vk::PipelineStageFlagBits::eFragmentShader);
+  // Read and/or written as a storage image, in eGeneral layout.
+  static ImageAccess Storage(vk::AccessFlags access,
+                             vk::PipelineStageFlags stages =
+                                 vk::PipelineStageFlagBits::eComputeShader);
+  // Read or written by a transfer command (e.g. a blit) in |layout|.
+  static ImageAccess Transfer(vk::AccessFlags access, vk::ImageLayout layout);
+  // Handed off to the presentation engine.
+  static ImageAccess Present();
+};
+
+// Tracks the layout of an image, and which accesses to it are still in
+// flight, in order to compute the barrier that each new access requires.
+// Reads are only made to wait for previous writes (and for layout
+// transitions); writes wait for all previous accesses.
+class ImageSyncState {
+ public:
+  // The image is initially in |layout|.  Any layout transition must wait for
+  // |stages|, e.g. the stage that waits for the semaphore of a swapchain image.
+  explicit ImageSyncState(
+      vk::ImageLayout layout = vk::ImageLayout::eUndefined,
+      vk::PipelineStageFlags stages = vk::PipelineStageFlags());
+
+  // Return true if |access| must be preceded by a barrier, and if so fill in
+  // the layouts and access masks of |barrier| (but not the image or
+  // subresource range), and add the stages that the barrier must wait for and
+  // block to |src_stages| and |dst_stages|.  Then update the state as if
+  // |access| had happened.
+  bool Access(const ImageAccess& access,
+              vk::ImageMemoryBarrier* barrier,
+              vk::PipelineStageFlags* src_stages,
+              vk::PipelineStageFlags* dst_stages);
+
+  vk::ImageLayout layout() const { return layout_; }
+
+ private:
+  vk::ImageLayout layout_;
+  // The stages and accesses of the last write, or of the last layout
+  // transition.
+  vk::PipelineStageFlags write_stages_;
+  vk::AccessFlags write_access_;
+  // Stages that have read the image since it was last written, and that the
+  // last write has therefore been made visible to.
+  vk::PipelineStageFlags read_stages_;
+};
+
+// A small render graph.  Passes declare the images that they access and how,
+// and are recorded when Execute() is called.  The graph then:
+// - inserts the minimal barriers between passes, batching all of the layout
+//   transitions that a pass needs into a single vkCmdPipelineBarrier(),
+// - allocates the transient images that it creates, aliasing those whose
+//   lifetimes do not overlap so that they share the same Image,
+// - submits the frame in a single batch, unless requested otherwise.
+// Passes may still synchronize images that are private to them (e.g. the
+// levels of a depth pyramid) themselves.  Not thread-safe.
+class RenderGraph {
+ public:
+  using ImageId = size_t;
+  using RecordFunc =
+      std::function<void(RenderGraph* graph, CommandBuffer* command_buffer)>;
+  // Submits the commands that have been recorded so far, and returns a new
+  // CommandBuffer to continue recording into.
+  using SubmitFunc = std::function<CommandBuffer*()>;
+
+  struct Stats {
+    uint32_t pass_count = 0;
+    uint32_t barrier_count = 0;
+    uint32_t pipeline_barrier_count = 0;
+    uint32_t transient_image_count = 0;
+    uint32_t allocated_image_count = 0;
+    uint32_t submission_count = 0;
+  };
+
+  explicit RenderGraph(ImageFactory* image_factory);
+  ~RenderGraph();
+
+  // Create an image that lives only for the duration of the graph.  Its
+  // contents are undefined before the first pass that accesses it, which must
+  // discard them.
+  ImageId CreateImage(const ImageInfo& info);
+
+  // Use an image that outlives the graph, and is in |layout| when the graph
+  // is executed.  The first barrier for the image waits for |stages|, e.g. the
+  // stage at which a semaphore that guards the image is waited upon.
+  // Importing the same image again returns the same ImageId, and the other
+  // arguments are then ignored.
+  ImageId ImportImage(const ImagePtr& image,
+                      vk::ImageLayout layout,
+                      vk::PipelineStageFlags stages = vk::PipelineStageFlags());
+
+  // Declare an image that will be created by a pass while it is recorded;
+  // the pass must then call SetImage().  The access by which the pass creates
+  // it describes the state that it leaves the image in.
+  ImageId DeclareImage();
+  void SetImage(ImageId id, const ImagePtr& image);
+
+  // Return the image; transient images are only available while the graph is
+  // being executed.
+  const ImagePtr& GetImage(ImageId id) const;
+
+  struct ImageUse {
+    ImageId image;
+    ImageAccess access;
+  };
+
+  // Add a pass, which is recorded by |record| after any barriers that its
+  // image uses require.  |record| may be null, e.g. for a pass that only
+  // transitions an image for presentation.
+  void AddPass(const char* name,
+               std::vector<ImageUse> uses,
+               RecordFunc record);
+
+  // Mark a point at which the commands recorded so far may be submitted, so
+  // that the GPU can begin working on them.  Only honored if a SubmitFunc is
+  // passed to Execute().
+  void AddSubmitPoint();
+
+  // Record all of the passes, in the order that they were added, into
+  // |command_buffer|.  If |submit| is not null, it is called at each submit
+  // point.  The graph cannot be executed again.
+  void Execute(CommandBuffer* command_buffer, const SubmitFunc& submit);
+
+  const Stats& stats() const { return stats_; }
+
+  // Assign each transient image to a physical image.  |infos| and the
+  // [first, last] pass index ranges in |lifetimes| describe the transient
+  // images; returns the physical index of each, where images with the same
+  // index share an Image.  Exposed for testing.
+  static std::vector<size_t> AliasTransientImages(
+      const std::vector<ImageInfo>& infos,
+      const std::vector<std::pair<size_t, size_t>>& lifetimes);
+
+ private:
+  struct Resource {
+    ImagePtr image;
+    bool is_transient = false;
+    ImageInfo info;
+    // The state of the image; shared by transient images that alias.
+    size_t state_index = 0;
+  };
+
+  struct Pass {
+    const char* name;
+    std::vector<ImageUse> uses;
+    RecordFunc record;
+    bool submit_after = false;
+  };
+
+  // Allocate the transient images, aliasing where possible.
+  void AllocateTransientImages();
+
+  // Record the barriers that |pass| requires.
+  void RecordBarriers(const Pass& pass, CommandBuffer* command_buffer);
+
+  ImageFactory* const image_factory_;
+  std::vector<Resource> resources_;
+  std::vector<ImageSyncState> states_;
+  std::unordered_map<Image*, ImageId> imported_images_;
+  std::vector<Pass> passes_;
+  bool executed_ = false;
+  Stats stats_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RenderGraph);
+};
+
+}  // namespace impl
+}  // namespace escher
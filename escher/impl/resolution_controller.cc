@@ -0,0 +1,43 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/resolution_controller.h"
+
+#include <algorithm>
+
+#include "lib/ftl/logging.h"
+
+namespace escher {
+namespace impl {
+
+ResolutionController::ResolutionController(const Config& config)
+    : config_(config), scale_(config.max_scale) {
+  FTL_DCHECK(config.min_scale > 0.f);
+  FTL_DCHECK(config.min_scale <= config.max_scale);
+  FTL_DCHECK(config.max_scale <= 1.f);
+  FTL_DCHECK(config.step > 0.f);
+  FTL_DCHECK(config.hysteresis >= 0.f && config.hysteresis < 1.f);
+}
+
+void ResolutionController::ReportFrameTime(float scale,
+                                           uint64_t microseconds) {
+  if (scale != scale_) {
+    return;
+  }
+  const double time = static_cast<double>(microseconds);
+  const double target = static_cast<double>(config_.target_frame_time);
+  if (time > target) {
+    scale_ = std::max(scale_ - config_.step, config_.min_scale);
+  } else if (scale_ < config_.max_scale) {
+    const float higher_scale = std::min(scale_ + config_.step,
+                                        config_.max_scale);
+    const double ratio = higher_scale / scale_;
+    if (time * ratio * ratio <= target * (1.0 - config_.hysteresis)) {
+      scale_ = higher_scale;
+    }
+  }
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,54 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Chooses the scale at which to render, so that the GPU time of each frame
+// stays close to a target.  The GPU time is assumed to be roughly
+// proportional to the number of pixels rendered, i.e. to the square of the
+// scale.  The scale is lowered by one step as soon as a frame exceeds the
+// target, and raised by one step only if a frame is fast enough that it would
+// still have been within the target, less the hysteresis, at the higher
+// scale.  Not thread-safe.
+class ResolutionController {
+ public:
+  struct Config {
+    // GPU time per frame to aim for, in microseconds.
+    uint64_t target_frame_time = 16000;
+    // Bounds of the scale, which must be within (0, 1].
+    float min_scale = 0.5f;
+    float max_scale = 1.f;
+    // Amount by which the scale is changed at once.
+    float step = 0.125f;
+    // Fraction of the target that must be left over after raising the scale.
+    float hysteresis = 0.1f;
+  };
+
+  explicit ResolutionController(const Config& config);
+
+  // Report the GPU time of a finished frame that was rendered at |scale|.
+  // Frames that were rendered at a different scale than the current one are
+  // ignored, since the scale has already been adjusted since they were
+  // recorded.
+  void ReportFrameTime(float scale, uint64_t microseconds);
+
+  const Config& config() const { return config_; }
+  float scale() const { return scale_; }
+
+ private:
+  const Config config_;
+  float scale_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(ResolutionController);
+};
+
+}  // namespace impl
+}  // namespace escher
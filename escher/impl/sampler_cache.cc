@@ -0,0 +1,62 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/sampler_cache.h"
+
+#include "escher/impl/vulkan_utils.h"
+
+namespace escher {
+namespace impl {
+
+SamplerCache::SamplerCache(vk::Device device)
+    : SamplerCache(
+          [device](const vk::SamplerCreateInfo& info) {
+            return ESCHER_CHECKED_VK_RESULT(device.createSampler(info));
+          },
+          [device](vk::Sampler sampler) { device.destroySampler(sampler); }) {}
+
+SamplerCache::SamplerCache(CreateFunc create, DestroyFunc destroy)
+    : create_(std::move(create)), destroy_(std::move(destroy)) {}
+
+SamplerCache::~SamplerCache() {
+  for (auto& pair : samplers_) {
+    destroy_(pair.second);
+  }
+}
+
+vk::Sampler SamplerCache::ObtainSampler(const vk::SamplerCreateInfo& info) {
+  FTL_DCHECK(!info.pNext);
+
+  // The fields are appended one by one, so that padding does not affect the
+  // key.
+  ByteKey key;
+  AppendToKey(&key, static_cast<VkSamplerCreateFlags>(info.flags));
+  AppendToKey(&key, info.magFilter);
+  AppendToKey(&key, info.minFilter);
+  AppendToKey(&key, info.mipmapMode);
+  AppendToKey(&key, info.addressModeU);
+  AppendToKey(&key, info.addressModeV);
+  AppendToKey(&key, info.addressModeW);
+  AppendToKey(&key, info.mipLodBias);
+  AppendToKey(&key, info.anisotropyEnable);
+  AppendToKey(&key, info.maxAnisotropy);
+  AppendToKey(&key, info.compareEnable);
+  AppendToKey(&key, info.compareOp);
+  AppendToKey(&key, info.minLod);
+  AppendToKey(&key, info.maxLod);
+  AppendToKey(&key, info.borderColor);
+  AppendToKey(&key, info.unnormalizedCoordinates);
+
+  vk::Sampler& sampler = samplers_[std::move(key)];
+  if (sampler) {
+    ++hit_count_;
+  } else {
+    ++miss_count_;
+    sampler = create_(info);
+  }
+  return sampler;
+}
+
+}  // namespace impl
+}  // namespace escher
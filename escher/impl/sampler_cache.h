@@ -0,0 +1,55 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/util/hash.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Caches vk::Samplers, so that Textures which sample with the same parameters
+// share a single sampler, rather than each creating and destroying their own.
+// Only a handful of distinct samplers are ever used, so they are never
+// evicted; they are destroyed along with the cache.  Not thread-safe.
+class SamplerCache {
+ public:
+  using CreateFunc = std::function<vk::Sampler(const vk::SamplerCreateInfo&)>;
+  using DestroyFunc = std::function<void(vk::Sampler)>;
+
+  // Samplers are created and destroyed on |device|.
+  explicit SamplerCache(vk::Device device);
+  // Samplers are created and destroyed by the given functions, e.g. by tests
+  // that run without a device.
+  SamplerCache(CreateFunc create, DestroyFunc destroy);
+  ~SamplerCache();
+
+  // Return a sampler that was created from |info|, creating it if this is
+  // the first time that an equal |info| is requested.  The sampler is owned
+  // by the cache.  |info| must not have a pNext chain.
+  vk::Sampler ObtainSampler(const vk::SamplerCreateInfo& info);
+
+  // Statistics, for debugging.
+  uint32_t hit_count() const { return hit_count_; }
+  uint32_t miss_count() const { return miss_count_; }
+  size_t size() const { return samplers_.size(); }
+
+ private:
+  const CreateFunc create_;
+  const DestroyFunc destroy_;
+  std::unordered_map<ByteKey, vk::Sampler, ByteKeyHash> samplers_;
+
+  uint32_t hit_count_ = 0;
+  uint32_t miss_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(SamplerCache);
+};
+
+}  // namespace impl
+}  // namespace escher
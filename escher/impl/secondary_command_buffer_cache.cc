@@ -0,0 +1,131 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/secondary_command_buffer_cache.h"
+
+#include <algorithm>
+
+#include "escher/escher.h"
+#include "escher/impl/command_buffer.h"
+#include "escher/impl/vulkan_utils.h"
+#include "escher/resources/resource.h"
+#include "escher/util/trace_macros.h"
+
+namespace escher {
+namespace impl {
+
+SecondaryCommandBufferCache::SecondaryCommandBufferCache(Escher* escher)
+    : escher_(escher), device_(escher->vk_device()), entries_(1) {
+  vk::CommandPoolCreateInfo info;
+  info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+  info.queueFamilyIndex = escher->vulkan_context().queue_family_index;
+  pool_ = ESCHER_CHECKED_VK_RESULT(device_.createCommandPool(info));
+
+  // Needed to know when evicted buffers may be reused.
+  Register(escher->command_buffer_sequencer());
+}
+
+SecondaryCommandBufferCache::~SecondaryCommandBufferCache() {
+  Unregister(escher_->command_buffer_sequencer());
+
+  std::vector<Entry> entries = std::move(retired_entries_);
+  entries_.Clear(
+      [&entries](Entry* entry) { entries.push_back(std::move(*entry)); });
+  bool is_pending = false;
+  for (auto& entry : entries) {
+    is_pending |= entry.last_sequence_number > last_finished_sequence_number_;
+    free_command_buffers_.push_back(std::move(entry.command_buffer));
+  }
+  if (is_pending) {
+    // Buffers may not be freed while they are still pending.
+    device_.waitIdle();
+  }
+
+  std::vector<vk::CommandBuffer> buffers_to_free;
+  for (auto& command_buffer : free_command_buffers_) {
+    buffers_to_free.push_back(command_buffer->get());
+  }
+  free_command_buffers_.clear();
+  if (!buffers_to_free.empty()) {
+    device_.freeCommandBuffers(pool_,
+                               static_cast<uint32_t>(buffers_to_free.size()),
+                               buffers_to_free.data());
+  }
+  device_.destroyCommandPool(pool_);
+}
+
+void SecondaryCommandBufferCache::Execute(CommandBuffer* command_buffer,
+                                          vk::RenderPass render_pass,
+                                          Key key,
+                                          const ResourcePtr& resource,
+                                          const RecordCallback& record) {
+  Entry& entry = entries_.Obtain(std::move(key), [&]() {
+    TRACE_DURATION("gfx", "escher::SecondaryCommandBufferCache::Execute[record]");
+    Entry recorded;
+    recorded.command_buffer = GetFreeCommandBuffer();
+    recorded.command_buffer->BeginSecondary(render_pass);
+    record(recorded.command_buffer.get());
+    recorded.command_buffer->EndSecondary();
+    recorded.resource = resource;
+    return recorded;
+  });
+
+  // Only the first primary buffer to execute the secondary one needs to wait
+  // for the semaphores that were taken while recording it.
+  entry.command_buffer->MoveWaitSemaphoresTo(command_buffer);
+  entry.last_sequence_number = command_buffer->sequence_number();
+
+  vk::CommandBuffer secondary = entry.command_buffer->get();
+  command_buffer->get().executeCommands(1, &secondary);
+  ++executed_count_;
+}
+
+void SecondaryCommandBufferCache::EvictUnusedCommandBuffers() {
+  entries_.EndRound([this](Entry* entry) {
+    retired_entries_.push_back(std::move(*entry));
+  });
+  OnCommandBufferFinished(last_finished_sequence_number_);
+}
+
+void SecondaryCommandBufferCache::OnCommandBufferFinished(
+    uint64_t sequence_number) {
+  FTL_DCHECK(sequence_number >= last_finished_sequence_number_);
+  last_finished_sequence_number_ = sequence_number;
+
+  auto finished_end = std::partition(
+      retired_entries_.begin(), retired_entries_.end(),
+      [sequence_number](const Entry& entry) {
+        return entry.last_sequence_number > sequence_number;
+      });
+  for (auto it = finished_end; it != retired_entries_.end(); ++it) {
+    // Release the resources that were retained by the recorded commands now,
+    // rather than when the buffer is next reused.
+    it->command_buffer->used_resources_.clear();
+    free_command_buffers_.push_back(std::move(it->command_buffer));
+  }
+  retired_entries_.erase(finished_end, retired_entries_.end());
+}
+
+std::unique_ptr<CommandBuffer>
+SecondaryCommandBufferCache::GetFreeCommandBuffer() {
+  if (!free_command_buffers_.empty()) {
+    auto command_buffer = std::move(free_command_buffers_.back());
+    free_command_buffers_.pop_back();
+    return command_buffer;
+  }
+
+  vk::CommandBufferAllocateInfo info;
+  info.commandPool = pool_;
+  info.level = vk::CommandBufferLevel::eSecondary;
+  info.commandBufferCount = 1;
+  std::vector<vk::CommandBuffer> allocated_vulkan_buffers =
+      ESCHER_CHECKED_VK_RESULT(device_.allocateCommandBuffers(info));
+  // Secondary buffers are never submitted, so they need no fence.
+  return std::unique_ptr<CommandBuffer>(
+      new CommandBuffer(device_, allocated_vulkan_buffers[0], vk::Fence(),
+                        vk::PipelineStageFlagBits::eAllGraphics));
+}
+
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,88 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/forward_declarations.h"
+#include "escher/impl/aging_cache.h"
+#include "escher/impl/command_buffer_sequencer.h"
+#include "escher/util/hash.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+namespace impl {
+
+// Caches secondary command buffers, so that commands which are the same from
+// frame to frame need only be recorded once, and can thereafter be replayed
+// with vkCmdExecuteCommands().  Each buffer is identified by a key, which must
+// capture everything that the recorded commands depend upon; keys are compared
+// exactly, not just by their hashes.  Buffers that are not executed between
+// consecutive calls to EvictUnusedCommandBuffers() are discarded once the GPU
+// has finished with them.  Not thread-safe.
+class SecondaryCommandBufferCache : public CommandBufferSequencerListener {
+ public:
+  using Key = ByteKey;
+  using RecordCallback = std::function<void(CommandBuffer* secondary)>;
+
+  explicit SecondaryCommandBufferCache(Escher* escher);
+  ~SecondaryCommandBufferCache() override;
+
+  // Execute the buffer identified by |key| within the first subpass of
+  // |render_pass|, which must have been begun on |command_buffer| with
+  // vk::SubpassContents::eSecondaryCommandBuffers.  If no such buffer is
+  // cached, |record| is first invoked to record one.  |resource| (e.g. the
+  // display list whose commands are recorded) is retained for as long as the
+  // buffer remains in the cache.
+  void Execute(CommandBuffer* command_buffer,
+               vk::RenderPass render_pass,
+               Key key,
+               const ResourcePtr& resource,
+               const RecordCallback& record);
+
+  // Discard all buffers that have not been executed since the previous call.
+  void EvictUnusedCommandBuffers();
+
+  // Statistics, for debugging.
+  uint32_t recorded_count() const { return entries_.miss_count(); }
+  uint32_t executed_count() const { return executed_count_; }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    std::unique_ptr<CommandBuffer> command_buffer;
+    ResourcePtr resource;
+    // Sequence number of the last primary buffer that executed this one.
+    uint64_t last_sequence_number = 0;
+  };
+
+  // Implement CommandBufferSequencerListener::OnCommandBufferFinished().
+  // Recycles the buffers of evicted entries that the GPU has finished with.
+  void OnCommandBufferFinished(uint64_t sequence_number) override;
+
+  // Return a buffer from |free_command_buffers_|, or allocate a new one.
+  std::unique_ptr<CommandBuffer> GetFreeCommandBuffer();
+
+  Escher* const escher_;
+  const vk::Device device_;
+  vk::CommandPool pool_;
+
+  // Each round ends with EvictUnusedCommandBuffers().
+  AgingCache<Entry> entries_;
+  // Evicted entries that may still be pending on the GPU.
+  std::vector<Entry> retired_entries_;
+  std::vector<std::unique_ptr<CommandBuffer>> free_command_buffers_;
+  uint64_t last_finished_sequence_number_ = 0;
+
+  uint32_t executed_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(SecondaryCommandBufferCache);
+};
+
+}  // namespace impl
+}  // namespace escher
@@ -363,6 +363,47 @@ void main() {
 }
 )GLSL";
 
+// Appends each cell of the packed lookup table within the push-constant
+// bounds that requires sampling or filtering to the tile list, and counts
+// them in the dispatch command at its head.
+constexpr char g_tile_list_kernel_src[] = R"GLSL(
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0, rgba8) uniform readonly image2D lookupTable;
+
+// Must match SsdoAccelerator::GenerateTileList().
+layout (std430, binding = 1) buffer TileList {
+  uint group_count_x;
+  uint group_count_y;
+  uint group_count_z;
+  uint padding;
+  uint tiles[];
+};
+
+// The first tile, and the number of tiles in each dimension.
+layout(push_constant) uniform Bounds {
+  ivec2 origin;
+  ivec2 extent;
+};
+
+void main() {
+  ivec2 tile = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(tile, extent))) {
+    return;
+  }
+  tile += origin;
+  ivec2 cell = tile % 4;
+  vec4 texel = imageLoad(lookupTable, tile / 4);
+  if (((int(texel[cell.y] * 255.0 + 0.5) >> (cell.x * 2)) & 3) != 0) {
+    uint index = atomicAdd(group_count_x, 1);
+    tiles[index] = uint(tile.x) | (uint(tile.y) << 16);
+  }
+}
+)GLSL";
+
 }  // namespace
 
 SsdoAccelerator::SsdoAccelerator(Escher* escher, ImageFactory* image_factory)
@@ -467,6 +508,79 @@ TexturePtr SsdoAccelerator::GenerateNullLookupTable(
   return tmp_texture;
 }
 
+BufferPtr SsdoAccelerator::GenerateTileList(CommandBuffer* command_buffer,
+                                            const TexturePtr& lookup_table,
+                                            const vk::Rect2D& render_area,
+                                            Timestamper* timestamper) {
+  TRACE_DURATION("gfx", "escher::SsdoAccelerator::GenerateTileList");
+
+  const int32_t bounds[4] = {
+      render_area.offset.x / static_cast<int32_t>(kTileSize),
+      render_area.offset.y / static_cast<int32_t>(kTileSize),
+      static_cast<int32_t>(
+          (render_area.offset.x + render_area.extent.width + kTileSize - 1) /
+          kTileSize),
+      static_cast<int32_t>(
+          (render_area.offset.y + render_area.extent.height + kTileSize - 1) /
+          kTileSize)};
+  const int32_t push_constants[4] = {bounds[0], bounds[1],
+                                     bounds[2] - bounds[0],
+                                     bounds[3] - bounds[1]};
+  FTL_DCHECK(bounds[2] <= static_cast<int32_t>(lookup_table->width() * 4));
+  FTL_DCHECK(bounds[3] <= static_cast<int32_t>(lookup_table->height() * 4));
+  const uint32_t tile_count = push_constants[2] * push_constants[3];
+
+  BufferPtr tile_list = Buffer::New(
+      escher_->resource_recycler(), escher_->gpu_allocator(),
+      kTileListHeaderSize + tile_count * sizeof(uint32_t),
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eIndirectBuffer |
+          vk::BufferUsageFlagBits::eTransferDst,
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+  // Start with an empty list, and wait for the lookup table to be written.
+  const uint32_t header[4] = {0, 1, 1, 0};
+  command_buffer->get().updateBuffer(tile_list->get(), 0, sizeof(header),
+                                     header);
+  vk::MemoryBarrier barrier;
+  barrier.srcAccessMask =
+      vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask =
+      vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer |
+          vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 1,
+      &barrier, 0, nullptr, 0, nullptr);
+
+  if (!tile_list_kernel_) {
+    FTL_DLOG(INFO) << "Lazily instantiating tile_list_kernel_";
+    tile_list_kernel_ = std::make_unique<ComputeShader>(
+        escher_, std::vector<vk::ImageLayout>{vk::ImageLayout::eGeneral},
+        std::vector<vk::DescriptorType>{vk::DescriptorType::eStorageBuffer},
+        sizeof(push_constants), g_tile_list_kernel_src);
+  }
+
+  constexpr uint32_t kLocalSize = 8;
+  tile_list_kernel_->Dispatch(
+      {lookup_table}, {tile_list}, command_buffer,
+      (push_constants[2] + kLocalSize - 1) / kLocalSize,
+      (push_constants[3] + kLocalSize - 1) / kLocalSize, 1, push_constants);
+
+  // The list is consumed by indirect dispatches, and by their kernels.
+  barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead |
+                          vk::AccessFlagBits::eShaderRead;
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eDrawIndirect |
+          vk::PipelineStageFlagBits::eComputeShader,
+      vk::DependencyFlags(), 1, &barrier, 0, nullptr, 0, nullptr);
+
+  timestamper->AddTimestamp("generated SSDO tile list");
+  return tile_list;
+}
+
 TexturePtr SsdoAccelerator::UnpackLookupTable(
     CommandBuffer* command_buffer,
     const TexturePtr& packed_lookup_table,
@@ -37,6 +37,26 @@ class SsdoAccelerator {
                                  vk::ImageUsageFlags image_flags,
                                  Timestamper* timestamper);
 
+  // Size of the tiles of GenerateTileList(), in pixels.
+  static constexpr uint32_t kTileSize = 8;
+  // Size of the header of the buffers generated by GenerateTileList().
+  static constexpr vk::DeviceSize kTileListHeaderSize = 16;
+
+  // Generates a compacted list of the tiles that overlap |render_area| and
+  // that require SSDO sampling or filtering, so that SSDO kernels can be
+  // dispatched over only these.  Each tile is one pixel of the depth image
+  // that |lookup_table| was generated from, i.e. a pair of bits of the table;
+  // |render_area| is in pixels of the image that SSDO is computed for, which
+  // is kTileSize times larger in each dimension.  The buffer begins with a
+  // vk::DispatchIndirectCommand of one workgroup per tile, padded to
+  // kTileListHeaderSize, and is followed by one uint32_t per tile, holding its
+  // x and y coordinates (in tiles) in the low and high 16 bits.  The buffer is
+  // ready to be read by compute shaders and indirect dispatches.
+  BufferPtr GenerateTileList(CommandBuffer* command_buffer,
+                             const TexturePtr& lookup_table,
+                             const vk::Rect2D& render_area,
+                             Timestamper* timestamper);
+
   // Unpack the image generated by GenerateLookupTable(), or another image with
   // the same packed format, into an image 4x larger in each dimension, suitable
   // for debug visualization.  For each ouput pixel, the corresponding pair of
@@ -72,6 +92,8 @@ class SsdoAccelerator {
   // Used by UnpackLookupTable() to unpack an image in the same format as
   // generated by GenerateLookupTable().
   std::unique_ptr<ComputeShader> unpack_kernel_;
+  // Used by GenerateTileList().
+  std::unique_ptr<ComputeShader> tile_list_kernel_;
 
   // If |enabled| is false, calls GenerateNullLookupTable(), which has
   // negligible cost.
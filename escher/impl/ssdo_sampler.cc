@@ -4,6 +4,8 @@
 
 #include "escher/impl/ssdo_sampler.h"
 
+#include <algorithm>
+
 #include "escher/escher.h"
 #include "escher/impl/command_buffer.h"
 #include "escher/impl/glsl_compiler.h"
@@ -18,6 +20,7 @@
 #include "escher/renderer/texture.h"
 #include "escher/resources/resource_recycler.h"
 #include "escher/shape/mesh.h"
+#include "escher/vk/buffer.h"
 
 namespace escher {
 namespace impl {
@@ -25,7 +28,8 @@ namespace impl {
 namespace {
 
 // Must match the descriptor set index used for textures in the fragment shaders
-// below (g_sampler_fragment_src and g_filter_fragment_src).
+// below (g_sampler_fragment_src, g_filter_fragment_src,
+// g_accumulate_fragment_src and g_upsample_fragment_src).
 constexpr char kTextureDescriptorSetBindIndex = 0;
 
 constexpr char g_vertex_src[] = R"GLSL(
@@ -73,6 +77,18 @@ constexpr char g_sampler_fragment_src[] = R"GLSL(
 
     // The size of the viewing volume in (width, height, depth).
     vec3 viewing_volume;
+
+    // Offset added to the noise texture, and position of the taps within
+    // their radial bands, so that these can be varied from frame to frame.
+    float noise_offset;
+    float tap_jitter;
+
+    // The number of screen-space samples to use in the computation.
+    int tap_count;
+
+    // Pixels of the depth map per unit of the viewing volume; only used by
+    // g_sampler_kernel_src, whose taps are offset in pixels.
+    float tap_scale;
   } pushed;
 
   // Depth information about the scene.
@@ -92,10 +108,7 @@ constexpr char g_sampler_fragment_src[] = R"GLSL(
   // Must match SsdoSampler::kNoiseSize (C++).
   const int kNoiseSize = 5;
 
-  // The number of screen-space samples to use in the computation.
-  const int kTapCount = 8;
-
-  // These should be relatively primary to each other and to kTapCount;
+  // These should be relatively primary to each other and to the tap count;
   // TODO: only kSpirals.x is used... should .y also be used?
   const vec2 kSpirals = vec2(7.0, 5.0);
 
@@ -149,7 +162,9 @@ constexpr char g_sampler_fragment_src[] = R"GLSL(
       return;
     }
 
-    vec2 seed = texture(noise, fract(gl_FragCoord.xy / float(kNoiseSize))).rg;
+    vec2 seed = fract(
+        texture(noise, fract(gl_FragCoord.xy / float(kNoiseSize))).rg +
+        pushed.noise_offset);
 
     float sampled_depth = texture(depth_map, fragment_uv).r;
     float fragment_z = sampled_depth * -pushed.viewing_volume.z;
@@ -157,12 +172,12 @@ constexpr char g_sampler_fragment_src[] = R"GLSL(
     float fill_light_intensity = 1.0 - key_light_intensity;
 
     float L = 0.0;
-    for (int i = 0; i < kTapCount; ++i) {
-      float alpha = (float(i) + 0.5) / float(kTapCount);
+    for (int i = 0; i < pushed.tap_count; ++i) {
+      float alpha = (float(i) + pushed.tap_jitter) / float(pushed.tap_count);
       L += key_light_intensity * sampleKeyIllumination(fragment_uv, fragment_z, alpha, seed);
       L += fill_light_intensity * sampleFillIllumination(fragment_uv, fragment_z, alpha, seed);
     }
-    L = clamp(L / float(kTapCount), 0.0, 1.0);
+    L = clamp(L / float(pushed.tap_count), 0.0, 1.0);
 
     outColor = vec4(L, sampled_depth, 0.0, 1.0);
   }
@@ -244,30 +259,159 @@ constexpr char g_filter_fragment_src[] = R"GLSL(
   }
 )GLSL";
 
-// TODO: this is currently EXTREMELY slow: see comment on SampleUsingKernel().
+// Blends the noisy occlusion data produced by g_sampler_fragment_src into the
+// accumulated occlusion of previous frames.  The history is reprojected with
+// the previous frame's camera, and is rejected where the depth that it
+// recorded does not match, i.e. where the fragment was not visible.
+constexpr char g_accumulate_fragment_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  // Texture coordinates generated by the vertex shader.
+  layout(location = 0) in vec2 fragment_uv;
+
+  layout(location = 0) out vec4 outColor;
+
+  // Uniform parameters.
+  layout(push_constant) uniform AccumulateConfig {
+    // Maps (u, v, depth, 1) in this frame to the same point in the previous
+    // frame, in homogeneous coordinates.
+    mat4 reprojection;
+    // The part of the history texture, in UV, that holds the scene.
+    vec2 uv_limit;
+    float scene_depth;
+    // Weight of this frame's samples, where the history is valid.
+    float blend;
+  } pushed;
+
+  // Texture containing this frame's unfiltered illumination data.
+  layout(set = 0, binding = 0) uniform sampler2D illumination;
+
+  // Texture containing the illumination accumulated by previous frames.
+  layout(set = 0, binding = 1) uniform sampler2D history;
+
+  // Depth information about the scene.
+  layout(set = 0, binding = 2) uniform sampler2D depth_map;
+
+  void main() {
+    float current = texture(illumination, fragment_uv).x;
+    float depth = texture(depth_map, fragment_uv).r;
+
+    vec4 previous = pushed.reprojection * vec4(fragment_uv, depth, 1.0);
+    vec2 previous_uv = previous.xy / previous.w;
+    float previous_depth = previous.z / previous.w;
+
+    float accumulated = current;
+    if (all(greaterThanEqual(previous_uv, vec2(0.0))) &&
+        all(lessThanEqual(previous_uv, pushed.uv_limit))) {
+      vec4 history_tap = texture(history, previous_uv);
+      // The history's depth is stored with only 8 bits, so allow it to differ
+      // by a couple of steps.
+      float tolerance = max(1.0, pushed.scene_depth * 2.0 / 255.0);
+      if (abs(history_tap.y - previous_depth) * pushed.scene_depth <=
+          tolerance) {
+        accumulated = mix(history_tap.x, current, pushed.blend);
+      }
+    }
+    outColor = vec4(accumulated, depth, 0.0, 1.0);
+  }
+)GLSL";
+
+// Upsamples illumination that was sampled and filtered at a reduced
+// resolution, for use by a full-resolution lighting pass.  Each fragment blends
+// the four nearest low-resolution texels, weighting each both by its distance
+// and by how close its depth is to that of the fragment, so that shadows do not
+// bleed across silhouettes.
+constexpr char g_upsample_fragment_src[] = R"GLSL(
+  #version 450
+  #extension GL_ARB_separate_shader_objects : enable
+
+  layout(location = 0) out vec4 outColor;
+
+  // Uniform parameters.
+  layout(push_constant) uniform UpsampleConfig {
+    // Converts gl_FragCoord to the texel coordinates of the illumination
+    // texture.
+    vec2 frag_coord_to_texel;
+    // Converts texel coordinates of the illumination texture to UV.
+    vec2 texel_to_uv;
+    float scene_depth;
+  } pushed;
+
+  // Texture containing low-resolution filtered illumination data.
+  layout(set = 0, binding = 0) uniform sampler2D illumination;
+
+  // Full-resolution depth information about the scene.
+  layout(set = 0, binding = 1) uniform sampler2D depth_map;
+
+  void main() {
+    // Depth of this fragment, on the same scale as the filter's keys.
+    ivec2 frag_coord = ivec2(gl_FragCoord.xy);
+    float center_depth = texelFetch(depth_map, frag_coord, 0).r;
+    float center_key = center_depth * pushed.scene_depth;
+
+    // The four texels that surround this fragment's center.
+    vec2 texel = gl_FragCoord.xy * pushed.frag_coord_to_texel - vec2(0.5, 0.5);
+    vec2 base = floor(texel);
+    vec2 f = texel - base;
+
+    float sum = 0.0;
+    float total_weight = 0.0;
+    // Fallback if no texel is at a similar depth: the closest one in depth.
+    float closest_illumination = 1.0;
+    float closest_distance = 1e9;
+    for (int i = 0; i < 4; ++i) {
+      vec2 offset = vec2(i & 1, i >> 1);
+      vec4 tap = texture(illumination,
+                         (base + offset + vec2(0.5, 0.5)) * pushed.texel_to_uv);
+      float distance = abs(tap.y * pushed.scene_depth - center_key);
+      vec2 bilinear = mix(vec2(1.0) - f, f, offset);
+      float weight = bilinear.x * bilinear.y * max(0.0, 1.0 - distance);
+      sum += weight * tap.x;
+      total_weight += weight;
+      if (distance < closest_distance) {
+        closest_distance = distance;
+        closest_illumination = tap.x;
+      }
+    }
+
+    float upsampled_illumination =
+        total_weight > 0.001 ? sum / total_weight : closest_illumination;
+    outColor = vec4(upsampled_illumination, center_depth, 0.0, 1.0);
+  }
+)GLSL";
+
+// Same algorithm as g_sampler_fragment_src, computed for one 8x8 tile of the
+// output by each workgroup.  The depths that the tile's taps may read, i.e.
+// the tile plus an apron of kShadowRadius pixels, are loaded into shared
+// memory once, rather than by each tap.  Only the tiles in the list generated
+// by SsdoAccelerator::GenerateTileList() are dispatched.
 constexpr char g_sampler_kernel_src[] = R"GLSL(
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(local_size_x = 4, local_size_y = 4) in;
+// Must match kSsdoAccelDownsampleFactor, which is the size of the tiles.
+const int kTileSize = 8;
+layout(local_size_x = kTileSize, local_size_y = kTileSize) in;
+
+layout (binding = 0) uniform sampler2D depth_map;
+layout (binding = 1) uniform sampler2D noise;
+layout (binding = 2, rg8) uniform writeonly image2D result;
 
-layout (binding = 0) uniform sampler2D depthTexture;
-layout (binding = 1, rgba8) uniform image2D resultImage;
-layout (binding = 2, rgba8) uniform image2D noiseImage;
+// Must match SsdoAccelerator::GenerateTileList().
+layout (std430, binding = 3) readonly buffer TileList {
+  uvec4 header;
+  uint tiles[];
+};
 
-// Uniform parameters.
+// Uniform parameters; see g_sampler_fragment_src.
 layout(push_constant) uniform SamplerConfig {
-  // A description of the directional key light:
-  //
-  //  * theta, phi: The direction from which the light is received. The first
-  //    coordinate is theta (the the azimuthal angle, in radians) and the second
-  //    coordinate is phi (the polar angle, in radians).
-  //  * dispersion: The angular variance in the light, in radians.
-  //  * intensity: The amount of light emitted.
   vec4 key_light;
-
-  // The size of the viewing volume in (width, height, depth).
   vec3 viewing_volume;
+  float noise_offset;
+  float tap_jitter;
+  int tap_count;
+  float tap_scale;
 } pushed;
 
 const float kPi = 3.14159265359;
@@ -275,15 +419,23 @@ const float kPi = 3.14159265359;
 // Must match SsdoSampler::kNoiseSize (C++).
 const int kNoiseSize = 5;
 
-// The number of screen-space samples to use in the computation.
-const int kTapCount = 8;
-
-// These should be relatively primary to each other and to kTapCount;
-// TODO: only kSpirals.x is used... should .y also be used?
 const vec2 kSpirals = vec2(7.0, 5.0);
 
-// TODO(abarth): Make the shader less sensitive to this parameter.
-const float kSampleRadius = 16.0;  // screen pixels.
+// In units of the viewing volume, as in g_sampler_fragment_src.  Taps are
+// offset by up to kSampleRadius * tap_scale pixels, which must not exceed the
+// apron.
+const float kSampleRadius = 16.0;
+// Must match SsdoSampler::kShadowRadius (C++).
+const int kApron = 16;
+const int kSharedSize = kTileSize + 2 * kApron;
+
+shared float shared_depth[kSharedSize * kSharedSize];
+
+// Returns the depth of the texel nearest to |pos|, relative to the tile.
+float tapDepth(vec2 pos) {
+  ivec2 texel = clamp(ivec2(floor(pos)) + kApron, 0, kSharedSize - 1);
+  return shared_depth[texel.y * kSharedSize + texel.x];
+}
 
 float sampleKeyIllumination(vec2 pos,
                             float fragment_z,
@@ -294,12 +446,9 @@ float sampleKeyIllumination(vec2 pos,
   float theta = key_light0.x + fract(seed.x + alpha * kSpirals.x) * key_light_dispersion;
   float radius = alpha * kSampleRadius;
 
-  float raw_depth = texture(depthTexture,
-                            pos + radius * vec2(cos(theta), sin(theta))).r;
-  float tap_z = raw_depth * -pushed.viewing_volume.z;
-
-  // TODO: use clamp here, once we can use GLSL standard library.
-  return 1.0 - max(0.0, (tap_z - fragment_z) / radius);
+  vec2 tap_delta = radius * pushed.tap_scale * vec2(cos(theta), sin(theta));
+  float tap_z = tapDepth(pos + tap_delta) * -pushed.viewing_volume.z;
+  return 1.0 - clamp((tap_z - fragment_z) / radius, 0.0, 1.0);
 }
 
 float sampleFillIllumination(vec2 pos,
@@ -309,50 +458,218 @@ float sampleFillIllumination(vec2 pos,
   float theta = 2.0 * kPi * (seed.x + alpha * kSpirals.x);
   float radius = alpha * kSampleRadius;
 
-  float raw_depth = texture(depthTexture,
-                            pos + radius * vec2(cos(theta), sin(theta))).r;
-  float tap_z = raw_depth * -pushed.viewing_volume.z;
-
-  return 1.0 - max(0.0, (tap_z - fragment_z) / radius);
+  vec2 tap_delta = radius * pushed.tap_scale * vec2(cos(theta), sin(theta));
+  float tap_z = tapDepth(pos + tap_delta) * -pushed.viewing_volume.z;
+  return 1.0 - clamp((tap_z - fragment_z) / radius, 0.0, 1.0);
 }
 
-// Size of square region that is computed by each invocation of the kernel.
-const int kSize = 4;
 void main() {
-  uint x = gl_GlobalInvocationID.x * kSize;
-  uint y = gl_GlobalInvocationID.y * kSize;
-
-  for (int xx = 0; xx < kSize; ++xx) {
-    for (int yy = 0; yy < kSize; ++yy) {
-      vec2 pos = vec2(x + xx, y + yy);
-      vec2 seed = imageLoad(noiseImage,
-                            ivec2(fract(pos / float(kNoiseSize)).rg)).rg;
-
-      float sampled_depth = texture(depthTexture, pos).r;
-      float fragment_z = sampled_depth * -pushed.viewing_volume.z;
-      float key_light_intensity = pushed.key_light.w;
-      float fill_light_intensity = 1.0 - key_light_intensity;
-
-      float L = 0.0;
-      for (int i = 0; i < kTapCount; ++i) {
-        float alpha = (float(i) + 0.5) / float(kTapCount);
-        L += key_light_intensity * sampleKeyIllumination(pos, fragment_z, alpha, seed);
-        L += fill_light_intensity * sampleFillIllumination(pos, fragment_z, alpha, seed);
-      }
-      L = clamp(L / float(kTapCount), 0.0, 1.0);
+  uint packed_tile = tiles[gl_WorkGroupID.x];
+  ivec2 tile = ivec2(packed_tile & 0xffff, packed_tile >> 16) * kTileSize;
+  ivec2 pixel = tile + ivec2(gl_LocalInvocationID.xy);
+  ivec2 size = textureSize(depth_map, 0);
+  bool in_bounds = all(lessThan(pixel, imageSize(result)));
+
+  // Load the tile and its apron, clamping to the edge of the depth map as
+  // its sampler would.
+  for (int i = int(gl_LocalInvocationIndex); i < kSharedSize * kSharedSize;
+       i += kTileSize * kTileSize) {
+    ivec2 texel = tile - kApron + ivec2(i % kSharedSize, i / kSharedSize);
+    shared_depth[i] = texelFetch(depth_map, clamp(texel, ivec2(0), size - 1),
+                                 0).r;
+  }
+  barrier();
 
-      // TODO: This ensures that shadows aren't pure-black.  Replace this with
-      // something more principled/controllable.
-      L = L * 0.75 + 0.25;
+  if (!in_bounds) {
+    return;
+  }
+
+  vec2 pos = vec2(gl_LocalInvocationID.xy) + 0.5;
+  vec2 seed = fract(texelFetch(noise, pixel % kNoiseSize, 0).rg +
+                    pushed.noise_offset);
+
+  float sampled_depth = tapDepth(pos);
+  float fragment_z = sampled_depth * -pushed.viewing_volume.z;
+  float key_light_intensity = pushed.key_light.w;
+  float fill_light_intensity = 1.0 - key_light_intensity;
+
+  float L = 0.0;
+  for (int i = 0; i < pushed.tap_count; ++i) {
+    float alpha = (float(i) + pushed.tap_jitter) / float(pushed.tap_count);
+    L += key_light_intensity * sampleKeyIllumination(pos, fragment_z, alpha, seed);
+    L += fill_light_intensity * sampleFillIllumination(pos, fragment_z, alpha, seed);
+  }
+  L = clamp(L / float(pushed.tap_count), 0.0, 1.0);
+
+  imageStore(result, pixel, vec4(L, sampled_depth, 0.0, 1.0));
+}
+)GLSL";
 
-      imageStore(resultImage, ivec2(pos), vec4(L, sampled_depth, 0.0, 1.0));
+// Same filter as g_filter_fragment_src, but both the horizontal and the
+// vertical pass are computed by a single dispatch, one 8x8 tile per
+// workgroup.  The tile and an apron of the filter radius are loaded into
+// shared memory, the rows of the tile and of its vertical apron are filtered
+// horizontally into shared memory, and these are then filtered vertically.
+// This approximates running g_filter_fragment_src twice; the difference is
+// that the horizontally filtered values are kept at full precision, rather
+// than being rounded to the 8 bits of an intermediate image.  Only the tiles
+// in the list generated by SsdoAccelerator::GenerateTileList() are
+// dispatched.
+constexpr char g_filter_kernel_src[] = R"GLSL(
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Must match kSsdoAccelDownsampleFactor, which is the size of the tiles.
+const int kTileSize = 8;
+layout(local_size_x = kTileSize, local_size_y = kTileSize) in;
+
+layout (binding = 0) uniform sampler2D illumination;
+layout (binding = 1, rgba8) uniform readonly image2D accelerator;
+layout (binding = 2, rg8) uniform writeonly image2D result;
+
+// Must match SsdoAccelerator::GenerateTileList().
+layout (std430, binding = 3) readonly buffer TileList {
+  uvec4 header;
+  uint tiles[];
+};
+
+layout(push_constant) uniform FilterConfig {
+  float scene_depth;
+} pushed;
+
+// Must match g_filter_fragment_src.
+const int kRadius = 4;
+const int kSharedSize = kTileSize + 2 * kRadius;
+
+// Unfiltered illumination of the tile and its apron.
+shared vec2 unfiltered[kSharedSize * kSharedSize];
+// Horizontally filtered illumination of the tile and its vertical apron.
+shared vec2 horizontal[kSharedSize * kTileSize];
+
+bool isUnshadowed(ivec2 pixel) {
+  ivec2 cell = (pixel / kTileSize) % 4;
+  vec4 accel = imageLoad(accelerator, pixel / (kTileSize * 4));
+  return ((int(accel[cell.y] * 255.0 + 0.5) >> (cell.x * 2)) & 3) == 0;
+}
+
+// Adds the pair of taps at distance |r| from |center| to the weighted sum,
+// as g_filter_fragment_src does.
+void addTaps(vec2 center,
+             vec2 left_tap,
+             vec2 right_tap,
+             int r,
+             inout float sum,
+             inout float total_weight) {
+  float center_key = center.y * pushed.scene_depth;
+  float left_key_weight =
+      max(0.0, 1.0 - abs(left_tap.y * pushed.scene_depth - center_key));
+  float right_key_weight =
+      max(0.0, 1.0 - abs(right_tap.y * pushed.scene_depth - center_key));
+
+  float position_weight = float(kRadius - r + 1) / float(kRadius + 1);
+  float tap_weight = position_weight * left_key_weight * right_key_weight;
+
+  sum += tap_weight * left_tap.x + tap_weight * right_tap.x;
+  total_weight += 2.0 * tap_weight;
+}
+
+void main() {
+  uint packed_tile = tiles[gl_WorkGroupID.x];
+  ivec2 tile = ivec2(packed_tile & 0xffff, packed_tile >> 16) * kTileSize;
+  ivec2 pixel = tile + ivec2(gl_LocalInvocationID.xy);
+  ivec2 size = textureSize(illumination, 0);
+  bool in_bounds = all(lessThan(pixel, imageSize(result)));
+
+  // Load the tile and its apron, clamping to the edge of the illumination
+  // texture as its sampler would.
+  const int kThreads = kTileSize * kTileSize;
+  for (int i = int(gl_LocalInvocationIndex); i < kSharedSize * kSharedSize;
+       i += kThreads) {
+    ivec2 texel = tile - kRadius + ivec2(i % kSharedSize, i / kSharedSize);
+    unfiltered[i] =
+        texelFetch(illumination, clamp(texel, ivec2(0), size - 1), 0).rg;
+  }
+  barrier();
+
+  // Horizontal pass.  Rows of the apron lie in the tiles above and below,
+  // which the two-pass filter leaves unshadowed if the accelerator says so.
+  for (int i = int(gl_LocalInvocationIndex); i < kSharedSize * kTileSize;
+       i += kThreads) {
+    int x = i % kTileSize;
+    int y = i / kTileSize;
+    ivec2 texel = clamp(tile + ivec2(x, y - kRadius), ivec2(0), size - 1);
+    if (isUnshadowed(texel)) {
+      horizontal[i] = vec2(1.0, 0.0);
+      continue;
     }
+    int center_index = y * kSharedSize + x + kRadius;
+    vec2 center = unfiltered[center_index];
+    float sum = center.x;
+    float total_weight = 1.0;
+    for (int r = 1; r <= kRadius; ++r) {
+      addTaps(center, unfiltered[center_index - r],
+              unfiltered[center_index + r], r, sum, total_weight);
+    }
+    horizontal[i] = vec2(sum / total_weight, center.y);
+  }
+  barrier();
+
+  if (!in_bounds) {
+    return;
   }
+
+  // Vertical pass, which the two-pass filter also skips for unshadowed
+  // pixels.
+  if (isUnshadowed(pixel)) {
+    imageStore(result, pixel, vec4(1.0, 0.0, 0.0, 1.0));
+    return;
+  }
+  int center_index =
+      (int(gl_LocalInvocationID.y) + kRadius) * kTileSize +
+      int(gl_LocalInvocationID.x);
+  vec2 center = horizontal[center_index];
+  float sum = center.x;
+  float total_weight = 1.0;
+  for (int r = 1; r <= kRadius; ++r) {
+    addTaps(center, horizontal[center_index - r * kTileSize],
+            horizontal[center_index + r * kTileSize], r, sum, total_weight);
+  }
+  imageStore(result, pixel, vec4(sum / total_weight, center.y, 0.0, 1.0));
 }
 )GLSL";
 
+// Clears |image|, which is in eGeneral layout, to the value of unshadowed
+// pixels, which is what the kernels leave the tiles that they skip as.
+void ClearToUnshadowed(CommandBuffer* command_buffer, const ImagePtr& image) {
+  vk::ClearColorValue clear_value(std::array<float, 4>{{1.f, 0.f, 0.f, 1.f}});
+  vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+  command_buffer->get().clearColorImage(
+      image->get(), vk::ImageLayout::eGeneral, &clear_value, 1, &range);
+
+  vk::ImageMemoryBarrier barrier;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+  barrier.oldLayout = vk::ImageLayout::eGeneral;
+  barrier.newLayout = vk::ImageLayout::eGeneral;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image->get();
+  barrier.subresourceRange = range;
+  command_buffer->get().pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), 0,
+      nullptr, 0, nullptr, 1, &barrier);
+}
+
+struct Pipelines {
+  PipelinePtr sampler;
+  PipelinePtr filter;
+  PipelinePtr upsample;
+  PipelinePtr accumulate;
+};
+
 // TODO: refactor this into a PipelineBuilder class.
-std::pair<PipelinePtr, PipelinePtr> CreatePipelines(
+Pipelines CreatePipelines(
     vk::Device device,
     vk::RenderPass render_pass,
     const MeshShaderBinding& mesh_shader_binding,
@@ -367,6 +684,12 @@ std::pair<PipelinePtr, PipelinePtr> CreatePipelines(
   auto filter_fragment_spirv_future =
       compiler->Compile(vk::ShaderStageFlagBits::eFragment,
                         {{g_filter_fragment_src}}, std::string(), "main");
+  auto upsample_fragment_spirv_future =
+      compiler->Compile(vk::ShaderStageFlagBits::eFragment,
+                        {{g_upsample_fragment_src}}, std::string(), "main");
+  auto accumulate_fragment_spirv_future =
+      compiler->Compile(vk::ShaderStageFlagBits::eFragment,
+                        {{g_accumulate_fragment_src}}, std::string(), "main");
 
   vk::ShaderModule vertex_module;
   {
@@ -469,9 +792,11 @@ std::pair<PipelinePtr, PipelinePtr> CreatePipelines(
   vk::PushConstantRange push_constants;
   push_constants.stageFlags = vk::ShaderStageFlagBits::eFragment;
   push_constants.offset = 0;
-  // This allows us to share a pipeline-layout between two pipelines.
-  push_constants.size = std::max(sizeof(SsdoSampler::SamplerConfig),
-                                 sizeof(SsdoSampler::FilterConfig));
+  // This allows us to share a pipeline-layout between all of the pipelines.
+  push_constants.size = std::max({sizeof(SsdoSampler::SamplerConfig),
+                                  sizeof(SsdoSampler::FilterConfig),
+                                  sizeof(SsdoSampler::UpsampleConfig),
+                                  sizeof(SsdoSampler::AccumulateConfig)});
 
   vk::PipelineLayoutCreateInfo pipeline_layout_info;
   pipeline_layout_info.setLayoutCount = 1;
@@ -533,11 +858,48 @@ std::pair<PipelinePtr, PipelinePtr> CreatePipelines(
   auto filter_pipeline = ftl::MakeRefCounted<Pipeline>(
       device, vk_filter_pipeline, pipeline_layout, PipelineSpec());
 
+  // Pipeline configuration specific to the SSDO upsample pass.
+  vk::ShaderModule upsample_fragment_module;
+  {
+    SpirvData spirv = upsample_fragment_spirv_future.get();
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = spirv.size() * sizeof(uint32_t);
+    module_info.pCode = spirv.data();
+    upsample_fragment_module =
+        ESCHER_CHECKED_VK_RESULT(device.createShaderModule(module_info));
+  }
+  fragment_stage_info.module = upsample_fragment_module;
+  vk::Pipeline vk_upsample_pipeline = ESCHER_CHECKED_VK_RESULT(
+      device.createGraphicsPipeline(nullptr, pipeline_info));
+  auto upsample_pipeline = ftl::MakeRefCounted<Pipeline>(
+      device, vk_upsample_pipeline, pipeline_layout, PipelineSpec());
+
+  // Pipeline configuration specific to the SSDO accumulation pass.
+  vk::ShaderModule accumulate_fragment_module;
+  {
+    SpirvData spirv = accumulate_fragment_spirv_future.get();
+
+    vk::ShaderModuleCreateInfo module_info;
+    module_info.codeSize = spirv.size() * sizeof(uint32_t);
+    module_info.pCode = spirv.data();
+    accumulate_fragment_module =
+        ESCHER_CHECKED_VK_RESULT(device.createShaderModule(module_info));
+  }
+  fragment_stage_info.module = accumulate_fragment_module;
+  vk::Pipeline vk_accumulate_pipeline = ESCHER_CHECKED_VK_RESULT(
+      device.createGraphicsPipeline(nullptr, pipeline_info));
+  auto accumulate_pipeline = ftl::MakeRefCounted<Pipeline>(
+      device, vk_accumulate_pipeline, pipeline_layout, PipelineSpec());
+
   device.destroyShaderModule(vertex_module);
   device.destroyShaderModule(sampler_fragment_module);
   device.destroyShaderModule(filter_fragment_module);
+  device.destroyShaderModule(upsample_fragment_module);
+  device.destroyShaderModule(accumulate_fragment_module);
 
-  return {sampler_pipeline, filter_pipeline};
+  return {sampler_pipeline, filter_pipeline, upsample_pipeline,
+          accumulate_pipeline};
 }
 
 vk::RenderPass CreateRenderPass(vk::Device device) {
@@ -627,10 +989,17 @@ SsdoSampler::SsdoSampler(Escher* escher,
       render_pass_(CreateRenderPass(device_)),
       sampler_kernel_(escher,
                       {vk::ImageLayout::eShaderReadOnlyOptimal,
-                       vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral},
-                      {},
+                       vk::ImageLayout::eShaderReadOnlyOptimal,
+                       vk::ImageLayout::eGeneral},
+                      {vk::DescriptorType::eStorageBuffer},
                       sizeof(SamplerConfig),
-                      g_sampler_kernel_src) {
+                      g_sampler_kernel_src),
+      filter_kernel_(escher,
+                     {vk::ImageLayout::eShaderReadOnlyOptimal,
+                      vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral},
+                     {vk::DescriptorType::eStorageBuffer},
+                     sizeof(float),
+                     g_filter_kernel_src) {
   FTL_DCHECK(noise_image->width() == kNoiseSize &&
              noise_image->height() == kNoiseSize);
 
@@ -641,8 +1010,10 @@ SsdoSampler::SsdoSampler(Escher* escher,
       CreatePipelines(device_, render_pass_,
                       model_data->GetMeshShaderBinding(full_screen_->spec()),
                       pool_.layout(), escher->glsl_compiler());
-  sampler_pipeline_ = pipelines.first;
-  filter_pipeline_ = pipelines.second;
+  sampler_pipeline_ = pipelines.sampler;
+  filter_pipeline_ = pipelines.filter;
+  upsample_pipeline_ = pipelines.upsample;
+  accumulate_pipeline_ = pipelines.accumulate;
 }
 
 SsdoSampler::~SsdoSampler() {
@@ -688,6 +1059,7 @@ SsdoSampler::GetDescriptorSetLayoutCreateInfo() {
 
 void SsdoSampler::Sample(CommandBuffer* command_buffer,
                          const FramebufferPtr& framebuffer,
+                         const vk::Rect2D& render_area,
                          const TexturePtr& depth_texture,
                          const TexturePtr& accelerator_texture,
                          const SamplerConfig* push_constants) {
@@ -738,7 +1110,8 @@ void SsdoSampler::Sample(CommandBuffer* command_buffer,
 
   vk::ClearValue clear_value(
       vk::ClearColorValue(std::array<uint32_t, 4>{{0, 0, 0, 0}}));
-  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1);
+  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1,
+                                  render_area);
   {
     auto vk_pipeline_layout = sampler_pipeline_->layout();
 
@@ -758,27 +1131,40 @@ void SsdoSampler::Sample(CommandBuffer* command_buffer,
   command_buffer->EndRenderPass();
 }
 
-// TODO: this is currently EXTREMELY slow.  We need to dispatch far fewer
-// threads, but dispatching 1/16th as many (as we would if we batched 4x4
-// regions) is still very slow, even without modifying the kernel to do 16x as
-// much work in each invocation!  Something else is wrong, and figuring out what
-// probably needs better tools.  For now, the fragment shader version should be
-// used instead.
 void SsdoSampler::SampleUsingKernel(CommandBuffer* command_buffer,
+                                    const BufferPtr& tile_list,
                                     const TexturePtr& depth_texture,
                                     const TexturePtr& output_texture,
                                     const SamplerConfig* push_constants) {
   FTL_DCHECK(depth_texture->width() == output_texture->width());
   FTL_DCHECK(depth_texture->height() == output_texture->height());
-  uint32_t width = depth_texture->width();
-  uint32_t height = depth_texture->width();
+  // Taps must stay within the apron of depths that is loaded for each tile.
+  FTL_DCHECK(push_constants->tap_scale <= 1.f);
+
+  ClearToUnshadowed(command_buffer, output_texture->image());
+  sampler_kernel_.DispatchIndirect(
+      {depth_texture, noise_texture_, output_texture}, {tile_list},
+      command_buffer, tile_list, 0, push_constants);
+}
 
-  sampler_kernel_.Dispatch({depth_texture, output_texture, noise_texture_}, {},
-                           command_buffer, width, height, 1, push_constants);
+void SsdoSampler::FilterUsingKernel(CommandBuffer* command_buffer,
+                                    const BufferPtr& tile_list,
+                                    const TexturePtr& unfiltered_illumination,
+                                    const TexturePtr& accelerator_texture,
+                                    const TexturePtr& output_texture,
+                                    float scene_depth) {
+  FTL_DCHECK(unfiltered_illumination->width() == output_texture->width());
+  FTL_DCHECK(unfiltered_illumination->height() == output_texture->height());
+
+  ClearToUnshadowed(command_buffer, output_texture->image());
+  filter_kernel_.DispatchIndirect(
+      {unfiltered_illumination, accelerator_texture, output_texture},
+      {tile_list}, command_buffer, tile_list, 0, &scene_depth);
 }
 
 void SsdoSampler::Filter(CommandBuffer* command_buffer,
                          const FramebufferPtr& framebuffer,
+                         const vk::Rect2D& render_area,
                          const TexturePtr& unfiltered_illumination,
                          const TexturePtr& accelerator_texture,
                          const FilterConfig* push_constants) {
@@ -831,7 +1217,8 @@ void SsdoSampler::Filter(CommandBuffer* command_buffer,
 
   vk::ClearValue clear_value(
       vk::ClearColorValue(std::array<uint32_t, 4>{{0, 0, 0, 0}}));
-  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1);
+  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1,
+                                  render_area);
   {
     auto vk_pipeline_layout = sampler_pipeline_->layout();
 
@@ -851,13 +1238,166 @@ void SsdoSampler::Filter(CommandBuffer* command_buffer,
   command_buffer->EndRenderPass();
 }
 
+void SsdoSampler::Upsample(CommandBuffer* command_buffer,
+                           const FramebufferPtr& framebuffer,
+                           const vk::Rect2D& render_area,
+                           const TexturePtr& filtered_illumination,
+                           const TexturePtr& depth_texture,
+                           const UpsampleConfig* push_constants) {
+  auto vk_command_buffer = command_buffer->get();
+  auto descriptor_set = pool_.Allocate(1, command_buffer)->get(0);
+
+  vk::Viewport viewport;
+  viewport.width = framebuffer->width();
+  viewport.height = framebuffer->height();
+  vk_command_buffer.setViewport(0, 1, &viewport);
+
+  constexpr uint32_t kUpdatedDescriptorCount = 3;
+  vk::WriteDescriptorSet writes[kUpdatedDescriptorCount];
+  for (uint32_t i = 0; i < kUpdatedDescriptorCount; ++i) {
+    // Common to all image descriptors.
+    writes[i].dstSet = descriptor_set;
+    writes[i].dstArrayElement = 0;
+    writes[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    writes[i].descriptorCount = 1;
+  }
+
+  // Specific to illumination texture.
+  vk::DescriptorImageInfo light_tex_info;
+  light_tex_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  light_tex_info.imageView = filtered_illumination->image_view();
+  light_tex_info.sampler = filtered_illumination->sampler();
+  writes[0].dstBinding = 0;
+  writes[0].pImageInfo = &light_tex_info;
+
+  // Specific to depth texture.
+  vk::DescriptorImageInfo depth_texture_info;
+  depth_texture_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  depth_texture_info.imageView = depth_texture->image_view();
+  depth_texture_info.sampler = depth_texture->sampler();
+  writes[1].dstBinding = 1;
+  writes[1].pImageInfo = &depth_texture_info;
+
+  // Specific to noise texture.
+  // TODO: this is unused by the shader, but we set it anyway so that we can
+  // use the same pipeline-layout for all pipelines.
+  vk::DescriptorImageInfo noise_texture_info;
+  noise_texture_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  noise_texture_info.imageView = noise_texture_->image_view();
+  noise_texture_info.sampler = noise_texture_->sampler();
+  writes[2].dstBinding = 2;
+  writes[2].pImageInfo = &noise_texture_info;
+
+  device_.updateDescriptorSets(kUpdatedDescriptorCount, writes, 0, nullptr);
+
+  vk::ClearValue clear_value(
+      vk::ClearColorValue(std::array<uint32_t, 4>{{0, 0, 0, 0}}));
+  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1,
+                                  render_area);
+  {
+    auto vk_pipeline_layout = upsample_pipeline_->layout();
+
+    vk_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                   upsample_pipeline_->get());
+
+    vk_command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics, vk_pipeline_layout,
+        kTextureDescriptorSetBindIndex, 1, &descriptor_set, 0, nullptr);
+
+    vk_command_buffer.pushConstants(vk_pipeline_layout,
+                                    vk::ShaderStageFlagBits::eFragment, 0,
+                                    sizeof(UpsampleConfig), push_constants);
+
+    command_buffer->DrawMesh(full_screen_);
+  }
+  command_buffer->EndRenderPass();
+}
+
+void SsdoSampler::Accumulate(CommandBuffer* command_buffer,
+                             const FramebufferPtr& framebuffer,
+                             const vk::Rect2D& render_area,
+                             const TexturePtr& unfiltered_illumination,
+                             const TexturePtr& history_texture,
+                             const TexturePtr& depth_texture,
+                             const AccumulateConfig* push_constants) {
+  auto vk_command_buffer = command_buffer->get();
+  auto descriptor_set = pool_.Allocate(1, command_buffer)->get(0);
+
+  vk::Viewport viewport;
+  viewport.width = framebuffer->width();
+  viewport.height = framebuffer->height();
+  vk_command_buffer.setViewport(0, 1, &viewport);
+
+  constexpr uint32_t kUpdatedDescriptorCount = 3;
+  vk::WriteDescriptorSet writes[kUpdatedDescriptorCount];
+  for (uint32_t i = 0; i < kUpdatedDescriptorCount; ++i) {
+    // Common to all image descriptors.
+    writes[i].dstSet = descriptor_set;
+    writes[i].dstArrayElement = 0;
+    writes[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    writes[i].descriptorCount = 1;
+  }
+
+  // Specific to illumination texture.
+  vk::DescriptorImageInfo light_tex_info;
+  light_tex_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  light_tex_info.imageView = unfiltered_illumination->image_view();
+  light_tex_info.sampler = unfiltered_illumination->sampler();
+  writes[0].dstBinding = 0;
+  writes[0].pImageInfo = &light_tex_info;
+
+  // Specific to history texture.
+  vk::DescriptorImageInfo history_texture_info;
+  history_texture_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  history_texture_info.imageView = history_texture->image_view();
+  history_texture_info.sampler = history_texture->sampler();
+  writes[1].dstBinding = 1;
+  writes[1].pImageInfo = &history_texture_info;
+
+  // Specific to depth texture, which takes the place of the noise texture.
+  vk::DescriptorImageInfo depth_texture_info;
+  depth_texture_info.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  depth_texture_info.imageView = depth_texture->image_view();
+  depth_texture_info.sampler = depth_texture->sampler();
+  writes[2].dstBinding = 2;
+  writes[2].pImageInfo = &depth_texture_info;
+
+  device_.updateDescriptorSets(kUpdatedDescriptorCount, writes, 0, nullptr);
+
+  vk::ClearValue clear_value(
+      vk::ClearColorValue(std::array<uint32_t, 4>{{0, 0, 0, 0}}));
+  command_buffer->BeginRenderPass(render_pass_, framebuffer, &clear_value, 1,
+                                  render_area);
+  {
+    auto vk_pipeline_layout = accumulate_pipeline_->layout();
+
+    vk_command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                                   accumulate_pipeline_->get());
+
+    vk_command_buffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics, vk_pipeline_layout,
+        kTextureDescriptorSetBindIndex, 1, &descriptor_set, 0, nullptr);
+
+    vk_command_buffer.pushConstants(vk_pipeline_layout,
+                                    vk::ShaderStageFlagBits::eFragment, 0,
+                                    sizeof(AccumulateConfig), push_constants);
+
+    command_buffer->DrawMesh(full_screen_);
+  }
+  command_buffer->EndRenderPass();
+}
+
 SsdoSampler::SamplerConfig::SamplerConfig(const Stage& stage)
     : key_light(vec4(stage.key_light().direction(),
                      stage.key_light().dispersion(),
                      stage.key_light().intensity())),
       viewing_volume(vec3(stage.viewing_volume().width(),
                           stage.viewing_volume().height(),
-                          stage.viewing_volume().depth())) {}
+                          stage.viewing_volume().depth())),
+      noise_offset(0.f),
+      tap_jitter(0.5f),
+      tap_count(kTapCount),
+      tap_scale(1.f) {}
 
 }  // namespace impl
 }  // namespace escher
@@ -32,6 +32,9 @@ class SsdoSampler {
   // Must match the fragment shader in ssdo_sampler.cc
   constexpr static uint32_t kSsdoAccelDownsampleFactor = 8;
 
+  // Default number of samples that Sample() takes per pixel.
+  constexpr static int32_t kTapCount = 8;
+
   // TODO: eR8G8Srgb would be preferable, but must check if it is supported.
   // TODO: validate this choice via performance profiling.
   const static vk::Format kColorFormat = vk::Format::eR8G8Unorm;
@@ -39,6 +42,16 @@ class SsdoSampler {
   struct SamplerConfig {
     vec4 key_light;
     vec3 viewing_volume;
+    // Varied from frame to frame when the results of several frames are
+    // accumulated, so that each frame samples different points; see
+    // Accumulate().
+    float noise_offset;
+    float tap_jitter;
+    int32_t tap_count;
+    // Pixels of the depth texture per unit of the viewing volume, by which
+    // SampleUsingKernel() scales its taps, so that they span the same part of
+    // the scene as those of Sample() at any resolution.  At most 1.
+    float tap_scale;
 
     // Convenient way to populate SamplerConfig from a Stage.
     SamplerConfig(const Stage& stage);
@@ -49,6 +62,26 @@ class SsdoSampler {
     float scene_depth;
   };
 
+  struct AccumulateConfig {
+    // Maps (u, v, depth, 1) in the current frame to the same point in the
+    // frame that the history was accumulated in.
+    mat4 reprojection;
+    // The part of the history texture, in UV, that holds the scene.
+    vec2 uv_limit;
+    float scene_depth;
+    // Weight of the current frame's samples, where the history is valid.
+    float blend;
+  };
+
+  struct UpsampleConfig {
+    // Converts framebuffer coordinates to texel coordinates of the
+    // low-resolution illumination texture.
+    vec2 frag_coord_to_texel;
+    // Converts texel coordinates of the illumination texture to UV.
+    vec2 texel_to_uv;
+    float scene_depth;
+  };
+
   static const vk::DescriptorSetLayoutCreateInfo&
   GetDescriptorSetLayoutCreateInfo();
 
@@ -59,32 +92,79 @@ class SsdoSampler {
   ~SsdoSampler();
 
   // Stochastic sampling to determine obscurance.  The output requires filtering
-  // to reduce noise.
+  // to reduce noise.  Only |render_area| of |framebuffer| is written; depth is
+  // sampled up to kShadowRadius pixels beyond it.
   void Sample(CommandBuffer* command_buffer,
               const FramebufferPtr& framebuffer,
+              const vk::Rect2D& render_area,
               const TexturePtr& depth_texture,
               const TexturePtr& accelerator_texture,
               const SamplerConfig* push_constants);
 
   // Same algorithm as Sample(), implemented with a compute kernel instead of
-  // a fragment shader.  Currently very inefficient, but keeping around for
-  // experimentation: it seems that there's no fundamental reason that this
-  // version cannot exceed the performance of the fragment shader version.
-  // TODO: improve or delete.
+  // a fragment shader.  Each workgroup computes one 8x8 tile of |tile_list|,
+  // as generated by SsdoAccelerator::GenerateTileList(), reading depth from
+  // shared memory into which the tile and an apron of kShadowRadius pixels
+  // are loaded once; the rest of |output_texture| is cleared to unshadowed.
+  // |depth_texture| is read in eShaderReadOnlyOptimal layout, while
+  // |output_texture| must be a storage image in eGeneral layout, which can
+  // also be cleared.  Taps are offset in pixels of |output_texture|, scaled
+  // by the config's |tap_scale|.
   void SampleUsingKernel(CommandBuffer* command_buffer,
+                         const BufferPtr& tile_list,
                          const TexturePtr& depth_texture,
                          const TexturePtr& output_texture,
                          const SamplerConfig* push_constants);
 
   // Filter the noisy output from Sample().  This should be called twice, to
   // filter in a horizontal and a vertical direction (the direction is selected
-  // by the FilterConfig's 'stride' parameter).
+  // by the FilterConfig's 'stride' parameter).  Only |render_area| of
+  // |framebuffer| is written.
   void Filter(CommandBuffer* command_buffer,
               const FramebufferPtr& framebuffer,
+              const vk::Rect2D& render_area,
               const TexturePtr& unfiltered_illumination,
               const TexturePtr& accelerator_texture,
               const FilterConfig* push_constants);
 
+  // Same filter as calling Filter() twice, horizontally and then vertically,
+  // implemented with a single compute dispatch that keeps the intermediate
+  // result in shared memory, at full precision.  Only the 8x8 tiles of
+  // |tile_list| are filtered, as in SampleUsingKernel().
+  // |unfiltered_illumination| is read in eShaderReadOnlyOptimal layout, while
+  // |accelerator_texture| and |output_texture| must be storage images in
+  // eGeneral layout.
+  void FilterUsingKernel(CommandBuffer* command_buffer,
+                         const BufferPtr& tile_list,
+                         const TexturePtr& unfiltered_illumination,
+                         const TexturePtr& accelerator_texture,
+                         const TexturePtr& output_texture,
+                         float scene_depth);
+
+  // Blend the noisy output from Sample() into |history_texture|, the result of
+  // the previous call, reprojected according to the AccumulateConfig.  Where
+  // the depth in the history does not match, the history is discarded.  Only
+  // |render_area| of |framebuffer| is written.
+  void Accumulate(CommandBuffer* command_buffer,
+                  const FramebufferPtr& framebuffer,
+                  const vk::Rect2D& render_area,
+                  const TexturePtr& unfiltered_illumination,
+                  const TexturePtr& history_texture,
+                  const TexturePtr& depth_texture,
+                  const AccumulateConfig* push_constants);
+
+  // Upsample the output of Filter() or Accumulate(), which was computed at a
+  // reduced resolution, to the resolution of |framebuffer|, which must match
+  // that of |depth_texture|.  Low-resolution texels are weighted by how close
+  // their depths are to that of each fragment, so that shadow edges remain
+  // crisp at silhouettes.  Only |render_area| of |framebuffer| is written.
+  void Upsample(CommandBuffer* command_buffer,
+                const FramebufferPtr& framebuffer,
+                const vk::Rect2D& render_area,
+                const TexturePtr& filtered_illumination,
+                const TexturePtr& depth_texture,
+                const UpsampleConfig* push_constants);
+
   // TODO: This is exposed so that PaperRenderer can use it to create
   // Framebuffers, but it would be nice to find a way to remove this.
   vk::RenderPass render_pass() { return render_pass_; }
@@ -97,7 +177,10 @@ class SsdoSampler {
   vk::RenderPass render_pass_;
   PipelinePtr sampler_pipeline_;
   PipelinePtr filter_pipeline_;
+  PipelinePtr upsample_pipeline_;
+  PipelinePtr accumulate_pipeline_;
   ComputeShader sampler_kernel_;
+  ComputeShader filter_kernel_;
 };
 
 }  // namespace impl
@@ -16,10 +16,12 @@ constexpr vk::DeviceSize kBufferSize = 65536;
 
 UniformBufferPool::UniformBufferPool(Escher* escher,
                                      GpuAllocator* allocator,
-                                     vk::MemoryPropertyFlags additional_flags)
+                                     vk::MemoryPropertyFlags additional_flags,
+                                     vk::BufferUsageFlags additional_usage)
     : ResourceManager(escher),
       allocator_(allocator ? allocator : escher->gpu_allocator()),
       flags_(additional_flags | vk::MemoryPropertyFlagBits::eHostVisible),
+      usage_(additional_usage | vk::BufferUsageFlagBits::eUniformBuffer),
       buffer_size_(kBufferSize) {}
 
 UniformBufferPool::~UniformBufferPool() {}
@@ -39,7 +41,7 @@ void UniformBufferPool::InternalAllocate() {
   vk::Buffer new_buffers[kBufferBatchSize];
   vk::BufferCreateInfo info;
   info.size = buffer_size_;
-  info.usage = vk::BufferUsageFlagBits::eUniformBuffer;
+  info.usage = usage_;
   info.sharingMode = vk::SharingMode::eExclusive;
   for (uint32_t i = 0; i < kBufferBatchSize; ++i) {
     new_buffers[i] = ESCHER_CHECKED_VK_RESULT(device().createBuffer(info));
@@ -18,14 +18,16 @@ namespace impl {
 // to the pool upon destruction.  If necessary, it will grow by creating new
 // buffers (and allocating backing memory for them).  |additional_flags| allows
 // the user to customize the memory that is allocated by the pool; by default,
-// only eHostVisible is used.  Not thread-safe.
+// only eHostVisible is used.  Similarly, |additional_usage| allows the buffers
+// to be used for other purposes, e.g. as vertex buffers.  Not thread-safe.
 class UniformBufferPool : public ResourceManager {
  public:
   UniformBufferPool(
       Escher* escher,
       // If no allocator is provided, Escher's default allocator will be used.
       GpuAllocator* allocator = nullptr,
-      vk::MemoryPropertyFlags additional_flags = vk::MemoryPropertyFlags());
+      vk::MemoryPropertyFlags additional_flags = vk::MemoryPropertyFlags(),
+      vk::BufferUsageFlags additional_usage = vk::BufferUsageFlags());
   ~UniformBufferPool();
 
   BufferPtr Allocate();
@@ -44,6 +46,9 @@ class UniformBufferPool : public ResourceManager {
   // host-visible and coherent).
   const vk::MemoryPropertyFlags flags_;
 
+  // Specify how the pool's buffers may be used.
+  const vk::BufferUsageFlags usage_;
+
   // The size of each allocated buffer.
   const vk::DeviceSize buffer_size_;
 
@@ -61,6 +61,27 @@ uint32_t GetMemoryTypeIndex(vk::PhysicalDevice device,
   return 0;
 }
 
+vk::MemoryPropertyFlags GetSupportedMemoryProperties(
+    vk::PhysicalDevice device,
+    uint32_t type_bits,
+    vk::MemoryPropertyFlags properties) {
+  if (!(properties & vk::MemoryPropertyFlagBits::eLazilyAllocated)) {
+    return properties;
+  }
+  vk::PhysicalDeviceMemoryProperties memory_types =
+      device.getMemoryProperties();
+  for (uint32_t i = 0; i < memory_types.memoryTypeCount; ++i) {
+    if ((type_bits & 1) == 1) {
+      auto available_properties = memory_types.memoryTypes[i].propertyFlags;
+      if ((available_properties & properties) == properties)
+        return properties;
+    }
+    type_bits >>= 1;
+  }
+  return properties & ~vk::MemoryPropertyFlags(
+                          vk::MemoryPropertyFlagBits::eLazilyAllocated);
+}
+
 // Return the sample-count corresponding to the specified flag-bits.
 uint32_t SampleCountFlagBitsToInt(vk::SampleCountFlagBits bits) {
   switch (bits) {
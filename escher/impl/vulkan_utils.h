@@ -56,6 +56,15 @@ uint32_t GetMemoryTypeIndex(vk::PhysicalDevice device,
                             uint32_t type_bits,
                             vk::MemoryPropertyFlags required_properties);
 
+// Return |properties| for allocating memory of one of the types specified by
+// |type_bits|, minus eLazilyAllocated if none of those types has it along with
+// the other flags.  Lazily-allocated memory is typically only supported by
+// tile-based GPUs, and only for some images, but is merely an optimization.
+vk::MemoryPropertyFlags GetSupportedMemoryProperties(
+    vk::PhysicalDevice device,
+    uint32_t type_bits,
+    vk::MemoryPropertyFlags properties);
+
 // Return the sample-count corresponding to the specified flag-bits.
 uint32_t SampleCountFlagBitsToInt(vk::SampleCountFlagBits bits);
 
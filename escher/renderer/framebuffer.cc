@@ -52,7 +52,8 @@ Framebuffer::Framebuffer(Escher* escher,
                          uint32_t width,
                          uint32_t height,
                          std::vector<ImagePtr> images,
-                         vk::RenderPass render_pass)
+                         vk::RenderPass render_pass,
+                         bool retain_images)
     : Resource(escher->resource_recycler()),
       width_(width),
       height_(height),
@@ -93,6 +94,10 @@ Framebuffer::Framebuffer(Escher* escher,
   info.height = height;
   info.layers = 1;
   framebuffer_ = ESCHER_CHECKED_VK_RESULT(device.createFramebuffer(info));
+
+  if (!retain_images) {
+    images_.clear();
+  }
 }
 
 Framebuffer::~Framebuffer() {
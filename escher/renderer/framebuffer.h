@@ -16,11 +16,15 @@ class Framebuffer : public Resource {
   static const ResourceTypeInfo kTypeInfo;
   const ResourceTypeInfo& type_info() const override { return kTypeInfo; }
 
+  // If |retain_images| is false, the caller is responsible for destroying the
+  // Framebuffer before it is used again after any of its images is destroyed;
+  // see impl::FramebufferCache.
   Framebuffer(Escher* escher,
               uint32_t width,
               uint32_t height,
               std::vector<ImagePtr> images,
-              vk::RenderPass render_pass);
+              vk::RenderPass render_pass,
+              bool retain_images = true);
   Framebuffer(impl::EscherImpl* escher_impl,
               uint32_t width,
               uint32_t height,
@@ -40,6 +44,7 @@ class Framebuffer : public Resource {
   uint32_t width() const { return width_; }
   uint32_t height() const { return height_; }
 
+  // Only valid if the images were retained.
   const ImagePtr& get_image(uint32_t index) const { return images_.at(index); }
 
  private:
@@ -4,11 +4,24 @@
 
 #include "escher/renderer/image.h"
 
+#include <atomic>
+
 #include "escher/impl/vulkan_utils.h"
 #include "escher/vk/gpu_mem.h"
 
 namespace escher {
 
+namespace {
+
+// Images may be created on any thread, and their uids must be unique because
+// they key cached framebuffers; see impl::FramebufferCache.
+uint64_t NextImageUid() {
+  static std::atomic<uint64_t> next_uid(1);
+  return next_uid++;
+}
+
+}  // namespace
+
 const ResourceTypeInfo Image::kTypeInfo("Image",
                                         ResourceType::kResource,
                                         ResourceType::kWaitableResource,
@@ -20,6 +33,7 @@ Image::Image(ResourceManager* image_owner,
              GpuMemPtr mem)
     : WaitableResource(image_owner),
       info_(info),
+      uid_(NextImageUid()),
       image_(vk_image),
       mem_(std::move(mem)) {
   // TODO: How do we future-proof this in case more formats are added?
@@ -49,6 +63,9 @@ Image::Image(ResourceManager* image_owner,
 }
 
 Image::~Image() {
+  for (auto& pair : image_views_) {
+    vulkan_context().device.destroyImageView(pair.second);
+  }
   if (!mem_) {
     // Probably a swapchain image.  We don't own the image or the memory.
     FTL_LOG(INFO) << "Destroying Image with unowned VkImage (perhaps a "
@@ -58,6 +75,28 @@ Image::~Image() {
   }
 }
 
+vk::ImageView Image::GetImageView(vk::ImageAspectFlags aspect_mask) {
+  for (auto& pair : image_views_) {
+    if (pair.first == aspect_mask) {
+      return pair.second;
+    }
+  }
+
+  vk::ImageViewCreateInfo view_info;
+  view_info.viewType = vk::ImageViewType::e2D;
+  view_info.subresourceRange.baseMipLevel = 0;
+  view_info.subresourceRange.levelCount = 1;
+  view_info.subresourceRange.baseArrayLayer = 0;
+  view_info.subresourceRange.layerCount = 1;
+  view_info.subresourceRange.aspectMask = aspect_mask;
+  view_info.format = format();
+  view_info.image = image_;
+  vk::ImageView image_view = ESCHER_CHECKED_VK_RESULT(
+      vulkan_context().device.createImageView(view_info));
+  image_views_.emplace_back(aspect_mask, image_view);
+  return image_view;
+}
+
 vk::DeviceSize Image::memory_offset() const {
   return mem_->offset() + mem_offset_;
 }
@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <utility>
+#include <vector>
+
 #include "escher/forward_declarations.h"
 #include "escher/renderer/semaphore_wait.h"
 #include "escher/resources/waitable_resource.h"
@@ -46,6 +49,10 @@ class Image : public WaitableResource {
   Image(ResourceManager* image_owner, ImageInfo info, vk::Image, GpuMemPtr mem);
 
   const ImageInfo& info() const { return info_; }
+  // Identifies the Image among all that have ever been created.  Unlike its
+  // address or its vk::Image, it is never reused once the Image is destroyed,
+  // and so can safely identify it in a cache that does not retain it.
+  uint64_t uid() const { return uid_; }
   vk::Image get() const { return image_; }
   vk::Format format() const { return info_.format; }
   uint32_t width() const { return info_.width; }
@@ -53,17 +60,26 @@ class Image : public WaitableResource {
   bool has_depth() const { return has_depth_; }
   bool has_stencil() const { return has_stencil_; }
   const GpuMemPtr& memory() const { return mem_; }
+
+  // Return a 2D view of the image's single mip level, for the aspects in
+  // |aspect_mask|.  Views are created on demand, and are owned by the Image,
+  // so that they survive when it is recycled (e.g. by an ImageCache); they
+  // are destroyed along with the Image.
+  vk::ImageView GetImageView(vk::ImageAspectFlags aspect_mask);
   // Offset of the Image within it's GpuMem + the offset of the GpuMem within
   // its slab.  NOTE: not the same as memory()->offset().
   vk::DeviceSize memory_offset() const;
 
  private:
   const ImageInfo info_;
+  const uint64_t uid_;
   const vk::Image image_;
   GpuMemPtr mem_;
   const vk::DeviceSize mem_offset_ = 0;
   bool has_depth_;
   bool has_stencil_;
+  // Indexed by aspect mask; rarely more than one.
+  std::vector<std::pair<vk::ImageAspectFlags, vk::ImageView>> image_views_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(Image);
 };
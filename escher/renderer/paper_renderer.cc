@@ -4,32 +4,39 @@
 
 #include "escher/renderer/paper_renderer.h"
 
+#include <algorithm>
+#include <cmath>
+
+#include "escher/escher.h"
 #include "escher/geometry/tessellation.h"
 #include "escher/impl/command_buffer.h"
 #include "escher/impl/command_buffer_pool.h"
+#include "escher/impl/damage_tracker.h"
+#include "escher/impl/depth_pyramid.h"
 #include "escher/impl/escher_impl.h"
+#include "escher/impl/framebuffer_cache.h"
 #include "escher/impl/image_cache.h"
+#include "escher/impl/layer_cache.h"
 #include "escher/impl/mesh_manager.h"
 #include "escher/impl/model_data.h"
 #include "escher/impl/model_display_list.h"
 #include "escher/impl/model_pipeline_cache.h"
 #include "escher/impl/model_renderer.h"
+#include "escher/impl/object_key.h"
+#include "escher/impl/render_graph.h"
 #include "escher/impl/ssdo_accelerator.h"
 #include "escher/impl/ssdo_sampler.h"
 #include "escher/impl/vulkan_utils.h"
 #include "escher/renderer/framebuffer.h"
 #include "escher/renderer/image.h"
 #include "escher/scene/camera.h"
+#include "escher/scene/layer.h"
 #include "escher/scene/model.h"
+#include "escher/scene/stage.h"
 #include "escher/util/depth_to_color.h"
 #include "escher/util/image_utils.h"
 #include "escher/util/trace_macros.h"
-
-// If 1 uses a compute kernel to perform SSDO sampling, otherwise uses a
-// fragment shader.  For not-yet-understood reasons, the compute kernel is
-// drastically inefficient.
-// TODO: try to improve the compute kernel, and if that fails, delete this code.
-#define SSDO_SAMPLING_USES_KERNEL 0
+#include "escher/vk/gpu_mem.h"
 
 namespace escher {
 
@@ -44,9 +51,71 @@ constexpr float kMaxDepth = 1.f;
 constexpr uint32_t kSsdoAccelDownsampleFactor =
     impl::SsdoSampler::kSsdoAccelDownsampleFactor;
 
+// Radius of shadows, in screen pixels.  Determines how far beyond the damaged
+// parts of a frame must be rendered again.
+constexpr uint32_t kShadowRadius = impl::SsdoSampler::kShadowRadius;
+
 constexpr bool kSkipFiltering = false;
 
-constexpr uint32_t kLightingPassSampleCount = 1;
+// Number of SSDO samples per pixel in frames that are accumulated with the
+// history of previous frames, and the weight of each such frame's samples.
+constexpr int32_t kTemporalSsdoTapCount = impl::SsdoSampler::kTapCount / 4;
+constexpr float kTemporalSsdoBlend = 0.2f;
+
+// Enough for several full-screen layers.
+constexpr vk::DeviceSize kDefaultLayerMemoryBudget = 64 * 1024 * 1024;
+
+// Return |rect| expanded by |margin| pixels in each direction, and clamped to
+// an image of the specified size.
+vk::Rect2D ExpandRect(const vk::Rect2D& rect,
+                      uint32_t margin,
+                      uint32_t width,
+                      uint32_t height) {
+  const int32_t x0 = std::max(rect.offset.x - static_cast<int32_t>(margin), 0);
+  const int32_t y0 = std::max(rect.offset.y - static_cast<int32_t>(margin), 0);
+  const int32_t x1 = std::min(
+      rect.offset.x + static_cast<int32_t>(rect.extent.width + margin),
+      static_cast<int32_t>(width));
+  const int32_t y1 = std::min(
+      rect.offset.y + static_cast<int32_t>(rect.extent.height + margin),
+      static_cast<int32_t>(height));
+  vk::Rect2D result;
+  result.offset = vk::Offset2D{x0, y0};
+  result.extent = vk::Extent2D{static_cast<uint32_t>(x1 - x0),
+                               static_cast<uint32_t>(y1 - y0)};
+  return result;
+}
+
+// Return the matrix that maps normalized device coordinates to the UV
+// coordinates of an image, whose top-left |uv_limit| holds the viewport.
+// Depth is unchanged.
+mat4 UvFromNdc(vec2 uv_limit) {
+  mat4 result(1.f);
+  result[0][0] = 0.5f * uv_limit.x;
+  result[1][1] = 0.5f * uv_limit.y;
+  result[3][0] = 0.5f * uv_limit.x;
+  result[3][1] = 0.5f * uv_limit.y;
+  return result;
+}
+
+// Return the rectangle of an image downsampled by |factor| that covers |rect|,
+// clamped to the downsampled image's size.
+vk::Rect2D DownsampleRect(const vk::Rect2D& rect,
+                          uint32_t factor,
+                          uint32_t width,
+                          uint32_t height) {
+  const uint32_t x0 = rect.offset.x / factor;
+  const uint32_t y0 = rect.offset.y / factor;
+  const uint32_t x1 = std::min(
+      (rect.offset.x + rect.extent.width + factor - 1) / factor, width);
+  const uint32_t y1 = std::min(
+      (rect.offset.y + rect.extent.height + factor - 1) / factor, height);
+  vk::Rect2D result;
+  result.offset = vk::Offset2D{static_cast<int32_t>(x0),
+                               static_cast<int32_t>(y0)};
+  result.extent = vk::Extent2D{x1 - x0, y1 - y0};
+  return result;
+}
 
 }  // namespace
 
@@ -57,9 +126,13 @@ PaperRenderer::PaperRenderer(Escher* escher)
       // TODO: perhaps cache depth_format_ in EscherImpl.
       depth_format_(ESCHER_CHECKED_VK_RESULT(
           impl::GetSupportedDepthStencilFormat(context_.physical_device))),
+      transient_attachment_memory_flags_(
+          vk::MemoryPropertyFlagBits::eDeviceLocal |
+          vk::MemoryPropertyFlagBits::eLazilyAllocated),
       // TODO: could potentially share ModelData/PipelineCache/ModelRenderer
       // between multiple PaperRenderers.
       model_data_(std::make_unique<impl::ModelData>(escher)),
+      framebuffer_cache_(std::make_unique<impl::FramebufferCache>(escher)),
       ssdo_(std::make_unique<impl::SsdoSampler>(
           escher,
           full_screen_,
@@ -72,6 +145,8 @@ PaperRenderer::PaperRenderer(Escher* escher)
       ssdo_accelerator_(
           std::make_unique<impl::SsdoAccelerator>(escher, image_cache_)),
       depth_to_color_(std::make_unique<DepthToColor>(escher, image_cache_)),
+      layer_cache_(
+          std::make_unique<impl::LayerCache>(kDefaultLayerMemoryBudget)),
       clear_values_(
           {vk::ClearColorValue(std::array<float, 4>{{0.f, 0.f, 0.f, 1.f}}),
            vk::ClearDepthStencilValue(kMaxDepth, 0)}) {}
@@ -85,164 +160,407 @@ PaperRenderer::~PaperRenderer() {
 
 void PaperRenderer::DrawDepthPrePass(const ImagePtr& depth_image,
                                      const ImagePtr& dummy_color_image,
+                                     float scale,
                                      const Stage& stage,
                                      const Model& model,
-                                     const Camera& camera) {
+                                     const Camera& camera,
+                                     const impl::OcclusionCuller*
+                                         previous_frame_depth,
+                                     const vk::Rect2D* render_area) {
   TRACE_DURATION("gfx", "escher::PaperRenderer::DrawDepthPrePass", "width",
                  depth_image->width(), "height", depth_image->height());
 
   auto command_buffer = current_frame();
 
-  FramebufferPtr framebuffer = ftl::MakeRefCounted<Framebuffer>(
-      escher(), depth_image->width(), depth_image->height(),
-      std::vector<ImagePtr>{dummy_color_image, depth_image},
-      model_renderer_->depth_prepass());
-
-  float scale = static_cast<float>(depth_image->width()) / stage.width();
-  FTL_DCHECK(scale ==
-             static_cast<float>(depth_image->height()) / stage.height());
+  FramebufferPtr framebuffer = framebuffer_cache_->ObtainFramebuffer(
+      model_renderer_->depth_prepass(), {dummy_color_image, depth_image},
+      command_buffer);
 
-  auto display_list_flags =
-      ModelDisplayListFlag::kUseDepthPrepass |
-      (sort_by_pipeline_ ? ModelDisplayListFlag::kSortByPipeline
-                         : ModelDisplayListFlag::kNull);
+  // Nothing else is drawn in the depth prepass, so the stencil buffer need
+  // not be restored after the last clip group.
+  auto display_list_flags = GetDisplayListFlags() |
+                            ModelDisplayListFlag::kUseDepthPrepass |
+                            ModelDisplayListFlag::kSkipFinalStencilRestore;
   ModelDisplayListPtr display_list = model_renderer_->CreateDisplayList(
       stage, model, camera, display_list_flags, scale, 1, TexturePtr(),
-      command_buffer);
+      previous_frame_depth, render_area, command_buffer);
 
-  command_buffer->KeepAlive(framebuffer);
   command_buffer->KeepAlive(display_list);
-  command_buffer->BeginRenderPass(model_renderer_->depth_prepass(), framebuffer,
-                                  clear_values_);
-  model_renderer_->Draw(stage, display_list, command_buffer);
+  if (render_area) {
+    command_buffer->BeginRenderPass(model_renderer_->depth_prepass(),
+                                    framebuffer, clear_values_, *render_area,
+                                    GetSubpassContents());
+  } else {
+    command_buffer->BeginRenderPass(model_renderer_->depth_prepass(),
+                                    framebuffer, clear_values_,
+                                    GetSubpassContents());
+  }
+  DrawModelDisplayList(stage, display_list, model_renderer_->depth_prepass(),
+                       command_buffer);
   command_buffer->EndRenderPass();
 }
 
-void PaperRenderer::DrawSsdoPasses(const ImagePtr& depth_in,
-                                   const ImagePtr& color_out,
-                                   const ImagePtr& color_aux,
-                                   const TexturePtr& accelerator_texture,
-                                   const Stage& stage) {
-  TRACE_DURATION("gfx", "escher::PaperRenderer::DrawSsdoPasses");
+void PaperRenderer::GenerateDepthPyramid(const ImagePtr& depth_image,
+                                         const Stage& stage,
+                                         const Camera& camera) {
+  TRACE_DURATION("gfx", "escher::PaperRenderer::GenerateDepthPyramid");
 
-  FTL_DCHECK(color_out->width() == color_aux->width() &&
-             color_out->height() == color_aux->height());
-  uint32_t width = color_out->width();
-  uint32_t height = color_out->height();
+  // Objects are tested against the readback using the unscaled camera
+  // transform; see ModelDisplayListBuilder::SetPreviousFrameDepth().
+  if (static_cast<float>(depth_image->width()) != stage.width()) {
+    return;
+  }
+  if (!depth_pyramid_) {
+    depth_pyramid_ = std::make_unique<impl::DepthPyramid>(escher(),
+                                                          image_cache_);
+  }
 
   auto command_buffer = current_frame();
-
-  auto fb_out = ftl::MakeRefCounted<Framebuffer>(
-      escher(), width, height, std::vector<ImagePtr>{color_out},
-      ssdo_->render_pass());
-
-  auto fb_aux = ftl::MakeRefCounted<Framebuffer>(
-      escher(), width, height, std::vector<ImagePtr>{color_aux},
-      ssdo_->render_pass());
-
-  command_buffer->KeepAlive(fb_out);
-  command_buffer->KeepAlive(fb_aux);
-  command_buffer->KeepAlive(accelerator_texture);
-
-#if SSDO_SAMPLING_USES_KERNEL
   TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
-      escher()->resource_recycler(), depth_in, vk::Filter::eNearest,
+      escher()->resource_recycler(), depth_image, vk::Filter::eNearest,
       vk::ImageAspectFlagBits::eDepth);
-
-  TexturePtr output_texture = ftl::MakeRefCounted<Texture>(
-      escher()->resource_recycler() color_out, vk::Filter::eNearest,
-      vk::ImageAspectFlagBits::eColor);
-
   command_buffer->KeepAlive(depth_texture);
-  command_buffer->KeepAlive(output_texture);
-  command_buffer->KeepAlive(fb_out);
-  command_buffer->KeepAlive(fb_aux);
 
-  // Prepare to sample from the depth buffer.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      vk::ImageLayout::eGeneral);
-  command_buffer->TransitionImageLayout(color_out, vk::ImageLayout::eUndefined,
-                                        vk::ImageLayout::eGeneral);
+  depth_pyramid_->Generate(command_buffer, depth_texture,
+                           camera.projection() * camera.transform(), this);
+}
 
-  AddTimestamp("finished layout transition before SSDO sampling");
+void PaperRenderer::DrawSsdoPasses(impl::RenderGraph* graph,
+                                   impl::RenderGraph::ImageId depth_in,
+                                   impl::RenderGraph::ImageId color_out,
+                                   const impl::RenderGraph::ImageId* color_aux,
+                                   impl::RenderGraph::ImageId accelerator,
+                                   const SharedTexture& accelerator_texture,
+                                   const SharedBuffer& tile_list,
+                                   const Stage& stage,
+                                   float scale,
+                                   const impl::SsdoSampler::SamplerConfig&
+                                       sampler_config,
+                                   const vk::Rect2D& render_area) {
+  using impl::ImageAccess;
+
+  // The lookup table is read by the fragment shaders of the render passes.
+  const ImageAccess accelerator_access = ImageAccess::Storage(
+      vk::AccessFlagBits::eShaderRead,
+      vk::PipelineStageFlagBits::eFragmentShader);
+
+  // The fused compute filter cannot filter in place, so the samples are
+  // written to |color_aux| instead.
+  const bool filter = !kSkipFiltering && color_aux;
+  const impl::RenderGraph::ImageId samples =
+      filter && enable_ssdo_compute_filtering_ ? *color_aux : color_out;
+
+  // The kernels clear their output before writing the active tiles.
+  const ImageAccess kernel_output_access = ImageAccess::Storage(
+      vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eTransferWrite,
+      vk::PipelineStageFlagBits::eComputeShader |
+          vk::PipelineStageFlagBits::eTransfer);
+
+  if (enable_ssdo_compute_sampling_) {
+    graph->AddPass(
+        "SSDO sampling",
+        {{depth_in,
+          ImageAccess::Sampled(vk::PipelineStageFlagBits::eComputeShader)},
+         {samples, kernel_output_access}},
+        [this, scale, sampler_config, depth_in, samples, tile_list](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          TRACE_DURATION("gfx",
+                         "escher::PaperRenderer::DrawSsdoPasses[sample]");
+          TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(depth_in),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth);
+          TexturePtr output_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(samples),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eColor);
+          command_buffer->KeepAlive(depth_texture);
+          command_buffer->KeepAlive(output_texture);
+
+          // The kernel offsets its taps in pixels of the scaled image.
+          impl::SsdoSampler::SamplerConfig scaled_config = sampler_config;
+          scaled_config.tap_scale = scale;
+          ssdo_->SampleUsingKernel(command_buffer, *tile_list, depth_texture,
+                                   output_texture, &scaled_config);
+          AddTimestamp("finished SSDO sampling");
+        });
+  } else {
+    // The sampling and filter render passes leave their output in
+    // eShaderReadOnlyOptimal layout, ready for the next pass to sample.
+    graph->AddPass(
+        "SSDO sampling",
+        {{depth_in, ImageAccess::Sampled()},
+         {accelerator, accelerator_access},
+         {samples, ImageAccess::ColorAttachment(
+                       true, vk::ImageLayout::eShaderReadOnlyOptimal)}},
+        [this, sampler_config, depth_in, samples, accelerator_texture,
+         render_area](impl::RenderGraph* graph,
+                      impl::CommandBuffer* command_buffer) {
+          TRACE_DURATION("gfx", "escher::PaperRenderer::DrawSsdoPasses[sample]");
+          const ImagePtr& output = graph->GetImage(samples);
+          auto framebuffer = framebuffer_cache_->ObtainFramebuffer(
+              ssdo_->render_pass(), {output}, command_buffer);
+          TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(depth_in),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth);
+          command_buffer->KeepAlive(depth_texture);
+
+          // Taps are offset in units of the unscaled viewing volume, so they
+          // cover the same part of the screen at any scale, and depths need
+          // no adjustment.
+          ssdo_->Sample(command_buffer, framebuffer, render_area, depth_texture,
+                        *accelerator_texture, &sampler_config);
+          AddTimestamp("finished SSDO sampling");
+        });
+  }
 
-  impl::SsdoSampler::SamplerConfig sampler_config(stage);
-  ssdo_->SampleUsingKernel(command_buffer, depth_texture, output_texture,
-                           &sampler_config);
-  AddTimestamp("finished SSDO sampling");
+  if (!filter) {
+    return;
+  }
 
-#else
-  TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
-      escher()->resource_recycler(), depth_in, vk::Filter::eNearest,
-      vk::ImageAspectFlagBits::eDepth);
-  command_buffer->KeepAlive(depth_texture);
+  if (enable_ssdo_compute_filtering_) {
+    graph->AddPass(
+        "SSDO filter",
+        {{samples,
+          ImageAccess::Sampled(vk::PipelineStageFlagBits::eComputeShader)},
+         {accelerator, ImageAccess::Storage(vk::AccessFlagBits::eShaderRead)},
+         {color_out, kernel_output_access}},
+        [this, &stage, samples, color_out, accelerator_texture, tile_list](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          TRACE_DURATION("gfx",
+                         "escher::PaperRenderer::DrawSsdoPasses[filter]");
+          TexturePtr input_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(samples),
+              vk::Filter::eNearest);
+          TexturePtr output_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(color_out),
+              vk::Filter::eNearest);
+          command_buffer->KeepAlive(input_texture);
+          command_buffer->KeepAlive(output_texture);
+
+          ssdo_->FilterUsingKernel(command_buffer, *tile_list, input_texture,
+                                   *accelerator_texture, output_texture,
+                                   stage.viewing_volume().depth());
+          AddTimestamp("finished SSDO filter");
+        });
+    return;
+  }
 
-  // Prepare to sample from the depth buffer.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      vk::ImageLayout::eShaderReadOnlyOptimal);
+  // Do two filter passes, one horizontal and one vertical.  The stride is
+  // one pixel of the output in |direction|.
+  auto add_filter_pass = [=, &stage](const char* name,
+                                     const char* timestamp,
+                                     impl::RenderGraph::ImageId input,
+                                     impl::RenderGraph::ImageId output,
+                                     vec2 direction) {
+    graph->AddPass(
+        name,
+        {{input, ImageAccess::Sampled()},
+         {accelerator, accelerator_access},
+         {output, ImageAccess::ColorAttachment(
+                      true, vk::ImageLayout::eShaderReadOnlyOptimal)}},
+        [this, &stage, timestamp, input, output, direction,
+         accelerator_texture, render_area](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          TRACE_DURATION("gfx", "escher::PaperRenderer::DrawSsdoPasses[filter]");
+          const ImagePtr& output_image = graph->GetImage(output);
+          auto framebuffer = framebuffer_cache_->ObtainFramebuffer(
+              ssdo_->render_pass(), {output_image}, command_buffer);
+          auto input_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(input),
+              vk::Filter::eNearest);
+          command_buffer->KeepAlive(input_texture);
+
+          impl::SsdoSampler::FilterConfig filter_config;
+          filter_config.stride =
+              direction / vec2(output_image->width(), output_image->height());
+          filter_config.scene_depth = stage.viewing_volume().depth();
+          ssdo_->Filter(command_buffer, framebuffer, render_area,
+                        input_texture, *accelerator_texture, &filter_config);
+          AddTimestamp(timestamp);
+        });
+  };
+  add_filter_pass("SSDO filter pass 1", "finished SSDO filter pass 1",
+                  color_out, *color_aux, vec2(1.f, 0.f));
+  add_filter_pass("SSDO filter pass 2", "finished SSDO filter pass 2",
+                  *color_aux, color_out, vec2(0.f, 1.f));
+}
 
-  AddTimestamp("finished layout transition before SSDO sampling");
+impl::RenderGraph::ImageId PaperRenderer::DrawTemporalSsdoPasses(
+    impl::RenderGraph* graph,
+    impl::RenderGraph::ImageId depth_in,
+    impl::RenderGraph::ImageId accelerator,
+    const SharedTexture& accelerator_texture,
+    const SharedBuffer& tile_list,
+    const ImageInfo& info,
+    const Stage& stage,
+    const Camera& camera,
+    float scale) {
+  using impl::ImageAccess;
+  using ImageId = impl::RenderGraph::ImageId;
+
+  // The scene covers the top-left |uv_limit| of the images; the history can
+  // only be reprojected into images that cover it in the same way.
+  const vec2 uv_limit(std::min(1.f, scale * stage.width() / info.width),
+                      std::min(1.f, scale * stage.height() / info.height));
+  const mat4 transform = camera.projection() * camera.transform();
+  const bool has_history = ssdo_history_ &&
+                           ssdo_history_frame_number_ + 1 == frame_number() &&
+                           ssdo_history_->width() == info.width &&
+                           ssdo_history_->height() == info.height &&
+                           ssdo_history_uv_limit_ == uv_limit;
+
+  // The history outlives the graph, so it cannot be a transient image.
+  ImagePtr history_image = image_cache_->NewImage(info);
+  const ImageId history_out =
+      graph->ImportImage(history_image, vk::ImageLayout::eUndefined);
+  vk::Rect2D render_area;
+  render_area.extent = vk::Extent2D{info.width, info.height};
 
   impl::SsdoSampler::SamplerConfig sampler_config(stage);
-  ssdo_->Sample(command_buffer, fb_out, depth_texture, accelerator_texture,
-                &sampler_config);
-
-  AddTimestamp("finished SSDO sampling");
-
-  // Now that we have finished sampling the depth buffer, transition it for
-  // reuse as a depth buffer in the lighting pass.
-  command_buffer->TransitionImageLayout(
-      depth_in, vk::ImageLayout::eShaderReadOnlyOptimal,
-      vk::ImageLayout::eDepthStencilAttachmentOptimal);
-
-  AddTimestamp("finished layout transition before SSDO filtering");
-#endif
-
-  // Do two filter passes, one horizontal and one vertical.
-  if (!kSkipFiltering) {
-    {
-      auto color_out_tex = ftl::MakeRefCounted<Texture>(
-          escher()->resource_recycler(), color_out, vk::Filter::eNearest);
-      command_buffer->KeepAlive(color_out_tex);
-
-      impl::SsdoSampler::FilterConfig filter_config;
-      filter_config.stride = vec2(1.f / stage.viewing_volume().width(), 0.f);
-      filter_config.scene_depth = stage.viewing_volume().depth();
-      ssdo_->Filter(command_buffer, fb_aux, color_out_tex, accelerator_texture,
-                    &filter_config);
-
-#if SSDO_SAMPLING_USES_KERNEL
-      command_buffer->TransitionImageLayout(
-          color_out, vk::ImageLayout::eGeneral,
-          vk::ImageLayout::eColorAttachmentOptimal);
-#else
-      command_buffer->TransitionImageLayout(
-          color_out, vk::ImageLayout::eShaderReadOnlyOptimal,
-          vk::ImageLayout::eColorAttachmentOptimal);
-#endif
-
-      AddTimestamp("finished SSDO filter pass 1");
-    }
-    {
-      auto color_aux_tex = ftl::MakeRefCounted<Texture>(
-          escher()->resource_recycler(), color_aux, vk::Filter::eNearest);
-      command_buffer->KeepAlive(color_aux_tex);
-
-      impl::SsdoSampler::FilterConfig filter_config;
-      filter_config.stride = vec2(0.f, 1.f / stage.viewing_volume().height());
-      filter_config.scene_depth = stage.viewing_volume().depth();
-      ssdo_->Filter(command_buffer, fb_out, color_aux_tex, accelerator_texture,
-                    &filter_config);
-
-      command_buffer->TransitionImageLayout(
-          color_aux, vk::ImageLayout::eShaderReadOnlyOptimal,
-          vk::ImageLayout::eColorAttachmentOptimal);
-
-      AddTimestamp("finished SSDO filter pass 2");
-    }
+  if (!has_history) {
+    // Start from a fully-sampled and filtered frame.
+    const ImageId aux = graph->CreateImage(info);
+    DrawSsdoPasses(graph, depth_in, history_out, &aux, accelerator,
+                   accelerator_texture, tile_list, stage, scale,
+                   sampler_config, render_area);
+    ssdo_history_length_ = 0;
+  } else {
+    // Vary the samples from frame to frame along an R2 low-discrepancy
+    // sequence, and skip the filter passes: accumulating the samples of
+    // several frames removes the noise instead.
+    const uint32_t n = ++ssdo_history_length_ % 1024;
+    sampler_config.noise_offset = std::fmod(n * 0.7548777f, 1.f);
+    sampler_config.tap_jitter = std::fmod(0.5f + n * 0.5698403f, 1.f);
+    sampler_config.tap_count = kTemporalSsdoTapCount;
+    const ImageId samples = graph->CreateImage(info);
+    DrawSsdoPasses(graph, depth_in, samples, nullptr, accelerator,
+                   accelerator_texture, tile_list, stage, scale,
+                   sampler_config, render_area);
+
+    const ImageId history_in =
+        graph->ImportImage(ssdo_history_,
+                           vk::ImageLayout::eShaderReadOnlyOptimal);
+    impl::SsdoSampler::AccumulateConfig accumulate_config;
+    const mat4 uv_from_ndc = UvFromNdc(uv_limit);
+    accumulate_config.reprojection = uv_from_ndc * ssdo_history_transform_ *
+                                     glm::inverse(transform) *
+                                     glm::inverse(uv_from_ndc);
+    accumulate_config.uv_limit = uv_limit;
+    accumulate_config.scene_depth = stage.viewing_volume().depth();
+    accumulate_config.blend = kTemporalSsdoBlend;
+    graph->AddPass(
+        "SSDO accumulation",
+        {{samples, ImageAccess::Sampled()},
+         {history_in, ImageAccess::Sampled()},
+         {depth_in, ImageAccess::Sampled()},
+         {history_out, ImageAccess::ColorAttachment(
+                           true, vk::ImageLayout::eShaderReadOnlyOptimal)}},
+        [this, samples, history_in, depth_in, history_out, render_area,
+         accumulate_config](impl::RenderGraph* graph,
+                            impl::CommandBuffer* command_buffer) {
+          TRACE_DURATION("gfx",
+                         "escher::PaperRenderer::DrawTemporalSsdoPasses");
+          auto framebuffer = framebuffer_cache_->ObtainFramebuffer(
+              ssdo_->render_pass(), {graph->GetImage(history_out)},
+              command_buffer);
+          auto samples_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(samples),
+              vk::Filter::eNearest);
+          command_buffer->KeepAlive(samples_texture);
+          auto history_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(history_in),
+              vk::Filter::eLinear);
+          command_buffer->KeepAlive(history_texture);
+          TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(depth_in),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth);
+          command_buffer->KeepAlive(depth_texture);
+
+          ssdo_->Accumulate(command_buffer, framebuffer, render_area,
+                            samples_texture, history_texture, depth_texture,
+                            &accumulate_config);
+          AddTimestamp("finished SSDO accumulation");
+        });
+  }
+  // The history is left ready for sampling by the next frame, whether or not
+  // it is sampled by this one; compute kernels leave it in eGeneral layout.
+  graph->AddPass("SSDO history", {{history_out, ImageAccess::Sampled()}},
+                 nullptr);
+
+  ssdo_history_ = std::move(history_image);
+  ssdo_history_frame_number_ = frame_number();
+  ssdo_history_transform_ = transform;
+  ssdo_history_uv_limit_ = uv_limit;
+  return history_out;
+}
+
+void PaperRenderer::DrawSsdoUpsamplePass(impl::RenderGraph* graph,
+                                         impl::RenderGraph::ImageId color_in,
+                                         impl::RenderGraph::ImageId depth_in,
+                                         impl::RenderGraph::ImageId color_out,
+                                         uint32_t factor,
+                                         const Stage& stage,
+                                         const vk::Rect2D& render_area) {
+  using impl::ImageAccess;
+
+  graph->AddPass(
+      "SSDO upsample",
+      {{color_in, ImageAccess::Sampled()},
+       {depth_in, ImageAccess::Sampled()},
+       {color_out, ImageAccess::ColorAttachment(
+                       true, vk::ImageLayout::eShaderReadOnlyOptimal)}},
+      [this, &stage, color_in, depth_in, color_out, factor, render_area](
+          impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+        TRACE_DURATION("gfx", "escher::PaperRenderer::DrawSsdoUpsamplePass");
+        const ImagePtr& output_image = graph->GetImage(color_out);
+        auto framebuffer = framebuffer_cache_->ObtainFramebuffer(
+            ssdo_->render_pass(), {output_image}, command_buffer);
+
+        const ImagePtr& input_image = graph->GetImage(color_in);
+        TexturePtr input_texture = ftl::MakeRefCounted<Texture>(
+            escher()->resource_recycler(), input_image, vk::Filter::eNearest);
+        command_buffer->KeepAlive(input_texture);
+        TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
+            escher()->resource_recycler(), graph->GetImage(depth_in),
+            vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth);
+        command_buffer->KeepAlive(depth_texture);
+
+        impl::SsdoSampler::UpsampleConfig upsample_config;
+        upsample_config.frag_coord_to_texel = vec2(1.f / factor);
+        upsample_config.texel_to_uv =
+            vec2(1.f / input_image->width(), 1.f / input_image->height());
+        upsample_config.scene_depth = stage.viewing_volume().depth();
+        ssdo_->Upsample(command_buffer, framebuffer, render_area,
+                        input_texture, depth_texture, &upsample_config);
+        AddTimestamp("finished SSDO upsample");
+      });
+}
+
+impl::ModelDisplayListFlags PaperRenderer::GetDisplayListFlags() const {
+  impl::ModelDisplayListFlags flags;
+  if (sort_by_pipeline_) {
+    flags |= ModelDisplayListFlag::kSortByPipeline;
+  }
+  if (share_descriptor_sets_) {
+    flags |= ModelDisplayListFlag::kShareDescriptorSetsBetweenObjects;
+  }
+  if (enable_multi_draw_indirect_) {
+    flags |= ModelDisplayListFlag::kUseMultiDrawIndirect;
+  }
+  if (enable_occlusion_culling_) {
+    flags |= ModelDisplayListFlag::kUseOcclusionCulling;
+  }
+  switch (frustum_culling_mode_) {
+    case FrustumCullingMode::kNone:
+      break;
+    case FrustumCullingMode::kCpu:
+      flags |= ModelDisplayListFlag::kUseCpuFrustumCulling;
+      break;
+    case FrustumCullingMode::kGpu:
+      flags |= ModelDisplayListFlag::kUseMultiDrawIndirect |
+               ModelDisplayListFlag::kUseGpuFrustumCulling;
+      break;
   }
+  return flags;
 }
 
 void PaperRenderer::UpdateModelRenderer(vk::Format pre_pass_color_format,
@@ -253,32 +571,39 @@ void PaperRenderer::UpdateModelRenderer(vk::Format pre_pass_color_format,
   if (!model_renderer_) {
     model_renderer_ = std::make_unique<impl::ModelRenderer>(
         escher_impl(), model_data_.get(), pre_pass_color_format,
-        lighting_pass_color_format, kLightingPassSampleCount,
+        lighting_pass_color_format, lighting_pass_sample_count_,
         ESCHER_CHECKED_VK_RESULT(
             impl::GetSupportedDepthStencilFormat(context_.physical_device)));
   }
 }
 
 void PaperRenderer::DrawLightingPass(uint32_t sample_count,
+                                     float scale,
                                      const FramebufferPtr& framebuffer,
                                      const TexturePtr& illumination_texture,
                                      const Stage& stage,
                                      const Model& model,
                                      const Camera& camera,
-                                     const Model* overlay_model) {
+                                     const Model* overlay_model,
+                                     const TexturePtr& layer_texture,
+                                     const vk::Rect2D* render_area) {
   TRACE_DURATION("gfx", "escher::PaperRenderer::DrawLightingPass", "width",
                  framebuffer->width(), "height", framebuffer->height());
 
   auto command_buffer = current_frame();
   command_buffer->KeepAlive(framebuffer);
 
-  auto display_list_flags =
-      (sort_by_pipeline_ ? ModelDisplayListFlag::kSortByPipeline
-                         : ModelDisplayListFlag::kNull);
+  // The overlay is drawn after the model in the same render pass, and relies
+  // upon the stencil buffer having been restored.
+  const bool has_overlay = overlay_model && !overlay_model->objects().empty();
+  auto display_list_flags = GetDisplayListFlags();
+  if (!has_overlay) {
+    display_list_flags |= ModelDisplayListFlag::kSkipFinalStencilRestore;
+  }
 
   ModelDisplayListPtr display_list = model_renderer_->CreateDisplayList(
-      stage, model, camera, display_list_flags, 1.f, sample_count,
-      illumination_texture, command_buffer);
+      stage, model, camera, display_list_flags, scale, sample_count,
+      illumination_texture, nullptr, render_area, command_buffer);
   command_buffer->KeepAlive(display_list);
 
   // Update the clear color from the stage
@@ -291,27 +616,60 @@ void PaperRenderer::DrawLightingPass(uint32_t sample_count,
   overlay_stage.set_viewing_volume(stage.viewing_volume());
   Camera overlay_camera = Camera::NewOrtho(overlay_stage.viewing_volume());
   impl::ModelDisplayListPtr overlay_display_list;
-  if (overlay_model && !overlay_model->objects().empty()) {
-    display_list_flags = ModelDisplayListFlag::kDisableDepthTest;
+  if (has_overlay) {
+    display_list_flags = ModelDisplayListFlag::kDisableDepthTest |
+                         ModelDisplayListFlag::kSkipFinalStencilRestore;
     overlay_display_list = model_renderer_->CreateDisplayList(
-        overlay_stage, *overlay_model, overlay_camera, display_list_flags, 1.f,
-        sample_count, TexturePtr(), command_buffer);
+        overlay_stage, *overlay_model, overlay_camera, display_list_flags,
+        scale, sample_count, TexturePtr(), nullptr, render_area,
+        command_buffer);
     command_buffer->KeepAlive(overlay_display_list);
   }
 
-  command_buffer->BeginRenderPass(model_renderer_->lighting_pass(), framebuffer,
-                                  clear_values_);
+  // The layer image is composited behind the model by a screen-filling rect.
+  // It is already lit, so it is drawn without an illumination texture.
+  impl::ModelDisplayListPtr layer_display_list;
+  if (layer_texture) {
+    const ViewingVolume& volume = overlay_stage.viewing_volume();
+    Model layer_model(std::vector<Object>{Object::NewRect(
+        vec2(0.f, 0.f), vec2(volume.width(), volume.height()),
+        0.5f * (volume.top() + volume.bottom()),
+        Material::New(vec4(1.f, 1.f, 1.f, 1.f), layer_texture))});
+    layer_display_list = model_renderer_->CreateDisplayList(
+        overlay_stage, layer_model, overlay_camera,
+        ModelDisplayListFlag::kDisableDepthTest, scale, sample_count,
+        TexturePtr(), nullptr, render_area, command_buffer);
+    command_buffer->KeepAlive(layer_display_list);
+  }
+
+  if (render_area) {
+    // The rest of the output image is preserved.  Both render passes are
+    // compatible with the display lists' pipelines, and with secondary command
+    // buffers recorded for either.
+    command_buffer->BeginRenderPass(model_renderer_->partial_lighting_pass(),
+                                    framebuffer, clear_values_, *render_area,
+                                    GetSubpassContents());
+  } else {
+    command_buffer->BeginRenderPass(model_renderer_->lighting_pass(),
+                                    framebuffer, clear_values_,
+                                    GetSubpassContents());
+  }
 
-  model_renderer_->Draw(stage, display_list, command_buffer);
+  if (layer_display_list) {
+    DrawModelDisplayList(stage, layer_display_list,
+                         model_renderer_->lighting_pass(), command_buffer);
+  }
+  DrawModelDisplayList(stage, display_list, model_renderer_->lighting_pass(),
+                       command_buffer);
   if (overlay_display_list) {
-    model_renderer_->Draw(stage, overlay_display_list, command_buffer);
+    DrawModelDisplayList(stage, overlay_display_list,
+                         model_renderer_->lighting_pass(), command_buffer);
   }
 
   command_buffer->EndRenderPass();
 }
 
 void PaperRenderer::DrawDebugOverlays(const ImagePtr& output,
-                                      const ImagePtr& depth,
                                       const ImagePtr& illumination,
                                       const TexturePtr& ssdo_accel,
                                       const TexturePtr& ssdo_accel_depth) {
@@ -339,8 +697,8 @@ void PaperRenderer::DrawDebugOverlays(const ImagePtr& output,
 
     // Used to visualize both the SSDO acceleration look-up table, as well as
     // the depth image that was used to generate it.
-    src_width = depth->width() / kSsdoAccelDownsampleFactor;
-    src_height = depth->height() / kSsdoAccelDownsampleFactor;
+    src_width = ssdo_accel_depth->width();
+    src_height = ssdo_accel_depth->height();
     blit.srcOffsets[1] = vk::Offset3D{src_width, src_height, 1};
     blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
 
@@ -398,168 +756,841 @@ void PaperRenderer::DrawFrame(const Stage& stage,
 
   UpdateModelRenderer(color_image_out->format(), color_image_out->format());
 
-  uint32_t width = color_image_out->width();
-  uint32_t height = color_image_out->height();
-
   BeginFrame();
 
-  // Downsized depth-only prepass for SSDO acceleration.
-  FTL_CHECK(width % kSsdoAccelDownsampleFactor == 0);
-  FTL_CHECK(height % kSsdoAccelDownsampleFactor == 0);
-  uint32_t ssdo_accel_width = width / kSsdoAccelDownsampleFactor;
-  uint32_t ssdo_accel_height = height / kSsdoAccelDownsampleFactor;
-  ImagePtr ssdo_accel_depth_image = image_utils::NewDepthImage(
-      image_cache_, depth_format_, ssdo_accel_width, ssdo_accel_height,
-      vk::ImageUsageFlagBits::eSampled);
-  TexturePtr ssdo_accel_depth_texture = ftl::MakeRefCounted<Texture>(
-      escher()->resource_recycler(), ssdo_accel_depth_image,
-      vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth,
-      // TODO: use a more descriptive enum than true.
-      true);
-  {
-    // TODO: maybe share this with SsdoAccelerator::GenerateLookupTable().
-    // However, this would require refactoring to match the color format
-    // expected by ModelRenderer.
-    ImagePtr ssdo_accel_dummy_color_image = image_cache_->NewImage(
-        {color_image_out->format(), ssdo_accel_width, ssdo_accel_height, 1,
-         vk::ImageUsageFlagBits::eColorAttachment});
-
-    DrawDepthPrePass(ssdo_accel_depth_image, ssdo_accel_dummy_color_image,
-                     stage, model, camera);
-    SubmitPartialFrame();
-
-    AddTimestamp("finished SSDO acceleration depth pre-pass");
-  }
-
-  // Compute SSDO acceleration structure.
-  TexturePtr ssdo_accel_texture = ssdo_accelerator_->GenerateLookupTable(
-      current_frame(), ssdo_accel_depth_texture,
-      vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc,
-      this);
-  SubmitPartialFrame();
-
-  // Depth-only pre-pass.
-  ImagePtr depth_image = image_utils::NewDepthImage(
-      image_cache_, depth_format_, width, height,
-      vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc);
-  {
-    current_frame()->TakeWaitSemaphore(
-        color_image_out, vk::PipelineStageFlagBits::eColorAttachmentOutput);
-
-    DrawDepthPrePass(depth_image, color_image_out, stage, model, camera);
-    SubmitPartialFrame();
-
-    AddTimestamp("finished depth pre-pass");
+  // Choose the scale of this frame.  Damage is tracked relative to frames
+  // rendered at the same scale.
+  const float scale =
+      enable_dynamic_resolution_ ? resolution_controller_->scale() : 1.f;
+  // Only frames whose times will be reported are remembered, so that the
+  // queue stays no longer than the ring of frames in flight.
+  if (enable_dynamic_resolution_ && is_current_frame_timed()) {
+    pending_frame_scales_.emplace_back(frame_number(), scale);
+  }
+  if (scale != render_scale_ && damage_tracker_) {
+    damage_tracker_->Reset();
+  }
+  render_scale_ = scale;
+
+  impl::RenderGraph graph(image_cache_);
+
+  // The layer is rendered first (if necessary), so that it can be composited
+  // during the lighting pass.
+  TexturePtr layer_texture;
+  if (model.layer()) {
+    layer_texture = ObtainLayerTexture(&graph, stage, *model.layer(), camera,
+                                       color_image_out->format(),
+                                       color_image_out->width(),
+                                       color_image_out->height());
   }
 
-  // Compute the illumination and store the result in a texture.
-  TexturePtr illumination_texture;
-  if (enable_lighting_) {
-    ImagePtr illum1 = image_cache_->NewImage(
-        {impl::SsdoSampler::kColorFormat, width, height, 1,
-         vk::ImageUsageFlagBits::eSampled |
-             vk::ImageUsageFlagBits::eColorAttachment |
-             vk::ImageUsageFlagBits::eStorage |
-             vk::ImageUsageFlagBits::eTransferSrc});
+  if (enable_damage_tracking_) {
+    damage_rect_ = ComputeDamage(stage, model, camera, color_image_out,
+                                 overlay_model, layer_texture);
+    // A scaled frame cannot be rendered in part, but unchanged frames are
+    // still skipped.
+    if (scale != 1.f && damage_rect_.extent.width != 0 &&
+        damage_rect_.extent.height != 0) {
+      damage_rect_.offset = vk::Offset2D{0, 0};
+      damage_rect_.extent =
+          vk::Extent2D{color_image_out->width(), color_image_out->height()};
+    }
+  } else {
+    damage_rect_.offset = vk::Offset2D{0, 0};
+    damage_rect_.extent =
+        vk::Extent2D{color_image_out->width(), color_image_out->height()};
+  }
 
-    ImagePtr illum2 = image_cache_->NewImage(
-        {impl::SsdoSampler::kColorFormat, width, height, 1,
-         vk::ImageUsageFlagBits::eSampled |
-             vk::ImageUsageFlagBits::eColorAttachment |
-             vk::ImageUsageFlagBits::eStorage |
-             vk::ImageUsageFlagBits::eTransferSrc});
+  current_frame()->TakeWaitSemaphore(
+      color_image_out, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+
+  // If nothing has changed, the image is presented as it is.
+  if (damage_rect_.extent.width != 0 && damage_rect_.extent.height != 0) {
+    const impl::RenderGraph::ImageId output =
+        DrawScene(&graph, stage, model, camera, color_image_out, damage_rect_,
+                  overlay_model, layer_texture, false, scale);
+
+    // We could push this flexibility farther by letting our client specify
+    // the desired output layout, but for now we'll assume that the image is
+    // being presented immediately.
+    graph.AddPass("present", {{output, impl::ImageAccess::Present()}},
+                  [this](impl::RenderGraph*, impl::CommandBuffer*) {
+                    AddTimestamp("finished transition to presentation layout");
+                  });
+  }
 
-    DrawSsdoPasses(depth_image, illum1, illum2, ssdo_accel_texture, stage);
-    SubmitPartialFrame();
+  impl::RenderGraph::SubmitFunc submit;
+  if (enable_early_submission_) {
+    submit = [this]() {
+      SubmitPartialFrame();
+      return current_frame();
+    };
+  }
+  graph.Execute(current_frame(), submit);
+  render_graph_stats_ = graph.stats();
 
-    illumination_texture = ftl::MakeRefCounted<Texture>(
-        escher()->resource_recycler(), illum1, vk::Filter::eNearest);
+  model_renderer_->EndFrame();
+  framebuffer_cache_->EndFrame();
+  EndFrame(frame_done, frame_retired_callback);
+}
 
-    // Done after previous SubmitPartialFrame(), because this is needed by the
-    // final lighting pass.
-    current_frame()->KeepAlive(illumination_texture);
+impl::RenderGraph::ImageId PaperRenderer::DrawScene(
+    impl::RenderGraph* graph,
+    const Stage& stage,
+    const Model& model,
+    const Camera& camera,
+    const ImagePtr& color_image_out,
+    const vk::Rect2D& render_area,
+    const Model* overlay_model,
+    const TexturePtr& layer_texture,
+    bool is_layer,
+    float scale) {
+  TRACE_DURATION("gfx", "escher::PaperRenderer::DrawScene", "is_layer",
+                 is_layer, "render_width", render_area.extent.width,
+                 "render_height", render_area.extent.height, "render_scale",
+                 scale);
+  using impl::ImageAccess;
+  using ImageId = impl::RenderGraph::ImageId;
+
+  const vk::Format format = color_image_out->format();
+  const uint32_t output_width = color_image_out->width();
+  const uint32_t output_height = color_image_out->height();
+
+  // A scaled scene is rendered into the top-left corner of images that are
+  // just large enough to hold it (but whose size is still a multiple of
+  // kSsdoAccelDownsampleFactor), and then stretched to fill the output.
+  const bool is_scaled = scale != 1.f;
+  auto scaled_size = [](uint32_t size, float scale) {
+    const uint32_t scaled = static_cast<uint32_t>(std::ceil(size * scale));
+    return std::min(size, (scaled + kSsdoAccelDownsampleFactor - 1) /
+                              kSsdoAccelDownsampleFactor *
+                              kSsdoAccelDownsampleFactor);
+  };
+  const uint32_t width = scaled_size(output_width, scale);
+  const uint32_t height = scaled_size(output_height, scale);
+
+  // SSDO is sampled and filtered at a further reduced scale, from a depth
+  // buffer of its own, and then upsampled; see set_ssdo_downsample_factor().
+  // The SSDO acceleration table is generated at the same scale.
+  const uint32_t ssdo_factor = ssdo_downsample_factor_;
+  const float ssdo_scale = scale / ssdo_factor;
+  const uint32_t ssdo_width = scaled_size(output_width, ssdo_scale);
+  const uint32_t ssdo_height = scaled_size(output_height, ssdo_scale);
+
+  // When only part of the image is rendered, SSDO is computed kShadowRadius
+  // pixels beyond it (which more than covers the reach of the SSDO filters),
+  // and depth a further kShadowRadius pixels beyond that, since that is how
+  // far SSDO samples it.
+  const bool is_partial = render_area.extent.width != output_width ||
+                          render_area.extent.height != output_height;
+  FTL_DCHECK(!is_scaled || !is_partial);
+  const vk::Rect2D ssdo_area =
+      ExpandRect(render_area, kShadowRadius, width, height);
+  const vk::Rect2D depth_area =
+      ExpandRect(ssdo_area, kShadowRadius, width, height);
+  const vk::Rect2D ssdo_render_area =
+      DownsampleRect(ssdo_area, ssdo_factor, ssdo_width, ssdo_height);
+  const vk::Rect2D ssdo_depth_area =
+      DownsampleRect(depth_area, ssdo_factor, ssdo_width, ssdo_height);
+
+  // The rest of a partially-rendered image is preserved from the last frame,
+  // which left it ready for presentation.  The image's wait semaphore is
+  // waited upon by the color-attachment-output stage; see DrawFrame().
+  const ImageId output = graph->ImportImage(
+      color_image_out,
+      is_partial ? vk::ImageLayout::ePresentSrcKHR
+                 : vk::ImageLayout::eUndefined,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput);
+
+  // The scene is lit into |scene_color|, which is |output| itself unless the
+  // scene is scaled.
+  const ImageId scene_color =
+      is_scaled ? graph->CreateImage({format, width, height, 1,
+                                      vk::ImageUsageFlagBits::eColorAttachment |
+                                          vk::ImageUsageFlagBits::eTransferSrc})
+                : output;
+
+  // Objects that were hidden in a previous frame are culled from both depth
+  // pre-passes, but not from the lighting pass.  Only the SSDO illumination
+  // can be affected if they have since become visible, and only until the
+  // next pyramid is read back.  Partial frames neither generate pyramids nor
+  // use them, since they could otherwise be stale indefinitely; nor do scaled
+  // frames, whose depth does not cover the whole stage.
+  const bool use_depth_pyramid =
+      enable_hi_z_culling_ && !is_layer && !is_partial && !is_scaled;
+  const impl::OcclusionCuller* previous_frame_depth =
+      use_depth_pyramid && depth_pyramid_
+          ? depth_pyramid_->GetPreviousFrameDepth(camera.projection() *
+                                                  camera.transform())
+          : nullptr;
+
+  // The illumination of whole frames is kept, and reused for as long as
+  // nothing that affects it changes; see set_enable_ssdo_reuse().  The depth
+  // pre-passes are then skipped as well, since the lighting pass clears depth.
+  const bool keep_illumination =
+      enable_ssdo_reuse_ && enable_lighting_ && !is_layer && !is_partial &&
+      !use_depth_pyramid && !enable_ssdo_temporal_accumulation_ &&
+      !show_debug_info_;
+  ByteKey ssdo_scene_key;
+  if (keep_illumination) {
+    ssdo_scene_key = ComputeSsdoSceneKey(stage, model, camera, output_width,
+                                         output_height, scale);
   }
+  const bool reuse_illumination =
+      keep_illumination && ssdo_reusable_illumination_ &&
+      ssdo_scene_key == ssdo_reusable_illumination_key_;
 
-  // Use multisampling for final lighting pass, or not.
-  if (kLightingPassSampleCount == 1) {
-    FramebufferPtr lighting_fb = ftl::MakeRefCounted<Framebuffer>(
-        escher(), width, height,
-        std::vector<ImagePtr>{color_image_out, depth_image},
-        model_renderer_->lighting_pass());
+  // Downsized depth-only prepass for SSDO acceleration.
+  FTL_CHECK(ssdo_width % kSsdoAccelDownsampleFactor == 0);
+  FTL_CHECK(ssdo_height % kSsdoAccelDownsampleFactor == 0);
+  uint32_t ssdo_accel_width = ssdo_width / kSsdoAccelDownsampleFactor;
+  uint32_t ssdo_accel_height = ssdo_height / kSsdoAccelDownsampleFactor;
+  const ImageId ssdo_accel_depth = graph->CreateImage(
+      {depth_format_, ssdo_accel_width, ssdo_accel_height, 1,
+       vk::ImageUsageFlagBits::eSampled |
+           vk::ImageUsageFlagBits::eDepthStencilAttachment});
+  // TODO: maybe share this with SsdoAccelerator::GenerateLookupTable().
+  // However, this would require refactoring to match the color format
+  // expected by ModelRenderer.
+  const ImageId ssdo_accel_dummy_color =
+      graph->CreateImage({format, ssdo_accel_width, ssdo_accel_height, 1,
+                          vk::ImageUsageFlagBits::eColorAttachment});
+  if (!reuse_illumination) {
+    graph->AddPass(
+        "SSDO acceleration depth pre-pass",
+        {{ssdo_accel_dummy_color, ImageAccess::ColorAttachment(true)},
+         {ssdo_accel_depth, ImageAccess::DepthAttachment(true)}},
+        [this, &stage, &model, &camera, ssdo_accel_depth,
+         ssdo_accel_dummy_color, ssdo_scale, previous_frame_depth](
+            impl::RenderGraph* graph, impl::CommandBuffer*) {
+          DrawDepthPrePass(graph->GetImage(ssdo_accel_depth),
+                           graph->GetImage(ssdo_accel_dummy_color),
+                           ssdo_scale / kSsdoAccelDownsampleFactor, stage,
+                           model, camera, previous_frame_depth, nullptr);
+          AddTimestamp("finished SSDO acceleration depth pre-pass");
+        });
+    graph->AddSubmitPoint();
+  }
+
+  // Compute SSDO acceleration structure.  The lookup table is created by
+  // SsdoAccelerator, which leaves it in eGeneral layout.  The SSDO kernels
+  // are dispatched over the list of its active tiles.
+  const ImageId ssdo_accel = graph->DeclareImage();
+  SharedTexture ssdo_accel_texture = std::make_shared<TexturePtr>();
+  SharedBuffer ssdo_tile_list = std::make_shared<BufferPtr>();
+  const bool generate_tile_list =
+      enable_ssdo_compute_sampling_ || enable_ssdo_compute_filtering_;
+  if (!reuse_illumination) {
+    graph->AddPass(
+        "SSDO acceleration lookup table",
+        {{ssdo_accel_depth,
+          ImageAccess::Sampled(vk::PipelineStageFlagBits::eComputeShader)},
+         {ssdo_accel, ImageAccess::Storage(vk::AccessFlagBits::eShaderWrite)}},
+        [this, ssdo_accel_depth, ssdo_accel, ssdo_accel_texture, ssdo_tile_list,
+         generate_tile_list, ssdo_render_area](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          TexturePtr depth_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(ssdo_accel_depth),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth,
+              // TODO: use a more descriptive enum than true.
+              true);
+          command_buffer->KeepAlive(depth_texture);
+          *ssdo_accel_texture = ssdo_accelerator_->GenerateLookupTable(
+              command_buffer, depth_texture,
+              vk::ImageUsageFlagBits::eSampled |
+                  vk::ImageUsageFlagBits::eTransferSrc,
+              this);
+          command_buffer->KeepAlive(*ssdo_accel_texture);
+          graph->SetImage(ssdo_accel, (*ssdo_accel_texture)->image());
+          if (generate_tile_list) {
+            *ssdo_tile_list = ssdo_accelerator_->GenerateTileList(
+                command_buffer, *ssdo_accel_texture, ssdo_render_area, this);
+            command_buffer->KeepAlive(*ssdo_tile_list);
+          }
+        });
+    graph->AddSubmitPoint();
+  }
+
+  // Depth-only pre-pass.  It discards the contents of its color attachment,
+  // so it cannot use the output image if the rest of that is to be preserved.
+  const ImageId depth = graph->CreateImage(
+      {depth_format_, width, height, 1,
+       vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc |
+           vk::ImageUsageFlagBits::eDepthStencilAttachment});
+  const ImageId dummy_color =
+      is_partial
+          ? graph->CreateImage({format, width, height, 1,
+                                vk::ImageUsageFlagBits::eColorAttachment})
+          : scene_color;
+  if (!reuse_illumination) {
+    graph->AddPass(
+        "depth pre-pass",
+        {{dummy_color, ImageAccess::ColorAttachment(true)},
+         {depth, ImageAccess::DepthAttachment(true)}},
+        [this, &stage, &model, &camera, depth, dummy_color, scale,
+         previous_frame_depth, is_partial,
+         depth_area](impl::RenderGraph* graph, impl::CommandBuffer*) {
+          DrawDepthPrePass(graph->GetImage(depth), graph->GetImage(dummy_color),
+                           scale, stage, model, camera, previous_frame_depth,
+                           is_partial ? &depth_area : nullptr);
+          AddTimestamp("finished depth pre-pass");
+        });
+    graph->AddSubmitPoint();
+  }
+
+  if (use_depth_pyramid) {
+    graph->AddPass(
+        "depth pyramid",
+        {{depth,
+          ImageAccess::Sampled(vk::PipelineStageFlagBits::eComputeShader)}},
+        [this, &stage, &camera, depth](impl::RenderGraph* graph,
+                                       impl::CommandBuffer*) {
+          GenerateDepthPyramid(graph->GetImage(depth), stage, camera);
+        });
+  }
+
+  // Compute the illumination and store the result in a texture.
+  ImageId illumination = 0;
+  if (reuse_illumination) {
+    illumination = graph->ImportImage(ssdo_reusable_illumination_,
+                                      vk::ImageLayout::eShaderReadOnlyOptimal);
+  } else if (enable_lighting_) {
+    const ImageInfo illumination_info{
+        impl::SsdoSampler::kColorFormat, width, height, 1,
+        vk::ImageUsageFlagBits::eSampled |
+            vk::ImageUsageFlagBits::eColorAttachment |
+            vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst};
+    ImageInfo ssdo_info = illumination_info;
+    ssdo_info.width = ssdo_width;
+    ssdo_info.height = ssdo_height;
+
+    // Kept illumination outlives the graph, so it cannot be a transient image.
+    // The lighting pass leaves it in eShaderReadOnlyOptimal layout.
+    ImagePtr kept_illumination;
+    if (keep_illumination) {
+      kept_illumination = image_cache_->NewImage(illumination_info);
+      illumination =
+          graph->ImportImage(kept_illumination, vk::ImageLayout::eUndefined);
+    } else if (ssdo_factor != 1) {
+      illumination = graph->CreateImage(illumination_info);
+    }
+
+    // At a reduced resolution, SSDO is computed from a depth buffer rendered
+    // at that resolution, and the result is upsampled guided by the
+    // full-resolution depth buffer.
+    ImageId ssdo_depth = depth;
+    if (ssdo_factor != 1) {
+      ssdo_depth = graph->CreateImage(
+          {depth_format_, ssdo_width, ssdo_height, 1,
+           vk::ImageUsageFlagBits::eSampled |
+               vk::ImageUsageFlagBits::eDepthStencilAttachment});
+      const ImageId ssdo_dummy_color =
+          graph->CreateImage({format, ssdo_width, ssdo_height, 1,
+                              vk::ImageUsageFlagBits::eColorAttachment});
+      graph->AddPass(
+          "SSDO depth pre-pass",
+          {{ssdo_dummy_color, ImageAccess::ColorAttachment(true)},
+           {ssdo_depth, ImageAccess::DepthAttachment(true)}},
+          [this, &stage, &model, &camera, ssdo_depth, ssdo_dummy_color,
+           ssdo_scale, previous_frame_depth, is_partial,
+           ssdo_depth_area](impl::RenderGraph* graph, impl::CommandBuffer*) {
+            DrawDepthPrePass(graph->GetImage(ssdo_depth),
+                             graph->GetImage(ssdo_dummy_color), ssdo_scale,
+                             stage, model, camera, previous_frame_depth,
+                             is_partial ? &ssdo_depth_area : nullptr);
+            AddTimestamp("finished SSDO depth pre-pass");
+          });
+    }
+
+    // Partial frames and layers are not accumulated, since the history only
+    // follows the whole of the frames drawn by DrawFrame().
+    ImageId ssdo_illumination;
+    if (enable_ssdo_temporal_accumulation_ && !is_layer && !is_partial) {
+      ssdo_illumination = DrawTemporalSsdoPasses(
+          graph, ssdo_depth, ssdo_accel, ssdo_accel_texture, ssdo_tile_list,
+          ssdo_info, stage, camera, ssdo_scale);
+    } else {
+      ssdo_illumination = kept_illumination && ssdo_factor == 1
+                              ? illumination
+                              : graph->CreateImage(ssdo_info);
+      const ImageId ssdo_illumination_aux = graph->CreateImage(ssdo_info);
+      DrawSsdoPasses(graph, ssdo_depth, ssdo_illumination,
+                     &ssdo_illumination_aux, ssdo_accel, ssdo_accel_texture,
+                     ssdo_tile_list, stage, ssdo_scale,
+                     impl::SsdoSampler::SamplerConfig(stage),
+                     ssdo_render_area);
+    }
 
-    current_frame()->KeepAlive(lighting_fb);
+    if (ssdo_factor == 1) {
+      illumination = ssdo_illumination;
+    } else {
+      DrawSsdoUpsamplePass(graph, ssdo_illumination, depth, illumination,
+                           ssdo_factor, stage, render_area);
+    }
+    graph->AddSubmitPoint();
 
-    DrawLightingPass(kLightingPassSampleCount, lighting_fb,
-                     illumination_texture, stage, model, camera, overlay_model);
+    if (kept_illumination) {
+      ssdo_reusable_illumination_ = std::move(kept_illumination);
+      ssdo_reusable_illumination_key_ = std::move(ssdo_scene_key);
+    }
+  }
+
+  // Returns the illumination texture, if any, for the lighting pass.
+  auto get_illumination_texture = [this, illumination](
+      impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+    if (!enable_lighting_) {
+      return TexturePtr();
+    }
+    auto texture = ftl::MakeRefCounted<Texture>(escher()->resource_recycler(),
+                                                graph->GetImage(illumination),
+                                                vk::Filter::eNearest);
+    command_buffer->KeepAlive(texture);
+    return texture;
+  };
+
+  // Uses that are shared by both variants of the lighting pass.
+  std::vector<impl::RenderGraph::ImageUse> lighting_uses;
+  if (enable_lighting_) {
+    lighting_uses.push_back({illumination, ImageAccess::Sampled()});
+  }
+  if (layer_texture) {
+    lighting_uses.push_back(
+        {graph->ImportImage(layer_texture->image(),
+                            vk::ImageLayout::eShaderReadOnlyOptimal),
+         ImageAccess::Sampled()});
+  }
 
-    AddTimestamp("finished lighting pass");
+  // Use multisampling for final lighting pass, or not.
+  const uint32_t sample_count = lighting_pass_sample_count_;
+  if (sample_count == 1) {
+    lighting_uses.push_back(
+        {scene_color, ImageAccess::ColorAttachment(!is_partial)});
+    lighting_uses.push_back({depth, ImageAccess::DepthAttachment(false)});
+    graph->AddPass(
+        "lighting pass", std::move(lighting_uses),
+        [this, &stage, &model, &camera, scene_color, depth, scale,
+         overlay_model, layer_texture, is_partial, render_area,
+         get_illumination_texture](impl::RenderGraph* graph,
+                                   impl::CommandBuffer* command_buffer) {
+          FramebufferPtr lighting_fb = framebuffer_cache_->ObtainFramebuffer(
+              model_renderer_->lighting_pass(),
+              {graph->GetImage(scene_color), graph->GetImage(depth)},
+              command_buffer);
+
+          DrawLightingPass(1, scale, lighting_fb,
+                           get_illumination_texture(graph, command_buffer),
+                           stage, model, camera, overlay_model, layer_texture,
+                           is_partial ? &render_area : nullptr);
+
+          AddTimestamp("finished lighting pass");
+        });
   } else {
+    // The multisampled attachments are resolved into |scene_color| at the end
+    // of the render pass, and are never stored, so a tile-based GPU need not
+    // back them with memory.
     ImageInfo info;
     info.width = width;
     info.height = height;
-    info.sample_count = kLightingPassSampleCount;
-    info.format = color_image_out->format();
+    info.sample_count = sample_count;
+    info.format = format;
     info.usage = vk::ImageUsageFlagBits::eColorAttachment |
-                 vk::ImageUsageFlagBits::eTransferSrc;
-    ImagePtr color_image_multisampled = image_cache_->NewImage(info);
+                 vk::ImageUsageFlagBits::eTransientAttachment;
+    info.memory_flags = transient_attachment_memory_flags_;
+    const ImageId color_multisampled = graph->CreateImage(info);
 
-    // TODO: use lazily-allocated image: since we don't care about saving the
-    // depth buffer, a tile-based GPU doesn't actually need this memory.
     info.format = depth_format_;
-    info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
-    ImagePtr depth_image_multisampled = image_cache_->NewImage(info);
-
-    FramebufferPtr multisample_fb = ftl::MakeRefCounted<Framebuffer>(
-        escher(), width, height,
-        std::vector<ImagePtr>{color_image_multisampled,
-                              depth_image_multisampled},
-        model_renderer_->lighting_pass());
-
-    current_frame()->KeepAlive(multisample_fb);
-
-    DrawLightingPass(kLightingPassSampleCount, multisample_fb,
-                     illumination_texture, stage, model, camera, overlay_model);
-
-    AddTimestamp("finished lighting pass");
-
-    // TODO: do this during lighting sub-pass by adding a resolve attachment.
-    vk::ImageResolve resolve;
-    vk::ImageSubresourceLayers layers;
-    layers.aspectMask = vk::ImageAspectFlagBits::eColor;
-    layers.mipLevel = 0;
-    layers.baseArrayLayer = 0;
-    layers.layerCount = 1;
-    resolve.srcSubresource = layers;
-    resolve.srcOffset = vk::Offset3D{0, 0, 0};
-    resolve.dstSubresource = layers;
-    resolve.dstOffset = vk::Offset3D{0, 0, 0};
-    resolve.extent = vk::Extent3D{width, height, 0};
-    current_frame()->get().resolveImage(
-        color_image_multisampled->get(),
-        vk::ImageLayout::eColorAttachmentOptimal, color_image_out->get(),
-        vk::ImageLayout::eColorAttachmentOptimal, resolve);
-
-    AddTimestamp("finished multisample resolve");
-  }
-
-  DrawDebugOverlays(
-      color_image_out, depth_image,
-      illumination_texture ? illumination_texture->image() : ImagePtr(),
-      ssdo_accel_texture, ssdo_accel_depth_texture);
-
-  // ModelRenderer's lighting render-pass leaves the color-attachment format
-  // as eColorAttachmentOptimal, since it's not clear how it will be used
-  // next.
-  // We could push this flexibility farther by letting our client specify the
-  // desired output format, but for now we'll assume that the image is being
-  // presented immediately.
-  current_frame()->TransitionImageLayout(
-      color_image_out, vk::ImageLayout::eColorAttachmentOptimal,
-      vk::ImageLayout::ePresentSrcKHR);
-
-  AddTimestamp("finished transition to presentation layout");
+    info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment |
+                 vk::ImageUsageFlagBits::eTransientAttachment;
+    const ImageId depth_multisampled = graph->CreateImage(info);
+
+    lighting_uses.push_back(
+        {color_multisampled, ImageAccess::ColorAttachment(true)});
+    lighting_uses.push_back(
+        {depth_multisampled, ImageAccess::DepthAttachment(true)});
+    lighting_uses.push_back(
+        {scene_color, ImageAccess::ColorAttachment(!is_partial)});
+    graph->AddPass(
+        "lighting pass", std::move(lighting_uses),
+        [this, &stage, &model, &camera, color_multisampled, depth_multisampled,
+         scene_color, scale, overlay_model, layer_texture, is_partial,
+         render_area, sample_count, get_illumination_texture](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          FramebufferPtr multisample_fb =
+              framebuffer_cache_->ObtainFramebuffer(
+                  model_renderer_->lighting_pass(),
+                  {graph->GetImage(color_multisampled),
+                   graph->GetImage(depth_multisampled),
+                   graph->GetImage(scene_color)},
+                  command_buffer);
+
+          DrawLightingPass(sample_count, scale, multisample_fb,
+                           get_illumination_texture(graph, command_buffer),
+                           stage, model, camera, overlay_model, layer_texture,
+                           is_partial ? &render_area : nullptr);
+
+          AddTimestamp("finished lighting pass");
+        });
+  }
 
-  EndFrame(frame_done, frame_retired_callback);
+  if (is_scaled) {
+    // Only the top-left corner of |scene_color| holds the scene.
+    const int32_t src_width =
+        static_cast<int32_t>(std::round(output_width * scale));
+    const int32_t src_height =
+        static_cast<int32_t>(std::round(output_height * scale));
+    graph->AddPass(
+        "upscale",
+        {{scene_color,
+          ImageAccess::Transfer(vk::AccessFlagBits::eTransferRead,
+                                vk::ImageLayout::eTransferSrcOptimal)},
+         {output, ImageAccess::Transfer(vk::AccessFlagBits::eTransferWrite,
+                                        vk::ImageLayout::eTransferDstOptimal)}},
+        [this, scene_color, output, src_width, src_height, output_width,
+         output_height](impl::RenderGraph* graph,
+                        impl::CommandBuffer* command_buffer) {
+          vk::ImageBlit blit;
+          blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+          blit.srcSubresource.layerCount = 1;
+          blit.srcOffsets[1] = vk::Offset3D{src_width, src_height, 1};
+          blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+          blit.dstSubresource.layerCount = 1;
+          blit.dstOffsets[1] =
+              vk::Offset3D{static_cast<int32_t>(output_width),
+                           static_cast<int32_t>(output_height), 1};
+          command_buffer->get().blitImage(
+              graph->GetImage(scene_color)->get(),
+              vk::ImageLayout::eTransferSrcOptimal,
+              graph->GetImage(output)->get(),
+              vk::ImageLayout::eTransferDstOptimal, 1, &blit,
+              vk::Filter::eLinear);
+          AddTimestamp("finished upscale");
+        });
+  }
+
+  if (!is_layer && show_debug_info_) {
+    std::vector<impl::RenderGraph::ImageUse> debug_uses{
+        {output, ImageAccess::Transfer(
+                     vk::AccessFlagBits::eTransferWrite,
+                     vk::ImageLayout::eColorAttachmentOptimal)},
+        {ssdo_accel_depth,
+         ImageAccess::Sampled(vk::PipelineStageFlagBits::eComputeShader)},
+        {ssdo_accel, ImageAccess::Storage(vk::AccessFlagBits::eShaderRead)}};
+    if (enable_lighting_) {
+      debug_uses.push_back(
+          {illumination,
+           ImageAccess::Transfer(vk::AccessFlagBits::eTransferRead,
+                                 vk::ImageLayout::eShaderReadOnlyOptimal)});
+    }
+    graph->AddPass(
+        "debug overlays", std::move(debug_uses),
+        [this, output, illumination, ssdo_accel_depth, ssdo_accel_texture](
+            impl::RenderGraph* graph, impl::CommandBuffer* command_buffer) {
+          TexturePtr ssdo_accel_depth_texture = ftl::MakeRefCounted<Texture>(
+              escher()->resource_recycler(), graph->GetImage(ssdo_accel_depth),
+              vk::Filter::eNearest, vk::ImageAspectFlagBits::eDepth, true);
+          command_buffer->KeepAlive(ssdo_accel_depth_texture);
+          DrawDebugOverlays(
+              graph->GetImage(output),
+              enable_lighting_ ? graph->GetImage(illumination) : ImagePtr(),
+              *ssdo_accel_texture, ssdo_accel_depth_texture);
+        });
+  }
+
+  return output;
+}
+
+impl::LayerCache::Key PaperRenderer::ComputeLayerKey(const Stage& stage,
+                                                     const Layer& layer,
+                                                     const Camera& camera,
+                                                     vk::Format format,
+                                                     uint32_t width,
+                                                     uint32_t height) const {
+  const DirectionalLight& key_light = stage.key_light();
+  const ViewingVolume& volume = stage.viewing_volume();
+  impl::LayerCache::Key key;
+  key.camera_transform = camera.projection() * camera.transform();
+  key.format = format;
+  key.width = width;
+  key.height = height;
+  key.clear_color = stage.clear_color();
+  key.key_light = vec4(key_light.direction(), key_light.dispersion(),
+                       key_light.intensity());
+  key.fill_light_intensity = stage.fill_light().intensity();
+  key.viewing_volume =
+      vec4(volume.width(), volume.height(), volume.top(), volume.bottom());
+  key.enable_lighting = enable_lighting_;
+  key.renderer_settings = ComputeRendererSettingsKey();
+  for (const Layer* inner = layer.model().layer().get(); inner;
+       inner = inner->model().layer().get()) {
+    key.inner_layers.emplace_back(inner->id(), inner->revision());
+  }
+  return key;
+}
+
+TexturePtr PaperRenderer::ObtainLayerTexture(impl::RenderGraph* graph,
+                                             const Stage& stage,
+                                             const Layer& layer,
+                                             const Camera& camera,
+                                             vk::Format format,
+                                             uint32_t width,
+                                             uint32_t height) {
+  const impl::LayerCache::Key key =
+      ComputeLayerKey(stage, layer, camera, format, width, height);
+  TexturePtr texture = layer_cache_->Find(layer, key);
+  if (texture) {
+    return texture;
+  }
+
+  TRACE_DURATION("gfx", "escher::PaperRenderer::ObtainLayerTexture", "id",
+                 layer.id());
+
+  // Layers may themselves have layers.
+  const Model& model = layer.model();
+  TexturePtr background_texture;
+  if (model.layer()) {
+    background_texture = ObtainLayerTexture(graph, stage, *model.layer(),
+                                            camera, format, width, height);
+  }
+
+  ImagePtr image = image_cache_->NewImage(
+      {format, width, height, 1,
+       vk::ImageUsageFlagBits::eColorAttachment |
+           vk::ImageUsageFlagBits::eSampled |
+           vk::ImageUsageFlagBits::eTransferSrc |
+           vk::ImageUsageFlagBits::eTransferDst});
+  vk::Rect2D render_area;
+  render_area.extent = vk::Extent2D{width, height};
+  const impl::RenderGraph::ImageId output =
+      DrawScene(graph, stage, model, camera, image, render_area, nullptr,
+                background_texture, true, 1.f);
+  // Cached layer images are expected to be ready for sampling, whether or not
+  // they are sampled by this frame.
+  graph->AddPass("layer", {{output, impl::ImageAccess::Sampled()}}, nullptr);
+
+  const vk::DeviceSize size = image->memory()->size();
+  texture = ftl::MakeRefCounted<Texture>(escher()->resource_recycler(),
+                                         std::move(image),
+                                         vk::Filter::eNearest);
+  // Layers that don't fit within the budget are rendered again each frame.
+  layer_cache_->Insert(layer, key, texture, size);
+  return texture;
+}
+
+void PaperRenderer::DrawModelDisplayList(
+    const Stage& stage,
+    const impl::ModelDisplayListPtr& display_list,
+    vk::RenderPass render_pass,
+    impl::CommandBuffer* command_buffer) {
+  if (enable_secondary_command_buffers_) {
+    model_renderer_->DrawWithSecondaryCommandBuffers(stage, display_list,
+                                                     render_pass,
+                                                     command_buffer);
+  } else {
+    model_renderer_->Draw(stage, display_list, command_buffer);
+  }
+}
+
+vk::SubpassContents PaperRenderer::GetSubpassContents() const {
+  return enable_secondary_command_buffers_
+             ? vk::SubpassContents::eSecondaryCommandBuffers
+             : vk::SubpassContents::eInline;
+}
+
+ByteKey PaperRenderer::ComputeRendererSettingsKey() const {
+  ByteKey key;
+  AppendToKey(&key, ssdo_downsample_factor_);
+  AppendToKey(&key, ssdo_accelerator_->enabled());
+  AppendToKey(&key, enable_ssdo_temporal_accumulation_);
+  AppendToKey(&key, enable_ssdo_compute_sampling_);
+  AppendToKey(&key, enable_ssdo_compute_filtering_);
+  AppendToKey(&key, enable_ssdo_reuse_);
+  AppendToKey(&key, sort_by_pipeline_);
+  AppendToKey(&key, share_descriptor_sets_);
+  AppendToKey(&key, lighting_pass_sample_count_);
+  return key;
+}
+
+vk::Rect2D PaperRenderer::ComputeDamage(const Stage& stage,
+                                        const Model& model,
+                                        const Camera& camera,
+                                        const ImagePtr& color_image_out,
+                                        const Model* overlay_model,
+                                        const TexturePtr& layer_texture) {
+  TRACE_DURATION("gfx", "escher::PaperRenderer::ComputeDamage");
+
+  if (!damage_tracker_) {
+    damage_tracker_ = std::make_unique<impl::DamageTracker>(kShadowRadius);
+  }
+
+  vk::Rect2D full_frame;
+  full_frame.extent =
+      vk::Extent2D{color_image_out->width(), color_image_out->height()};
+  if (show_debug_info_) {
+    // The debug overlays are blitted from images that are only partially
+    // updated by partial frames.
+    damage_tracker_->Reset();
+    return full_frame;
+  }
+
+  const DirectionalLight& key_light = stage.key_light();
+  impl::DamageTracker::FrameState state;
+  state.camera_transform = camera.projection() * camera.transform();
+  state.clear_color = stage.clear_color();
+  state.key_light = vec4(key_light.direction(), key_light.dispersion(),
+                         key_light.intensity());
+  state.fill_light_intensity = stage.fill_light().intensity();
+  state.width = color_image_out->width();
+  state.height = color_image_out->height();
+  state.layer_image_uid = layer_texture ? layer_texture->image()->uid() : 0;
+  state.enable_lighting = enable_lighting_;
+  state.renderer_settings = ComputeRendererSettingsKey();
+
+  damage_tracker_->BeginFrame(state);
+  damage_tracker_->AddObjects(model.objects(), state.camera_transform, 0);
+  if (overlay_model) {
+    // Overlays are drawn with an orthographic camera; see DrawLightingPass().
+    Camera overlay_camera = Camera::NewOrtho(stage.viewing_volume());
+    damage_tracker_->AddObjects(
+        overlay_model->objects(),
+        overlay_camera.projection() * overlay_camera.transform(), 1);
+  }
+  return damage_tracker_->EndFrame(color_image_out->get());
+}
+
+ByteKey PaperRenderer::ComputeSsdoSceneKey(const Stage& stage,
+                                           const Model& model,
+                                           const Camera& camera,
+                                           uint32_t width,
+                                           uint32_t height,
+                                           float scale) const {
+  TRACE_DURATION("gfx", "escher::PaperRenderer::ComputeSsdoSceneKey");
+
+  ByteKey key;
+  AppendToKey(&key, camera.projection() * camera.transform());
+  const ViewingVolume& volume = stage.viewing_volume();
+  AppendToKey(&key, vec4(volume.width(), volume.height(), volume.top(),
+                         volume.bottom()));
+  const DirectionalLight& key_light = stage.key_light();
+  AppendToKey(&key, vec4(key_light.direction(), key_light.dispersion(),
+                         key_light.intensity()));
+  AppendToKey(&key, width);
+  AppendToKey(&key, height);
+  AppendToKey(&key, scale);
+  AppendToKey(&key, ssdo_downsample_factor_);
+  AppendToKey(&key, enable_ssdo_compute_sampling_);
+  AppendToKey(&key, enable_ssdo_compute_filtering_);
+  AppendToKey(&key, ssdo_accelerator_->enabled());
+  // Shape modifiers animate the model over time.
+  if (impl::HasShapeModifiers(model.objects())) {
+    AppendToKey(&key, model.time());
+  }
+  // A change to any object may affect the illumination anywhere, so the
+  // objects are simply keyed in order.
+  for (const Object& object : model.objects()) {
+    impl::AppendObjectToKey(&key, object);
+  }
+  return key;
+}
+
+void PaperRenderer::set_enable_damage_tracking(bool b) {
+  enable_damage_tracking_ = b;
+  if (!b && damage_tracker_) {
+    // Frames that are rendered in the meantime are not tracked.
+    damage_tracker_->Reset();
+  }
+}
+
+void PaperRenderer::set_enable_dynamic_resolution(bool b) {
+  enable_dynamic_resolution_ = b;
+  if (b) {
+    // Disabling dynamic resolution leaves the timing to the caller, who may
+    // have enabled it for its own purposes.
+    set_enable_gpu_frame_timing(true);
+  }
+  if (b && !resolution_controller_) {
+    resolution_controller_ = std::make_unique<impl::ResolutionController>(
+        impl::ResolutionController::Config());
+  }
+  if (!b) {
+    pending_frame_scales_.clear();
+  }
+}
+
+void PaperRenderer::set_dynamic_resolution_config(
+    const impl::ResolutionController::Config& config) {
+  resolution_controller_ =
+      std::make_unique<impl::ResolutionController>(config);
+}
+
+void PaperRenderer::OnGpuFrameTime(uint64_t frame_number,
+                                   uint64_t microseconds) {
+  // Frames that were not timed are never reported.
+  while (!pending_frame_scales_.empty() &&
+         pending_frame_scales_.front().first < frame_number) {
+    pending_frame_scales_.pop_front();
+  }
+  if (pending_frame_scales_.empty() ||
+      pending_frame_scales_.front().first != frame_number) {
+    return;
+  }
+  resolution_controller_->ReportFrameTime(
+      pending_frame_scales_.front().second, microseconds);
+  pending_frame_scales_.pop_front();
+}
+
+void PaperRenderer::set_layer_memory_budget(vk::DeviceSize budget) {
+  layer_cache_->set_memory_budget(budget);
+}
+
+const impl::LayerCache::Stats& PaperRenderer::layer_cache_stats() const {
+  return layer_cache_->stats();
+}
+
+void PaperRenderer::set_enable_ssdo_temporal_accumulation(bool b) {
+  enable_ssdo_temporal_accumulation_ = b;
+  if (!b) {
+    ssdo_history_ = nullptr;
+  }
+}
+
+void PaperRenderer::set_ssdo_downsample_factor(uint32_t factor) {
+  FTL_DCHECK(factor == 1 || factor == 2 || factor == 4);
+  ssdo_downsample_factor_ = factor;
+}
+
+void PaperRenderer::set_enable_ssdo_compute_sampling(bool b) {
+  // The kernel writes the eR8G8Unorm SSDO image as a storage image.
+  FTL_DCHECK(!b || escher()->device()->caps().storage_image_extended_formats);
+  enable_ssdo_compute_sampling_ = b;
+}
+
+void PaperRenderer::set_lighting_pass_sample_count(uint32_t count) {
+  FTL_DCHECK(escher()->device()->caps().framebuffer_sample_counts &
+             impl::SampleCountFlagBitsFromInt(count));
+  if (count == lighting_pass_sample_count_) {
+    return;
+  }
+  lighting_pass_sample_count_ = count;
+  // The lighting passes of the ModelRenderer are created for a single sample
+  // count, so it is created again by the next frame, once the pending frames
+  // no longer use it.
+  WaitForFramesInFlight();
+  model_renderer_.reset();
+}
+
+void PaperRenderer::set_enable_ssdo_compute_filtering(bool b) {
+  FTL_DCHECK(!b || escher()->device()->caps().storage_image_extended_formats);
+  enable_ssdo_compute_filtering_ = b;
+}
+
+void PaperRenderer::set_enable_ssdo_reuse(bool b) {
+  enable_ssdo_reuse_ = b;
+  if (!b) {
+    ssdo_reusable_illumination_ = nullptr;
+    ssdo_reusable_illumination_key_.clear();
+  }
 }
 
 void PaperRenderer::set_enable_ssdo_acceleration(bool b) {
@@ -4,8 +4,19 @@
 
 #pragma once
 
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "escher/forward_declarations.h"
+#include "escher/impl/layer_cache.h"
+#include "escher/impl/model_display_list_flags.h"
+#include "escher/impl/render_graph.h"
+#include "escher/impl/resolution_controller.h"
+#include "escher/impl/ssdo_sampler.h"
 #include "escher/renderer/renderer.h"
+#include "escher/util/hash.h"
 
 namespace escher {
 
@@ -13,6 +24,18 @@ class DepthToColor;
 
 class PaperRenderer : public Renderer {
  public:
+  // Specifies how objects that are outside of the view frustum are culled.
+  enum class FrustumCullingMode {
+    // All objects are drawn.
+    kNone,
+    // Objects are tested on the CPU while building display lists.
+    kCpu,
+    // Objects are tested by a compute shader, which disables their indirect
+    // draws.  Implies multi-draw-indirect, and has the same requirements; see
+    // set_enable_multi_draw_indirect().
+    kGpu
+  };
+
   explicit PaperRenderer(Escher* escher);
 
   void DrawFrame(const Stage& stage,
@@ -33,10 +56,145 @@ class PaperRenderer : public Renderer {
   // table each frame.
   void set_enable_ssdo_acceleration(bool b);
 
+  // Set the factor (1, 2 or 4) by which the resolution of SSDO sampling and
+  // filtering is reduced in each dimension.  The occlusion is computed from a
+  // depth buffer rendered at the reduced resolution, and is then upsampled
+  // before the lighting pass, guided by the full-resolution depth buffer so
+  // that shadow edges stay crisp at silhouettes.  Defaults to 1.
+  void set_ssdo_downsample_factor(uint32_t factor);
+
+  // Set whether SSDO should take a quarter as many samples per pixel in each
+  // frame, varying them from frame to frame, and accumulate them with those
+  // of previous frames instead of filtering them.  The accumulated result is
+  // reprojected from the previous frame's camera, and discarded wherever the
+  // depth does not match, e.g. where objects were hidden before.  Frames that
+  // have no history (such as partial frames; see set_enable_damage_tracking())
+  // are sampled and filtered as usual.
+  void set_enable_ssdo_temporal_accumulation(bool b);
+
+  // Set whether SSDO sampling should use a compute kernel, which loads each
+  // tile of the depth buffer into shared memory once and skips tiles that
+  // cannot be shadowed, rather than a fragment shader.  Its taps span the same
+  // part of the scene at any resolution.  Requires the
+  // shaderStorageImageExtendedFormats feature.
+  void set_enable_ssdo_compute_sampling(bool b);
+
+  // Set whether the SSDO filter should run as a single compute dispatch that
+  // filters both directions at once, rather than as two render passes.  The
+  // result differs only by the rounding of the intermediate values, which the
+  // render passes store in 8 bits.  Requires the
+  // shaderStorageImageExtendedFormats feature.
+  void set_enable_ssdo_compute_filtering(bool b);
+
+  // Set whether the SSDO illumination of a whole frame should be kept, and
+  // reused by following frames for as long as their model, camera, stage and
+  // SSDO settings are the same, so that only the lighting pass is drawn again,
+  // e.g. for a changed overlay.  Frames that are entirely unchanged are skipped
+  // by damage tracking instead; see set_enable_damage_tracking().  It is not
+  // reused with temporal accumulation, which refines it from frame to frame,
+  // nor with hi-z culling, which may have culled it from a stale depth.
+  void set_enable_ssdo_reuse(bool b);
+
+  // Set the number of samples per pixel of the lighting pass, which are
+  // resolved at the end of the pass; see ModelRenderer::lighting_pass().  The
+  // multisampled attachments are never stored, so on tile-based GPUs they are
+  // lazily allocated.  Must be one of the device's
+  // Caps::framebuffer_sample_counts.  Defaults to 1; changing it waits for the
+  // pending frames.
+  void set_lighting_pass_sample_count(uint32_t count);
+
   // Set whether objects should be sorted by their pipeline, or rendered in the
   // order that they are provided by the caller.
   void set_sort_by_pipeline(bool b) { sort_by_pipeline_ = b; }
 
+  // Set whether objects that use the same texture should share a single
+  // descriptor set, instead of each object using its own.
+  void set_share_descriptor_sets(bool b) { share_descriptor_sets_ = b; }
+
+  // Set whether runs of similar objects should be drawn by a single indirect
+  // draw call.  Only enable this if the Vulkan device was created with the
+  // multiDrawIndirect and drawIndirectFirstInstance features enabled.
+  void set_enable_multi_draw_indirect(bool b) {
+    enable_multi_draw_indirect_ = b;
+  }
+
+  // Set how objects that are outside of the view frustum are culled.
+  void set_frustum_culling_mode(FrustumCullingMode mode) {
+    frustum_culling_mode_ = mode;
+  }
+
+  // Set whether objects that are hidden behind large opaque rects and circles
+  // should be culled on the CPU.
+  void set_enable_occlusion_culling(bool b) { enable_occlusion_culling_ = b; }
+
+  // Set whether the depth buffer of each frame should be reduced to a
+  // hierarchical-Z pyramid and read back, so that objects which it shows to be
+  // hidden can be culled from the depth pre-passes of subsequent frames.  The
+  // lighting pass is never culled this way, so that objects which have become
+  // visible since are still drawn.
+  void set_enable_hi_z_culling(bool b) { enable_hi_z_culling_ = b; }
+
+  // Set whether models should be drawn by cached secondary command buffers, so
+  // that runs of objects that are unchanged since the previous frame are not
+  // recorded again.  Only effective for RetainedModels, whose unchanged objects
+  // keep the same uniforms from frame to frame; other models are re-recorded
+  // every frame, which is slower than drawing them directly.
+  void set_enable_secondary_command_buffers(bool b) {
+    enable_secondary_command_buffers_ = b;
+  }
+
+  // Set whether only the parts of the output image that may have changed since
+  // the last frame that was rendered into the same image should be rendered
+  // again.  Each object that changes damages its screen-space bounds, expanded
+  // by SsdoSampler::kShadowRadius to cover its shadow; see
+  // impl::DamageTracker.  Only enable this if output images retain their
+  // contents between frames, as swapchain images do, and are only rendered
+  // into by this renderer.
+  void set_enable_damage_tracking(bool b);
+
+  // The rectangle of the output image that was rendered by the last call to
+  // DrawFrame(), in pixels; the rest of the image was preserved.  Empty if
+  // nothing had changed.
+  const vk::Rect2D& damage_rect() const { return damage_rect_; }
+
+  // Set whether each frame should be submitted to the GPU in several batches
+  // (after the depth pre-passes, the SSDO passes, etc.), so that the GPU can
+  // begin working before the whole frame has been recorded.  By default, each
+  // frame is submitted at once.
+  void set_enable_early_submission(bool b) { enable_early_submission_ = b; }
+
+  // Set whether the scene should be rendered at a reduced resolution, and
+  // stretched to fill the output image, when the GPU takes too long to render
+  // it at full resolution.  The scale is chosen each frame from the measured
+  // GPU time of earlier frames; see impl::ResolutionController.  Requires
+  // timestamp queries, so enabling this also enables
+  // Renderer::set_enable_gpu_frame_timing(); disabling it leaves the timing
+  // enabled.  Damage tracking only skips unchanged frames while the scale is
+  // reduced.  Output images must support eTransferDst usage.
+  void set_enable_dynamic_resolution(bool b);
+
+  // Set the target GPU frame time and the bounds of the scale; see
+  // impl::ResolutionController::Config.  Restarts at the maximum scale.
+  void set_dynamic_resolution_config(
+      const impl::ResolutionController::Config& config);
+
+  // The scale at which the last frame was rendered: 1 unless dynamic
+  // resolution is enabled.
+  float render_scale() const { return render_scale_; }
+
+  // Passes, barriers, transient images and submissions of the last frame, for
+  // profiling.
+  const impl::RenderGraph::Stats& render_graph_stats() const {
+    return render_graph_stats_;
+  }
+
+  // Set the maximum total size of the images that Layers are rendered into;
+  // see Layer.  Layers that do not fit are rendered again in every frame.
+  void set_layer_memory_budget(vk::DeviceSize budget);
+
+  // Layer-image cache hits, misses and memory usage, for profiling.
+  const impl::LayerCache::Stats& layer_cache_stats() const;
+
   // Cycle through the available SSDO acceleration modes.  This is a temporary
   // API: eventually there will only be one mode (the best one!), but this is
   // useful during development.
@@ -45,26 +203,87 @@ class PaperRenderer : public Renderer {
  private:
   ~PaperRenderer() override;
 
+  // Reports the GPU time of the frame to |resolution_controller_|.
+  void OnGpuFrameTime(uint64_t frame_number, uint64_t microseconds) override;
+
   static constexpr uint32_t kFramebufferColorAttachmentIndex = 0;
   static constexpr uint32_t kFramebufferDepthAttachmentIndex = 1;
 
+  // A texture that is created while a RenderGraph is executed, and shared by
+  // the passes that use it.
+  using SharedTexture = std::shared_ptr<TexturePtr>;
+  // Likewise, a buffer.
+  using SharedBuffer = std::shared_ptr<BufferPtr>;
+
   // Render pass that generates a depth buffer, but no color fragments.  The
   // resulting depth buffer is used by DrawSsdoPasses() in order to compute
   // per-pixel occlusion, and by DrawLightingPass().
+  // The stage is drawn at |scale| into the top-left corner of |depth_image|.
+  // If |previous_frame_depth| is not null, objects that are hidden according
+  // to it are culled.  If |render_area| is not null, only it is rendered.
   void DrawDepthPrePass(const ImagePtr& depth_image,
                         const ImagePtr& dummy_color_image,
+                        float scale,
                         const Stage& stage,
                         const Model& model,
-                        const Camera& camera);
+                        const Camera& camera,
+                        const impl::OcclusionCuller* previous_frame_depth,
+                        const vk::Rect2D* render_area);
+
+  // Reduce the depth buffer generated by DrawDepthPrePass() to a hierarchical-
+  // Z pyramid, and read back the coarsest level for use in subsequent frames.
+  void GenerateDepthPyramid(const ImagePtr& depth_image,
+                            const Stage& stage,
+                            const Camera& camera);
+
+  // Add multiple render passes to |graph|.  The first samples the depth
+  // buffer to generate per-pixel occlusion information, and subsequent passes
+  // filter this noisy data, using |color_aux| as scratch space; if that is
+  // null, the data is not filtered.  |color_aux| and |color_out| must be
+  // storage images if compute sampling or filtering is enabled.  Only
+  // |render_area| of |color_out| is computed.  |accelerator_texture| is the
+  // texture of |accelerator|, as generated by SsdoAccelerator, and
+  // |tile_list| the list of its active tiles within |render_area|, which is
+  // only used by compute kernels.  |scale| is that at which the depth buffer
+  // was rendered.
+  void DrawSsdoPasses(impl::RenderGraph* graph,
+                      impl::RenderGraph::ImageId depth_in,
+                      impl::RenderGraph::ImageId color_out,
+                      const impl::RenderGraph::ImageId* color_aux,
+                      impl::RenderGraph::ImageId accelerator,
+                      const SharedTexture& accelerator_texture,
+                      const SharedBuffer& tile_list,
+                      const Stage& stage,
+                      float scale,
+                      const impl::SsdoSampler::SamplerConfig& sampler_config,
+                      const vk::Rect2D& render_area);
+
+  // Add the passes that compute SSDO for the whole of an image described by
+  // |info| to |graph|, accumulating it with the history of previous frames;
+  // see set_enable_ssdo_temporal_accumulation().  Returns the id of the
+  // result, which becomes the history of the next frame.
+  impl::RenderGraph::ImageId DrawTemporalSsdoPasses(
+      impl::RenderGraph* graph,
+      impl::RenderGraph::ImageId depth_in,
+      impl::RenderGraph::ImageId accelerator,
+      const SharedTexture& accelerator_texture,
+      const SharedBuffer& tile_list,
+      const ImageInfo& info,
+      const Stage& stage,
+      const Camera& camera,
+      float scale);
 
-  // Multiple render passes.  The first samples the depth buffer to generate
-  // per-pixel occlusion information, and subsequent passes filter this noisy
-  // data.
-  void DrawSsdoPasses(const ImagePtr& depth_in,
-                      const ImagePtr& color_out,
-                      const ImagePtr& color_aux,
-                      const TexturePtr& accelerator_texture,
-                      const Stage& stage);
+  // Add a render pass to |graph| that upsamples the illumination in
+  // |color_in|, which was computed by DrawSsdoPasses() at 1/|factor| of the
+  // resolution of |depth_in|, into |color_out|.  Only |render_area| of
+  // |color_out| is computed.
+  void DrawSsdoUpsamplePass(impl::RenderGraph* graph,
+                            impl::RenderGraph::ImageId color_in,
+                            impl::RenderGraph::ImageId depth_in,
+                            impl::RenderGraph::ImageId color_out,
+                            uint32_t factor,
+                            const Stage& stage,
+                            const vk::Rect2D& render_area);
 
   // Render pass that renders the fully-lit/shadowed scene.  Uses the depth
   // buffer from DrawDepthPrePass(), and the illumination texture from
@@ -74,20 +293,106 @@ class PaperRenderer : public Renderer {
   // might save bandwidth at the cost of more per-fragment computation (but
   // the latter might be mitigated by sorting front-to-back, etc.).  Revisit
   // after doing performance profiling.
+  // If |layer_texture| is not null, it is composited behind the model.  If
+  // |render_area| is not null, only it is rendered, and the rest of a
+  // single-sampled color attachment is preserved.  The stage is drawn at
+  // |scale|, as in DrawDepthPrePass().
   void DrawLightingPass(uint32_t sample_count,
+                        float scale,
                         const FramebufferPtr& framebuffer,
                         const TexturePtr& illumination_texture,
                         const Stage& stage,
                         const Model& model,
                         const Camera& camera,
-                        const Model* overlay_model);
+                        const Model* overlay_model,
+                        const TexturePtr& layer_texture,
+                        const vk::Rect2D* render_area);
+
+  // Add the passes that render |model| into |color_image_out| to |graph|: the
+  // depth pre-passes, SSDO and the lighting pass.  Returns the image's id in
+  // |graph|.  |is_layer| is true if the image is that of a Layer, which is
+  // neither used for Hi-Z culling nor overlaid with debug info.  Only
+  // |render_area| of the image is rendered.  If that is not the whole image,
+  // the rest is preserved, and the image must be in ePresentSrcKHR layout, as
+  // left by a previous DrawFrame().  If |scale| is less than 1, the whole image
+  // is rendered at that scale into smaller images, and then stretched to fill
+  // it by a final "upscale" pass.
+  impl::RenderGraph::ImageId DrawScene(impl::RenderGraph* graph,
+                                       const Stage& stage,
+                                       const Model& model,
+                                       const Camera& camera,
+                                       const ImagePtr& color_image_out,
+                                       const vk::Rect2D& render_area,
+                                       const Model* overlay_model,
+                                       const TexturePtr& layer_texture,
+                                       bool is_layer,
+                                       float scale);
+
+  // Return the rectangle of |color_image_out| that must be rendered, because
+  // it may differ from what was last rendered into the image; see
+  // set_enable_damage_tracking().
+  vk::Rect2D ComputeDamage(const Stage& stage,
+                           const Model& model,
+                           const Camera& camera,
+                           const ImagePtr& color_image_out,
+                           const Model* overlay_model,
+                           const TexturePtr& layer_texture);
+
+  // Return a key that identifies everything that affects the SSDO
+  // illumination of a whole frame; see set_enable_ssdo_reuse().
+  ByteKey ComputeSsdoSceneKey(const Stage& stage,
+                              const Model& model,
+                              const Camera& camera,
+                              uint32_t width,
+                              uint32_t height,
+                              float scale) const;
+
+  // Return a key that identifies the settings that may change the rendered
+  // pixels even slightly, e.g. the SSDO resolution or the order of draws of
+  // coplanar objects.  A partial frame or a cached layer image must match the
+  // pixels around it, so a change of these settings damages the whole frame
+  // and invalidates all cached layers.
+  ByteKey ComputeRendererSettingsKey() const;
+
+  // Return the key under which the image of |layer| is cached.  Its objects
+  // are identified by its revision, which is bumped when they are modified.
+  impl::LayerCache::Key ComputeLayerKey(const Stage& stage,
+                                        const Layer& layer,
+                                        const Camera& camera,
+                                        vk::Format format,
+                                        uint32_t width,
+                                        uint32_t height) const;
+
+  // Return the image of |layer|, adding the passes that render it to |graph|
+  // if it is not cached.  Once |graph| is executed, the image is in
+  // eShaderReadOnlyOptimal layout.
+  TexturePtr ObtainLayerTexture(impl::RenderGraph* graph,
+                                const Stage& stage,
+                                const Layer& layer,
+                                const Camera& camera,
+                                vk::Format format,
+                                uint32_t width,
+                                uint32_t height);
+
+  // Draw |display_list| in the current subpass of |render_pass|, either
+  // directly or via secondary command buffers; see GetSubpassContents().
+  void DrawModelDisplayList(const Stage& stage,
+                            const impl::ModelDisplayListPtr& display_list,
+                            vk::RenderPass render_pass,
+                            impl::CommandBuffer* command_buffer);
+
+  // Return how the subpasses of the model render passes are to be recorded.
+  vk::SubpassContents GetSubpassContents() const;
 
   void DrawDebugOverlays(const ImagePtr& output,
-                         const ImagePtr& depth,
                          const ImagePtr& illumination,
                          const TexturePtr& ssdo_accel,
                          const TexturePtr& ssdo_accel_depth);
 
+  // Return the display-list flags that are shared by all passes, according to
+  // the renderer's current settings.
+  impl::ModelDisplayListFlags GetDisplayListFlags() const;
+
   // Configure the renderer to use the specified output formats.
   void UpdateModelRenderer(vk::Format pre_pass_color_format,
                            vk::Format lighting_pass_color_format);
@@ -95,15 +400,61 @@ class PaperRenderer : public Renderer {
   MeshPtr full_screen_;
   impl::ImageCache* image_cache_;
   vk::Format depth_format_;
+  // Memory flags for attachments that are never stored, such as those of a
+  // multisampled lighting pass.  The image factory falls back to eDeviceLocal
+  // alone for images that can't be lazily allocated.
+  vk::MemoryPropertyFlags transient_attachment_memory_flags_;
   std::unique_ptr<impl::ModelData> model_data_;
   std::unique_ptr<impl::ModelRenderer> model_renderer_;
+  std::unique_ptr<impl::FramebufferCache> framebuffer_cache_;
   std::unique_ptr<impl::SsdoSampler> ssdo_;
   std::unique_ptr<impl::SsdoAccelerator> ssdo_accelerator_;
   std::unique_ptr<DepthToColor> depth_to_color_;
+  // Lazily created by GenerateDepthPyramid().
+  std::unique_ptr<impl::DepthPyramid> depth_pyramid_;
+  std::unique_ptr<impl::LayerCache> layer_cache_;
+  // Lazily created by ComputeDamage().
+  std::unique_ptr<impl::DamageTracker> damage_tracker_;
+  // SSDO accumulated by previous frames, in eShaderReadOnlyOptimal layout,
+  // and the frame number, camera transform and extent of the scene that it
+  // was accumulated at; see DrawTemporalSsdoPasses().
+  ImagePtr ssdo_history_;
+  uint64_t ssdo_history_frame_number_ = 0;
+  mat4 ssdo_history_transform_;
+  vec2 ssdo_history_uv_limit_;
+  uint32_t ssdo_history_length_ = 0;
+  // The illumination of the last whole frame that kept it, in
+  // eShaderReadOnlyOptimal layout, and the key of its scene; see
+  // set_enable_ssdo_reuse().
+  ImagePtr ssdo_reusable_illumination_;
+  ByteKey ssdo_reusable_illumination_key_;
+  vk::Rect2D damage_rect_;
+  // Created by set_enable_dynamic_resolution().
+  std::unique_ptr<impl::ResolutionController> resolution_controller_;
+  // The number and scale of each timed frame whose GPU time has not been
+  // reported.
+  std::deque<std::pair<uint64_t, float>> pending_frame_scales_;
+  float render_scale_ = 1.f;
   std::vector<vk::ClearValue> clear_values_;
   bool show_debug_info_ = false;
   bool enable_lighting_ = true;
+  uint32_t ssdo_downsample_factor_ = 1;
+  bool enable_ssdo_temporal_accumulation_ = false;
+  bool enable_ssdo_compute_sampling_ = false;
+  bool enable_ssdo_compute_filtering_ = false;
+  bool enable_ssdo_reuse_ = false;
+  uint32_t lighting_pass_sample_count_ = 1;
   bool sort_by_pipeline_ = true;
+  bool share_descriptor_sets_ = true;
+  bool enable_multi_draw_indirect_ = false;
+  FrustumCullingMode frustum_culling_mode_ = FrustumCullingMode::kNone;
+  bool enable_occlusion_culling_ = false;
+  bool enable_hi_z_culling_ = false;
+  bool enable_secondary_command_buffers_ = false;
+  bool enable_damage_tracking_ = false;
+  bool enable_early_submission_ = false;
+  bool enable_dynamic_resolution_ = false;
+  impl::RenderGraph::Stats render_graph_stats_;
 
   FRIEND_REF_COUNTED_THREAD_SAFE(PaperRenderer);
   FTL_DISALLOW_COPY_AND_ASSIGN(PaperRenderer);
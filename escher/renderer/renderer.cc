@@ -4,7 +4,7 @@
 
 #include "escher/renderer/renderer.h"
 
-#include <array>
+#include <vector>
 
 #include "escher/escher.h"
 #include "escher/impl/command_buffer_pool.h"
@@ -20,6 +20,16 @@
 
 namespace escher {
 
+namespace {
+
+// How long to wait for a frame in flight before warning that it is slow.  The
+// wait continues afterward, since slow GPUs and huge frames are legitimate.
+constexpr uint64_t kFrameInFlightWarningNanoseconds = 1000000000;
+
+}  // namespace
+
+constexpr uint32_t Renderer::kDefaultMaxFramesInFlight;
+
 impl::EscherImpl* Renderer::escher_impl() const {
   return escher_->impl();
 }
@@ -29,19 +39,122 @@ Renderer::Renderer(Escher* escher)
       escher_(escher),
       pool_(escher->command_buffer_pool()) {
   escher_impl()->IncrementRendererCount();
+  CreateFramesInFlight(kDefaultMaxFramesInFlight);
 }
 
 Renderer::~Renderer() {
   FTL_DCHECK(!current_frame_);
+  DestroyFramesInFlight();
   escher_impl()->DecrementRendererCount();
 }
 
+void Renderer::set_max_frames_in_flight(uint32_t count) {
+  FTL_DCHECK(!current_frame_);
+  FTL_DCHECK(count > 0);
+  if (count != frames_in_flight_.size()) {
+    DestroyFramesInFlight();
+    CreateFramesInFlight(count);
+  }
+}
+
+void Renderer::CreateFramesInFlight(uint32_t count) {
+  FTL_DCHECK(frames_in_flight_.empty());
+  frames_in_flight_.resize(count);
+  for (auto& frame : frames_in_flight_) {
+    frame.fence = ESCHER_CHECKED_VK_RESULT(
+        context_.device.createFence(vk::FenceCreateInfo()));
+    if (escher_impl()->supports_timer_queries()) {
+      vk::QueryPoolCreateInfo info;
+      info.queryType = vk::QueryType::eTimestamp;
+      info.queryCount = 2;
+      frame.timestamp_pool =
+          ESCHER_CHECKED_VK_RESULT(context_.device.createQueryPool(info));
+    }
+  }
+}
+
+void Renderer::DestroyFramesInFlight() {
+  for (auto& frame : frames_in_flight_) {
+    WaitForFrameInFlight(&frame);
+    context_.device.destroyFence(frame.fence);
+    if (frame.timestamp_pool) {
+      context_.device.destroyQueryPool(frame.timestamp_pool);
+    }
+  }
+  frames_in_flight_.clear();
+}
+
+void Renderer::WaitForFramesInFlight() {
+  FTL_DCHECK(!current_frame_);
+  for (auto& frame : frames_in_flight_) {
+    WaitForFrameInFlight(&frame);
+  }
+}
+
+void Renderer::WaitForFrameInFlight(FrameInFlight* frame) {
+  if (!frame->pending) {
+    return;
+  }
+  TRACE_DURATION("gfx", "escher::Renderer::WaitForFrameInFlight");
+  auto result = context_.device.waitForFences(
+      1, &frame->fence, true, kFrameInFlightWarningNanoseconds);
+  while (result == vk::Result::eTimeout) {
+    FTL_LOG(WARNING) << "Still waiting for frame in flight "
+                     << frame->frame_number;
+    result = context_.device.waitForFences(1, &frame->fence, true,
+                                           kFrameInFlightWarningNanoseconds);
+  }
+  // Anything else, e.g. a lost device, is unrecoverable.
+  FTL_CHECK(result == vk::Result::eSuccess)
+      << "Failed waiting for frame in flight: " << vk::to_string(result);
+  context_.device.resetFences(1, &frame->fence);
+  frame->pending = false;
+
+  if (frame->is_timed) {
+    frame->is_timed = false;
+    uint64_t timestamps[2];
+    vk::Result status = context_.device.getQueryPoolResults(
+        frame->timestamp_pool, 0, 2, sizeof(timestamps), timestamps,
+        sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+    if (status == vk::Result::eSuccess && timestamps[1] >= timestamps[0]) {
+      const float microsecond_multiplier =
+          escher_impl()->timestamp_period() * 0.001f;
+      OnGpuFrameTime(frame->frame_number,
+                     static_cast<uint64_t>((timestamps[1] - timestamps[0]) *
+                                           microsecond_multiplier));
+    }
+  }
+}
+
 void Renderer::BeginFrame() {
   TRACE_DURATION("gfx", "escher::Renderer::BeginFrame");
 
   FTL_DCHECK(!current_frame_);
   ++frame_number_;
+
+  // If the ring is full, wait for the oldest frame to finish.  Its resources
+  // are then recycled by GetCommandBuffer() below.
+  WaitForFrameInFlight(
+      &frames_in_flight_[frame_number_ % frames_in_flight_.size()]);
+
   current_frame_ = pool_->GetCommandBuffer();
+  elided_state_change_count_ = 0;
+
+  FrameInFlight& frame =
+      frames_in_flight_[frame_number_ % frames_in_flight_.size()];
+  if (enable_gpu_frame_timing_ && frame.timestamp_pool) {
+    vk::CommandBuffer command_buffer = current_frame_->get();
+    command_buffer.resetQueryPool(frame.timestamp_pool, 0, 2);
+    // Frames wait for their swapchain image at eColorAttachmentOutput (see
+    // PaperRenderer::DrawFrame()).  The timestamp is written at that stage,
+    // so that the time spent waiting for the image isn't counted; at
+    // eTopOfPipe, it would be written as soon as the frame was submitted.
+    command_buffer.writeTimestamp(
+        vk::PipelineStageFlagBits::eColorAttachmentOutput,
+        frame.timestamp_pool, 0);
+    frame.is_timed = true;
+    frame.frame_number = frame_number_;
+  }
 
   FTL_DCHECK(!profiler_);
   if (enable_profiling_ && escher_impl()->supports_timer_queries()) {
@@ -52,9 +165,15 @@ void Renderer::BeginFrame() {
   }
 }
 
+bool Renderer::is_current_frame_timed() const {
+  FTL_DCHECK(current_frame_);
+  return frames_in_flight_[frame_number_ % frames_in_flight_.size()].is_timed;
+}
+
 void Renderer::SubmitPartialFrame() {
   TRACE_DURATION("gfx", "escher::Renderer::SubmitPartialFrame");
   FTL_DCHECK(current_frame_);
+  elided_state_change_count_ += current_frame_->elided_state_change_count();
   current_frame_->Submit(context_.queue, nullptr);
   current_frame_ = pool_->GetCommandBuffer();
 }
@@ -64,13 +183,23 @@ void Renderer::EndFrame(const SemaphorePtr& frame_done,
   TRACE_DURATION("gfx", "escher::Renderer::EndFrame");
 
   FTL_DCHECK(current_frame_);
+  elided_state_change_count_ += current_frame_->elided_state_change_count();
+  last_frame_elided_state_change_count_ = elided_state_change_count_;
   current_frame_->AddSignalSemaphore(frame_done);
+  FrameInFlight& frame =
+      frames_in_flight_[frame_number_ % frames_in_flight_.size()];
+  if (frame.is_timed) {
+    current_frame_->get().writeTimestamp(
+        vk::PipelineStageFlagBits::eBottomOfPipe, frame.timestamp_pool, 1);
+  }
   if (profiler_) {
     // Avoid implicit reference to this in closure.
     TimestampProfilerPtr profiler = std::move(profiler_);
     auto frame_number = frame_number_;
+    auto elided_state_change_count = elided_state_change_count_;
     current_frame_->Submit(context_.queue, [frame_retired_callback, profiler,
-                                            frame_number]() {
+                                            frame_number,
+                                            elided_state_change_count]() {
       if (frame_retired_callback) {
         frame_retired_callback();
       }
@@ -89,6 +218,8 @@ void Renderer::EndFrame(const SemaphorePtr& frame_done,
         FTL_LOG(INFO) << timestamps[i].time << " \t | \t"
                       << timestamps[i].elapsed << "   \t" << timestamps[i].name;
       }
+      FTL_LOG(INFO) << "Elided " << elided_state_change_count
+                    << " redundant state changes";
       FTL_LOG(INFO) << "------------------------------------------------------";
     });
   } else {
@@ -96,6 +227,12 @@ void Renderer::EndFrame(const SemaphorePtr& frame_done,
   }
   current_frame_ = nullptr;
 
+  // Signaled once all work submitted so far, including this frame, finishes.
+  FTL_DCHECK(!frame.pending);
+  auto result = context_.queue.submit(0, nullptr, frame.fence);
+  FTL_CHECK(result == vk::Result::eSuccess);
+  frame.pending = true;
+
   escher_impl()->Cleanup();
 }
 
@@ -116,16 +253,18 @@ void Renderer::RunOffscreenBenchmark(
   constexpr uint64_t kSecondsToNanoseconds = 1000000000;
 
   // Create the images that we will render into, and the semaphores that will
-  // prevent us from rendering into the same image concurrently.  At the same
-  // time, draw a few throwaway frames, to warm things up before beginning the
-  // benchmark (this also signals the semaphores so that they can be waited
-  // upon in the actual benchmark run).
-  constexpr size_t kSwapchainSize = 3;
-  std::array<SemaphorePtr, kSwapchainSize> semaphores;
-  std::array<ImagePtr, kSwapchainSize> images;
+  // prevent us from rendering into the same image concurrently.  There is one
+  // image per frame in flight, so that the benchmark is throttled by
+  // BeginFrame() rather than by waiting for images.  At the same time, draw a
+  // few throwaway frames, to warm things up before beginning the benchmark
+  // (this also signals the semaphores so that they can be waited upon in the
+  // actual benchmark run).
+  const size_t image_count = max_frames_in_flight();
+  std::vector<SemaphorePtr> semaphores(image_count);
+  std::vector<ImagePtr> images(image_count);
   {
     auto image_cache = escher()->image_cache();
-    for (size_t i = 0; i < kSwapchainSize; ++i) {
+    for (size_t i = 0; i < image_count; ++i) {
       auto im = image_cache->NewImage(
           {framebuffer_format, framebuffer_width, framebuffer_height, 1,
            vk::ImageUsageFlagBits::eColorAttachment |
@@ -141,35 +280,23 @@ void Renderer::RunOffscreenBenchmark(
     auto command_buffer = pool_->GetCommandBuffer();
     command_buffer->Submit(context_.queue, nullptr);
     FTL_CHECK(vk::Result::eSuccess ==
-              command_buffer->Wait(kSwapchainSize * kSecondsToNanoseconds));
+              command_buffer->Wait(image_count * kSecondsToNanoseconds));
   }
 
   // Render the benchmark frames.
   Stopwatch stopwatch;
   stopwatch.Start();
 
-  impl::CommandBuffer* throttle = nullptr;
   bool was_profiling = enable_profiling_;
   set_enable_profiling(false);
   for (size_t current_frame = 0; current_frame < frame_count; ++current_frame) {
-    size_t image_index = current_frame % kSwapchainSize;
+    size_t image_index = current_frame % image_count;
 
     auto command_buffer = pool_->GetCommandBuffer();
     command_buffer->AddWaitSemaphore(semaphores[image_index],
                                      vk::PipelineStageFlagBits::eBottomOfPipe);
     command_buffer->Submit(context_.queue, nullptr);
 
-    // Don't get too many frames ahead of the GPU.  Every time we cycle through
-    // all images, wait for the previous frame that was rendered to that image
-    // to finish.
-    if (image_index == 0) {
-      if (throttle) {
-        FTL_CHECK(vk::Result::eSuccess ==
-                  throttle->Wait(kSwapchainSize * kSecondsToNanoseconds));
-      }
-      throttle = command_buffer;
-    }
-
     set_enable_profiling(current_frame == frame_count - 1);
     draw_func(images[image_index], semaphores[image_index]);
   }
@@ -177,12 +304,11 @@ void Renderer::RunOffscreenBenchmark(
 
   // Wait for the last frame to finish.
   auto command_buffer = pool_->GetCommandBuffer();
-  command_buffer->AddWaitSemaphore(
-      semaphores[(frame_count - 1) % kSwapchainSize],
-      vk::PipelineStageFlagBits::eBottomOfPipe);
+  command_buffer->AddWaitSemaphore(semaphores[(frame_count - 1) % image_count],
+                                   vk::PipelineStageFlagBits::eBottomOfPipe);
   command_buffer->Submit(context_.queue, nullptr);
   FTL_CHECK(vk::Result::eSuccess ==
-            command_buffer->Wait(kSwapchainSize * kSecondsToNanoseconds));
+            command_buffer->Wait(image_count * kSecondsToNanoseconds));
   stopwatch.Stop();
 
   FTL_LOG(INFO) << "------------------------------------------------------";
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "escher/forward_declarations.h"
 #include "escher/renderer/semaphore_wait.h"
 #include "escher/renderer/timestamper.h"
@@ -33,6 +35,33 @@ class Renderer : public ftl::RefCountedThreadSafe<Renderer>,
 
   uint64_t frame_number() const { return frame_number_; }
 
+  // The maximum number of frames that may be queued for the GPU at once.  The
+  // CPU records the next frame while the previous ones execute, and
+  // BeginFrame() blocks only once this many frames are still pending.  Larger
+  // values favor throughput, smaller values favor latency: each queued frame
+  // adds up to a frame of delay between recording and display.  Must not be
+  // called while a frame is being recorded; waits for all pending frames.
+  void set_max_frames_in_flight(uint32_t count);
+  uint32_t max_frames_in_flight() const {
+    return static_cast<uint32_t>(frames_in_flight_.size());
+  }
+
+  static constexpr uint32_t kDefaultMaxFramesInFlight = 3;
+
+  // If enabled (and supported by the device), the GPU time of each frame is
+  // measured by a pair of timestamps, excluding the time spent waiting for the
+  // output image, and reported to OnGpuFrameTime() once the frame has
+  // finished.
+  void set_enable_gpu_frame_timing(bool enabled) {
+    enable_gpu_frame_timing_ = enabled;
+  }
+
+  // Number of redundant GPU state changes (e.g. re-binding the same pipeline)
+  // that were elided while recording the most recently ended frame.
+  uint32_t elided_state_change_count() const {
+    return last_frame_elided_state_change_count_;
+  }
+
  protected:
   explicit Renderer(Escher* escher);
   virtual ~Renderer();
@@ -51,16 +80,61 @@ class Renderer : public ftl::RefCountedThreadSafe<Renderer>,
 
   impl::CommandBuffer* current_frame() { return current_frame_; }
 
+  // Called by BeginFrame() (or by set_max_frames_in_flight()) with the GPU
+  // time of an earlier frame, in microseconds, if GPU frame timing is
+  // enabled.  Frames are reported in order, but several frames late.
+  virtual void OnGpuFrameTime(uint64_t frame_number, uint64_t microseconds) {}
+
+  // Return true if the GPU time of the current frame is being measured, and
+  // will therefore be reported to OnGpuFrameTime().
+  bool is_current_frame_timed() const;
+
+  // Block until all pending frames are finished, e.g. before destroying
+  // resources that they may use.  Must not be called while a frame is being
+  // recorded.
+  void WaitForFramesInFlight();
+
   const VulkanContext context_;
 
  private:
+  // One slot in the ring of frames that may be in flight at the same time.
+  // The fence is submitted after the frame's last CommandBuffer, so that it
+  // is signaled once all of the frame's work is finished; at that point the
+  // frame's uniform buffers, descriptor sets, etc. have also been returned to
+  // their pools.
+  struct FrameInFlight {
+    vk::Fence fence;
+    bool pending = false;
+    // Holds the timestamps of the beginning and end of the frame, if it is
+    // timed; null if the device does not support timestamps.
+    vk::QueryPool timestamp_pool;
+    bool is_timed = false;
+    uint64_t frame_number = 0;
+  };
+
+  // Block until the frame in |frame| (if any) is finished.
+  void WaitForFrameInFlight(FrameInFlight* frame);
+
+  // Create or destroy the fences of |frames_in_flight_|.  Destroying them
+  // first waits for all pending frames.
+  void CreateFramesInFlight(uint32_t count);
+  void DestroyFramesInFlight();
+
   Escher* const escher_;
   impl::CommandBufferPool* pool_;
   impl::CommandBuffer* current_frame_ = nullptr;
 
   uint64_t frame_number_ = 0;
 
+  // Indexed by frame number, modulo the number of frames in flight.
+  std::vector<FrameInFlight> frames_in_flight_;
+
+  // Accumulated over all CommandBuffers used to record the current frame.
+  uint32_t elided_state_change_count_ = 0;
+  uint32_t last_frame_elided_state_change_count_ = 0;
+
   bool enable_profiling_ = false;
+  bool enable_gpu_frame_timing_ = false;
   // Created in BeginFrame() when profiling is enabled.
   TimestampProfilerPtr profiler_;
 
@@ -4,6 +4,7 @@
 
 #include "escher/renderer/simple_image_factory.h"
 
+#include "escher/impl/vulkan_utils.h"
 #include "escher/resources/resource_manager.h"
 #include "escher/util/image_utils.h"
 #include "escher/vk/gpu_allocator.h"
@@ -23,7 +24,10 @@ ImagePtr SimpleImageFactory::NewImage(const ImageInfo& info) {
   // Allocate memory and bind it to the image.
   vk::MemoryRequirements reqs =
       resource_manager_->device().getImageMemoryRequirements(image);
-  escher::GpuMemPtr memory = allocator_->Allocate(reqs, info.memory_flags);
+  escher::GpuMemPtr memory = allocator_->Allocate(
+      reqs, impl::GetSupportedMemoryProperties(
+                resource_manager_->vulkan_context().physical_device,
+                reqs.memoryTypeBits, info.memory_flags));
   vk::Result result = resource_manager_->device().bindImageMemory(
       image, memory->base(), memory->offset());
   FTL_CHECK(result == vk::Result::eSuccess);
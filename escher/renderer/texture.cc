@@ -4,8 +4,8 @@
 
 #include "escher/renderer/texture.h"
 
-#include "escher/impl/command_buffer.h"
-#include "escher/impl/vulkan_utils.h"
+#include "escher/escher.h"
+#include "escher/impl/sampler_cache.h"
 #include "escher/renderer/image.h"
 #include "escher/resources/resource_recycler.h"
 
@@ -24,18 +24,7 @@ Texture::Texture(ResourceRecycler* resource_recycler,
       image_(std::move(image)),
       width_(image_->width()),
       height_(image_->height()) {
-  vk::Device device = vulkan_context().device;
-
-  vk::ImageViewCreateInfo view_info;
-  view_info.viewType = vk::ImageViewType::e2D;
-  view_info.subresourceRange.baseMipLevel = 0;
-  view_info.subresourceRange.levelCount = 1;
-  view_info.subresourceRange.baseArrayLayer = 0;
-  view_info.subresourceRange.layerCount = 1;
-  view_info.subresourceRange.aspectMask = aspect_mask;
-  view_info.format = image_->format();
-  view_info.image = image_->get();
-  image_view_ = ESCHER_CHECKED_VK_RESULT(device.createImageView(view_info));
+  image_view_ = image_->GetImageView(aspect_mask);
 
   vk::SamplerCreateInfo sampler_info = {};
   sampler_info.magFilter = filter;
@@ -53,14 +42,11 @@ Texture::Texture(ResourceRecycler* resource_recycler,
   sampler_info.mipLodBias = 0.0f;
   sampler_info.minLod = 0.0f;
   sampler_info.maxLod = 0.0f;
-  sampler_ = ESCHER_CHECKED_VK_RESULT(device.createSampler(sampler_info));
+  sampler_ = resource_recycler->escher()->sampler_cache()->ObtainSampler(
+      sampler_info);
 }
 
-Texture::~Texture() {
-  vk::Device device = vulkan_context().device;
-  device.destroySampler(sampler_);
-  device.destroyImageView(image_view_);
-}
+Texture::~Texture() = default;
 
 TexturePtr Texture::New(ResourceRecycler* resource_recycler,
                         ImagePtr image,
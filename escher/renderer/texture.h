@@ -14,11 +14,13 @@ class Texture : public Resource {
   static const ResourceTypeInfo kTypeInfo;
   const ResourceTypeInfo& type_info() const override { return kTypeInfo; }
 
-  // Construct a new Texture, which encapsulates a newly-created VkImageView and
-  // VkSampler.  |aspect_mask| is used to create the VkImageView, and |filter|
-  // and |use_unnormalized_coordinates| are used to create the VkSampler.
-  // |resource_recycler| guarantees that the underlying Vulkan resources are not
-  // destroyed while still referenced by a pending command buffer.
+  // Construct a new Texture, which pairs a VkImageView of |image| with a
+  // VkSampler.  |aspect_mask| selects the VkImageView, which is owned and
+  // reused by |image|, and |filter| and |use_unnormalized_coordinates| select
+  // the VkSampler, which is shared via Escher's SamplerCache; constructing a
+  // Texture therefore rarely creates any Vulkan objects.  |resource_recycler|
+  // guarantees that the Texture (and hence |image|) is not destroyed while
+  // still referenced by a pending command buffer.
   Texture(ResourceRecycler* resource_recycler,
           ImagePtr image,
           vk::Filter filter,
@@ -41,7 +43,6 @@ class Texture : public Resource {
 
  private:
   ImagePtr image_;
-  vk::Device device_;
   vk::ImageView image_view_;
   vk::Sampler sampler_;
   uint32_t width_;
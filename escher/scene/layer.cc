@@ -0,0 +1,28 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/scene/layer.h"
+
+#include <atomic>
+
+namespace escher {
+
+namespace {
+
+uint64_t NextLayerId() {
+  static std::atomic<uint64_t> next_id(1);
+  return next_id++;
+}
+
+}  // namespace
+
+Layer::Layer(Model model) : id_(NextLayerId()), model_(std::move(model)) {}
+
+Layer::~Layer() = default;
+
+LayerPtr Layer::New(Model model) {
+  return ftl::MakeRefCounted<Layer>(std::move(model));
+}
+
+}  // namespace escher
@@ -0,0 +1,54 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <cstdint>
+
+#include "escher/forward_declarations.h"
+#include "escher/scene/model.h"
+#include "lib/ftl/memory/ref_counted.h"
+
+namespace escher {
+
+// A part of a scene that seldom changes, e.g. the finished strokes of a
+// drawing.  When a Model's layer() is set, the layer's objects are drawn
+// behind the model's own objects.  PaperRenderer renders the layer, including
+// its lighting, into an image, and composites that image in subsequent frames
+// until the layer is invalidated or the camera moves.  Consequently the layer
+// and the rest of the model do not cast shadows upon each other.
+class Layer : public ftl::RefCountedThreadSafe<Layer> {
+ public:
+  explicit Layer(Model model);
+  ~Layer();
+
+  static LayerPtr New(Model model);
+
+  const Model& model() const { return model_; }
+
+  // Return the model for modification; this invalidates the layer.
+  Model* mutable_model() {
+    Invalidate();
+    return &model_;
+  }
+
+  // Force the layer to be rendered again, e.g. after one of its materials has
+  // changed.
+  void Invalidate() { ++revision_; }
+
+  // Unique among all layers, for the lifetime of the process.
+  uint64_t id() const { return id_; }
+
+  // Incremented whenever the layer is invalidated.
+  uint64_t revision() const { return revision_; }
+
+ private:
+  const uint64_t id_;
+  Model model_;
+  uint64_t revision_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(Layer);
+};
+
+}  // namespace escher
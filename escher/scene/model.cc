@@ -4,6 +4,8 @@
 
 #include "escher/scene/model.h"
 
+#include "escher/scene/layer.h"
+
 namespace escher {
 
 Model::Model() = default;
@@ -12,7 +14,8 @@ Model::~Model() = default;
 
 Model::Model(std::vector<Object> objects) : objects_(std::move(objects)) {}
 
-Model::Model(Model&& other) : objects_(std::move(other.objects_)) {
+Model::Model(Model&& other)
+    : objects_(std::move(other.objects_)), layer_(std::move(other.layer_)) {
   other.objects_.clear();
   other.time_ = 0.f;
 }
@@ -22,8 +25,13 @@ Model& Model::operator=(Model&& other) {
   other.objects_.clear();
   time_ = other.time_;
   other.time_ = 0.f;
+  layer_ = std::move(other.layer_);
 
   return *this;
 }
 
+void Model::set_layer(LayerPtr layer) {
+  layer_ = std::move(layer);
+}
+
 }  // namespace escher
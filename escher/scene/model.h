@@ -6,11 +6,14 @@
 
 #include <vector>
 
+#include "escher/forward_declarations.h"
 #include "escher/scene/object.h"
 #include "lib/ftl/macros.h"
 
 namespace escher {
 
+class RetainedModel;
+
 // The model to render.
 //
 // TODO(jeffbrown): This currently only contains a vector of objects to be
@@ -33,9 +36,21 @@ class Model {
   float time() const { return time_; }
   void set_time(float time) { time_ = time; }
 
+  // Non-null if the model belongs to a RetainedModel, which records how its
+  // objects have changed from frame to frame.
+  const RetainedModel* retained_model() const { return retained_model_; }
+
+  // If non-null, the layer is drawn behind the model's objects; see Layer.
+  const LayerPtr& layer() const { return layer_; }
+  void set_layer(LayerPtr layer);
+
  private:
+  friend class RetainedModel;
+
   std::vector<Object> objects_;
   float time_ = 0.0f;
+  const RetainedModel* retained_model_ = nullptr;
+  LayerPtr layer_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(Model);
 };
@@ -25,6 +25,8 @@ class Object {
   Object(std::vector<Object> clippers, std::vector<Object> clippees);
   Object(const Object& other) = default;
   Object(Object&& other) = default;
+  Object& operator=(const Object& other) = default;
+  Object& operator=(Object&& other) = default;
   static Object NewRect(const vec2& top_left_position,
                         const vec2& size,
                         float z,
@@ -47,6 +49,7 @@ class Object {
 
   // Return the object's 4x4 transformation matrix.
   const mat4& transform() const { return transform_; }
+  void set_transform(const mat4& transform) { transform_ = transform; }
 
   // The shape to draw.
   const Shape& shape() const { return shape_; }
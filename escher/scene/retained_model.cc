@@ -0,0 +1,127 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/scene/retained_model.h"
+
+#include "escher/scene/layer.h"
+
+namespace escher {
+
+constexpr RetainedModel::ObjectHandle RetainedModel::kInvalidHandle;
+
+RetainedModel::RetainedModel() {
+  model_.retained_model_ = this;
+}
+
+RetainedModel::~RetainedModel() = default;
+
+RetainedModel::ObjectHandle RetainedModel::AddObject(Object object) {
+  ++revision_;
+  ObjectHandle handle = next_handle_++;
+  indices_[handle] = objects_.size();
+  objects_.push_back({handle, revision_, revision_, revision_, revision_});
+  model_.mutable_objects().push_back(std::move(object));
+  return handle;
+}
+
+void RetainedModel::RemoveObject(ObjectHandle handle) {
+  auto it = indices_.find(handle);
+  FTL_DCHECK(it != indices_.end());
+  const size_t index = it->second;
+  indices_.erase(it);
+
+  ++revision_;
+  objects_.erase(objects_.begin() + index);
+  auto& objects = model_.mutable_objects();
+  objects.erase(objects.begin() + index);
+  // Draw order must be preserved, so all subsequent objects move down.
+  for (size_t i = index; i < objects_.size(); ++i) {
+    indices_[objects_[i].handle] = i;
+  }
+}
+
+void RetainedModel::ReplaceObject(ObjectHandle handle, Object object) {
+  const ObjectDirtyFlags all_flags =
+      ObjectDirtyFlag::kTransform | ObjectDirtyFlag::kMaterial |
+      ObjectDirtyFlag::kShape | ObjectDirtyFlag::kShapeModifierData;
+  size_t index = MarkDirty(handle, all_flags);
+  model_.mutable_objects()[index] = std::move(object);
+}
+
+void RetainedModel::set_layer(LayerPtr layer) {
+  model_.set_layer(std::move(layer));
+}
+
+bool RetainedModel::HasObject(ObjectHandle handle) const {
+  return indices_.find(handle) != indices_.end();
+}
+
+const Object& RetainedModel::object(ObjectHandle handle) const {
+  auto it = indices_.find(handle);
+  FTL_DCHECK(it != indices_.end());
+  return model_.objects()[it->second];
+}
+
+void RetainedModel::SetTransform(ObjectHandle handle, const mat4& transform) {
+  size_t index = MarkDirty(handle, ObjectDirtyFlag::kTransform);
+  model_.mutable_objects()[index].set_transform(transform);
+}
+
+void RetainedModel::SetMaterial(ObjectHandle handle, MaterialPtr material) {
+  size_t index = MarkDirty(handle, ObjectDirtyFlag::kMaterial);
+  model_.mutable_objects()[index].set_material(std::move(material));
+}
+
+void RetainedModel::SetShape(ObjectHandle handle, Shape shape) {
+  auto it = indices_.find(handle);
+  FTL_DCHECK(it != indices_.end());
+  // Shape modifiers determine which modifier data is used.
+  ObjectDirtyFlags flags(ObjectDirtyFlag::kShape);
+  if (shape.modifiers() != model_.objects()[it->second].shape().modifiers()) {
+    flags |= ObjectDirtyFlag::kShapeModifierData;
+  }
+  size_t index = MarkDirty(handle, flags);
+  model_.mutable_objects()[index].mutable_shape() = std::move(shape);
+}
+
+ObjectDirtyFlags RetainedModel::GetDirtyFlags(size_t index,
+                                              uint64_t since_revision) const {
+  const ObjectInfo& info = objects_[index];
+  ObjectDirtyFlags flags;
+  if (info.transform_revision > since_revision) {
+    flags |= ObjectDirtyFlag::kTransform;
+  }
+  if (info.material_revision > since_revision) {
+    flags |= ObjectDirtyFlag::kMaterial;
+  }
+  if (info.shape_revision > since_revision) {
+    flags |= ObjectDirtyFlag::kShape;
+  }
+  if (info.shape_modifier_data_revision > since_revision) {
+    flags |= ObjectDirtyFlag::kShapeModifierData;
+  }
+  return flags;
+}
+
+size_t RetainedModel::MarkDirty(ObjectHandle handle, ObjectDirtyFlags flags) {
+  auto it = indices_.find(handle);
+  FTL_DCHECK(it != indices_.end());
+  ++revision_;
+  ObjectInfo& info = objects_[it->second];
+  if (flags & ObjectDirtyFlag::kTransform) {
+    info.transform_revision = revision_;
+  }
+  if (flags & ObjectDirtyFlag::kMaterial) {
+    info.material_revision = revision_;
+  }
+  if (flags & ObjectDirtyFlag::kShape) {
+    info.shape_revision = revision_;
+  }
+  if (flags & ObjectDirtyFlag::kShapeModifierData) {
+    info.shape_modifier_data_revision = revision_;
+  }
+  return it->second;
+}
+
+}  // namespace escher
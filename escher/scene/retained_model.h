@@ -0,0 +1,134 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "escher/scene/model.h"
+#include "escher/scene/object.h"
+#include "lib/ftl/macros.h"
+
+namespace escher {
+
+// Kinds of change that can be made to an object of a RetainedModel.
+enum class ObjectDirtyFlag {
+  kTransform = 1 << 0,
+  kMaterial = 1 << 1,
+  kShape = 1 << 2,
+  kShapeModifierData = 1 << 3,
+};
+
+using ObjectDirtyFlags = vk::Flags<ObjectDirtyFlag>;
+
+inline ObjectDirtyFlags operator|(ObjectDirtyFlag bit0, ObjectDirtyFlag bit1) {
+  return ObjectDirtyFlags(bit0) | bit1;
+}
+
+// A model whose top-level objects persist from frame to frame.  Each object is
+// addressed by a stable handle, and every change made through the handle is
+// recorded, so that renderers can retain per-object GPU state (e.g. uniforms
+// and descriptor sets) between frames, and only update it for the objects that
+// have changed.
+class RetainedModel {
+ public:
+  using ObjectHandle = uint32_t;
+  // Never returned by AddObject().
+  static constexpr ObjectHandle kInvalidHandle = 0;
+
+  RetainedModel();
+  ~RetainedModel();
+
+  // Add the object in front of all existing objects, and return its handle.
+  // Handles are never reused, even after the object is removed.
+  ObjectHandle AddObject(Object object);
+  // Remove the object; takes time proportional to the number of objects.
+  void RemoveObject(ObjectHandle handle);
+  // Replace the object entirely; all of its dirty flags are set.  Used to make
+  // changes that cannot be made by the methods below, e.g. to the clippees of
+  // a clip group.
+  void ReplaceObject(ObjectHandle handle, Object object);
+
+  bool HasObject(ObjectHandle handle) const;
+  const Object& object(ObjectHandle handle) const;
+
+  void SetTransform(ObjectHandle handle, const mat4& transform);
+  void SetMaterial(ObjectHandle handle, MaterialPtr material);
+  void SetShape(ObjectHandle handle, Shape shape);
+  // Set per-object ShapeModifier data; see Object::set_shape_modifier_data().
+  template <typename DataT>
+  void SetShapeModifierData(ObjectHandle handle, const DataT& data);
+
+  // Time in seconds; see Model::time().
+  void set_time(float time) { model_.set_time(time); }
+
+  // The layer that is drawn behind the objects; see Model::layer().
+  void set_layer(LayerPtr layer);
+
+  // The objects, in back to front draw order.  The model refers back to this
+  // RetainedModel; see Model::retained_model().
+  const Model& model() const { return model_; }
+
+  // Return the handle of model().objects()[index].
+  ObjectHandle GetHandle(size_t index) const { return objects_[index].handle; }
+
+  // Incremented by every change to the model.  Renderers remember the revision
+  // that they last saw, and later pass it to GetDirtyFlags().
+  uint64_t revision() const { return revision_; }
+
+  // Return the kinds of change that have been made to model().objects()[index]
+  // since the model was at |since_revision|.  All flags are set for objects
+  // that were added since then.
+  ObjectDirtyFlags GetDirtyFlags(size_t index, uint64_t since_revision) const;
+
+ private:
+  struct ObjectInfo {
+    ObjectHandle handle;
+    // Revision at which each kind of change was last made.
+    uint64_t transform_revision;
+    uint64_t material_revision;
+    uint64_t shape_revision;
+    uint64_t shape_modifier_data_revision;
+  };
+
+  // Return the index of the object in |model_|, after recording that the
+  // specified kinds of change are being made to it.
+  size_t MarkDirty(ObjectHandle handle, ObjectDirtyFlags flags);
+
+  Model model_;
+  // Parallel to model_.objects().
+  std::vector<ObjectInfo> objects_;
+  std::unordered_map<ObjectHandle, size_t> indices_;
+  ObjectHandle next_handle_ = kInvalidHandle + 1;
+  uint64_t revision_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RetainedModel);
+};
+
+// Inline function definitions.
+
+template <typename DataT>
+void RetainedModel::SetShapeModifierData(ObjectHandle handle,
+                                         const DataT& data) {
+  size_t index = MarkDirty(handle, ObjectDirtyFlag::kShapeModifierData);
+  model_.mutable_objects()[index].set_shape_modifier_data(data);
+}
+
+}  // namespace escher
+
+namespace vk {
+
+template <>
+struct FlagTraits<escher::ObjectDirtyFlag> {
+  enum {
+    allFlags = VkFlags(escher::ObjectDirtyFlag::kTransform) |
+               VkFlags(escher::ObjectDirtyFlag::kMaterial) |
+               VkFlags(escher::ObjectDirtyFlag::kShape) |
+               VkFlags(escher::ObjectDirtyFlag::kShapeModifierData)
+  };
+};
+
+}  // namespace vk
@@ -6,10 +6,25 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 namespace escher {
 
 // FNV-1a 32-bit Hash (http://www.isthe.com/chongo/tech/comp/fnv/index.html)
+// of |size| bytes.
+inline std::size_t HashBytes(const uint8_t* data, std::size_t size) {
+  constexpr uint32_t kPrime = 16777619;
+  constexpr uint32_t kOffsetBasis = 2166136261;
+
+  uint32_t n = kOffsetBasis;
+  while (size-- > 0) {
+    n = (n ^ *data) * kPrime;
+    ++data;
+  }
+  return static_cast<std::size_t>(n);
+}
+
+// Hashes the bytes of a value with HashBytes().
 //
 // NOTE: if the hashed type is a struct, it must be tightly packed; if there are
 // any padding bytes, their value will be undefined, and therefore the resulting
@@ -18,17 +33,27 @@ namespace escher {
 template <typename T>
 struct Hash {
   std::size_t operator()(const T& hashee) const {
-    constexpr uint32_t kPrime = 16777619;
-    constexpr uint32_t kOffsetBasis = 2166136261;
-
-    size_t len = sizeof(hashee);
-    uint32_t n = kOffsetBasis;
-    const uint8_t* data = reinterpret_cast<const uint8_t*>(&hashee);
-    while (len-- > 0) {
-      n = (n ^ *data) * kPrime;
-      ++data;
-    }
-    return static_cast<std::size_t>(n);
+    return HashBytes(reinterpret_cast<const uint8_t*>(&hashee),
+                     sizeof(hashee));
+  }
+};
+
+// A key that identifies e.g. a cached object by the bytes of everything that
+// it depends upon.  Keys are built by appending one field at a time with
+// AppendToKey(), so that padding does not affect them, and are compared
+// exactly, not just by their hashes.
+using ByteKey = std::vector<uint8_t>;
+
+template <typename T>
+void AppendToKey(ByteKey* key, const T& value) {
+  auto bytes = reinterpret_cast<const uint8_t*>(&value);
+  key->insert(key->end(), bytes, bytes + sizeof(T));
+}
+
+// Hashes a ByteKey with HashBytes(), e.g. for use in an std::unordered_map.
+struct ByteKeyHash {
+  std::size_t operator()(const ByteKey& key) const {
+    return HashBytes(key.data(), key.size());
   }
 };
 
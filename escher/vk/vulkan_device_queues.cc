@@ -21,9 +21,17 @@ static FuncT GetDeviceProcAddr(vk::Device device, const char* func_name) {
 #define GET_DEVICE_PROC_ADDR(XXX) \
   XXX = GetDeviceProcAddr<PFN_vk##XXX>(device, "vk" #XXX)
 
-VulkanDeviceQueues::Caps::Caps(vk::PhysicalDeviceProperties props)
+VulkanDeviceQueues::Caps::Caps(
+    vk::PhysicalDeviceProperties props,
+    const vk::PhysicalDeviceFeatures& enabled_features)
     : max_image_width(props.limits.maxImageDimension2D),
-      max_image_height(props.limits.maxImageDimension2D) {}
+      max_image_height(props.limits.maxImageDimension2D),
+      multi_draw_indirect(enabled_features.multiDrawIndirect &&
+                          enabled_features.drawIndirectFirstInstance),
+      storage_image_extended_formats(
+          enabled_features.shaderStorageImageExtendedFormats),
+      framebuffer_sample_counts(props.limits.framebufferColorSampleCounts &
+                                props.limits.framebufferDepthSampleCounts) {}
 
 VulkanDeviceQueues::ProcAddrs::ProcAddrs(
     vk::Device device,
@@ -165,6 +173,18 @@ ftl::RefPtr<VulkanDeviceQueues> VulkanDeviceQueues::New(
   device_info.enabledExtensionCount = extension_names.size();
   device_info.ppEnabledExtensionNames = extension_names.data();
 
+  // Enable the optional features that Escher can take advantage of, if they
+  // are supported.
+  vk::PhysicalDeviceFeatures supported_features =
+      physical_device.getFeatures();
+  vk::PhysicalDeviceFeatures enabled_features;
+  enabled_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+  enabled_features.drawIndirectFirstInstance =
+      supported_features.drawIndirectFirstInstance;
+  enabled_features.shaderStorageImageExtendedFormats =
+      supported_features.shaderStorageImageExtendedFormats;
+  device_info.pEnabledFeatures = &enabled_features;
+
   // It's possible that the main queue and transfer queue are in the same
   // queue family.  Adjust the device-creation parameters to account for this.
   uint32_t main_queue_index = 0;
@@ -199,7 +219,8 @@ ftl::RefPtr<VulkanDeviceQueues> VulkanDeviceQueues::New(
 
   return ftl::AdoptRef(new VulkanDeviceQueues(
       device, physical_device, main_queue, main_queue_family, transfer_queue,
-      transfer_queue_family, std::move(instance), std::move(params)));
+      transfer_queue_family, std::move(instance), std::move(params),
+      enabled_features));
 }
 
 VulkanDeviceQueues::VulkanDeviceQueues(vk::Device device,
@@ -209,7 +230,9 @@ VulkanDeviceQueues::VulkanDeviceQueues(vk::Device device,
                                        vk::Queue transfer_queue,
                                        uint32_t transfer_queue_family,
                                        VulkanInstancePtr instance,
-                                       Params params)
+                                       Params params,
+                                       const vk::PhysicalDeviceFeatures&
+                                           enabled_features)
     : device_(device),
       physical_device_(physical_device),
       main_queue_(main_queue),
@@ -218,7 +241,7 @@ VulkanDeviceQueues::VulkanDeviceQueues(vk::Device device,
       transfer_queue_family_(transfer_queue_family),
       instance_(std::move(instance)),
       params_(std::move(params)),
-      caps_(physical_device.getProperties()),
+      caps_(physical_device.getProperties(), enabled_features),
       proc_addrs_(device_, params_.extension_names) {}
 
 VulkanDeviceQueues::~VulkanDeviceQueues() {
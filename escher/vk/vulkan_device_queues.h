@@ -32,8 +32,20 @@ class VulkanDeviceQueues
   struct Caps {
     uint32_t max_image_width = 0;
     uint32_t max_image_height = 0;
-
-    Caps(vk::PhysicalDeviceProperties props);
+    // True if the device was created with the multiDrawIndirect and
+    // drawIndirectFirstInstance features enabled.
+    bool multi_draw_indirect = false;
+    // True if the device was created with the
+    // shaderStorageImageExtendedFormats feature enabled, which allows storage
+    // images of formats such as eR8G8Unorm.
+    bool storage_image_extended_formats = false;
+    // The sample counts that are supported by both color and depth
+    // framebuffer attachments.
+    vk::SampleCountFlags framebuffer_sample_counts =
+        vk::SampleCountFlagBits::e1;
+
+    Caps(vk::PhysicalDeviceProperties props,
+         const vk::PhysicalDeviceFeatures& enabled_features);
   };
 
   // Contains dynamically-obtained addresses of device-specific functions.
@@ -91,7 +103,8 @@ class VulkanDeviceQueues
                      vk::Queue transfer_queue,
                      uint32_t transfer_queue_family,
                      VulkanInstancePtr instance,
-                     Params params);
+                     Params params,
+                     const vk::PhysicalDeviceFeatures& enabled_features);
 
   vk::Device device_;
   vk::PhysicalDevice physical_device_;
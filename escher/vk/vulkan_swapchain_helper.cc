@@ -64,9 +64,13 @@ void VulkanSwapchainHelper::DrawFrame(PaperRenderer* renderer,
   image->SetWaitSemaphore(image_available_semaphore);
   renderer->DrawFrame(stage, model, camera, image, overlay_model,
                       render_finished_semaphore, nullptr);
+  damage_rect_ = renderer->damage_rect();
 
-  // When the image is completely rendered, present it.
-  TRACE_DURATION("gfx", "escher::VulkanSwapchain::Present");
+  // When the image is completely rendered, present it.  The damage rect is
+  // only traced; see damage_rect().
+  TRACE_DURATION("gfx", "escher::VulkanSwapchain::Present", "damage_width",
+                 damage_rect_.extent.width, "damage_height",
+                 damage_rect_.extent.height);
   vk::PresentInfoKHR info;
   info.waitSemaphoreCount = 1;
   auto sema = render_finished_semaphore->value();
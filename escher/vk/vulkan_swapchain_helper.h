@@ -27,6 +27,14 @@ class VulkanSwapchainHelper {
 
   const VulkanSwapchain& swapchain() const { return swapchain_; }
 
+  // The rectangle of the image that was rendered by the last call to
+  // DrawFrame(); the rest of the image is the same as when it was last
+  // presented.  See PaperRenderer::set_enable_damage_tracking().  This only
+  // limits the rendering: the whole image is still presented, because passing
+  // the rectangle to the presentation engine requires
+  // VK_KHR_incremental_present, which is not enabled.
+  const vk::Rect2D& damage_rect() const { return damage_rect_; }
+
  private:
   VulkanSwapchain swapchain_;
   vk::Device device_;
@@ -35,6 +43,7 @@ class VulkanSwapchainHelper {
   size_t next_semaphore_index_ = 0;
   std::vector<SemaphorePtr> image_available_semaphores_;
   std::vector<SemaphorePtr> render_finished_semaphores_;
+  vk::Rect2D damage_rect_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(VulkanSwapchainHelper);
 };
@@ -13,7 +13,9 @@
 #include "escher/examples/waterfall/scenes/uber_scene3.h"
 #include "escher/examples/waterfall/scenes/wobbly_ocean_scene.h"
 #include "escher/examples/waterfall/scenes/wobbly_rings_scene.h"
+#include "escher/impl/vulkan_utils.h"
 #include "escher/scene/camera.h"
+#include "escher/shape/modifier_wobble.h"
 
 // Material design places objects from 0.0f to 24.0f.
 static constexpr float kNear = 100.f;
@@ -62,6 +64,23 @@ void WaterfallDemo::ProcessCommandLineArgs(int argc, char** argv) {
       show_debug_info_ = false;
     } else if (!strcmp("--toggle-lighting", argv[i])) {
       auto_toggle_lighting_ = true;
+    } else if (!strcmp("--compare-ssdo-sampling", argv[i])) {
+      compare_ssdo_sampling_ = true;
+    } else if (!strcmp("--frames-in-flight", argv[i])) {
+      // Trade latency for throughput; see Renderer::set_max_frames_in_flight().
+      if (i == argc - 1) {
+        FTL_LOG(ERROR) << "--frames-in-flight must be followed by a positive "
+                          "numeric argument";
+      } else {
+        char* end;
+        int count = strtol(argv[i + 1], &end, 10);
+        if (argv[i + 1] == end || count < 1) {
+          FTL_LOG(ERROR) << "--frames-in-flight must be followed by a positive "
+                            "numeric argument";
+        } else {
+          renderer_->set_max_frames_in_flight(count);
+        }
+      }
     }
   }
 }
@@ -139,17 +158,142 @@ bool WaterfallDemo::HandleKeyPress(std::string key) {
       case 'D':
         show_debug_info_ = !show_debug_info_;
         return true;
+      case 'F':
+        switch (frustum_culling_mode_) {
+          case escher::PaperRenderer::FrustumCullingMode::kNone:
+            frustum_culling_mode_ =
+                escher::PaperRenderer::FrustumCullingMode::kCpu;
+            FTL_LOG(INFO) << "Frustum culling: CPU";
+            break;
+          case escher::PaperRenderer::FrustumCullingMode::kCpu:
+            if (harness()->device_queues()->caps().multi_draw_indirect) {
+              frustum_culling_mode_ =
+                  escher::PaperRenderer::FrustumCullingMode::kGpu;
+              FTL_LOG(INFO) << "Frustum culling: GPU";
+              break;
+            }
+          // Fall through, since GPU culling is not supported.
+          case escher::PaperRenderer::FrustumCullingMode::kGpu:
+            frustum_culling_mode_ =
+                escher::PaperRenderer::FrustumCullingMode::kNone;
+            FTL_LOG(INFO) << "Frustum culling: none";
+            break;
+        }
+        return true;
+      case 'G': {
+        // Cycle through the supported sample counts, up to 8.
+        const auto supported =
+            harness()->device_queues()->caps().framebuffer_sample_counts;
+        do {
+          lighting_pass_sample_count_ = lighting_pass_sample_count_ == 8
+                                            ? 1
+                                            : lighting_pass_sample_count_ * 2;
+        } while (!(supported & escher::impl::SampleCountFlagBitsFromInt(
+                                   lighting_pass_sample_count_)));
+        FTL_LOG(INFO) << "Lighting pass sample count: "
+                      << lighting_pass_sample_count_;
+        return true;
+      }
+      case 'E':
+        enable_dynamic_resolution_ = !enable_dynamic_resolution_;
+        FTL_LOG(INFO) << "Dynamic resolution: "
+                      << (enable_dynamic_resolution_ ? "true" : "false");
+        return true;
+      case 'H':
+        enable_hi_z_culling_ = !enable_hi_z_culling_;
+        FTL_LOG(INFO) << "Hierarchical-Z culling: "
+                      << (enable_hi_z_culling_ ? "true" : "false");
+        return true;
+      case 'I':
+        enable_damage_tracking_ = !enable_damage_tracking_;
+        FTL_LOG(INFO) << "Damage tracking: "
+                      << (enable_damage_tracking_ ? "true" : "false");
+        return true;
+      case 'J':
+        if (!harness()
+                 ->device_queues()
+                 ->caps()
+                 .storage_image_extended_formats) {
+          FTL_LOG(INFO) << "SSDO compute filtering is not supported";
+          return true;
+        }
+        enable_ssdo_compute_filtering_ = !enable_ssdo_compute_filtering_;
+        FTL_LOG(INFO) << "SSDO compute filtering: "
+                      << (enable_ssdo_compute_filtering_ ? "true" : "false");
+        return true;
+      case 'K':
+        if (!harness()
+                 ->device_queues()
+                 ->caps()
+                 .storage_image_extended_formats) {
+          FTL_LOG(INFO) << "SSDO compute sampling is not supported";
+          return true;
+        }
+        enable_ssdo_compute_sampling_ = !enable_ssdo_compute_sampling_;
+        FTL_LOG(INFO) << "SSDO compute sampling: "
+                      << (enable_ssdo_compute_sampling_ ? "true" : "false");
+        return true;
+      case 'L':
+        ssdo_downsample_factor_ = ssdo_downsample_factor_ == 4
+                                      ? 1
+                                      : ssdo_downsample_factor_ * 2;
+        FTL_LOG(INFO) << "SSDO downsample factor: " << ssdo_downsample_factor_;
+        return true;
+      case 'M':
+        if (!harness()->device_queues()->caps().multi_draw_indirect) {
+          FTL_LOG(INFO) << "Multi-draw-indirect is not supported";
+          return true;
+        }
+        enable_multi_draw_indirect_ = !enable_multi_draw_indirect_;
+        FTL_LOG(INFO) << "Multi-draw-indirect: "
+                      << (enable_multi_draw_indirect_ ? "true" : "false");
+        return true;
+      case 'O':
+        enable_occlusion_culling_ = !enable_occlusion_culling_;
+        FTL_LOG(INFO) << "Occlusion culling: "
+                      << (enable_occlusion_culling_ ? "true" : "false");
+        return true;
       case 'P':
         profile_one_frame_ = true;
         return true;
+      case 'R':
+        enable_secondary_command_buffers_ = !enable_secondary_command_buffers_;
+        FTL_LOG(INFO) << "Secondary command buffers: "
+                      << (enable_secondary_command_buffers_ ? "true" : "false");
+        return true;
       case 'S':
         sort_by_pipeline_ = !sort_by_pipeline_;
         FTL_LOG(INFO) << "Sort object by pipeline: "
                       << (sort_by_pipeline_ ? "true" : "false");
         return true;
+      case 'N':
+        enable_layers_ = !enable_layers_;
+        FTL_LOG(INFO) << "Render the floor into a layer: "
+                      << (enable_layers_ ? "true" : "false");
+        return true;
       case 'T':
         stop_time_ = !stop_time_;
         return true;
+      case 'U':
+        enable_ssdo_temporal_accumulation_ =
+            !enable_ssdo_temporal_accumulation_;
+        FTL_LOG(INFO) << "SSDO temporal accumulation: "
+                      << (enable_ssdo_temporal_accumulation_ ? "true"
+                                                             : "false");
+        return true;
+      case 'V':
+        enable_ssdo_reuse_ = !enable_ssdo_reuse_;
+        FTL_LOG(INFO) << "Reuse SSDO of unchanged scenes: "
+                      << (enable_ssdo_reuse_ ? "true" : "false");
+        return true;
+      case 'W':
+        enable_retained_model_ = !enable_retained_model_;
+        FTL_LOG(INFO) << "Retained model: "
+                      << (enable_retained_model_ ? "true" : "false");
+        return true;
+      case 'X':
+        compare_ssdo_sampling_ = true;
+        return true;
       case '1':
         current_scene_ = 0;
         return true;
@@ -186,6 +330,125 @@ bool WaterfallDemo::HandleKeyPress(std::string key) {
   }
 }
 
+// Return true if the shapes of |a| and |b| are the same, ignoring any clippers
+// and shape modifier data.
+static bool HasSameShape(const escher::Object& a, const escher::Object& b) {
+  const escher::Shape& shape_a = a.shape();
+  const escher::Shape& shape_b = b.shape();
+  if (shape_a.type() != shape_b.type() ||
+      shape_a.modifiers() != shape_b.modifiers()) {
+    return false;
+  }
+  return shape_a.type() != escher::Shape::Type::kMesh ||
+         shape_a.mesh() == shape_b.mesh();
+}
+
+// Return true if |a| and |b| have the same wobble data, or none.  This is the
+// only kind of shape modifier data that the scenes use.
+static bool HasSameShapeModifierData(const escher::Object& a,
+                                     const escher::Object& b) {
+  auto wobble_a = a.shape_modifier_data<escher::ModifierWobble>();
+  auto wobble_b = b.shape_modifier_data<escher::ModifierWobble>();
+  if (!wobble_a || !wobble_b) {
+    return wobble_a == wobble_b;
+  }
+  return !memcmp(wobble_a, wobble_b, sizeof(escher::ModifierWobble));
+}
+
+// Return true if |a| and |b| are drawn identically.  For simplicity, clip
+// groups are never considered to be the same.
+static bool IsSameObject(const escher::Object& a, const escher::Object& b) {
+  return a.shape().type() != escher::Shape::Type::kNone &&
+         HasSameShape(a, b) && a.transform() == b.transform() &&
+         a.material() == b.material() && HasSameShapeModifierData(a, b);
+}
+
+const escher::Model& WaterfallDemo::PrepareModel(const escher::Model& model) {
+  std::vector<escher::Object> objects;
+  if (!enable_layers_) {
+    layer_ = nullptr;
+    if (!enable_retained_model_) {
+      return model;
+    }
+    objects = model.objects();
+  } else {
+    // Objects that lie on the floor are behind all others, so they can be
+    // composited behind the rest of the model.
+    std::vector<escher::Object> floor_objects;
+    for (const escher::Object& object : model.objects()) {
+      if (object.shape().type() != escher::Shape::Type::kNone &&
+          object.clippers().empty() && object.bounding_box().max().z <= 0.f) {
+        floor_objects.push_back(object);
+      } else {
+        objects.push_back(object);
+      }
+    }
+    if (!layer_) {
+      layer_ = escher::Layer::New(escher::Model(std::move(floor_objects)));
+    } else {
+      // Only invalidate the layer if its objects have changed.
+      const auto& layer_objects = layer_->model().objects();
+      bool is_changed = layer_objects.size() != floor_objects.size();
+      for (size_t i = 0; !is_changed && i < floor_objects.size(); ++i) {
+        is_changed = !IsSameObject(layer_objects[i], floor_objects[i]);
+      }
+      if (is_changed) {
+        *layer_->mutable_model() = escher::Model(std::move(floor_objects));
+      }
+    }
+  }
+
+  if (enable_retained_model_) {
+    UpdateRetainedModel(std::move(objects));
+    retained_model_.set_time(model.time());
+    retained_model_.set_layer(layer_);
+    return retained_model_.model();
+  }
+  layered_model_ = std::make_unique<escher::Model>(std::move(objects));
+  layered_model_->set_time(model.time());
+  layered_model_->set_layer(layer_);
+  return *layered_model_;
+}
+
+void WaterfallDemo::UpdateRetainedModel(std::vector<escher::Object> objects) {
+  if (objects.size() != retained_model_.model().objects().size()) {
+    // E.g. the scene has changed; start over.
+    while (!retained_model_.model().objects().empty()) {
+      retained_model_.RemoveObject(retained_model_.GetHandle(
+          retained_model_.model().objects().size() - 1));
+    }
+    for (escher::Object& object : objects) {
+      retained_model_.AddObject(std::move(object));
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < objects.size(); ++i) {
+    escher::Object& object = objects[i];
+    const escher::Object& retained = retained_model_.model().objects()[i];
+    const auto handle = retained_model_.GetHandle(i);
+    if (object.shape().type() == escher::Shape::Type::kNone ||
+        !HasSameShape(object, retained)) {
+      retained_model_.ReplaceObject(handle, std::move(object));
+      continue;
+    }
+    if (object.transform() != retained.transform()) {
+      retained_model_.SetTransform(handle, object.transform());
+    }
+    if (object.material() != retained.material()) {
+      retained_model_.SetMaterial(handle, object.material());
+    }
+    if (!HasSameShapeModifierData(object, retained)) {
+      auto wobble = object.shape_modifier_data<escher::ModifierWobble>();
+      if (wobble) {
+        retained_model_.SetShapeModifierData(handle, *wobble);
+      } else {
+        retained_model_.ReplaceObject(handle, std::move(object));
+      }
+    }
+  }
+}
+
 static escher::Camera GenerateCamera(int camera_projection_mode,
                                      const escher::ViewingVolume& volume) {
   switch (camera_projection_mode) {
@@ -210,10 +473,39 @@ static escher::Camera GenerateCamera(int camera_projection_mode,
   }
 }
 
+void WaterfallDemo::RunOffscreenBenchmark(
+    const escher::Model& model,
+    const escher::Camera& camera,
+    const escher::Model* overlay_model) {
+  stopwatch_.Stop();
+  renderer_->set_show_debug_info(false);
+  // Offscreen images are never presented, and each frame must be rendered
+  // in full to be representative.
+  renderer_->set_enable_damage_tracking(false);
+  renderer_->set_enable_ssdo_reuse(false);
+
+  renderer_->RunOffscreenBenchmark(
+      kDemoWidth, kDemoHeight, swapchain_helper_.swapchain().format,
+      kOffscreenBenchmarkFrameCount,
+      [this, &model, &camera, overlay_model](
+          const escher::ImagePtr& color_image_out,
+          const escher::SemaphorePtr& frame_done_semaphore) {
+        renderer_->DrawFrame(stage_, model, camera, color_image_out,
+                             overlay_model, frame_done_semaphore, nullptr);
+      });
+  renderer_->set_show_debug_info(show_debug_info_);
+  renderer_->set_enable_damage_tracking(enable_damage_tracking_);
+  renderer_->set_enable_ssdo_reuse(enable_ssdo_reuse_);
+  if (!stop_time_) {
+    stopwatch_.Start();
+  }
+}
+
 void WaterfallDemo::DrawFrame() {
   current_scene_ = current_scene_ % scenes_.size();
   auto& scene = scenes_.at(current_scene_);
-  escher::Model* model = scene->Update(stopwatch_, frame_count_, &stage_);
+  const escher::Model& model =
+      PrepareModel(*scene->Update(stopwatch_, frame_count_, &stage_));
   escher::Model* overlay_model = scene->UpdateOverlay(
       stopwatch_, frame_count_, swapchain_helper_.swapchain().width,
       swapchain_helper_.swapchain().height);
@@ -221,8 +513,23 @@ void WaterfallDemo::DrawFrame() {
   renderer_->set_show_debug_info(show_debug_info_);
   renderer_->set_enable_lighting(enable_lighting_);
   renderer_->set_sort_by_pipeline(sort_by_pipeline_);
+  renderer_->set_lighting_pass_sample_count(lighting_pass_sample_count_);
+  renderer_->set_enable_multi_draw_indirect(enable_multi_draw_indirect_);
+  renderer_->set_frustum_culling_mode(frustum_culling_mode_);
+  renderer_->set_enable_occlusion_culling(enable_occlusion_culling_);
+  renderer_->set_enable_hi_z_culling(enable_hi_z_culling_);
+  renderer_->set_enable_secondary_command_buffers(
+      enable_secondary_command_buffers_);
+  renderer_->set_enable_damage_tracking(enable_damage_tracking_);
   renderer_->set_enable_profiling(profile_one_frame_);
   renderer_->set_enable_ssdo_acceleration(enable_ssdo_acceleration_);
+  renderer_->set_ssdo_downsample_factor(ssdo_downsample_factor_);
+  renderer_->set_enable_ssdo_temporal_accumulation(
+      enable_ssdo_temporal_accumulation_);
+  renderer_->set_enable_ssdo_compute_sampling(enable_ssdo_compute_sampling_);
+  renderer_->set_enable_ssdo_compute_filtering(enable_ssdo_compute_filtering_);
+  renderer_->set_enable_ssdo_reuse(enable_ssdo_reuse_);
+  renderer_->set_enable_dynamic_resolution(enable_dynamic_resolution_);
   profile_one_frame_ = false;
 
   escher::Camera camera =
@@ -230,21 +537,22 @@ void WaterfallDemo::DrawFrame() {
 
   if (run_offscreen_benchmark_) {
     run_offscreen_benchmark_ = false;
-    stopwatch_.Stop();
-    renderer_->set_show_debug_info(false);
+    RunOffscreenBenchmark(model, camera, overlay_model);
+  }
 
-    renderer_->RunOffscreenBenchmark(
-        kDemoWidth, kDemoHeight, swapchain_helper_.swapchain().format,
-        kOffscreenBenchmarkFrameCount,
-        [this, model, &camera, overlay_model](
-            const escher::ImagePtr& color_image_out,
-            const escher::SemaphorePtr& frame_done_semaphore) {
-          renderer_->DrawFrame(stage_, *model, camera, color_image_out,
-                               overlay_model, frame_done_semaphore, nullptr);
-        });
-    renderer_->set_show_debug_info(show_debug_info_);
-    if (!stop_time_) {
-      stopwatch_.Start();
+  if (compare_ssdo_sampling_) {
+    compare_ssdo_sampling_ = false;
+    if (!harness()->device_queues()->caps().storage_image_extended_formats) {
+      FTL_LOG(INFO) << "SSDO compute sampling is not supported";
+    } else {
+      for (bool compute_sampling : {false, true}) {
+        FTL_LOG(INFO) << "SSDO sampling: "
+                      << (compute_sampling ? "compute" : "fragment");
+        renderer_->set_enable_ssdo_compute_sampling(compute_sampling);
+        RunOffscreenBenchmark(model, camera, overlay_model);
+      }
+      renderer_->set_enable_ssdo_compute_sampling(
+          enable_ssdo_compute_sampling_);
     }
   }
 
@@ -254,7 +562,7 @@ void WaterfallDemo::DrawFrame() {
     stopwatch_.Start();
   }
 
-  swapchain_helper_.DrawFrame(renderer_.get(), stage_, *model, camera,
+  swapchain_helper_.DrawFrame(renderer_.get(), stage_, model, camera,
                               overlay_model);
 
   if (++frame_count_ == 1) {
@@ -277,6 +585,9 @@ void WaterfallDemo::DrawFrame() {
     double fps = (frame_count_ - 2) * 1000000.0 /
                  (microseconds - first_frame_microseconds_);
     FTL_LOG(INFO) << "---- Average frame rate: " << fps;
+    if (enable_dynamic_resolution_) {
+      FTL_LOG(INFO) << "---- Render scale: " << renderer_->render_scale();
+    }
     FTL_LOG(INFO) << "---- Total GPU memory: "
                   << (escher()->GetNumGpuBytesAllocated() / 1024) << "kB";
   }
@@ -16,6 +16,8 @@
 #include "escher/geometry/types.h"
 #include "escher/material/color_utils.h"
 #include "escher/renderer/paper_renderer.h"
+#include "escher/scene/layer.h"
+#include "escher/scene/retained_model.h"
 #include "escher/scene/stage.h"
 #include "escher/util/stopwatch.h"
 #include "escher/vk/vulkan_swapchain_helper.h"
@@ -37,6 +39,15 @@ class WaterfallDemo : public Demo {
   void ProcessCommandLineArgs(int argc, char** argv);
   void InitializeEscherStage();
   void InitializeDemoScenes();
+  // Return the model to draw in place of |model|, according to
+  // |enable_layers_| and |enable_retained_model_|.
+  const escher::Model& PrepareModel(const escher::Model& model);
+  // Make |retained_model_| hold |objects|, changing only the parts of the
+  // objects that differ from the previous frame.
+  void UpdateRetainedModel(std::vector<escher::Object> objects);
+  void RunOffscreenBenchmark(const escher::Model& model,
+                             const escher::Camera& camera,
+                             const escher::Model* overlay_model);
 
   // Toggle debug overlays.
   bool show_debug_info_ = false;
@@ -45,8 +56,45 @@ class WaterfallDemo : public Demo {
   // True if the Model objects should be binned by pipeline, false if they
   // should be rendered in their natural order.
   bool sort_by_pipeline_ = true;
+  // Number of samples per pixel of the lighting pass.
+  uint32_t lighting_pass_sample_count_ = 1;
+  // True if runs of similar objects should be drawn by indirect draw calls.
+  bool enable_multi_draw_indirect_ = false;
+  // How objects outside of the view frustum are culled.
+  escher::PaperRenderer::FrustumCullingMode frustum_culling_mode_ =
+      escher::PaperRenderer::FrustumCullingMode::kNone;
+  // True if objects hidden behind large opaque objects should be culled.
+  bool enable_occlusion_culling_ = false;
+  // True if objects hidden according to the previous frame's depth should be
+  // culled from the depth pre-passes.
+  bool enable_hi_z_culling_ = false;
+  bool enable_secondary_command_buffers_ = false;
+  // True if only the parts of each frame that have changed should be rendered.
+  bool enable_damage_tracking_ = false;
   // True if SSDO should be accelerated by generating a lookup table each frame.
   bool enable_ssdo_acceleration_ = true;
+  // Factor by which the resolution of SSDO is reduced in each dimension.
+  uint32_t ssdo_downsample_factor_ = 1;
+  // True if SSDO should be accumulated over several frames.
+  bool enable_ssdo_temporal_accumulation_ = false;
+  // True if SSDO should be sampled by a compute kernel.
+  bool enable_ssdo_compute_sampling_ = false;
+  // True if SSDO should be filtered by a compute kernel.
+  bool enable_ssdo_compute_filtering_ = false;
+  // True if the SSDO of a frame should be reused while the scene is unchanged.
+  bool enable_ssdo_reuse_ = false;
+  // True if the objects that lie on the floor (at or below elevation 0)
+  // should be rendered into a Layer, which is only rendered again when they
+  // change.  The other objects no longer cast shadows upon them.
+  bool enable_layers_ = false;
+  // True if the scene should be mirrored by a RetainedModel, so that the
+  // renderer can reuse the uniforms (and, with secondary command buffers, the
+  // draw commands) of the objects that have not changed since the previous
+  // frame.
+  bool enable_retained_model_ = false;
+  // True if the scene should be rendered at a reduced resolution when the GPU
+  // takes too long to render it.
+  bool enable_dynamic_resolution_ = false;
   bool stop_time_ = false;
   // True if lighting should be periodically toggled on and off.
   bool auto_toggle_lighting_ = false;
@@ -55,6 +103,9 @@ class WaterfallDemo : public Demo {
   bool profile_one_frame_ = false;
   // Run an offscreen benchmark.
   bool run_offscreen_benchmark_ = false;
+  // Run the offscreen benchmark twice, once with fragment and once with
+  // compute SSDO sampling, so that the two can be compared.
+  bool compare_ssdo_sampling_ = false;
 
   // 3 camera projection modes:
   // - orthogonal full-screen
@@ -66,6 +117,11 @@ class WaterfallDemo : public Demo {
   escher::PaperRendererPtr renderer_;
   escher::VulkanSwapchainHelper swapchain_helper_;
   escher::Stage stage_;
+  // See PrepareModel().  The retained model is never replaced, since the
+  // renderer identifies its objects by their handles.
+  escher::LayerPtr layer_;
+  escher::RetainedModel retained_model_;
+  std::unique_ptr<escher::Model> layered_model_;
 
   escher::Stopwatch stopwatch_;
   uint64_t frame_count_ = 0;
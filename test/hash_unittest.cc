@@ -60,4 +60,17 @@ TEST(Hash, AllHashedTypes) {
   TestHashForValue(model_pipeline_spec);
 }
 
+TEST(Hash, ByteKeysAppendFieldsWithoutPadding) {
+  ByteKey key;
+  AppendToKey(&key, uint8_t(1));
+  AppendToKey(&key, uint32_t(2));
+  EXPECT_EQ(5U, key.size());
+
+  ByteKey same;
+  AppendToKey(&same, uint8_t(1));
+  AppendToKey(&same, uint32_t(2));
+  EXPECT_EQ(key, same);
+  EXPECT_EQ(ByteKeyHash()(key), ByteKeyHash()(same));
+}
+
 }  // namespace
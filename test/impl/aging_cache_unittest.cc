@@ -0,0 +1,98 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/aging_cache.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+ByteKey NewKey(uint32_t id) {
+  ByteKey key;
+  AppendToKey(&key, id);
+  return key;
+}
+
+// Obtain the value of |id| from |cache|, creating it as |id| if necessary.
+int Obtain(AgingCache<int>* cache, uint32_t id) {
+  return cache->Obtain(NewKey(id), [id]() { return static_cast<int>(id); });
+}
+
+TEST(AgingCache, CreatesOnlyOnMiss) {
+  AgingCache<int> cache(1);
+  int created_count = 0;
+  auto create = [&created_count]() { return ++created_count; };
+  EXPECT_EQ(1, cache.Obtain(NewKey(7), create));
+  EXPECT_EQ(1, cache.Obtain(NewKey(7), create));
+  EXPECT_EQ(2, cache.Obtain(NewKey(8), create));
+  EXPECT_EQ(1U, cache.hit_count());
+  EXPECT_EQ(2U, cache.miss_count());
+  EXPECT_EQ(2U, cache.size());
+}
+
+TEST(AgingCache, EvictsAfterMaxAgeUnusedRounds) {
+  // As configured by FramebufferCache, whose rounds are frames.
+  constexpr uint64_t kMaxAge = 8;
+  AgingCache<int> cache(kMaxAge);
+  std::vector<int> evicted;
+  auto evict = [&evicted](int* value) { evicted.push_back(*value); };
+
+  Obtain(&cache, 1);
+  Obtain(&cache, 2);
+  cache.EndRound(evict);
+  for (uint64_t i = 1; i < kMaxAge; ++i) {
+    Obtain(&cache, 2);
+    cache.EndRound(evict);
+  }
+  EXPECT_TRUE(evicted.empty());
+
+  // The first value has now gone unused for |kMaxAge| rounds.
+  cache.EndRound(evict);
+  EXPECT_EQ(std::vector<int>{1}, evicted);
+  EXPECT_EQ(1U, cache.size());
+
+  // An evicted value is created again when it is next obtained.
+  const uint32_t miss_count = cache.miss_count();
+  Obtain(&cache, 1);
+  EXPECT_EQ(miss_count + 1, cache.miss_count());
+}
+
+TEST(AgingCache, MaxAgeOfOneEvictsWhatTheRoundDidNotUse) {
+  // As configured by SecondaryCommandBufferCache, whose rounds end with each
+  // call to EvictUnusedCommandBuffers().
+  AgingCache<int> cache(1);
+  std::vector<int> evicted;
+  auto evict = [&evicted](int* value) { evicted.push_back(*value); };
+
+  Obtain(&cache, 1);
+  Obtain(&cache, 2);
+  cache.EndRound(evict);
+  EXPECT_TRUE(evicted.empty());
+
+  Obtain(&cache, 2);
+  cache.EndRound(evict);
+  EXPECT_EQ(std::vector<int>{1}, evicted);
+
+  cache.EndRound(evict);
+  EXPECT_EQ((std::vector<int>{1, 2}), evicted);
+  EXPECT_EQ(0U, cache.size());
+}
+
+TEST(AgingCache, ClearEvictsEverything) {
+  AgingCache<int> cache(4);
+  Obtain(&cache, 1);
+  Obtain(&cache, 2);
+  int evicted_count = 0;
+  cache.Clear([&evicted_count](int*) { ++evicted_count; });
+  EXPECT_EQ(2, evicted_count);
+  EXPECT_EQ(0U, cache.size());
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
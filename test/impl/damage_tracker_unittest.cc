@@ -0,0 +1,160 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/damage_tracker.h"
+
+#include "escher/scene/object.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+constexpr uint32_t kSize = 128;
+constexpr uint32_t kMargin = 4;
+
+// Maps [0, kSize] pixels to [-1, 1] in normalized device coordinates.  The
+// scale is a power of two, so that the mapping is exact.
+mat4 PixelsToNdc() {
+  mat4 transform(1);
+  transform[0][0] = 2.f / kSize;
+  transform[1][1] = 2.f / kSize;
+  transform[3][0] = -1.f;
+  transform[3][1] = -1.f;
+  return transform;
+}
+
+DamageTracker::FrameState NewFrameState() {
+  DamageTracker::FrameState state;
+  state.camera_transform = PixelsToNdc();
+  state.clear_color = vec4(0.f, 0.f, 0.f, 1.f);
+  state.key_light = vec4(0.f);
+  state.fill_light_intensity = 0.f;
+  state.width = kSize;
+  state.height = kSize;
+  state.layer_image_uid = 0;
+  state.enable_lighting = true;
+  return state;
+}
+
+vk::Image NewImage(uint64_t id) {
+  return vk::Image(reinterpret_cast<VkImage>(id));
+}
+
+vk::Rect2D NewRect(int32_t x, int32_t y, uint32_t width, uint32_t height) {
+  return vk::Rect2D(vk::Offset2D(x, y), vk::Extent2D(width, height));
+}
+
+Object NewSquare(float x, const MaterialPtr& material = MaterialPtr()) {
+  return Object::NewRect(vec2(x, 0.f), vec2(16.f, 16.f), 0.f, material);
+}
+
+vk::Rect2D DrawFrame(DamageTracker* tracker,
+                     const std::vector<Object>& objects,
+                     vk::Image target,
+                     const DamageTracker::FrameState& state = NewFrameState()) {
+  tracker->BeginFrame(state);
+  tracker->AddObjects(objects, state.camera_transform, 0);
+  return tracker->EndFrame(target);
+}
+
+TEST(DamageTracker, FirstFrameIsFullyDamaged) {
+  DamageTracker tracker(kMargin);
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1)));
+}
+
+TEST(DamageTracker, UnchangedFrameIsNotDamaged) {
+  DamageTracker tracker(kMargin);
+  DrawFrame(&tracker, {NewSquare(16.f), NewSquare(64.f)}, NewImage(1));
+  EXPECT_EQ(NewRect(0, 0, 0, 0),
+            DrawFrame(&tracker, {NewSquare(16.f), NewSquare(64.f)},
+                      NewImage(1)));
+  // Objects are matched by their contents, not by their order.
+  EXPECT_EQ(NewRect(0, 0, 0, 0),
+            DrawFrame(&tracker, {NewSquare(64.f), NewSquare(16.f)},
+                      NewImage(1)));
+}
+
+TEST(DamageTracker, MovedObjectDamagesOldAndNewBounds) {
+  DamageTracker tracker(kMargin);
+  DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1));
+  // The old bounds are [12, 36] x [0, 20] and the new bounds are [60, 84] x
+  // [0, 20], after expanding by the margin and clamping to the frame.
+  EXPECT_EQ(NewRect(12, 0, 72, 20),
+            DrawFrame(&tracker, {NewSquare(64.f)}, NewImage(1)));
+}
+
+TEST(DamageTracker, ChangedMaterialDamagesBounds) {
+  DamageTracker tracker(kMargin);
+  MaterialPtr material = Material::New(vec4(1.f, 0.f, 0.f, 1.f));
+  DrawFrame(&tracker, {NewSquare(16.f, material)}, NewImage(1));
+  material->set_color(vec4(0.f, 1.f, 0.f, 1.f));
+  EXPECT_EQ(NewRect(12, 0, 24, 20),
+            DrawFrame(&tracker, {NewSquare(16.f, material)}, NewImage(1)));
+}
+
+TEST(DamageTracker, ChangedFrameStateDamagesEverything) {
+  DamageTracker tracker(kMargin);
+  DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1));
+  DamageTracker::FrameState state = NewFrameState();
+  state.clear_color = vec4(1.f);
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1), state));
+}
+
+TEST(DamageTracker, ChangedRendererSettingsDamageEverything) {
+  DamageTracker tracker(kMargin);
+  DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1));
+  DamageTracker::FrameState state = NewFrameState();
+  AppendToKey(&state.renderer_settings, 2u);
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1), state));
+}
+
+TEST(DamageTracker, ChangedLayerImageDamagesEverything) {
+  DamageTracker tracker(kMargin);
+  DamageTracker::FrameState state = NewFrameState();
+  state.layer_image_uid = 1;
+  DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1), state);
+  EXPECT_EQ(NewRect(0, 0, 0, 0),
+            DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1), state));
+  state.layer_image_uid = 2;
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, NewImage(1), state));
+}
+
+TEST(DamageTracker, ShapeModifiersDamageEverything) {
+  DamageTracker tracker(kMargin);
+  Object wobbly = NewSquare(16.f);
+  wobbly.set_shape_modifiers(ShapeModifier::kWobble);
+  DrawFrame(&tracker, {wobbly}, NewImage(1));
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {wobbly}, NewImage(1)));
+}
+
+TEST(DamageTracker, DamageAccumulatesUntilTargetIsRendered) {
+  DamageTracker tracker(kMargin);
+  vk::Image a = NewImage(1);
+  vk::Image b = NewImage(2);
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, a));
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(16.f)}, b));
+  EXPECT_EQ(NewRect(12, 0, 72, 20),
+            DrawFrame(&tracker, {NewSquare(64.f)}, a));
+  // The object has not moved since the previous frame, but it has since |b|
+  // was last rendered.
+  EXPECT_EQ(NewRect(12, 0, 72, 20),
+            DrawFrame(&tracker, {NewSquare(64.f)}, b));
+  EXPECT_EQ(NewRect(0, 0, 0, 0), DrawFrame(&tracker, {NewSquare(64.f)}, a));
+
+  tracker.Reset();
+  EXPECT_EQ(NewRect(0, 0, kSize, kSize),
+            DrawFrame(&tracker, {NewSquare(64.f)}, b));
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,75 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/frustum_culler.h"
+
+#include "escher/geometry/bounding_box.h"
+#include "escher/geometry/types.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+// Maps x and y from [0,100] to [-1,1], and z from [0,10] to [0,1].
+mat4 TestProjection() {
+  mat4 matrix(1);
+  matrix[0][0] = 0.02f;
+  matrix[1][1] = 0.02f;
+  matrix[2][2] = 0.1f;
+  matrix[3][0] = -1.f;
+  matrix[3][1] = -1.f;
+  return matrix;
+}
+
+TEST(FrustumCuller, InsideAndStraddling) {
+  mat4 projection = TestProjection();
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, 10, 1}, {20, 20, 2})));
+  // Boxes that are partially inside must not be culled.
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({-10, -10, 1}, {10, 10, 2})));
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({90, 50, 9}, {110, 60, 11})));
+  // Flat boxes, like those of 2D meshes, are treated the same way.
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, 10, 0}, {20, 20, 0})));
+}
+
+TEST(FrustumCuller, Outside) {
+  mat4 projection = TestProjection();
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({-20, 10, 1}, {-10, 20, 2})));
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({110, 10, 1}, {120, 20, 2})));
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, -20, 1}, {20, -10, 2})));
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, 110, 1}, {20, 120, 2})));
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, 10, -2}, {20, 20, -1})));
+  EXPECT_TRUE(FrustumCuller::IsOutsideFrustum(
+      projection, BoundingBox({10, 10, 11}, {20, 20, 12})));
+}
+
+TEST(FrustumCuller, ObjectTransform) {
+  // Translating the box out of the frustum causes it to be culled.
+  mat4 translation(1);
+  translation[3][0] = 200.f;
+  BoundingBox box({10, 10, 1}, {20, 20, 2});
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(TestProjection(), box));
+  EXPECT_TRUE(
+      FrustumCuller::IsOutsideFrustum(TestProjection() * translation, box));
+}
+
+TEST(FrustumCuller, EmptyBoxIsNeverCulled) {
+  mat4 translation(1);
+  translation[3][0] = 200.f;
+  EXPECT_FALSE(FrustumCuller::IsOutsideFrustum(TestProjection() * translation,
+                                               BoundingBox()));
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,151 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/layer_cache.h"
+
+#include "escher/scene/layer.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+// Textures require a Vulkan device, so the cache is exercised with null
+// textures, and observed via its stats.
+constexpr vk::DeviceSize kImageSize = 1000;
+
+LayerPtr NewLayer() {
+  std::vector<Object> objects;
+  objects.push_back(Object::NewRect(vec2(0.f, 0.f), vec2(10.f, 10.f), 0.f,
+                                    MaterialPtr()));
+  return Layer::New(Model(std::move(objects)));
+}
+
+LayerCache::Key NewKey() {
+  LayerCache::Key key;
+  key.camera_transform = mat4(1.f);
+  key.format = vk::Format::eB8G8R8A8Unorm;
+  key.width = 100;
+  key.height = 100;
+  key.clear_color = vec4(0.f, 0.f, 0.f, 1.f);
+  key.key_light = vec4(1.f, 1.f, 0.5f, 0.7f);
+  key.fill_light_intensity = 0.3f;
+  key.viewing_volume = vec4(100.f, 100.f, 100.f, 0.f);
+  key.enable_lighting = true;
+  return key;
+}
+
+TEST(LayerCache, FindsInsertedLayer) {
+  LayerCache cache(10 * kImageSize);
+  auto layer = NewLayer();
+  auto key = NewKey();
+
+  cache.Find(*layer, key);
+  EXPECT_EQ(0U, cache.stats().hit_count);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+  EXPECT_EQ(kImageSize, cache.stats().memory_used);
+  cache.Find(*layer, key);
+  cache.Find(*layer, key);
+  EXPECT_EQ(2U, cache.stats().hit_count);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+
+  // Inserting the layer again replaces its previous image.
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+  EXPECT_EQ(kImageSize, cache.stats().memory_used);
+}
+
+TEST(LayerCache, InvalidatedLayerIsStale) {
+  LayerCache cache(10 * kImageSize);
+  auto layer = NewLayer();
+  auto key = NewKey();
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+
+  layer->mutable_model()->mutable_objects().pop_back();
+  cache.Find(*layer, key);
+  EXPECT_EQ(0U, cache.stats().hit_count);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+  // The stale image is dropped, rather than waiting to be evicted.
+  EXPECT_EQ(0U, cache.stats().memory_used);
+  EXPECT_EQ(0U, cache.stats().eviction_count);
+}
+
+TEST(LayerCache, ChangedKeyIsStale) {
+  LayerCache cache(10 * kImageSize);
+  auto layer = NewLayer();
+  auto key = NewKey();
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+
+  auto moved_key = key;
+  moved_key.camera_transform = glm::translate(vec3(1.f, 0.f, 0.f));
+  cache.Find(*layer, moved_key);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+  EXPECT_EQ(0U, cache.stats().memory_used);
+
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+  auto settings_key = key;
+  AppendToKey(&settings_key.renderer_settings, 2U);
+  cache.Find(*layer, settings_key);
+  EXPECT_EQ(2U, cache.stats().miss_count);
+
+  cache.Insert(*layer, key, TexturePtr(), kImageSize);
+  auto inner_key = key;
+  inner_key.inner_layers.emplace_back(1U, 0U);
+  cache.Find(*layer, inner_key);
+  EXPECT_EQ(3U, cache.stats().miss_count);
+  EXPECT_EQ(0U, cache.stats().hit_count);
+}
+
+TEST(LayerCache, EvictsLeastRecentlyUsedWithinBudget) {
+  LayerCache cache(2 * kImageSize);
+  auto a = NewLayer();
+  auto b = NewLayer();
+  auto c = NewLayer();
+  auto key = NewKey();
+
+  cache.Insert(*a, key, TexturePtr(), kImageSize);
+  cache.Insert(*b, key, TexturePtr(), kImageSize);
+  // Use |a|, so that |b| is the least recently used.
+  cache.Find(*a, key);
+  EXPECT_EQ(1U, cache.stats().hit_count);
+
+  cache.Insert(*c, key, TexturePtr(), kImageSize);
+  EXPECT_EQ(1U, cache.stats().eviction_count);
+  EXPECT_EQ(2 * kImageSize, cache.stats().memory_used);
+
+  cache.Find(*a, key);
+  cache.Find(*c, key);
+  EXPECT_EQ(3U, cache.stats().hit_count);
+  cache.Find(*b, key);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+
+  // Shrinking the budget evicts as well.
+  cache.set_memory_budget(kImageSize);
+  EXPECT_EQ(2U, cache.stats().eviction_count);
+  EXPECT_EQ(kImageSize, cache.stats().memory_used);
+  // |c| was used after |a|.
+  cache.Find(*c, key);
+  EXPECT_EQ(4U, cache.stats().hit_count);
+}
+
+TEST(LayerCache, DoesNotCacheImagesLargerThanBudget) {
+  LayerCache cache(kImageSize);
+  auto a = NewLayer();
+  auto b = NewLayer();
+  auto key = NewKey();
+
+  cache.Insert(*a, key, TexturePtr(), kImageSize);
+  cache.Insert(*b, key, TexturePtr(), 2 * kImageSize);
+  EXPECT_EQ(1U, cache.stats().uncached_count);
+  // |a| is not evicted to make room for an image that would not fit anyway.
+  EXPECT_EQ(0U, cache.stats().eviction_count);
+  EXPECT_EQ(kImageSize, cache.stats().memory_used);
+  cache.Find(*b, key);
+  EXPECT_EQ(1U, cache.stats().miss_count);
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
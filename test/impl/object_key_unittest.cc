@@ -0,0 +1,59 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/object_key.h"
+
+#include "escher/scene/object.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+Object NewSquare(float x, const MaterialPtr& material = MaterialPtr()) {
+  return Object::NewRect(vec2(x, 0.f), vec2(16.f, 16.f), 0.f, material);
+}
+
+ByteKey GetKey(const Object& object) {
+  ByteKey key;
+  AppendObjectToKey(&key, object);
+  return key;
+}
+
+TEST(ObjectKey, EqualObjectsHaveEqualKeys) {
+  MaterialPtr material = Material::New(vec4(1.f, 0.f, 0.f, 1.f));
+  EXPECT_EQ(GetKey(NewSquare(16.f, material)),
+            GetKey(NewSquare(16.f, material)));
+}
+
+TEST(ObjectKey, KeyCoversTransformAndMaterial) {
+  MaterialPtr material = Material::New(vec4(1.f, 0.f, 0.f, 1.f));
+  const ByteKey key = GetKey(NewSquare(16.f, material));
+  EXPECT_NE(key, GetKey(NewSquare(32.f, material)));
+  EXPECT_NE(key, GetKey(NewSquare(16.f)));
+
+  // Materials are mutable.
+  material->set_color(vec4(0.f, 1.f, 0.f, 1.f));
+  EXPECT_NE(key, GetKey(NewSquare(16.f, material)));
+}
+
+TEST(ObjectKey, KeyCoversClipGroups) {
+  const Object group({NewSquare(0.f)}, {NewSquare(16.f)});
+  EXPECT_EQ(GetKey(group), GetKey(Object({NewSquare(0.f)}, {NewSquare(16.f)})));
+  EXPECT_NE(GetKey(group), GetKey(Object({NewSquare(0.f)}, {NewSquare(32.f)})));
+  EXPECT_NE(GetKey(group), GetKey(Object({NewSquare(16.f)}, {NewSquare(0.f)})));
+}
+
+TEST(ObjectKey, ShapeModifiersOfClippeesAreFound) {
+  Object wobbly = NewSquare(16.f);
+  wobbly.set_shape_modifiers(ShapeModifier::kWobble);
+  EXPECT_FALSE(HasShapeModifiers(NewSquare(16.f)));
+  EXPECT_TRUE(HasShapeModifiers(wobbly));
+  EXPECT_TRUE(HasShapeModifiers(Object({NewSquare(0.f)}, {wobbly})));
+  EXPECT_TRUE(HasShapeModifiers(std::vector<Object>{NewSquare(0.f), wobbly}));
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,90 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/object_uniform_cache.h"
+
+#include "escher/scene/object.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+Object NewSquare(float x) {
+  return Object::NewRect(vec2(x, 0.f), vec2(16.f, 16.f), 0.f, MaterialPtr());
+}
+
+// Stands in for the uniforms that a display list writes for an object.
+constexpr uint32_t kWrittenOffset = 256;
+
+TEST(ObjectUniformCache, EntriesAreKeptBetweenDisplayLists) {
+  RetainedModel model;
+  auto a = model.AddObject(NewSquare(0.f));
+  ObjectUniformCache cache(ModelDisplayListFlags(), 1.f);
+
+  cache.BeginDisplayList(mat4(1.f));
+  EXPECT_EQ(0U, cache.GetEntry(a)->uniform_offset);
+  cache.GetEntry(a)->uniform_offset = kWrittenOffset;
+  cache.EndDisplayList(model);
+  EXPECT_EQ(model.revision(), cache.revision());
+
+  cache.BeginDisplayList(mat4(1.f));
+  EXPECT_EQ(kWrittenOffset, cache.GetEntry(a)->uniform_offset);
+  cache.EndDisplayList(model);
+}
+
+TEST(ObjectUniformCache, CameraChangeDiscardsEntries) {
+  RetainedModel model;
+  auto a = model.AddObject(NewSquare(0.f));
+  ObjectUniformCache cache(ModelDisplayListFlags(), 1.f);
+
+  cache.BeginDisplayList(mat4(1.f));
+  cache.GetEntry(a)->uniform_offset = kWrittenOffset;
+  cache.EndDisplayList(model);
+
+  cache.BeginDisplayList(mat4(2.f));
+  EXPECT_EQ(0U, cache.GetEntry(a)->uniform_offset);
+  cache.EndDisplayList(model);
+}
+
+TEST(ObjectUniformCache, RemovedObjectsAreEvicted) {
+  RetainedModel model;
+  auto a = model.AddObject(NewSquare(0.f));
+  auto b = model.AddObject(NewSquare(32.f));
+  ObjectUniformCache cache(ModelDisplayListFlags(), 1.f);
+
+  cache.BeginDisplayList(mat4(1.f));
+  cache.GetEntry(a)->uniform_offset = kWrittenOffset;
+  cache.GetEntry(b)->uniform_offset = kWrittenOffset;
+  cache.EndDisplayList(model);
+
+  // |b| is not obtained by the next display list, so its entry is discarded.
+  model.RemoveObject(b);
+  cache.BeginDisplayList(mat4(1.f));
+  EXPECT_EQ(kWrittenOffset, cache.GetEntry(a)->uniform_offset);
+  cache.EndDisplayList(model);
+
+  cache.BeginDisplayList(mat4(1.f));
+  EXPECT_EQ(kWrittenOffset, cache.GetEntry(a)->uniform_offset);
+  EXPECT_EQ(0U, cache.GetEntry(b)->uniform_offset);
+  cache.EndDisplayList(model);
+}
+
+TEST(ObjectUniformCache, OnlyRelevantFlagsAffectCompatibility) {
+  ObjectUniformCache cache(ModelDisplayListFlag::kUseDepthPrepass, 1.f);
+  EXPECT_TRUE(cache.IsCompatible(ModelDisplayListFlag::kUseDepthPrepass, 1.f));
+  EXPECT_TRUE(cache.IsCompatible(ModelDisplayListFlag::kUseDepthPrepass |
+                                     ModelDisplayListFlag::kSortByPipeline,
+                                 1.f));
+  EXPECT_FALSE(cache.IsCompatible(ModelDisplayListFlags(), 1.f));
+  EXPECT_FALSE(cache.IsCompatible(
+      ModelDisplayListFlag::kUseDepthPrepass |
+          ModelDisplayListFlag::kShareDescriptorSetsBetweenObjects,
+      1.f));
+  EXPECT_FALSE(cache.IsCompatible(ModelDisplayListFlag::kUseDepthPrepass, .5f));
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
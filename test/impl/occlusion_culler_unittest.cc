@@ -0,0 +1,116 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/occlusion_culler.h"
+
+#include "escher/geometry/bounding_box.h"
+#include "escher/geometry/types.h"
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+// With 8 cells in each dimension, each cell is 0.25 wide in normalized device
+// coordinates.
+constexpr uint32_t kSize = 8;
+
+TEST(OcclusionCuller, EmptyBufferOccludesNothing) {
+  OcclusionCuller culler(kSize, kSize);
+  EXPECT_EQ(1.f, culler.depth_at(0, 0));
+  EXPECT_EQ(1.f, culler.depth_at(kSize - 1, kSize - 1));
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f), 0.9f));
+}
+
+TEST(OcclusionCuller, DepthComparison) {
+  OcclusionCuller culler(kSize, kSize);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.5f);
+  EXPECT_TRUE(culler.IsOccluded(vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f), 0.6f));
+  // The occluder must be strictly nearer than the occludee.
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f), 0.5f));
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f), 0.4f));
+}
+
+TEST(OcclusionCuller, OccludersOnlyWriteFullyCoveredCells) {
+  OcclusionCuller culler(kSize, kSize);
+  // Covers cells 0.4 to 4.4 in each dimension; only cells 1 to 3 are fully
+  // covered.
+  culler.AddOccluder(vec2(-0.9f, -0.9f), vec2(0.1f, 0.1f), 0.5f);
+  EXPECT_EQ(1.f, culler.depth_at(0, 0));
+  EXPECT_EQ(1.f, culler.depth_at(0, 1));
+  EXPECT_EQ(0.5f, culler.depth_at(1, 1));
+  EXPECT_EQ(0.5f, culler.depth_at(3, 3));
+  EXPECT_EQ(1.f, culler.depth_at(4, 3));
+  EXPECT_EQ(1.f, culler.depth_at(3, 4));
+
+  // Touches cells 1 to 3.
+  EXPECT_TRUE(culler.IsOccluded(vec2(-0.7f, -0.7f), vec2(-0.1f, -0.1f), 0.6f));
+  // Touches cell 0, which is not covered.
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.8f, -0.7f), vec2(-0.1f, -0.1f), 0.6f));
+  // Touches cell 4, which is not covered.
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.7f, -0.7f), vec2(0.05f, -0.1f), 0.6f));
+}
+
+TEST(OcclusionCuller, NearestOccluderWins) {
+  OcclusionCuller culler(kSize, kSize);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.5f);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(0.f, 0.f), 0.3f);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.7f);
+  EXPECT_EQ(0.3f, culler.depth_at(0, 0));
+  EXPECT_EQ(0.5f, culler.depth_at(kSize - 1, kSize - 1));
+  EXPECT_TRUE(culler.IsOccluded(vec2(-1.f, -1.f), vec2(0.f, 0.f), 0.4f));
+  EXPECT_FALSE(culler.IsOccluded(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.4f));
+}
+
+TEST(OcclusionCuller, OffscreenRegionsAreIgnored) {
+  OcclusionCuller culler(kSize, kSize);
+  culler.AddOccluder(vec2(-2.f, -2.f), vec2(2.f, 2.f), 0.5f);
+  EXPECT_EQ(0.5f, culler.depth_at(0, 0));
+  EXPECT_EQ(0.5f, culler.depth_at(kSize - 1, kSize - 1));
+  // Partially offscreen: only the onscreen part is tested.
+  EXPECT_TRUE(culler.IsOccluded(vec2(0.5f, 0.5f), vec2(2.f, 2.f), 0.6f));
+  // Entirely offscreen: not considered to be occluded.
+  EXPECT_FALSE(culler.IsOccluded(vec2(2.f, 2.f), vec2(3.f, 3.f), 0.6f));
+}
+
+TEST(OcclusionCuller, Clear) {
+  OcclusionCuller culler(kSize, kSize);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.5f);
+  culler.Clear();
+  EXPECT_EQ(1.f, culler.depth_at(0, 0));
+  EXPECT_FALSE(culler.IsOccluded(vec2(-0.5f, -0.5f), vec2(0.5f, 0.5f), 0.6f));
+}
+
+TEST(OcclusionCuller, LoadDepths) {
+  // Width is not a multiple of kLaneCount, so rows are padded.
+  OcclusionCuller culler(3, 2);
+  const float depths[] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f};
+  culler.LoadDepths(depths);
+  EXPECT_EQ(0.1f, culler.depth_at(0, 0));
+  EXPECT_EQ(0.3f, culler.depth_at(2, 0));
+  EXPECT_EQ(0.4f, culler.depth_at(0, 1));
+  EXPECT_EQ(0.6f, culler.depth_at(2, 1));
+  // The top row is nearer than 0.35, but the bottom row is not.
+  EXPECT_TRUE(culler.IsOccluded(vec2(-1.f, -1.f), vec2(1.f, 0.f), 0.35f));
+  EXPECT_FALSE(culler.IsOccluded(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.35f));
+}
+
+TEST(OcclusionCuller, TransformedBoundingBox) {
+  OcclusionCuller culler(kSize, kSize);
+  culler.AddOccluder(vec2(-1.f, -1.f), vec2(1.f, 1.f), 0.5f);
+
+  BoundingBox box(vec3(-0.5f, -0.5f, 0.7f), vec3(0.5f, 0.5f, 0.8f));
+  EXPECT_TRUE(culler.IsOccluded(mat4(1), box));
+
+  // Moving the box in front of the occluder makes it visible.
+  mat4 translation(1);
+  translation[3][2] = -0.4f;
+  EXPECT_FALSE(culler.IsOccluded(translation, box));
+
+  EXPECT_FALSE(culler.IsOccluded(mat4(1), BoundingBox()));
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
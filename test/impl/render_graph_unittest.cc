@@ -0,0 +1,144 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/render_graph.h"
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+using StageFlags = vk::PipelineStageFlags;
+using StageBits = vk::PipelineStageFlagBits;
+
+struct AccessResult {
+  bool needs_barrier;
+  vk::ImageMemoryBarrier barrier;
+  StageFlags src_stages;
+  StageFlags dst_stages;
+};
+
+// Perform |access| on |state|, and return the barrier that it required, if
+// any.
+AccessResult Access(ImageSyncState* state, const ImageAccess& access) {
+  AccessResult result;
+  result.needs_barrier = state->Access(access, &result.barrier,
+                                       &result.src_stages, &result.dst_stages);
+  return result;
+}
+
+TEST(ImageSyncState, DiscardingWriteTransitionsFromUndefined) {
+  ImageSyncState state;
+  AccessResult result = Access(&state, ImageAccess::ColorAttachment(true));
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(vk::ImageLayout::eUndefined, result.barrier.oldLayout);
+  EXPECT_EQ(vk::ImageLayout::eColorAttachmentOptimal,
+            result.barrier.newLayout);
+  EXPECT_EQ(StageFlags(StageBits::eTopOfPipe), result.src_stages);
+  EXPECT_EQ(StageFlags(StageBits::eColorAttachmentOutput), result.dst_stages);
+}
+
+TEST(ImageSyncState, ReadAfterWriteWaitsForWrite) {
+  ImageSyncState state;
+  Access(&state, ImageAccess::ColorAttachment(true));
+  AccessResult result = Access(&state, ImageAccess::Sampled());
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(vk::ImageLayout::eColorAttachmentOptimal,
+            result.barrier.oldLayout);
+  EXPECT_EQ(vk::ImageLayout::eShaderReadOnlyOptimal, result.barrier.newLayout);
+  EXPECT_EQ(vk::AccessFlags(vk::AccessFlagBits::eColorAttachmentWrite),
+            result.barrier.srcAccessMask);
+  EXPECT_EQ(vk::AccessFlags(vk::AccessFlagBits::eShaderRead),
+            result.barrier.dstAccessMask);
+  EXPECT_EQ(StageFlags(StageBits::eColorAttachmentOutput), result.src_stages);
+  EXPECT_EQ(StageFlags(StageBits::eFragmentShader), result.dst_stages);
+}
+
+TEST(ImageSyncState, ReadAfterReadNeedsNoBarrier) {
+  ImageSyncState state;
+  Access(&state, ImageAccess::ColorAttachment(true));
+  Access(&state, ImageAccess::Sampled());
+  EXPECT_FALSE(Access(&state, ImageAccess::Sampled()).needs_barrier);
+
+  // The write must still be made visible to other stages.
+  AccessResult result =
+      Access(&state, ImageAccess::Sampled(StageBits::eComputeShader));
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(result.barrier.oldLayout, result.barrier.newLayout);
+  EXPECT_EQ(StageFlags(StageBits::eFragmentShader), result.src_stages);
+  EXPECT_EQ(StageFlags(StageBits::eComputeShader), result.dst_stages);
+}
+
+TEST(ImageSyncState, WriteAfterReadWaitsForReads) {
+  ImageSyncState state;
+  Access(&state, ImageAccess::Storage(vk::AccessFlagBits::eShaderWrite));
+  Access(&state, ImageAccess::Storage(vk::AccessFlagBits::eShaderRead,
+                                      StageBits::eFragmentShader));
+  AccessResult result =
+      Access(&state, ImageAccess::Storage(vk::AccessFlagBits::eShaderWrite));
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(vk::ImageLayout::eGeneral, result.barrier.oldLayout);
+  EXPECT_EQ(vk::ImageLayout::eGeneral, result.barrier.newLayout);
+  EXPECT_EQ(StageFlags(StageBits::eComputeShader | StageBits::eFragmentShader),
+            result.src_stages);
+}
+
+TEST(ImageSyncState, FinalLayoutIsTracked) {
+  ImageSyncState state;
+  Access(&state, ImageAccess::ColorAttachment(
+                     true, vk::ImageLayout::eShaderReadOnlyOptimal));
+  EXPECT_EQ(vk::ImageLayout::eShaderReadOnlyOptimal, state.layout());
+
+  // No transition is required, but the write must still be waited for.
+  AccessResult result = Access(&state, ImageAccess::Sampled());
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(vk::ImageLayout::eShaderReadOnlyOptimal,
+            result.barrier.oldLayout);
+}
+
+TEST(ImageSyncState, ImportedImageIsNotWaitedFor) {
+  ImageSyncState state(vk::ImageLayout::eShaderReadOnlyOptimal);
+  EXPECT_FALSE(Access(&state, ImageAccess::Sampled()).needs_barrier);
+
+  ImageSyncState present_state(vk::ImageLayout::ePresentSrcKHR);
+  AccessResult result =
+      Access(&present_state, ImageAccess::ColorAttachment(false));
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(vk::ImageLayout::ePresentSrcKHR, result.barrier.oldLayout);
+  EXPECT_EQ(StageFlags(StageBits::eTopOfPipe), result.src_stages);
+}
+
+TEST(ImageSyncState, TransitionWaitsForImportStages) {
+  // E.g. a swapchain image, whose semaphore is waited upon by the
+  // color-attachment-output stage.
+  ImageSyncState state(vk::ImageLayout::eUndefined,
+                       StageBits::eColorAttachmentOutput);
+  AccessResult result = Access(&state, ImageAccess::ColorAttachment(true));
+  EXPECT_TRUE(result.needs_barrier);
+  EXPECT_EQ(StageFlags(StageBits::eColorAttachmentOutput), result.src_stages);
+  EXPECT_EQ(vk::AccessFlags(), result.barrier.srcAccessMask);
+}
+
+TEST(RenderGraph, AliasTransientImages) {
+  ImageInfo color{vk::Format::eB8G8R8A8Unorm, 64, 64, 1,
+                  vk::ImageUsageFlagBits::eColorAttachment};
+  ImageInfo depth{vk::Format::eD24UnormS8Uint, 64, 64, 1,
+                  vk::ImageUsageFlagBits::eDepthStencilAttachment};
+
+  // The second color image overlaps the first, but the third does not, and
+  // can alias it.  The depth image is incompatible with all of them.
+  std::vector<size_t> physical = RenderGraph::AliasTransientImages(
+      {color, color, depth, color}, {{0, 2}, {1, 3}, {0, 5}, {3, 4}});
+  EXPECT_EQ((std::vector<size_t>{0, 2, 1, 0}), physical);
+
+  // Images that are used by the same pass cannot alias.
+  physical =
+      RenderGraph::AliasTransientImages({color, color}, {{0, 1}, {1, 2}});
+  EXPECT_NE(physical[0], physical[1]);
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,84 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/resolution_controller.h"
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+ResolutionController::Config NewConfig() {
+  ResolutionController::Config config;
+  config.target_frame_time = 10000;
+  config.min_scale = 0.5f;
+  config.max_scale = 1.f;
+  config.step = 0.25f;
+  config.hysteresis = 0.1f;
+  return config;
+}
+
+TEST(ResolutionController, StartsAtMaxScale) {
+  ResolutionController controller(NewConfig());
+  EXPECT_EQ(1.f, controller.scale());
+}
+
+TEST(ResolutionController, SlowFrameLowersScaleUntilMin) {
+  ResolutionController controller(NewConfig());
+  controller.ReportFrameTime(1.f, 20000);
+  EXPECT_EQ(0.75f, controller.scale());
+  controller.ReportFrameTime(0.75f, 20000);
+  EXPECT_EQ(0.5f, controller.scale());
+  controller.ReportFrameTime(0.5f, 20000);
+  EXPECT_EQ(0.5f, controller.scale());
+}
+
+TEST(ResolutionController, FramesAtOtherScalesAreIgnored) {
+  ResolutionController controller(NewConfig());
+  controller.ReportFrameTime(1.f, 20000);
+  EXPECT_EQ(0.75f, controller.scale());
+  // Frames that were already in flight when the scale was lowered.
+  controller.ReportFrameTime(1.f, 20000);
+  controller.ReportFrameTime(1.f, 20000);
+  EXPECT_EQ(0.75f, controller.scale());
+}
+
+TEST(ResolutionController, FastFrameRaisesScaleWithHysteresis) {
+  ResolutionController controller(NewConfig());
+  controller.ReportFrameTime(1.f, 20000);
+  controller.ReportFrameTime(0.75f, 20000);
+  ASSERT_EQ(0.5f, controller.scale());
+
+  // At scale 0.75, the frame would take 2.25 times as long: 9900us, which
+  // is within the target, but not by the hysteresis.
+  controller.ReportFrameTime(0.5f, 4400);
+  EXPECT_EQ(0.5f, controller.scale());
+
+  // 8100us is.
+  controller.ReportFrameTime(0.5f, 3600);
+  EXPECT_EQ(0.75f, controller.scale());
+
+  // Frames within the target do not lower the scale.
+  controller.ReportFrameTime(0.75f, 10000);
+  EXPECT_EQ(0.75f, controller.scale());
+}
+
+TEST(ResolutionController, ScaleNeverExceedsMax) {
+  ResolutionController::Config config = NewConfig();
+  config.max_scale = 0.9f;
+  ResolutionController controller(config);
+  EXPECT_EQ(0.9f, controller.scale());
+  controller.ReportFrameTime(0.9f, 100);
+  EXPECT_EQ(0.9f, controller.scale());
+
+  controller.ReportFrameTime(0.9f, 20000);
+  EXPECT_EQ(0.65f, controller.scale());
+  controller.ReportFrameTime(0.65f, 100);
+  EXPECT_EQ(0.9f, controller.scale());
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
@@ -0,0 +1,77 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/impl/sampler_cache.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace escher {
+namespace impl {
+namespace {
+
+// Hands out fake samplers, and records which ones are destroyed.
+class FakeSamplers {
+ public:
+  SamplerCache::CreateFunc create() {
+    return [this](const vk::SamplerCreateInfo&) {
+      ++created_count;
+      return vk::Sampler(reinterpret_cast<VkSampler>(created_count));
+    };
+  }
+  SamplerCache::DestroyFunc destroy() {
+    return [this](vk::Sampler sampler) { destroyed.push_back(sampler); };
+  }
+
+  uint64_t created_count = 0;
+  std::vector<vk::Sampler> destroyed;
+};
+
+vk::SamplerCreateInfo NewInfo(vk::Filter filter) {
+  vk::SamplerCreateInfo info;
+  info.magFilter = filter;
+  info.minFilter = filter;
+  return info;
+}
+
+TEST(SamplerCache, EqualInfosShareSampler) {
+  FakeSamplers fake;
+  SamplerCache cache(fake.create(), fake.destroy());
+  vk::Sampler sampler = cache.ObtainSampler(NewInfo(vk::Filter::eLinear));
+  EXPECT_EQ(sampler, cache.ObtainSampler(NewInfo(vk::Filter::eLinear)));
+  EXPECT_EQ(1U, fake.created_count);
+  EXPECT_EQ(1U, cache.hit_count());
+  EXPECT_EQ(1U, cache.miss_count());
+}
+
+TEST(SamplerCache, DifferentInfosMiss) {
+  FakeSamplers fake;
+  SamplerCache cache(fake.create(), fake.destroy());
+  vk::Sampler linear = cache.ObtainSampler(NewInfo(vk::Filter::eLinear));
+  vk::Sampler nearest = cache.ObtainSampler(NewInfo(vk::Filter::eNearest));
+  EXPECT_NE(linear, nearest);
+
+  vk::SamplerCreateInfo clamped = NewInfo(vk::Filter::eLinear);
+  clamped.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+  EXPECT_NE(linear, cache.ObtainSampler(clamped));
+  EXPECT_EQ(3U, cache.miss_count());
+  EXPECT_EQ(3U, cache.size());
+}
+
+TEST(SamplerCache, SamplersAreOnlyDestroyedWithCache) {
+  FakeSamplers fake;
+  {
+    SamplerCache cache(fake.create(), fake.destroy());
+    cache.ObtainSampler(NewInfo(vk::Filter::eLinear));
+    cache.ObtainSampler(NewInfo(vk::Filter::eNearest));
+    cache.ObtainSampler(NewInfo(vk::Filter::eLinear));
+    EXPECT_TRUE(fake.destroyed.empty());
+  }
+  EXPECT_EQ(2U, fake.destroyed.size());
+}
+
+}  // namespace
+}  // namespace impl
+}  // namespace escher
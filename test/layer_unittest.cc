@@ -0,0 +1,53 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/scene/layer.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using namespace escher;
+
+Model NewModel(size_t object_count) {
+  std::vector<Object> objects;
+  for (size_t i = 0; i < object_count; ++i) {
+    objects.push_back(Object::NewRect(vec2(0.f, 0.f), vec2(10.f, 10.f), 0.f,
+                                      MaterialPtr()));
+  }
+  return Model(std::move(objects));
+}
+
+TEST(Layer, IdsAreUnique) {
+  auto a = Layer::New(NewModel(1));
+  auto b = Layer::New(NewModel(1));
+  EXPECT_NE(a->id(), b->id());
+}
+
+TEST(Layer, ModificationInvalidates) {
+  auto layer = Layer::New(NewModel(2));
+  const uint64_t revision = layer->revision();
+  EXPECT_EQ(2U, layer->model().objects().size());
+  EXPECT_EQ(revision, layer->revision());
+
+  layer->mutable_model()->mutable_objects().pop_back();
+  EXPECT_EQ(1U, layer->model().objects().size());
+  EXPECT_LT(revision, layer->revision());
+
+  const uint64_t revision2 = layer->revision();
+  layer->Invalidate();
+  EXPECT_LT(revision2, layer->revision());
+}
+
+TEST(Layer, ModelMoveKeepsLayer) {
+  auto layer = Layer::New(NewModel(1));
+  Model model = NewModel(3);
+  model.set_layer(layer);
+
+  Model moved(std::move(model));
+  EXPECT_EQ(layer, moved.layer());
+  EXPECT_FALSE(model.layer());
+}
+
+}  // namespace
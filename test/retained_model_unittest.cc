@@ -0,0 +1,97 @@
+// Copyright 2017 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "escher/scene/retained_model.h"
+
+#include "escher/scene/layer.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using namespace escher;
+
+Object NewRect(float x) {
+  return Object::NewRect(vec2(x, 0.f), vec2(10.f, 10.f), 0.f, MaterialPtr());
+}
+
+TEST(RetainedModel, HandlesAreStable) {
+  RetainedModel retained;
+  EXPECT_EQ(&retained, retained.model().retained_model());
+
+  auto a = retained.AddObject(NewRect(1.f));
+  auto b = retained.AddObject(NewRect(2.f));
+  auto c = retained.AddObject(NewRect(3.f));
+  EXPECT_NE(RetainedModel::kInvalidHandle, a);
+  EXPECT_NE(a, b);
+  EXPECT_NE(b, c);
+
+  retained.RemoveObject(b);
+  EXPECT_FALSE(retained.HasObject(b));
+  ASSERT_EQ(2U, retained.model().objects().size());
+  // Draw order is preserved.
+  EXPECT_EQ(a, retained.GetHandle(0));
+  EXPECT_EQ(c, retained.GetHandle(1));
+  EXPECT_EQ(3.f, retained.object(c).transform()[3][0]);
+
+  // Handles are not reused.
+  auto d = retained.AddObject(NewRect(4.f));
+  EXPECT_NE(b, d);
+  EXPECT_EQ(d, retained.GetHandle(2));
+}
+
+TEST(RetainedModel, DirtyFlags) {
+  RetainedModel retained;
+  auto a = retained.AddObject(NewRect(1.f));
+  auto b = retained.AddObject(NewRect(2.f));
+
+  // New objects are entirely dirty.
+  EXPECT_EQ(ObjectDirtyFlags(vk::FlagTraits<ObjectDirtyFlag>::allFlags),
+            retained.GetDirtyFlags(0, 0));
+
+  const uint64_t revision = retained.revision();
+  EXPECT_EQ(ObjectDirtyFlags(), retained.GetDirtyFlags(0, revision));
+  EXPECT_EQ(ObjectDirtyFlags(), retained.GetDirtyFlags(1, revision));
+
+  retained.SetTransform(b, mat4(2.f));
+  EXPECT_EQ(ObjectDirtyFlags(), retained.GetDirtyFlags(0, revision));
+  EXPECT_EQ(ObjectDirtyFlags(ObjectDirtyFlag::kTransform),
+            retained.GetDirtyFlags(1, revision));
+  EXPECT_EQ(mat4(2.f), retained.object(b).transform());
+
+  retained.SetMaterial(a, Material::New(vec4(1.f, 0.f, 0.f, 1.f)));
+  EXPECT_EQ(ObjectDirtyFlags(ObjectDirtyFlag::kMaterial),
+            retained.GetDirtyFlags(0, revision));
+
+  // Changing the shape's modifiers also changes which modifier data is used.
+  retained.SetShape(a, Shape(Shape::Type::kCircle));
+  EXPECT_EQ(ObjectDirtyFlag::kMaterial | ObjectDirtyFlag::kShape,
+            retained.GetDirtyFlags(0, revision));
+  retained.SetShape(a, Shape(Shape::Type::kCircle, ShapeModifier::kWobble));
+  EXPECT_EQ(ObjectDirtyFlag::kMaterial | ObjectDirtyFlag::kShape |
+                ObjectDirtyFlag::kShapeModifierData,
+            retained.GetDirtyFlags(0, revision));
+
+  // Flags are relative to the revision that they are requested for.
+  EXPECT_EQ(ObjectDirtyFlags(),
+            retained.GetDirtyFlags(0, retained.revision()));
+}
+
+TEST(RetainedModel, LayerDoesNotDirtyObjects) {
+  RetainedModel retained;
+  retained.AddObject(NewRect(1.f));
+  const uint64_t revision = retained.revision();
+
+  std::vector<Object> layer_objects;
+  layer_objects.push_back(NewRect(2.f));
+  auto layer = Layer::New(Model(std::move(layer_objects)));
+  retained.set_layer(layer);
+  EXPECT_EQ(layer.get(), retained.model().layer().get());
+  EXPECT_EQ(revision, retained.revision());
+  EXPECT_EQ(ObjectDirtyFlags(), retained.GetDirtyFlags(0, revision));
+
+  retained.set_layer(LayerPtr());
+  EXPECT_FALSE(retained.model().layer());
+}
+
+}  // namespace